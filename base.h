@@ -50,6 +50,13 @@ typedef int sb4;
 #define nclear(p,n) do_clear((p),(n) * sizeof(*(p)))
 #define nsethi(p,n) memset((p),0xff,(n) * sizeof(*(p)))
 
+// per-thread instance of module state, for server worker threads
+#if defined  __STDC_VERSION__ && __STDC_VERSION__ >= 201101
+ #define Tls _Thread_local
+#else
+ #define Tls __thread
+#endif
+
 // c11 langage only
 #if defined  __STDC_VERSION__ && __STDC_VERSION__ >= 201101
  #define sassert(expr,msg) _Static_assert(expr,msg);
@@ -86,6 +93,7 @@ enum Runlvl { Runread,Runbaseprep,Runprep,Runcompound,Runpart,Runmknet,Runnet0,R
 // program-wide global vars go here
 struct globs {
   const char *progname;
+  const char *progpath; // as invoked
 
   ub1 doruns[Runcnt];
   enum Runlvl stopat,stopatcl;
@@ -98,6 +106,9 @@ struct globs {
   char netfile[1024];
   char netdir[1024];
   char querydir[256];
+  char srvsock[256];
+  char snapshot[256];
+  char netcachedir[256];
   ub4 serverid;
   ub4 msglvl;
   ub4 vrblvl;
@@ -128,6 +139,7 @@ struct globs {
 
   ub4 netvars[64];   // checked for Net_cnt in cfg
   ub4 engvars[64];   // checked for Eng_cnt in cfg
+  ub4 srvvars[64];   // checked for Srv_cnt in cfg
 
    ub4 periodt0,periodt1;
 
@@ -66,9 +66,10 @@ int inicfgcl(void)
 enum Cfgvar {
   Maxhops,Maxports,Maxstops,
   Maxvm,
-  Querydir,
+  Querydir,Srvsock,Snapshot,Netcachedir,
   Stopat,Enable,Disable,
   Net_gen,
+  Srv_gen,
   Net2pdf,Net2ext,
   Section,
   Eng_gen,
@@ -114,10 +115,24 @@ static struct cfgvar {
   {"net.patternend",Uint,Net_gen,Net_tpat1,0,20201231,20150315,"end day of transfer pattern base"},
   {"net.patternmintt",Uint,Net_gen,Net_tpatmintt,0,120,3,"minimum tranfser time for transfer pattern"},
   {"net.patternmaxtt",Uint,Net_gen,Net_tpatmaxtt,2,60 * 48,120,"maximum tranfser time for transfer pattern"},
+  {"net.lazyports",Uint,Net_gen,Net_lazyports,0,hi24,0,"partitions above this many ports build 2-stop rows per departure on demand, 0 for never"},
+  {"net.budgetmb",Uint,Net_gen,Net_budgetmb,0,hi24,0,"n-stop connection memory per partition in MB to fit variant limits in, 0 for fixed limits"},
+  {"net.threads",Uint,Net_gen,Net_threads,0,64,0,"n-stop net builder threads per partition, 0 to share the cpus"},
+  {"net.partthreads",Uint,Net_gen,Net_partthreads,0,64,0,"partitions built in parallel, 0 for one per cpu"},
+  {"net.cachedir",String,Netcachedir,0,0,0,0,"directory to cache n-stop connectivity in, none if empty"},
 
   // interface
   {"interface",Bool,Section,0,0,0,0,"configure client-server interface"},
   {"querydir",String,Querydir,0,0,0,0,"client query queue directory"},
+  {"srv.port",Uint,Srv_gen,Srv_port,0,65535,0,"tcp port to listen for queries, 0 for none"},
+  {"srv.sock",String,Srvsock,0,0,0,0,"local socket to listen for queries"},
+  {"srv.workers",Uint,Srv_gen,Srv_workers,0,64,0,"plan worker threads, 0 to fork per query"},
+  {"srv.cachemb",Uint,Srv_gen,Srv_cachemb,0,hi16,64,"plan result cache size in MB, 0 for none"},
+  {"srv.cacheage",Uint,Srv_gen,Srv_cacheage,0,hi24,600,"max age of cached plan results in seconds, 0 for unlimited"},
+  {"srv.rowcachemb",Uint,Srv_gen,Srv_rowmb,0,hi24,256,"on-demand 2-stop row cache size in MB, 0 to build per query"},
+  {"srv.deadline",Uint,Srv_gen,Srv_deadline,0,hi24,0,"msec a query may wait for a result if the client has no limit, 0 for none"},
+  {"srv.snapshot",String,Snapshot,0,0,0,0,"file to publish the built network to, for servers started with 'serve'"},
+  {"srv.snapmb",Uint,Srv_gen,Srv_snapmb,16,hi24,65536,"max size in MB of the network snapshot"},
 
   {"files",Bool,Section,0,0,0,0,"determines which files to generate"},
   {"net.pdf",Bool,Net2pdf,0,0,1,0,"write network to pdf"},
@@ -126,6 +141,7 @@ static struct cfgvar {
   {"engineering",Bool,Section,0,0,0,0,"engineering settings"},
   {"eng.periodlim",Uint,Eng_gen,Eng_periodlim,0,365 * 20,365 * 10,"schedule period limit"},
   {"eng.conncheck",Uint,Eng_gen,Eng_conchk,0,1,1,"check connectivity"},
+  {"eng.walkhist",Uint,Eng_gen,Eng_walkhist,0,1,0,"report all port to port distances when inferring walk links"},
   {"eng.options",String,Eng_opt,0,0,0,0,"engineering options"},
   {NULL,0,0,0,0,0,0,NULL}
 };
@@ -240,12 +256,16 @@ static int writecfg(int havecfg,const char *cname)
     case Maxstops: uval = globs.maxstops; break;
     case Maxvm:    uval = globs.maxvm; break;
     case Querydir: sval = globs.querydir; break;
+    case Srvsock:  sval = globs.srvsock; break;
+    case Snapshot: sval = globs.snapshot; break;
+    case Netcachedir: sval = globs.netcachedir; break;
     case Stopat:   uval = globs.stopat; break;
     case Enable: case Disable: break;
     case Net2pdf:  uval = globs.writpdf; break;
     case Net2ext:  uval = globs.writext; break;
     case Eng_gen:  uval = globs.engvars[vp->subvar]; break;
     case Net_gen:  uval = globs.netvars[vp->subvar]; break;
+    case Srv_gen:  uval = globs.srvvars[vp->subvar]; break;
     case Eng_opt: break;
     case Cfgcnt: case Section: break;
     }
@@ -305,9 +325,10 @@ static int limitvals(void)
     case Enable: case Disable: break;
     case Net2pdf: limitval(vp,&globs.writpdf); break;
     case Net2ext: limitval(vp,&globs.writext); break;
-    case Querydir: break;
+    case Querydir: case Srvsock: case Snapshot: case Netcachedir: break;
     case Eng_gen:  limitval(vp,globs.engvars + vp->subvar); break;
     case Net_gen:  limitval(vp,globs.netvars + vp->subvar); break;
+    case Srv_gen:  limitval(vp,globs.srvvars + vp->subvar); break;
     case Eng_opt: break;
     case Cfgcnt: case Section: break;
     }
@@ -336,7 +357,8 @@ static void finalize(void)
     case Net2ext: finalval(&globs.writext); break;
     case Eng_gen:  finalval(globs.engvars + vp->subvar); break;
     case Net_gen:  finalval(globs.netvars + vp->subvar); break;
-    case Querydir: break;
+    case Srv_gen:  finalval(globs.srvvars + vp->subvar); break;
+    case Querydir: case Srvsock: case Snapshot: case Netcachedir: break;
     case Eng_opt: break;
     case Cfgcnt: case Section: break;
     }
@@ -382,7 +404,7 @@ static int addvar(char *varname,char *val,ub4 varlen,ub4 vallen)
   var = vp->var;
   error_ge(var,Cfgcnt);
 
-  if (var != Enable && var != Disable && var != Eng_opt && var != Eng_gen && var != Net_gen) {
+  if (var != Enable && var != Disable && var != Eng_opt && var != Eng_gen && var != Net_gen && var != Srv_gen) {
     prvline = varseen[var];
     if (prvline) return warning(0,"%s: previously defined at line %u",fln,prvline);
   }
@@ -424,6 +446,9 @@ static int addvar(char *varname,char *val,ub4 varlen,ub4 vallen)
   case Maxstops: setval(vp,&globs.maxstops,uval); break;
   case Maxvm:    setval(vp,&globs.maxvm,uval); break;
   case Querydir: memcpy(globs.querydir,val,min(vallen,sizeof(globs.querydir)-1)); break;
+  case Srvsock:  memcpy(globs.srvsock,val,min(vallen,sizeof(globs.srvsock)-1)); break;
+  case Snapshot: memcpy(globs.snapshot,val,min(vallen,sizeof(globs.snapshot)-1)); break;
+  case Netcachedir: memcpy(globs.netcachedir,val,min(vallen,sizeof(globs.netcachedir)-1)); break;
   case Stopat:   setval(vp,&globs.stopat,uval); break;
   case Enable:   if (setruns[uval]) return error(0,"%s: previously set at line %u",val,setruns[uval]);
                  globs.doruns[uval] = 1; setruns[uval] = linno;
@@ -435,6 +460,7 @@ static int addvar(char *varname,char *val,ub4 varlen,ub4 vallen)
   case Net2ext:  setval(vp,&globs.writext,uval); break;
   case Net_gen:  setval(vp,globs.netvars + vp->subvar,uval); break;
   case Eng_gen:  setval(vp,globs.engvars + vp->subvar,uval); break;
+  case Srv_gen:  setval(vp,globs.srvvars + vp->subvar,uval); break;
   case Eng_opt:  eng_opt(val,vallen); break;
   case Cfgcnt: case Section: break;
   }
@@ -551,6 +577,7 @@ int readcfg(const char *name)
   int havecfg = 0;
 
   error_ge(Eng_cnt,Elemcnt(globs.engvars));
+  error_ge(Srv_cnt,Elemcnt(globs.srvvars));
 
   if (rdcfg(name,&havecfg)) return 1;
   if (limitvals()) return 1;
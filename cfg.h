@@ -29,7 +29,8 @@
 
 // end of limits
 
-enum Engvars { Eng_periodlim,Eng_conchk,Eng_cnt };
+enum Engvars { Eng_periodlim,Eng_conchk,Eng_walkhist,Eng_cnt };
+enum Srvvars { Srv_port,Srv_workers,Srv_cachemb,Srv_cacheage,Srv_rowmb,Srv_deadline,Srv_snapmb,Srv_cnt };
 enum Netvars {
   Net_partsize,
   Net_sumwalklimit,
@@ -43,12 +44,17 @@ enum Netvars {
   Net_tpatmaxtt,
   Net_mintt,
   Net_maxtt,
+  Net_lazyports,
+  Net_budgetmb,
+  Net_threads,
+  Net_partthreads,
   Net_cnt
 };
 
 sassert(Net_cnt < sizeof(globs.netvars),"globs.netvars < Net_cnt")
 sassert(Net_cnt < Elemcnt(globs.netvars),"globs.netvars < Net_cnt")
 sassert(Eng_cnt < sizeof(globs.engvars),"globs.engvars < Eng_cnt")
+sassert(Srv_cnt < Elemcnt(globs.srvvars),"globs.srvvars < Srv_cnt")
 
 #define Cfgcl (1U << 31)
 #define Cfgdef (1U << 30)
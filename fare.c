@@ -13,9 +13,18 @@
   an individual trip basis. Whether reserved is determined on a per-route basis.
   If so, a list of fare positions per fare group per expanded departure is maintained.
   The entries contain the price. This list is accessed in parallel to time events.
+
+  Updates never write entries that searches may be reading. Entries are grouped in pages of
+  Farepage departures. An update copies a page, changes the copy, and links it in front of the
+  older versions, tagged with the next epoch. An update request publishes its epoch when done.
+  A query pins the epoch current at its start, and reads for each page the newest version
+  not after that. It thus sees all updates of a request or none, without locks on read.
+  The writer releases versions no longer visible to any pinned query.
+  Versions are process-local, per network generation.
  */
 
 #include <string.h>
+#include <pthread.h>
 
 #include "base.h"
 #include "cfg.h"
@@ -32,6 +41,326 @@ static ub4 msgfile;
 
 #undef hdrstop
 
+/* index hop positions on reserved routes by departure and arrival port,
+   to resolve updates on dep,arr without scanning the route
+ */
+int mkfareidx(gnet *net)
+{
+  struct route *rp,*routes = net->routes;
+  ub4 *portsbyhop = net->portsbyhop;
+  ub4 rid,ridcnt = net->ridcnt;
+  ub4 pos,poscnt,hop,rcnt = 0;
+  ub8 ofs = 0;
+  ub4 *rposofs;
+  ub8 *idx,*rposidx;
+
+  if (net->fareposcnt == 0) return 0;
+
+  for (rid = 0; rid < ridcnt; rid++) {
+    rp = routes + rid;
+    if (rp->reserve) ofs += min(rp->hopcnt,Chainlen) * 2;
+  }
+  if (ofs == 0) return 0;
+  if (ofs >= hi32) return error(0,"\ah%lu route positions above max",ofs);
+
+  rposofs = net->rposofs = alloc(ridcnt,ub4,0xff,"fare rposofs",ridcnt);
+  rposidx = net->rposidx = alloc((ub4)ofs,ub8,0,"fare rposidx",ridcnt);
+
+  ofs = 0;
+  for (rid = 0; rid < ridcnt; rid++) {
+    rp = routes + rid;
+    poscnt = min(rp->hopcnt,Chainlen);
+    if (rp->reserve == 0 || poscnt == 0) continue;
+    rposofs[rid] = (ub4)ofs;
+    idx = rposidx + ofs;
+    for (pos = 0; pos < poscnt; pos++) {
+      hop = rp->hops[pos];
+      idx[pos] = (ub8)portsbyhop[hop * 2] << 32 | pos;
+      idx[poscnt + pos] = (ub8)portsbyhop[hop * 2 + 1] << 32 | pos;
+    }
+    sort8(idx,poscnt,FLN,"fare dep index");
+    sort8(idx + poscnt,poscnt,FLN,"fare arr index");
+    ofs += poscnt * 2;
+    rcnt++;
+  }
+  info(0,"fare index for %u reserved route\as",rcnt);
+  return 0;
+}
+
+// first position at or after pos where port appears, hi32 if none
+static ub4 findpos(ub8 *idx,ub4 cnt,ub4 port,ub4 pos)
+{
+  ub8 key = (ub8)port << 32 | pos;
+  ub4 lo = 0,hi = cnt,mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (idx[mid] < key) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo == cnt || (ub4)(idx[lo] >> 32) != port) return hi32;
+  return (ub4)idx[lo];
+}
+
+/* resolve hop from dep,arr on a reserved route. Via a compound hop if not adjacent
+   returns 0 on success
+ */
+int farehops(gnet *net,ub4 rid,ub4 dep,ub4 arr,ub4 *phop1,ub4 *phop2,ub4 *pchop)
+{
+  struct route *rp = net->routes + rid;
+  ub4 poscnt = min(rp->hopcnt,Chainlen);
+  ub4 pos,apos,h1ndx,h2ndx,hop1,hop2,chop;
+  ub4 *ridhops;
+  ub8 *idx;
+
+  if (net->rposofs == NULL || net->rposofs[rid] == hi32) return warn(0,"no fare index for rid %u",rid);
+  idx = net->rposidx + net->rposofs[rid];
+
+  // ports can occur more than once on a route : take the shortest span
+  h1ndx = h2ndx = hi32;
+  pos = findpos(idx,poscnt,dep,0);
+  while (pos != hi32) {
+    apos = findpos(idx + poscnt,poscnt,arr,pos);
+    if (apos != hi32 && (h1ndx == hi32 || apos - pos < h2ndx - h1ndx)) { h1ndx = pos; h2ndx = apos; }
+    pos = pos + 1 < poscnt ? findpos(idx,poscnt,dep,pos + 1) : hi32;
+  }
+  if (h1ndx == hi32) return error(0,"no hop found for %u-%u",dep,arr);
+
+  hop1 = rp->hops[h1ndx];
+  hop2 = rp->hops[h2ndx];
+  if (hop1 >= net->hopcnt) return error(0,"invalid hop %u found for %u-%u",hop1,dep,arr);
+  else if (hop2 >= net->hopcnt) return error(0,"invalid hop %u found for %u-%u",hop2,dep,arr);
+  if (hop1 == hop2) chop = hop1;
+  else {
+    ridhops = net->ridhopbase + rp->hop2pos;
+    chop = ridhops[h1ndx * rp->hopcnt + h2ndx];
+  }
+  if (chop == hi32) return 1;
+
+  *phop1 = hop1; *phop2 = hop2; *pchop = chop;
+  return 0;
+}
+
+#define Ngen 2
+#define Farepins 128  // distinct epochs of concurrent queries
+#define Verchunk 1024
+
+struct farestate {
+  ub4 gen;                 // network generation
+  ub4 pagecnt;
+  struct farever **vers;   // [pagecnt] newest version, NULL for none
+  ub4 epoch;               // last published
+  ub4 pinepochs[Farepins];
+  ub4 pinusers[Farepins];
+  struct farever *rethd,*rettl; // versions linking to older ones, in epoch order
+  ub4 vercnt;
+};
+
+static struct farestate farestates[Ngen];
+static struct farever *verfree;
+static pthread_mutex_t farelock = PTHREAD_MUTEX_INITIALIZER;
+
+static Tls struct farestate *usestate;
+static Tls ub4 useepoch;
+
+// use the current fare epoch for this thread until unpinned. Pin the network first
+ub4 farepin(void)
+{
+  struct farestate *st = NULL;
+  ub4 gen = netgenid();
+  ub4 i,slot = hi32;
+
+  pthread_mutex_lock(&farelock);
+  for (i = 0; i < Ngen; i++) {
+    if (farestates[i].vers && farestates[i].gen == gen) { st = farestates + i; break; }
+  }
+  if (st) {
+    for (i = 0; i < Farepins; i++) {
+      if (st->pinusers[i] && st->pinepochs[i] == st->epoch) { slot = i; break; }
+      else if (st->pinusers[i] == 0 && slot == hi32) slot = i;
+    }
+    if (slot == hi32) error(Exit,"more than %u fare epochs in use",Farepins);
+    st->pinepochs[slot] = st->epoch;
+    st->pinusers[slot]++;
+    useepoch = st->epoch;
+  } else useepoch = 0;
+  pthread_mutex_unlock(&farelock);
+  usestate = st;
+  return useepoch;
+}
+
+void fareunpin(void)
+{
+  struct farestate *st = usestate;
+  ub4 i;
+
+  if (st == NULL) return;
+  pthread_mutex_lock(&farelock);
+  for (i = 0; i < Farepins; i++) {
+    if (st->pinusers[i] && st->pinepochs[i] == useepoch) { st->pinusers[i]--; break; }
+  }
+  pthread_mutex_unlock(&farelock);
+  usestate = NULL;
+}
+
+// fare of group 0 for departure fi, as of the pinned epoch
+ub2 getfare(ub2 *fareposbase,ub4 fi)
+{
+  struct farestate *st = usestate;
+  struct farever *v;
+
+  if (st == NULL) return fareposbase[fi * Faregrp];
+  v = __atomic_load_n(st->vers + fi / Farepage,__ATOMIC_ACQUIRE);
+  while (v && v->epoch > useepoch) v = v->prv;
+  if (v == NULL) return fareposbase[fi * Faregrp];
+  return v->fares[(fi % Farepage) * Faregrp];
+}
+
+static struct farever *newver(void)
+{
+  struct farever *v;
+  ub4 n;
+
+  if (verfree == NULL) {
+    v = alloc(Verchunk,struct farever,0,"fare versions",Verchunk);
+    for (n = 0; n < Verchunk; n++) { v[n].prv = verfree; verfree = v + n; }
+  }
+  v = verfree;
+  verfree = v->prv;
+  return v;
+}
+
+// writer's state for the current generation
+static struct farestate *getstate(gnet *net)
+{
+  struct farestate *st;
+  struct farever *v,*ov;
+  ub4 gen = netgenid();
+  ub4 i,n,page;
+
+  for (i = 0; i < Ngen; i++) {
+    st = farestates + i;
+    if (st->vers && st->gen == gen) return st;
+  }
+
+  // take a free slot, or one of a previous generation without queries
+  pthread_mutex_lock(&farelock);
+  for (i = 0; i < Ngen; i++) {
+    st = farestates + i;
+    if (st->vers == NULL) break;
+    for (n = 0; n < Farepins; n++) if (st->pinusers[n]) break;
+    if (n == Farepins) break;
+  }
+  if (i == Ngen) {
+    pthread_mutex_unlock(&farelock);
+    warn(0,"no fare state available for generation %u",gen);
+    return NULL;
+  }
+
+  if (st->vers) {
+    info(0,"release %u fare versions of generation %u",st->vercnt,st->gen);
+    for (page = 0; page < st->pagecnt; page++) {
+      v = st->vers[page];
+      while (v) {
+        ov = v->prv;
+        v->prv = verfree;
+        verfree = v;
+        v = ov;
+      }
+    }
+    afree(st->vers,"fare versions");
+  }
+  oclear(*st);
+  st->gen = gen;
+  st->pagecnt = (ub4)((net->fareposcnt + Farepage - 1) / Farepage);
+  st->vers = alloc(st->pagecnt,struct farever *,0,"fare versions",st->pagecnt);
+  pthread_mutex_unlock(&farelock);
+  return st;
+}
+
+// writable entries for departure fi in the pending epoch
+static ub2 *farewrite(gnet *net,ub4 fi)
+{
+  struct farestate *st = getstate(net);
+  struct farever *v,*hd;
+  ub4 page,wepoch;
+  ub8 pofs,pcnt;
+
+  if (st == NULL) return NULL;
+  page = fi / Farepage;
+  if (page >= st->pagecnt) { error(0,"fare entry %u above %u pages",fi,st->pagecnt); return NULL; }
+  wepoch = st->epoch + 1;
+
+  hd = st->vers[page];
+  if (hd && hd->epoch == wepoch) return hd->fares + (fi % Farepage) * Faregrp;
+
+  v = newver();
+  if (hd) memcpy(v->fares,hd->fares,sizeof(v->fares));
+  else {
+    pofs = (ub8)page * Farepage;
+    pcnt = min(net->fareposcnt - pofs,Farepage);
+    memcpy(v->fares,net->fareposbase + pofs * Faregrp,pcnt * Faregrp * sizeof(ub2));
+  }
+  v->epoch = wepoch;
+  v->prv = hd;
+  v->retnxt = NULL;
+  __atomic_store_n(st->vers + page,v,__ATOMIC_RELEASE);
+  st->vercnt++;
+
+  if (hd) {
+    if (st->rettl) st->rettl->retnxt = v;
+    else st->rethd = v;
+    st->rettl = v;
+  }
+  return v->fares + (fi % Farepage) * Faregrp;
+}
+
+/* make the updates of a request visible to new queries,
+   and release versions superseded for all pinned queries
+ */
+void farepublish(gnet *net)
+{
+  struct farestate *st = getstate(net);
+  struct farever *v,*ov;
+  ub4 i,minpin,relcnt = 0;
+
+  if (st == NULL) return;
+
+  pthread_mutex_lock(&farelock);
+  st->epoch++;
+  minpin = st->epoch;
+  for (i = 0; i < Farepins; i++) {
+    if (st->pinusers[i]) minpin = min(minpin,st->pinepochs[i]);
+  }
+  while ( (v = st->rethd) && v->epoch <= minpin) {
+    while ( (ov = v->prv) ) {
+      v->prv = ov->prv;
+      ov->prv = verfree;
+      verfree = ov;
+      relcnt++;
+    }
+    st->rethd = v->retnxt;
+    if (st->rethd == NULL) st->rettl = NULL;
+  }
+  st->vercnt -= relcnt;
+  pthread_mutex_unlock(&farelock);
+  vrb0(0,"fare epoch %u, %u versions, %u released",st->epoch,st->vercnt,relcnt);
+}
+
+ub4 farestats(char *buf,ub4 len)
+{
+  struct farestate *st;
+  ub4 i,pos = 0;
+
+  pthread_mutex_lock(&farelock);
+  for (i = 0; i < Ngen; i++) {
+    st = farestates + i;
+    if (st->vers) pos += mysnprintf(buf,pos,len,"fares\tgeneration %u\tepoch %u\tversions %u\n",st->gen,st->epoch,st->vercnt);
+  }
+  pthread_mutex_unlock(&farelock);
+  return pos;
+}
+
 int fareupd(gnet *net,ub4 rid,ub4 hop1,ub4 hop2,ub4 chop,ub4 t,ub4 mask,ub4 nfare,ub4 *fares)
 {
   ub4 *fhopofs = net->fhopofs;
@@ -42,14 +371,14 @@ int fareupd(gnet *net,ub4 rid,ub4 hop1,ub4 hop2,ub4 chop,ub4 t,ub4 mask,ub4 nfar
   ub2 *farepos,*fareposbase = net->fareposbase;
   block *faremem = &net->faremem;
   ub8 *ev,*events = net->events;
-  ub4 rt,tt,prvt;
+  ub4 rt,tt,prvt,lo,hi,mid;
 
   if (fhopofs == NULL || fareposbase == NULL) return info(0,"no reserved routes for %u",hop1);
 
   hp = hops + hop1;
   tp = &hp->tp;
 
-  info(0,"rid %u chop %u hop2 %u mask %x",rid,chop,hop2,mask);
+  vrb0(0,"rid %u chop %u hop2 %u mask %x",rid,chop,hop2,mask);
   if (nfare > Faregrp) return error(0,"farecnt %u above %u",nfare,Faregrp);
 
   ub4 evcnt = tp->evcnt;
@@ -61,44 +390,47 @@ int fareupd(gnet *net,ub4 rid,ub4 hop1,ub4 hop2,ub4 chop,ub4 t,ub4 mask,ub4 nfar
 
   ofs = fhopofs[chop];
 
-  farepos = fareposbase + ofs * Faregrp;
   bound(faremem,(ofs + nfare) * Faregrp,ub2);
 
-  gndx = 0; tt = prvt = 0;
-  while (gndx < evcnt) {
-    prvt = tt;
-    rt = (ub4)ev[gndx * 2];
-    tt = rt + gt0;
-    if (tt >= t) break;
-    gndx++;
+  // first event at or after t. events are in time order
+  lo = 0; hi = evcnt;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if ((ub4)ev[mid * 2] + gt0 < t) lo = mid + 1;
+    else hi = mid;
   }
-  if (gndx == evcnt) return info(0,"\ad%u after \ad%u",t,tt);
+  gndx = lo;
+  if (gndx == evcnt) return info(0,"\ad%u after \ad%u",t,(ub4)ev[(evcnt - 1) * 2] + gt0);
+  rt = (ub4)ev[gndx * 2];
+  tt = rt + gt0;
+  prvt = gndx ? (ub4)ev[(gndx - 1) * 2] + gt0 : 0;
 
   if (gndx && tt > t) {
-    info(0,"found \ad%u before \ad%u",t,tt);
+    vrb0(0,"found \ad%u before \ad%u",t,tt);
     gndx--; rt = (ub4)ev[gndx * 2]; tt = rt + gt0;
   }
-  info(0,"found \ad%u as \ad%u after \ad%u",t,tt,prvt);
+  vrb0(0,"found \ad%u as \ad%u after \ad%u",t,tt,prvt);
 
   bound(faremem,(ofs + gndx + (Faregrp-1)) * Faregrp,ub2);
 
-  farepos += gndx * Faregrp;
+  farepos = farewrite(net,ofs + gndx);
+  if (farepos == NULL) return 1;
 
   // upper bits indicate entries to clear 
   if (mask & 0xf0) {
     nilmask = mask >> 4; f = 0;
     while (nilmask && f < Faregrp) {
       farepos[f] = hi16;
-      info(0,"fare %u set to n/a at %p",f,farepos);
+      vrb0(0,"fare %u set to n/a at %p",f,farepos);
       nilmask >>= 1; f++;
     }
   }
   f = fi = 0; mask &= 0xf;
-  info(0,"mask %x nfare %u",mask,nfare);
+  vrb0(0,"mask %x nfare %u",mask,nfare);
   while (mask && fi < nfare && f < Faregrp) {
     if (mask & 1) {
       farepos[f] = (ub2)fares[fi];
-      info(0,"fare %u set to %u",f,fares[fi]);
+      vrb0(0,"fare %u set to %u",f,fares[fi]);
       fi++;
     }
     mask >>= 1; f++;
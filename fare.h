@@ -9,5 +9,21 @@
    To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
  */
 
+#define Farepage 64  // departures per fare page
+
+struct farever {
+  ub4 epoch;               // visible to queries pinned at this epoch or later
+  struct farever *prv;     // older version. Also free list
+  struct farever *retnxt;  // writer's release list
+  ub2 fares[Farepage * Faregrp];
+};
+
 extern void inifare(void);
+extern ub4 farepin(void);
+extern void fareunpin(void);
+extern ub2 getfare(ub2 *fareposbase,ub4 fi);
+extern void farepublish(gnet *net);
+extern ub4 farestats(char *buf,ub4 len);
+extern int mkfareidx(gnet *net);
+extern int farehops(gnet *net,ub4 rid,ub4 dep,ub4 arr,ub4 *phop1,ub4 *phop2,ub4 *pchop);
 extern int fareupd(gnet *net,ub4 rid,ub4 hop1,ub4 hop2,ub4 chop,ub4 t,ub4 mask,ub4 nfare,ub4 *fares);
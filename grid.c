@@ -0,0 +1,238 @@
+// grid.c - spatial index of stops
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+/* Ports and member stops are bucketed in a uniform lat/lon grid, built once at network init.
+   Nearest lookups visit rings of cells around the query point, until the minimum distance
+   of the next ring exceeds the radius or the k-th nearest found.
+   The grid does not wrap at the date line.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "base.h"
+#include "cfg.h"
+#include "mem.h"
+#include "math.h"
+
+static ub4 msgfile;
+#include "msg.h"
+
+#include "util.h"
+#include "net.h"
+#include "grid.h"
+
+#define Gridmax 4096   // cells per axis
+#define Georadius (6371.0 * Geoscale) // mean earth radius in geo units
+
+void inigrid(void)
+{
+  msgfile = setmsgfile(__FILE__);
+  iniassert();
+}
+
+// as in geocode : ports without members and with service
+static int gridport(struct port *pp)
+{
+  return (pp->ndep || pp->narr) && pp->subcnt == 0;
+}
+
+int mkgeogrid(struct gnetwork *net)
+{
+  struct geogrid *gp;
+  struct port *pp,*ports = net->ports;
+  struct sport *sp,*sports = net->sports;
+  ub4 port,portcnt = net->portcnt;
+  ub4 sport,sportcnt = net->sportcnt;
+  ub4 n,cnt,cell,cellcnt,latcnt,loncnt,la,lo,hicell = 0;
+  ub4 *cellofs,*cellpos,*items,*tmpitems;
+  double *itemll,*tmpll;
+  double rlat,rlon,lolat,hilat,lolon,hilon,h,w,side;
+
+  cnt = sportcnt;
+  for (port = 0; port < portcnt; port++) {
+    if (gridport(ports + port)) cnt++;
+  }
+  if (cnt == 0) return info0(0,"no stops for geo grid");
+
+  tmpitems = alloc(cnt,ub4,0,"grid items",cnt);
+  tmpll = alloc(cnt * 2,double,0,"grid latlon",cnt);
+
+  n = 0;
+  for (sport = 0; sport < sportcnt; sport++) {
+    sp = sports + sport;
+    tmpitems[n] = portcnt + sport;
+    tmpll[n * 2] = sp->rlat;
+    tmpll[n * 2 + 1] = sp->rlon;
+    n++;
+  }
+  for (port = 0; port < portcnt; port++) {
+    pp = ports + port;
+    if (gridport(pp) == 0) continue;
+    tmpitems[n] = port;
+    tmpll[n * 2] = pp->rlat;
+    tmpll[n * 2 + 1] = pp->rlon;
+    n++;
+  }
+
+  lolat = lolon = 10;
+  hilat = hilon = -10;
+  for (n = 0; n < cnt; n++) {
+    rlat = tmpll[n * 2]; rlon = tmpll[n * 2 + 1];
+    lolat = min(lolat,rlat); hilat = max(hilat,rlat);
+    lolon = min(lolon,rlon); hilon = max(hilon,rlon);
+  }
+
+  // aim at a few stops per cell
+  h = hilat - lolat;
+  w = (hilon - lolon) * cos((lolat + hilat) / 2);
+  side = sqrt(max(h,1e-5) * max(w,1e-5) / max(cnt / 2,1));
+  latcnt = min((ub4)(h / side) + 1,Gridmax);
+  loncnt = min((ub4)(w / side) + 1,Gridmax);
+  cellcnt = latcnt * loncnt;
+
+  gp = alloc(1,struct geogrid,0,"geo grid",cnt);
+  gp->latcnt = latcnt;
+  gp->loncnt = loncnt;
+  gp->lat0 = lolat;
+  gp->lon0 = lolon;
+  gp->cellh = h > 0 ? h / latcnt : side;
+  gp->cellw = hilon > lolon ? (hilon - lolon) / loncnt : side;
+  gp->itemcnt = cnt;
+
+  cellofs = gp->cellofs = alloc(cellcnt + 1,ub4,0,"grid cells",cellcnt);
+  cellpos = alloc(cnt,ub4,0,"grid cellpos",cnt);
+  items = gp->items = alloc(cnt,ub4,0,"grid items",cnt);
+  itemll = gp->itemll = alloc(cnt * 2,double,0,"grid latlon",cnt);
+
+  for (n = 0; n < cnt; n++) {
+    la = min((ub4)((tmpll[n * 2] - lolat) / gp->cellh),latcnt - 1);
+    lo = min((ub4)((tmpll[n * 2 + 1] - lolon) / gp->cellw),loncnt - 1);
+    cell = la * loncnt + lo;
+    cellpos[n] = cell;
+    cellofs[cell + 1]++;
+  }
+  for (cell = 0; cell < cellcnt; cell++) {
+    hicell = max(hicell,cellofs[cell + 1]);
+    cellofs[cell + 1] += cellofs[cell];
+  }
+  for (n = 0; n < cnt; n++) {
+    cell = cellpos[n];
+    la = cellofs[cell]++;
+    items[la] = tmpitems[n];
+    itemll[la * 2] = tmpll[n * 2];
+    itemll[la * 2 + 1] = tmpll[n * 2 + 1];
+  }
+  for (cell = cellcnt; cell; cell--) cellofs[cell] = cellofs[cell - 1];
+  cellofs[0] = 0;
+
+  afree(cellpos,"grid cellpos");
+  afree(tmpll,"grid latlon");
+  afree(tmpitems,"grid items");
+
+  net->geogrid = gp;
+  info(0,"geo grid of %u x %u cells for %u stops, max %u per cell",latcnt,loncnt,cnt,hicell);
+  return 0;
+}
+
+// add to the sorted list of nearest
+static ub4 addnear(ub4 item,ub4 dist,ub4 k,ub4 n,ub4 *items,ub4 *dists)
+{
+  ub4 i;
+
+  if (n == k && dist >= dists[k - 1]) return n;
+  if (n < k) n++;
+  i = n - 1;
+  while (i && dists[i - 1] > dist) {
+    dists[i] = dists[i - 1];
+    items[i] = items[i - 1];
+    i--;
+  }
+  dists[i] = dist;
+  items[i] = item;
+  return n;
+}
+
+// lower bound in geo units for items r rings away
+static double ringdist(struct geogrid *gp,ub4 r,double coslat)
+{
+  double dlat,dlon,lb;
+
+  if (r < 2) return 0;
+  dlat = (r - 1) * gp->cellh;
+  dlon = (r - 1) * gp->cellw;
+
+  lb = dlat * Georadius;
+  if (dlon < M_PI) lb = min(lb,2 * Georadius * asin(coslat * sin(dlon / 2)));
+  return lb * 0.85;  // margin for approximations in geodist
+}
+
+/* find up to k nearest stops within radius in geo units, nearest first
+   returns count found
+ */
+ub4 geonear(struct gnetwork *net,double rlat,double rlon,ub4 radius,ub4 k,ub4 *items,ub4 *dists)
+{
+  struct geogrid *gp = net->geogrid;
+  double *ll;
+  double coslat,fla,flo,lat2d,fdist;
+  long qla,qlo,la,lo,lat1,lat2,lon1,lon2,lacnt,locnt;
+  ub4 r,r0,cell,ofs,dist,n = 0;
+  int done;
+
+  if (gp == NULL || k == 0) return 0;
+  k = min(k,Geonear_max);
+
+  lacnt = (long)gp->latcnt;
+  locnt = (long)gp->loncnt;
+  fla = floor((rlat - gp->lat0) / gp->cellh);
+  flo = floor((rlon - gp->lon0) / gp->cellw);
+  qla = (long)fla;
+  qlo = (long)flo;
+
+  lat2d = gp->lat0 + (double)gp->latcnt * gp->cellh;
+  coslat = cos(max(fabs(rlat),max(fabs(gp->lat0),fabs(lat2d))));
+
+  // start at the nearest ring overlapping the grid
+  la = max(max(-qla,qla - lacnt + 1),max(-qlo,qlo - locnt + 1));
+  r0 = la > 0 ? (ub4)la : 0;
+
+  for (r = r0; ; r++) {
+    dist = (ub4)min(ringdist(gp,r,coslat),(double)hi32);
+    if (dist > radius) break;
+    if (n == k && dist > dists[k - 1]) break;
+
+    lat1 = max(qla - (long)r,0);
+    lat2 = min(qla + (long)r,lacnt - 1);
+    lon1 = max(qlo - (long)r,0);
+    lon2 = min(qlo + (long)r,locnt - 1);
+    done = (qla - (long)r <= 0 && qla + (long)r >= lacnt - 1 && qlo - (long)r <= 0 && qlo + (long)r >= locnt - 1);
+
+    for (la = lat1; la <= lat2; la++) {
+      for (lo = lon1; lo <= lon2; lo++) {
+
+        // only the cells on this ring
+        if (la != qla - (long)r && la != qla + (long)r && lo != qlo - (long)r && lo != qlo + (long)r) {
+          if (lo < qlo + (long)r) lo = min(qlo + (long)r,lon2 + 1) - 1;
+          continue;
+        }
+        cell = (ub4)(la * locnt + lo);
+        for (ofs = gp->cellofs[cell]; ofs < gp->cellofs[cell + 1]; ofs++) {
+          ll = gp->itemll + ofs * 2;
+          fdist = geodist(rlat,rlon,ll[0],ll[1]);
+          dist = (ub4)fdist;
+          if (dist <= radius) n = addnear(gp->items[ofs],dist,k,n,items,dists);
+        }
+      }
+    }
+    if (done) break;
+  }
+  return n;
+}
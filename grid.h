@@ -0,0 +1,26 @@
+// grid.h - spatial index of stops
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+#define Geonear_max 64
+
+struct geogrid {
+  ub4 latcnt,loncnt;
+  double lat0,lon0;    // radians, south-west corner
+  double cellh,cellw;  // radians
+  ub4 itemcnt;
+  ub4 *cellofs;        // [latcnt * loncnt + 1] into items
+  ub4 *items;          // port, or portcnt + sport
+  double *itemll;      // [itemcnt * 2] rlat,rlon
+};
+
+extern void inigrid(void);
+extern int mkgeogrid(struct gnetwork *net);
+extern ub4 geonear(struct gnetwork *net,double rlat,double rlon,ub4 radius,ub4 k,ub4 *items,ub4 *dists);
@@ -177,6 +177,23 @@ ub4 rnd(ub4 range)
   return r;
 }
 
+// idem on caller state, for concurrent users needing a repeatable sequence
+ub4 rndr(ub8 *state,ub4 range)
+{
+  ub8 x = *state;
+  ub4 r;
+
+  if (x == 0) x = 0x05a3ae52de3bbf0aULL;
+  x ^= x >> 12; // a
+  x ^= x << 25; // b
+  x ^= x >> 27; // c
+  *state = x;
+  r = (ub4)((x * 2685821657736338717ULL) >> 32);
+  if (range == 0) r = 1;
+  else if (range != hi32) r %= range;
+  return r;
+}
+
 double frnd(ub4 range)
 {
   double x;
@@ -24,6 +24,7 @@ extern int mkhist(ub4 callee,ub4 *data, ub4 n,struct range *rp, ub4 ivcnt,ub4 *b
 extern int mkhist2(ub2 *data, ub4 n,struct range *rp, ub4 ivcnt,ub4 *bins, const char *desc,ub4 lvl);
 
 extern ub4 rnd(ub4 range);
+extern ub4 rndr(ub8 *state,ub4 range);
 extern double frnd(ub4 range);
 
 extern int mkheightmap(ub4 *map,ub4 n);
@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 #include "base.h"
 #include "os.h"
@@ -63,6 +64,42 @@ static ub4 curainfo;
 
 static const ub4 blkmagic = 0x3751455d;
 
+// alloc and afree may be called from server worker threads
+static pthread_mutex_t memlock = PTHREAD_MUTEX_INITIALIZER;
+
+/* optional arena to build the network in, to share among processes : see snapshot in net.c
+   While set, all allocations are placed here. Freed memory is not reused
+ */
+static char *arenabase;
+static size_t arenalen,arenapos;
+
+void setarena(void *base,size_t len,size_t pos)
+{
+  arenabase = base;
+  arenalen = len;
+  arenapos = pos;
+}
+
+size_t arenause(void) { return arenapos; }
+
+static void *arenaalloc(size_t n,const char *desc,ub4 fln)
+{
+  size_t pos = (arenapos + 63) & ~(size_t)63;
+
+  if (pos + n > arenalen) errorfln(fln,Exit,FLN,"arena of %u MB full at %u MB for %s",(ub4)(arenalen >> 20),(ub4)(pos >> 20),desc);
+  arenapos = pos + n;
+  return arenabase + pos;
+}
+
+// give back whole pages
+static void arenafree(char *p,size_t n)
+{
+  size_t lo = ((size_t)p + 4095) & ~(size_t)4095;
+  size_t hi = ((size_t)p + n) & ~(size_t)4095;
+
+  if (hi > lo) osmrelease((void *)lo,hi - lo);
+}
+
 static void addsum(ub4 fln,const char *desc,ub4 mbcnt)
 {
   ub4 idlen = 0;
@@ -121,7 +158,7 @@ void showmemsums(void)
   showedmemsums = 1;
 }
 
-void *alloc_fln(ub4 elems,ub4 elsize,const char *slen,const char *sel,ub1 fill,const char *desc,ub4 arg,ub4 fln)
+static void *doalloc(ub4 elems,ub4 elsize,const char *slen,const char *sel,ub1 fill,const char *desc,ub4 arg,ub4 fln)
 {
   ub8 n8 = (ub8)elems * (ub8)elsize;
   size_t n;
@@ -162,7 +199,10 @@ void *alloc_fln(ub4 elems,ub4 elsize,const char *slen,const char *sel,ub1 fill,c
     errorfln(fln,Exit,FLN,"exceeding %u MB limit by %u+%u=%u MB for %s-%u",Maxmem_mb,totalMB,nm,nm + totalMB,desc,arg);
   }
 
-  if (nm >= mmap_from_mb) {
+  if (arenabase) {
+    p = arenaalloc(n,desc,fln);
+    if (fill) memset(p, fill, n); // arena starts zeroed
+  } else if (nm >= mmap_from_mb) {
     if (nm > 64) infofln2(fln,0,FLN,"alloc %u MB. for %s-%u",nm,desc,arg);
     p = osmmap(n);
     if (!p) { errorfln(fln,Exit,FLN,"cannot allocate %u MB for %s-%u",nm,desc,arg); return NULL; }
@@ -191,7 +231,8 @@ void *alloc_fln(ub4 elems,ub4 elsize,const char *slen,const char *sel,ub1 fill,c
   ai->allocfln = fln;
   ai->freefln = 0;
   ai->alloced = 1;
-  ai->mmap = (nm >= mmap_from_mb);
+  if (arenabase) ai->mmap = 2;
+  else ai->mmap = (nm >= mmap_from_mb);
   ai->mb = nm;
   ai->len = n;
 
@@ -199,7 +240,17 @@ void *alloc_fln(ub4 elems,ub4 elsize,const char *slen,const char *sel,ub1 fill,c
   return p;
 }
 
-int afree_fln(void *p,ub4 fln, const char *desc)
+void *alloc_fln(ub4 elems,ub4 elsize,const char *slen,const char *sel,ub1 fill,const char *desc,ub4 arg,ub4 fln)
+{
+  void *p;
+
+  pthread_mutex_lock(&memlock);
+  p = doalloc(elems,elsize,slen,sel,fill,desc,arg,fln);
+  pthread_mutex_unlock(&memlock);
+  return p;
+}
+
+static int dofree(void *p,ub4 fln, const char *desc)
 {
   block *b = lrupool;
   struct ainfo *ai = ainfos;
@@ -230,7 +281,9 @@ int afree_fln(void *p,ub4 fln, const char *desc)
   ai->alloced = 0;
   nm = ai->mb;
   subsum(desc,nm);
-  if (ai->mmap) {
+  if (ai->mmap == 2) {
+    if (arenabase) arenafree(p,ai->len);
+  } else if (ai->mmap) {
     if (osmunmap(p,ai->len)) return oserror(0,"cannot free %u MB at %p",nm,p);
   }
   else free(p);
@@ -238,6 +291,16 @@ int afree_fln(void *p,ub4 fln, const char *desc)
   return 0;
 }
 
+int afree_fln(void *p,ub4 fln, const char *desc)
+{
+  int rv;
+
+  pthread_mutex_lock(&memlock);
+  rv = dofree(p,fln,desc);
+  pthread_mutex_unlock(&memlock);
+  return rv;
+}
+
 // static block *lrutail = lrupool;
 static ub4 blockseq = 1;
 
@@ -258,9 +321,14 @@ void * trimblock_fln(block *blk,size_t elems,ub4 elsize,const char *selems,const
   if (elsize != blk->elsize) errorfln(fln,Exit,FLN,"size mismatch: %s size %u on %s size %u block '%s'",selsize,elsize,blk->selsize,blk->elsize,desc);
   if (elems >= blk->elems) errorfln(fln,Exit,FLN,"%s:\ah%lu above %s:\ah%lu block '%s'",selems,elems,blk->selems,blk->elems,desc);
   p = blk->base;
-  if (blk->mmap) {
-    info(0,"skip realloc from \ah%lu to \ah%lu for %s",blk->elems * blk->elsize,elems * elsize,desc);
-    return p;
+  if (blk->mmap) {  // give back whole pages past the new end
+    char *lo = (char *)(((size_t)p + elems * elsize + 4095) & ~(size_t)4095);
+    char *hi = (char *)(((size_t)p + blk->elems * blk->elsize) & ~(size_t)4095);
+
+    if (hi > lo) {
+      if (arenabase && lo >= arenabase && hi <= arenabase + arenalen) arenafree(lo,(size_t)(hi - lo));
+      else if (osmunmap(lo,(size_t)(hi - lo))) oswarning(0,"cannot release \ah%lu for %s",(ub8)(hi - lo),desc);
+    }
   } else {
     p = realloc(blk->base,elems * elsize);
     if (!p) errorfln(fln,Exit,FLN,"cannot reallocate to \ah%lu for %s",elems * elsize,desc);
@@ -317,7 +385,9 @@ void * __attribute__ ((format (printf,8,9))) mkblock_fln(
   descpos += mysnprintf(desc,descpos,desclen," - \ah%lu %s of %u %s alloc ",(unsigned long)elems,selems,elsize,selsize);
   descpos += msgfln(desc,descpos,desclen,fln,0);
   blk->desclen = descpos;
+  pthread_mutex_lock(&memlock);
   blk->seq = blockseq++;
+  pthread_mutex_unlock(&memlock);
 
   vrbfln(fln,V0|CC,"block '%s' ",desc);
 
@@ -330,7 +400,13 @@ void * __attribute__ ((format (printf,8,9))) mkblock_fln(
   if (nm >= Maxmem_mb) errorfln(fln,Exit,FLN,"exceeding %u MB limit by %u MB for %s",Maxmem_mb,nm,desc);
   if (totalMB + nm >= Maxmem_mb) errorfln(fln,Exit,FLN,"exceeding %u MB limit by %u MB for %s",Maxmem_mb,nm,desc);
 
-  if (nm >= mmap_from_mb) {
+  if (arenabase) {
+    pthread_mutex_lock(&memlock);
+    p = arenaalloc(n,desc,fln);
+    pthread_mutex_unlock(&memlock);
+    blk->mmap = 1; // no realloc
+    if (opts & Init1) memset(p, 0xff, n);
+  } else if (nm >= mmap_from_mb) {
     if (nm > 1024) infofln2(fln,0,FLN,"alloc %u MB. for %s",nm,desc);
     p = osmmap(n);
     if (!p) errorfln(fln,Exit,FLN,"cannot allocate %u MB for %s",nm,desc);
@@ -356,14 +432,46 @@ void * __attribute__ ((format (printf,8,9))) mkblock_fln(
 
   if (nm > 1024) infofln(fln,0,"alloc %u MB for %s, total %u", nm, desc, totalMB);
 
+  pthread_mutex_lock(&memlock);
   addsum(fln,desc,nm);
 
   if (lruhead >= lrupool + Elemcnt(lrupool)) lruhead = lrupool;
   memcpy(lruhead,blk,sizeof(block));
+  pthread_mutex_unlock(&memlock);
 
   return p;
 }
 
+// use memory not from mkblock, e.g. a mapped file, as block. not counted, trimmed or freed here
+void *mapblock_fln(block *blk,void *base,size_t elems,ub4 elsize,const char *selems,const char *selsize,ub4 fln,const char *desc)
+{
+  ub4 descpos,desclen = sizeof(blk->desc);
+
+  error_zp(blk,fln);
+  error_zp(base,fln);
+
+  if (blkmagic == blk->magic) errorfln(fln,Exit,FLN,"reusing block %s",blk->desc);
+  if (elems == 0) errorfln(fln,Exit,FLN,"zero length block %s",desc);
+  if (elsize == 0) errorfln(fln,Exit,FLN,"zero element size %s",desc);
+
+  blk->magic = blkmagic;
+  descpos = mysnprintf(blk->desc,0,desclen,"%s - \ah%lu %s of %u %s mapped ",desc,(unsigned long)elems,selems,elsize,selsize);
+  descpos += msgfln(blk->desc,descpos,desclen,fln,0);
+  blk->desclen = descpos;
+  pthread_mutex_lock(&memlock);
+  blk->seq = blockseq++;
+  pthread_mutex_unlock(&memlock);
+
+  blk->base = base;
+  blk->elems = elems;
+  blk->elsize = elsize;
+  blk->selems = selems;
+  blk->selsize = selsize;
+  blk->fln = fln;
+  blk->mmap = 1; // no realloc
+  return base;
+}
+
 size_t nearblock(size_t adr)
 {
   block *b = lrupool,*blklo,*blkhi;
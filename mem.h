@@ -50,6 +50,7 @@ enum Blkopts { Noinit, Init0, Init1 };
 #define allocnz(cnt,el,fill,desc,arg) (cnt) ? (el*)alloc_fln((cnt),sizeof(el),#cnt,#el,(fill),(desc),(arg),MFLN) : NULL
 #define mkblock(blk,cnt,el,opt,...) (el*)mkblock_fln((blk),(cnt),sizeof(el),(opt),#cnt,#el,MFLN,__VA_ARGS__)
 #define trimblock(blk,cnt,el) (el*)trimblock_fln((blk),(cnt),sizeof(el),#cnt,#el,MFLN)
+#define mapblock(blk,base,cnt,el,desc) (el*)mapblock_fln((blk),(base),(cnt),sizeof(el),#cnt,#el,MFLN,(desc))
 
 #define afree(ptr,desc) afree_fln((ptr),MFLN,(desc))
 
@@ -63,6 +64,10 @@ extern int afree_fln(void *p,ub4 fln, const char *desc);
 extern void * __attribute__ ((format (printf,8,9))) mkblock_fln(block *blk,size_t elems,ub4 elsize,enum Blkopts opts,const char *selems,const char *selsize,ub4 fln,const char *fmt,...);
 extern void bound_fln(block *blk,size_t pos,ub4 elsize,const char *spos,const char *sel,ub4 fln);
 extern void * trimblock_fln(block *blk,size_t elems,ub4 elsize,const char *selems,const char *selsize,ub4 fln);
+extern void *mapblock_fln(block *blk,void *base,size_t elems,ub4 elsize,const char *selems,const char *selsize,ub4 fln,const char *desc);
+
+extern void setarena(void *base,size_t len,size_t pos);
+extern size_t arenause(void);
 
 extern void showmemsums(void);
 
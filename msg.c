@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "base.h"
 
@@ -70,18 +71,19 @@ static const char *msgnames_long[Msglvl_last] = {
   "verbose" };
 
 #define MSGLEN 2048
-static char msgbuf[MSGLEN];
-static char ccbuf[MSGLEN];
-static char ccbuf2[MSGLEN];
+static Tls char msgbuf[MSGLEN];
+static Tls char ccbuf[MSGLEN];
+static Tls char ccbuf2[MSGLEN];
 
 static ub4 lastwarntoggle = 1;
 static char lastwarn[MSGLEN];
 static char lastwarn2[MSGLEN];
 static char lasterr[MSGLEN];
-static ub4 cclen,ccfln,lastwarniter,lastwarn2iter;
+static Tls ub4 cclen,ccfln;
+static ub4 lastwarniter,lastwarn2iter;
 
-static char prefix[128];
-static ub4 prefixlen;
+static Tls char prefix[128];
+static Tls ub4 prefixlen;
 
 static ub4 hicnts[Msglvl_last];
 static ub4 hiflns[Msglvl_last];
@@ -91,7 +93,10 @@ static ub4 hiflns2[Msglvl_last];
 static char himsgbufs[Msglvl_last][MSGLEN];
 static char himsgbufs2[Msglvl_last][MSGLEN];
 
-static ub4 decorpos;
+static Tls ub4 decorpos;
+
+// message buffers are per thread, summaries and output are shared
+static pthread_mutex_t msglock = PTHREAD_MUTEX_INITIALIZER;
 
 static ub8 progstart;
 
@@ -630,8 +635,8 @@ ub4 __attribute__ ((format (printf,4,5))) mysnprintf(char *dst, ub4 pos, ub4 len
   return n;
 }
 
-static ub4 callstack[64];
-static ub4 callpos;
+static Tls ub4 callstack[64];
+static Tls ub4 callpos;
 
 void enter(ub4 fln)
 {
@@ -780,6 +785,8 @@ static void __attribute__ ((nonnull(5))) msg(enum Msglvl lvl, ub4 sublvl, ub4 fl
   msgbuf[pos] = 0;
 
   ub4 cnt;
+
+  pthread_mutex_lock(&msglock);
   iter = himsgcnt[file * Maxmsgline | iterndx];
   cnt = iter & hi24;
   if (cnt < hi24) {
@@ -812,6 +819,7 @@ static void __attribute__ ((nonnull(5))) msg(enum Msglvl lvl, ub4 sublvl, ub4 fl
   msgbuf[pos++] = '\n';
   msgwrite(msgbuf,pos,code & Notty);
   if ( (code & Msg_ccerr) && lvl <= Warn && msg_fd != 2) myttywrite(msgbuf,pos);
+  pthread_mutex_unlock(&msglock);
 }
 
 void vmsg(enum Msglvl lvl,ub4 fln,const char *fmt,va_list ap)
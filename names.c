@@ -0,0 +1,378 @@
+// names.c - stop name index
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+/* Names of ports and member stops are normalized into lowercase words, built once at network init.
+   Each word of each name is an entry in an array sorted on word, so a prefix is a binary search
+   followed by a run of entries. Matches are ranked on match class, then on stop size and modes.
+   Fuzzy matching scans the distinct words for a small edit distance, only when nothing else matched.
+   Non-ascii bytes are kept as-is, without case folding.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+#include "cfg.h"
+#include "mem.h"
+#include "math.h"
+
+static ub4 msgfile;
+#include "msg.h"
+
+#include "os.h"
+#include "util.h"
+#include "net.h"
+#include "names.h"
+
+#define Qwords 16
+#define Wghtbits 24
+
+static int memeq(const char *s,const char *q,ub4 n) { return !memcmp(s,q,n); }
+
+void ininames(void)
+{
+  msgfile = setmsgfile(__FILE__);
+  iniassert();
+}
+
+// lowercase alphanumerics, other ascii collapsed into single spaces
+static ub4 normalize(const char *src,ub4 len,char *dst,ub4 dlen)
+{
+  ub4 i,n = 0;
+  ub1 c;
+  int sep = 0;
+
+  for (i = 0; i < len && src[i] && n + 2 < dlen; i++) {
+    c = (ub1)src[i];
+    if (c >= 'A' && c <= 'Z') c = (ub1)(c + 'a' - 'A');
+    else if ((c < 'a' || c > 'z') && (c < '0' || c > '9') && c < 0x80) { sep = 1; continue; }
+    if (sep && n) dst[n++] = ' ';
+    sep = 0;
+    dst[n++] = (char)c;
+  }
+  dst[n] = 0;
+  return n;
+}
+
+static ub4 wordlen(const char *s)
+{
+  ub4 n = 0;
+
+  while (s[n] && s[n] != ' ') n++;
+  return n;
+}
+
+static ub4 popcnt(ub4 x)
+{
+  ub4 n = 0;
+
+  while (x) { n++; x &= x - 1; }
+  return n;
+}
+
+struct nament {
+  ub4 ofs;
+  ub4 item;
+  ub4 weight;
+};
+
+static const char *sortpool;
+
+// on word, shorter first, then heaviest
+static int entcmp(const void *a,const void *b)
+{
+  const struct nament *aa = (const struct nament *)a;
+  const struct nament *bb = (const struct nament *)b;
+  const char *wa = sortpool + aa->ofs;
+  const char *wb = sortpool + bb->ofs;
+  ub4 la = wordlen(wa),lb = wordlen(wb);
+  int c = memcmp(wa,wb,min(la,lb));
+
+  if (c) return c;
+  else if (la != lb) return la < lb ? -1 : 1;
+  else if (aa->weight != bb->weight) return aa->weight > bb->weight ? -1 : 1;
+  else return aa->item < bb->item ? -1 : 1;
+}
+
+int mknameidx(struct gnetwork *net)
+{
+  struct nameidx *nx;
+  struct port *pp,*ports = net->ports;
+  struct sport *sp,*sports = net->sports;
+  ub4 portcnt = net->portcnt;
+  ub4 sportcnt = net->sportcnt;
+  ub4 item,itemcnt = portcnt + sportcnt;
+  ub4 n,pos,len,poslen,entcnt,namelen,ndep,modes;
+  ub4 *nameofs,*weight;
+  struct nament *tmpents;
+  const char *name;
+  char *pool;
+  char buf[256];
+
+  if (itemcnt == 0) return info0(0,"no stops for name index");
+
+  nx = alloc(1,struct nameidx,0,"name index",itemcnt);
+  nameofs = nx->nameofs = alloc(itemcnt,ub4,0,"name ofs",itemcnt);
+  weight = nx->weight = alloc(itemcnt,ub4,0,"name weight",itemcnt);
+
+  // pass 1 : pool size and word count
+  poslen = entcnt = 0;
+  for (item = 0; item < itemcnt; item++) {
+    if (item < portcnt) { pp = ports + item; name = pp->name; namelen = pp->namelen; }
+    else { sp = sports + item - portcnt; name = sp->name; namelen = sp->namelen; }
+    len = normalize(name,namelen,buf,sizeof(buf));
+    poslen += len + 1;
+    for (pos = 0; pos < len; pos++) if (pos == 0 || buf[pos - 1] == ' ') entcnt++;
+  }
+
+  pool = nx->pool = alloc(poslen,char,0,"name pool",itemcnt);
+  tmpents = alloc(max(entcnt,1),struct nament,0,"name ents",entcnt);
+
+  // pass 2 : fill
+  poslen = n = 0;
+  for (item = 0; item < itemcnt; item++) {
+    if (item < portcnt) {
+      pp = ports + item; name = pp->name; namelen = pp->namelen;
+      ndep = pp->ndep + pp->narr; modes = pp->modes;
+    } else {
+      sp = sports + item - portcnt; name = sp->name; namelen = sp->namelen;
+      ndep = sp->ndep + sp->narr; modes = sp->modes;
+    }
+    weight[item] = (min(ndep,(1U << (Wghtbits - 4)) - 1) << 4) | min(popcnt(modes),15);
+    len = normalize(name,namelen,pool + poslen,sizeof(buf));
+    nameofs[item] = poslen;
+    for (pos = 0; pos < len; pos++) {
+      if (pos && pool[poslen + pos - 1] != ' ') continue;
+      tmpents[n].ofs = poslen + pos;
+      tmpents[n].item = item;
+      tmpents[n].weight = weight[item];
+      n++;
+    }
+    poslen += len + 1;
+  }
+  error_ne(n,entcnt);
+
+  sortpool = pool;
+  if (entcnt > 1) qsort(tmpents,entcnt,sizeof(struct nament),entcmp);
+
+  nx->ents = alloc(max(entcnt,1),ub4,0,"name ents",entcnt);
+  nx->entitems = alloc(max(entcnt,1),ub4,0,"name entitems",entcnt);
+  for (n = 0; n < entcnt; n++) {
+    nx->ents[n] = tmpents[n].ofs;
+    nx->entitems[n] = tmpents[n].item;
+  }
+  afree(tmpents,"name ents");
+
+  nx->itemcnt = itemcnt;
+  nx->entcnt = entcnt;
+  net->nameidx = nx;
+  info(0,"name index of %u words for %u stops in %u bytes",entcnt,itemcnt,poslen);
+  return 0;
+}
+
+// edit distance counting a transposition as one edit, capped at lim + 1
+static ub4 editdist(const char *a,ub4 la,const char *b,ub4 lb,ub4 lim)
+{
+  ub4 rows[3][Namequery_max + 1];
+  ub4 *pp,*prv,*cur,*tmp;
+  ub4 i,j,lo,d;
+
+  if (la > Namequery_max) return lim + 1;
+  if ((la > lb ? la - lb : lb - la) > lim) return lim + 1;
+
+  pp = rows[0]; prv = rows[1]; cur = rows[2];
+  for (j = 0; j <= la; j++) prv[j] = j;
+  for (i = 1; i <= lb; i++) {
+    cur[0] = lo = i;
+    for (j = 1; j <= la; j++) {
+      d = min(min(prv[j] + 1,cur[j - 1] + 1),prv[j - 1] + (a[j - 1] != b[i - 1]));
+      if (i > 1 && j > 1 && a[j - 1] == b[i - 2] && a[j - 2] == b[i - 1]) d = min(d,pp[j - 2] + 1);
+      cur[j] = d;
+      lo = min(lo,d);
+    }
+    if (lo > lim) return lim + 1;
+    tmp = pp; pp = prv; prv = cur; cur = tmp;
+  }
+  return min(prv[la],lim + 1);
+}
+
+static ub4 fuzzlim(ub4 len)
+{
+  if (len < 3) return 0;
+  else if (len < 8) return 1;
+  else return 2;
+}
+
+struct qword {
+  const char *s;
+  ub4 len;
+};
+
+/* match class of a normalized name for all query words : the weakest among words
+   returns 0 for no match, else class + 1
+ */
+static ub4 matchname(const char *name,const struct qword *qw,ub4 qcnt,const char *qnorm,ub4 fuzzy,ub4 *pedits)
+{
+  const char *w;
+  ub4 q,wl,ed,best,bested,cls = Name_token,edits = 0;
+
+  for (q = 0; q < qcnt; q++) {
+    best = 0; bested = hi32;
+    w = name;
+    while (*w) {
+      wl = wordlen(w);
+      if (wl == qw[q].len && memeq(w,qw[q].s,wl)) { best = Name_token + 1; break; }
+      else if (wl > qw[q].len && memeq(w,qw[q].s,qw[q].len)) best = Name_prefix + 1;
+      else if (fuzzy && best == 0) {
+        ed = editdist(qw[q].s,qw[q].len,w,wl,fuzzlim(qw[q].len));
+        if (ed <= fuzzlim(qw[q].len)) bested = min(bested,ed);
+      }
+      w += wl;
+      if (*w == ' ') w++;
+    }
+    if (best == 0 && bested != hi32) { best = Name_fuzzy + 1; edits += bested; }
+    if (best == 0) return 0;
+    cls = min(cls,best - 1);
+  }
+  if (cls == Name_token && strcmp(name,qnorm) == 0) cls = Name_exact;
+  *pedits = edits;
+  return cls + 1;
+}
+
+// add to the list of best matches, highest score first
+static ub4 addmatch(ub4 item,ub4 match,ub4 score,ub4 k,ub4 n,struct namematch *res)
+{
+  ub4 i;
+
+  for (i = 0; i < n; i++) if (res[i].item == item) return n;
+  if (n == k && score <= res[k - 1].score) return n;
+  if (n < k) n++;
+  i = n - 1;
+  while (i && res[i - 1].score < score) {
+    res[i] = res[i - 1];
+    i--;
+  }
+  res[i].item = item;
+  res[i].match = match;
+  res[i].score = score;
+  return n;
+}
+
+// first entry with word not below the given prefix
+static ub4 lowerbound(struct nameidx *nx,const char *s,ub4 len)
+{
+  ub4 lo = 0,hi = nx->entcnt,mid,wl;
+  const char *w;
+  int c;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    w = nx->pool + nx->ents[mid];
+    wl = wordlen(w);
+    c = memcmp(w,s,min(wl,len));
+    if (c < 0 || (c == 0 && wl < len)) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+static ub4 mkscore(ub4 cls,ub4 edits,ub4 weight)
+{
+  return (cls << 28) | ((3 - min(edits,3)) << Wghtbits) | weight;
+}
+
+/* look up a stop name as exact, word, prefix or fuzzy match
+   returns count of matches, best first
+ */
+ub4 namelookup(struct gnetwork *net,const char *query,ub4 qlen,ub4 k,struct namematch *res)
+{
+  struct nameidx *nx = net->nameidx;
+  struct qword qw[Qwords];
+  char qnorm[Namequery_max + 1];
+  const char *w,*pw;
+  ub4 pos,len,wl,qcnt = 0,piv = 0,ent,item,cls,edits,plen,n = 0;
+  int near;
+
+  if (nx == NULL || k == 0 || nx->entcnt == 0) return 0;
+  k = min(k,Namematch_max);
+
+  len = normalize(query,qlen,qnorm,sizeof(qnorm));
+  for (pos = 0; pos < len && qcnt < Qwords; pos++) {
+    if (pos && qnorm[pos - 1] != ' ') continue;
+    qw[qcnt].s = qnorm + pos;
+    qw[qcnt].len = wordlen(qnorm + pos);
+    if (qw[qcnt].len > qw[piv].len) piv = qcnt;
+    qcnt++;
+  }
+  if (qcnt == 0) return 0;
+
+  // candidates from the longest query word as prefix
+  pw = qw[piv].s; plen = qw[piv].len;
+  for (ent = lowerbound(nx,pw,plen); ent < nx->entcnt; ent++) {
+    w = nx->pool + nx->ents[ent];
+    if (wordlen(w) < plen || memcmp(w,pw,plen)) break;
+    item = nx->entitems[ent];
+    cls = matchname(nx->pool + nx->nameofs[item],qw,qcnt,qnorm,0,&edits);
+    if (cls) n = addmatch(item,cls - 1,mkscore(cls - 1,0,nx->weight[item]),k,n,res);
+  }
+  if (n || fuzzlim(plen) == 0) return n;
+
+  // fuzzy : scan distinct words near the longest query word
+  pw = NULL; wl = 0; near = 0;
+  for (ent = 0; ent < nx->entcnt; ent++) {
+    w = nx->pool + nx->ents[ent];
+    if (pw == NULL || wordlen(w) != wl || memcmp(w,pw,wl)) {
+      pw = w;
+      wl = wordlen(w);
+      near = (editdist(qw[piv].s,plen,w,wl,fuzzlim(plen)) <= fuzzlim(plen));
+    }
+    if (near == 0) continue;
+    item = nx->entitems[ent];
+    cls = matchname(nx->pool + nx->nameofs[item],qw,qcnt,qnorm,1,&edits);
+    if (cls) n = addmatch(item,cls - 1,mkscore(cls - 1,edits,nx->weight[item]),k,n,res);
+  }
+  return n;
+}
+
+static const char *matchnames[] = { "fuzzy","prefix","word","exact" };
+
+// reply for command 'n'
+int namesearch(const char *query,ub4 qlen,ub4 cnt,struct myfile *rep)
+{
+  struct namematch res[Namematch_max];
+  gnet *net = getgnet();
+  struct port *pp,*ports = net->ports;
+  struct sport *sp,*sports = net->sports;
+  ub4 portcnt = net->portcnt;
+  ub4 n,matchcnt,item,pos = 0;
+  ub4 len = sizeof(rep->localbuf);
+  ub8 t0 = gettime_usec();
+
+  matchcnt = namelookup(net,query,qlen,cnt,res);
+  info(0,"%u result\as for '%.*s' in %u usec",matchcnt,qlen,query,(ub4)(gettime_usec() - t0));
+  if (matchcnt == 0) return error(0,"no stop name matches '%.*s'",qlen,query);
+
+  //  match \t id \t pid \t modes \t name
+
+  for (n = 0; n < matchcnt && pos + 256 < len; n++) {
+    item = res[n].item;
+    if (item < portcnt) {
+      pp = ports + item;
+      pos += mysnprintf(rep->localbuf,pos,len,".name\t%s\t%u\t%u\t%u\t%s\n",matchnames[res[n].match],item,item,pp->modes,pp->name);
+    } else {
+      sp = sports + item - portcnt;
+      pos += mysnprintf(rep->localbuf,pos,len,".name\t%s\t%u\t%u\t%u\t%s\n",matchnames[res[n].match],item,sp->parent,sp->modes,sp->name);
+    }
+  }
+  rep->len = pos;
+  rep->buf = rep->localbuf;
+  return 0;
+}
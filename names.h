@@ -0,0 +1,36 @@
+// names.h - stop name index
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+#define Namematch_max 64
+#define Namequery_max 128
+
+enum Namematch { Name_fuzzy,Name_prefix,Name_token,Name_exact };
+
+struct nameidx {
+  ub4 itemcnt;         // portcnt + sportcnt
+  ub4 entcnt;
+  char *pool;          // normalized names : lowercase words separated by a space
+  ub4 *nameofs;        // [itemcnt] into pool
+  ub4 *weight;         // [itemcnt] rank within a match class
+  ub4 *ents;           // [entcnt] word starts in pool, sorted on word then weight
+  ub4 *entitems;       // [entcnt] port, or portcnt + sport
+};
+
+struct namematch {
+  ub4 item;
+  ub4 match;           // enum Namematch
+  ub4 score;
+};
+
+extern void ininames(void);
+extern int mknameidx(struct gnetwork *net);
+extern ub4 namelookup(struct gnetwork *net,const char *query,ub4 qlen,ub4 k,struct namematch *res);
+extern int namesearch(const char *query,ub4 qlen,ub4 cnt,struct myfile *rep);
@@ -23,7 +23,9 @@
    - Prepare various metrics used for heuristics
  */
 
+#include <math.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "base.h"
 #include "cfg.h"
@@ -33,11 +35,16 @@
 static ub4 msgfile;
 #include "msg.h"
 
+#include "os.h"
 #include "util.h"
 #include "time.h"
 #include "net.h"
 #include "netn.h"
 #include "netev.h"
+#include "netcache.h"
+#include "grid.h"
+#include "names.h"
+#include "fare.h"
 
 #undef hdrstop
 
@@ -53,107 +60,506 @@ void ininet(void)
   iniassert();
 }
 
+/* network generations : a reload maps a newly published snapshot next to the current one.
+   New queries use the current generation, a pinned query keeps the generation it started on.
+   A replaced generation is unmapped when its last query is done.
+   Snapshots alternate between two base addresses on generation parity.
+   Without snapshot, the network built in-process is generation 0.
+ */
+#define Ngen 2
+
+struct netgen {
+  ub4 id;
+  ub4 users;
+  char *mem;       // mapped snapshot
+  size_t len;
+  struct gnetwork *gnet;  // NULL if free
+  struct network *nets;
+};
+
+static struct netgen netgens[Ngen];
+static struct netgen *curgen;
+static Tls struct netgen *usegen;
+
+static pthread_mutex_t genlock = PTHREAD_MUTEX_INITIALIZER;
+
 struct network *getnet(ub4 part)
 {
+  struct netgen *gp = usegen ? usegen : curgen;
+
   error_ge(part,Npart);
-  return gs_nets + part;
+  return gp ? gp->nets + part : gs_nets + part;
 }
 
 struct gnetwork *getgnet(void)
 {
-  return &gs_gnet;
+  struct netgen *gp = usegen ? usegen : curgen;
+
+  return gp ? gp->gnet : &gs_gnet;
 }
 
-// infer walk links
-static int mkwalks(struct network *net)
+// use the current generation for this thread until unpinned
+ub4 pinnet(void)
 {
-  ub4 portcnt = net->portcnt;
-  ub4 hopcnt = net->hopcnt;
-  ub4 chopcnt = net->chopcnt;
-  struct port *ports,*pdep,*parr;
-  char *dname,*aname;
-  ub4 dist,lodist = hi32,hidist = 0;
-  ub4 dep,arr,deparr,port2;
-  ub4 walklimit = net->walklimit;
-  ub4 walkspeed = net->walkspeed;  // geo's per hour
-  struct eta eta;
+  struct netgen *gp;
+
+  pthread_mutex_lock(&genlock);
+  gp = curgen;
+  if (gp) gp->users++;
+  pthread_mutex_unlock(&genlock);
+  usegen = gp;
+  return gp ? gp->id : 0;
+}
 
-  if (portcnt == 0) return error(0,"no ports for %u hops net",hopcnt);
-  if (hopcnt == 0) return error(0,"no hops for %u port net",portcnt);
+void unpinnet(void)
+{
+  struct netgen *gp = usegen;
 
-  if (walklimit < 2) {
-    net->whopcnt = chopcnt;
-    return info(0,"no walk links for %u m limit",walklimit * 10);
+  if (gp == NULL) return;
+  pthread_mutex_lock(&genlock);
+  gp->users--;
+  pthread_mutex_unlock(&genlock);
+  usegen = NULL;
+}
+
+ub4 netgenid(void)
+{
+  struct netgen *gp = usegen ? usegen : curgen;
+
+  return gp ? gp->id : 0;
+}
+
+// unmap replaced generations without queries
+static void dropgen(struct netgen *gp)
+{
+  info(0,"drop network generation %u",gp->id);
+  if (gp->mem && osmunmap(gp->mem,gp->len)) oserror(0,"cannot unmap generation %u",gp->id);
+  gp->mem = NULL;
+  gp->gnet = NULL;
+}
+
+void dropnetgens(void)
+{
+  struct netgen *gp;
+
+  pthread_mutex_lock(&genlock);
+  for (gp = netgens; gp < netgens + Ngen; gp++) {
+    if (gp != curgen && gp->gnet && gp->users == 0) dropgen(gp);
   }
+  pthread_mutex_unlock(&genlock);
+}
+
+ub4 netgenstats(char *buf,ub4 len)
+{
+  struct netgen *gp;
+  ub4 pos;
 
-  port2 = portcnt * portcnt;
+  pthread_mutex_lock(&genlock);
+  pos = mysnprintf(buf,0,len,"net\tgeneration %u\n",curgen ? curgen->id : 0);
+  for (gp = netgens; gp < netgens + Ngen; gp++) {
+    if (gp->gnet) pos += mysnprintf(buf,pos,len,"gen\t%u\t%s\tqueries %u\t%u MB\n",gp->id,gp == curgen ? "current" : "draining",gp->users,(ub4)(gp->len >> 20));
+  }
+  pthread_mutex_unlock(&genlock);
+  return pos;
+}
 
-  ports = net->ports;
+/* Network snapshot, to pay the network memory once per host for multiple servers.
+   The builder places all network memory in a file-backed arena at a fixed address,
+   and after mknet publishes it with the root structures at the end.
+   Servers map the file private at the same address : pages are shared until written,
+   e.g. by fare updates, which thus stay local to each server.
+   The file is built as <name>.new and renamed when complete.
+ */
+#define Snapmagic 0x536e6150
+#define Snapversion 2
+#define Snapbase 0x200000000000UL
+#define Snapspan 0x100000000000UL // between generation bases
+#define Snaphdrlen 4096
+
+struct snaphdr {
+  ub4 magic,version;
+  ub8 base,len;
+  ub8 rootofs;
+  ub4 gen;
+  ub4 builder;  // pid
+  ub4 t0;       // publish time in secs
+};
+
+struct snaproot {
+  block eventmem,evmapmem;  // from basenet
+  struct gnetwork gnet;
+  struct network nets[];    // [partcnt]
+};
+
+static char snapname[1024];
+static char *snapmem;
+static size_t snaplen;
+static ub4 snapgen;
+
+// read and check header of a published snapshot
+static int rdsnaphdr(const char *name,struct snaphdr *hdr)
+{
+  struct myfile mf;
+  long nr;
+  int fd;
+
+  fd = osopen(name);
+  if (fd == -1) return oserror(0,"cannot open snapshot %s",name);
+  nr = osread(fd,hdr,sizeof(*hdr));
+  if (osfdinfo(&mf,fd)) { osclose(fd); return oserror(0,"cannot access %s",name); }
+  osclose(fd);
+
+  if (nr != (long)sizeof(*hdr)) return error(0,"cannot read snapshot header of %s",name);
+  if (hdr->magic != Snapmagic) return error(0,"%s is not a network snapshot",name);
+  if (hdr->version != Snapversion) return error(0,"snapshot %s has version %u, expected %u",name,hdr->version,Snapversion);
+  if (mf.len < hdr->len) return error(0,"snapshot %s truncated to \ah%lu from \ah%lu",name,(ub8)mf.len,hdr->len);
+  return 0;
+}
 
-  // geographical direct-line distance
-  ub4 *dist0 = alloc(port2, ub4,0xff,"net0 geodist",portcnt);
+int mksnapshot(const char *name,ub4 mbytes)
+{
+  struct snaphdr hdr;
+  size_t len = (size_t)mbytes << 20;
+  size_t base;
+  int rv;
 
-  for (dep = 0; dep < portcnt; dep++) {
-    pdep = ports + dep;
-    if (pdep->valid == 0) continue;
-//    error_zz(pdep->lat,pdep->lon);
+  if (sizeof(void *) < 8) return error0(0,"network snapshot needs 64-bit addresses");
+  if (len < 2 * Snaphdrlen) return error(0,"snapshot size %u MB too small",mbytes);
+  if (len > Snapspan) return error(0,"snapshot size %u MB above %u",mbytes,(ub4)(Snapspan >> 20));
+
+  // follow up on a previous generation
+  rv = osexists(name);
+  if (rv == 1 && rdsnaphdr(name,&hdr) == 0) snapgen = hdr.gen + 1;
+  else snapgen = 1;
+  base = Snapbase + (snapgen & 1) * Snapspan;
+
+  fmtstring(snapname,"%s.new",name);
+  snapmem = osmmapfile(snapname,len,(void *)base,Osmap_create|Osmap_shared);
+  if (snapmem == NULL) return 1;
+  snaplen = len;
+  setarena(snapmem,len,Snaphdrlen);
+  info(0,"building network generation %u in snapshot %s of max %u MB",snapgen,snapname,mbytes);
+  return 0;
+}
+
+int pubsnapshot(const char *name)
+{
+  struct gnetwork *gn = &gs_gnet;
+  struct snaphdr *hdr = (struct snaphdr *)snapmem;
+  struct snaproot *root;
+  struct network *net;
+  struct netgen *gp;
+  ub4 part,partcnt = gn->partcnt;
+  ub4 rootlen = (ub4)(sizeof(struct snaproot) + partcnt * sizeof(struct network));
+  size_t len;
+
+  if (snapmem == NULL) return 0;
+
+  root = (struct snaproot *)alloc(rootlen,ub1,0,"snapshot root",partcnt);
+  len = (arenause() + 4095) & ~(size_t)4095;
+  setarena(NULL,0,0);
+
+  root->eventmem = *gn->eventmem;
+  root->evmapmem = *gn->evmapmem;
+  root->gnet = *gn;
+  root->gnet.eventmem = &root->eventmem;
+  root->gnet.evmapmem = &root->evmapmem;
+  for (part = 0; part < partcnt; part++) {
+    net = root->nets + part;
+    *net = gs_nets[part];
+    net->eventmem = &root->eventmem;
+    net->evmapmem = &root->evmapmem;
+    net->faremem = &root->gnet.faremem;
   }
-  for (dep = 0; dep < portcnt; dep++) {
-    if (progress(&eta,"port %u of %u for \ah%u distance pairs",dep,portcnt,port2)) return 1;
-    pdep = ports + dep;
-    if (pdep->valid == 0) continue;
-    dname = pdep->name;
-    for (arr = 0; arr < portcnt; arr++) {
-      if (dep == arr) continue;
+
+  hdr->magic = Snapmagic;
+  hdr->version = Snapversion;
+  hdr->base = (ub8)(size_t)snapmem;
+  hdr->len = len;
+  hdr->rootofs = (ub8)((char *)root - snapmem);
+  hdr->gen = snapgen;
+  hdr->builder = globs.pid;
+  hdr->t0 = gettime_sec();
+
+  if (osmsync(snapmem,len)) return oserror(0,"cannot sync snapshot %s",snapname);
+
+  // later changes in this process stay local, as in attached servers
+  if (osmmapfile(snapname,len,snapmem,Osmap_fixed) == NULL) return 1;
+  if (snaplen > len) osmunmap(snapmem + len,snaplen - len);
+  snaplen = len;
+
+  if (ostruncate(snapname,len)) return oserror(0,"cannot truncate %s",snapname);
+  if (osrename(snapname,name)) return oserror(0,"cannot rename %s to %s",snapname,name);
+
+  // the network built here becomes the first generation
+  gp = netgens + (snapgen & 1);
+  gp->id = snapgen;
+  gp->mem = snapmem;
+  gp->len = len;
+  gp->gnet = gn;
+  gp->nets = gs_nets;
+  curgen = gp;
+
+  info(0,"published network generation %u in snapshot %s of %u MB for %u partition\as",snapgen,name,(ub4)(len >> 20),partcnt);
+  return 0;
+}
+
+// drop an unpublished snapshot after a failed build
+void rmsnapshot(void)
+{
+  if (snapmem == NULL || curgen) return;
+  setarena(NULL,0,0);
+  osmunmap(snapmem,snaplen);
+  snapmem = NULL;
+  if (osremove(snapname)) oserror(0,"cannot remove %s",snapname);
+}
+
+// generation of the published snapshot, 0 if none
+ub4 snapshotgen(const char *name)
+{
+  struct snaphdr hdr;
+
+  if (osexists(name) != 1 || rdsnaphdr(name,&hdr)) return 0;
+  return hdr.gen;
+}
+
+// use network from snapshot as new current generation
+int attachsnapshot(const char *name)
+{
+  struct snaphdr hdr;
+  struct snaproot *root;
+  struct netgen *gp;
+  ub4 partcnt,prvgen;
+  char *mem;
+
+  if (rdsnaphdr(name,&hdr)) return 1;
+
+  if (curgen && curgen->id == hdr.gen) return info(0,"network generation %u in %s is current",hdr.gen,name);
+
+  gp = netgens + (hdr.gen & 1);
+  pthread_mutex_lock(&genlock);
+  if (gp == curgen) {
+    pthread_mutex_unlock(&genlock);
+    return error(0,"snapshot generation %u would replace current %u",hdr.gen,gp->id);
+  } else if (gp->gnet && gp->users) {
+    pthread_mutex_unlock(&genlock);
+    return warn(0,"generation %u still in use by %u queries",gp->id,gp->users);
+  } else if (gp->gnet) dropgen(gp);
+  pthread_mutex_unlock(&genlock);
+
+  mem = osmmapfile(name,(size_t)hdr.len,(void *)(size_t)hdr.base,0);
+  if (mem == NULL) return 1;
+
+  root = (struct snaproot *)(mem + hdr.rootofs);
+  partcnt = root->gnet.partcnt;
+  if (partcnt > Npart) {
+    osmunmap(mem,(size_t)hdr.len);
+    return error(0,"snapshot %s has %u partitions, max %u",name,partcnt,Npart);
+  }
+
+  gp->id = hdr.gen;
+  gp->users = 0;
+  gp->mem = mem;
+  gp->len = (size_t)hdr.len;
+  gp->gnet = &root->gnet;
+  gp->nets = root->nets;
+
+  pthread_mutex_lock(&genlock);
+  prvgen = curgen ? curgen->id : 0;
+  curgen = gp;
+  pthread_mutex_unlock(&genlock);
+
+  info(0,"attached network generation %u from %s of %u MB by process %u, %u partition\as",hdr.gen,name,(ub4)(hdr.len >> 20),hdr.builder,partcnt);
+  infocc(prvgen,0,"generation %u now serves new queries instead of %u",hdr.gen,prvgen);
+  globs.netok = 1;
+  return 0;
+}
+
+/* Walk links are inferred between ports within walking distance.
+   Ports are bucketed in a lat/lon grid with cells of at least the walk limit,
+   so only ports in neighbouring cells need a distance check.
+   Cells are hashed into buckets, as the grid of a large area is sparse.
+   The grid does not wrap at the date line.
+ */
+
+#define Walkradius (6371.0 * Geoscale * 0.85) // margin for approximations in geodist
+
+struct walkgrid {
+  double lat0,lon0;    // radians, south-west corner
+  double cellh,cellw;  // radians
+  ub4 bucketcnt;
+  ub4 *bucketofs;      // [bucketcnt + 1] into items
+  ub4 *items;          // ports, ascending per bucket
+  ub4 *cells;          // [portcnt * 2] lat,lon cell per port
+};
+
+static ub4 walkbucket(struct walkgrid *wg,ub4 la,ub4 lo)
+{
+  return ((la * 0x9e3779b1) ^ (lo * 0x85ebca6b)) & (wg->bucketcnt - 1);
+}
+
+// ports with a position can have walk links
+static int walkport(struct port *pp)
+{
+  return pp->valid && pp->lat && pp->lon;
+}
+
+static ub4 mkwalkgrid(struct network *net,struct walkgrid *wg)
+{
+  struct port *pp,*ports = net->ports;
+  ub4 port,portcnt = net->portcnt;
+  ub4 cnt = 0,bucket,bucketcnt,la,lo,*bucketofs,*cells;
+  double lolat = 10,hilat = -10,lolon = 10,coslat;
+
+  for (port = 0; port < portcnt; port++) {
+    pp = ports + port;
+    if (walkport(pp) == 0) continue;
+    lolat = min(lolat,pp->rlat); hilat = max(hilat,pp->rlat);
+    lolon = min(lolon,pp->rlon);
+    cnt++;
+  }
+  if (cnt == 0) return 0;
+
+  // cells span the walk limit in both directions at the highest latitude
+  coslat = max(cos(max(fabs(lolat),fabs(hilat))),0.05);
+  wg->lat0 = lolat;
+  wg->lon0 = lolon;
+  wg->cellh = (net->walklimit + 1) / Walkradius;
+  wg->cellw = wg->cellh / coslat;
+
+  bucketcnt = 1;
+  while (bucketcnt < cnt * 2) bucketcnt <<= 1;
+  wg->bucketcnt = bucketcnt;
+
+  bucketofs = wg->bucketofs = alloc(bucketcnt + 1,ub4,0,"net walk buckets",bucketcnt);
+  cells = wg->cells = alloc(portcnt * 2,ub4,0,"net walk cells",portcnt);
+  wg->items = alloc(cnt,ub4,0,"net walk ports",cnt);
+
+  for (port = 0; port < portcnt; port++) {
+    pp = ports + port;
+    if (walkport(pp) == 0) continue;
+    la = cells[port * 2] = (ub4)((pp->rlat - lolat) / wg->cellh);
+    lo = cells[port * 2 + 1] = (ub4)((pp->rlon - lolon) / wg->cellw);
+    bucketofs[walkbucket(wg,la,lo) + 1]++;
+  }
+  for (bucket = 0; bucket < bucketcnt; bucket++) bucketofs[bucket + 1] += bucketofs[bucket];
+  for (port = 0; port < portcnt; port++) {
+    if (walkport(ports + port) == 0) continue;
+    bucket = walkbucket(wg,cells[port * 2],cells[port * 2 + 1]);
+    wg->items[bucketofs[bucket]++] = port;
+  }
+  for (bucket = bucketcnt; bucket; bucket--) bucketofs[bucket] = bucketofs[bucket - 1];
+  bucketofs[0] = 0;
+
+  info(0,"walk grid of %u buckets for %u ports, cell %u x %u",bucketcnt,cnt,(ub4)(wg->cellh * Walkradius),(ub4)(wg->cellw * coslat * Walkradius));
+  return cnt;
+}
+
+static void rmwalkgrid(struct walkgrid *wg)
+{
+  afree(wg->bucketofs,"net walk buckets");
+  afree(wg->cells,"net walk cells");
+  afree(wg->items,"net walk ports");
+}
+
+// walk links from dep as arr << 32 | dist, ascending on arr
+static ub4 walknear(struct network *net,struct walkgrid *wg,ub4 dep,ub8 *near)
+{
+  struct port *pdep,*parr,*ports = net->ports;
+  ub4 walklimit = net->walklimit;
+  ub4 la,lo,dla,dlo,bucket,ofs,arr,dist,b,n = 0,bcnt = 0;
+  ub4 buckets[9];
+
+  pdep = ports + dep;
+  if (walkport(pdep) == 0) return 0;
+
+  la = wg->cells[dep * 2];
+  lo = wg->cells[dep * 2 + 1];
+
+  for (dla = 0; dla < 3; dla++) {
+    if (la + dla == 0) continue;
+    for (dlo = 0; dlo < 3; dlo++) {
+      if (lo + dlo == 0) continue;
+      bucket = walkbucket(wg,la + dla - 1,lo + dlo - 1);
+      for (b = 0; b < bcnt; b++) if (buckets[b] == bucket) break;
+      if (b == bcnt) buckets[bcnt++] = bucket;
+    }
+  }
+
+  for (b = 0; b < bcnt; b++) {
+    bucket = buckets[b];
+    for (ofs = wg->bucketofs[bucket]; ofs < wg->bucketofs[bucket + 1]; ofs++) {
+      arr = wg->items[ofs];
+      if (arr == dep) continue;
       parr = ports + arr;
-      if (parr->valid == 0) continue;
-      aname = parr->name;
-      error_eq_cc(pdep->gid,parr->gid,"%s %s",dname,aname);
-      deparr = dep * portcnt + arr;
-      if (pdep->lat && pdep->lat == parr->lat && pdep->lon && pdep->lon == parr->lon) {
-        info(Iter,"ports %u-%u coloc %u,%u-%u,%u %s to %s",dep,arr,pdep->lat,pdep->lon,parr->lat,parr->lon,dname,aname);
+      error_eq_cc(pdep->gid,parr->gid,"%s %s",pdep->name,parr->name);
+      if (pdep->lat == parr->lat && pdep->lon == parr->lon) {
+        info(Iter,"ports %u-%u coloc %u,%u-%u,%u %s to %s",dep,arr,pdep->lat,pdep->lon,parr->lat,parr->lon,pdep->name,parr->name);
         dist = 0;
-      } else {
-        dist = fgeodist(pdep,parr);
-//        infocc(dist == 0 || dep == 0,0,"ports %u-%u dist %u %s to %s",dep,arr,dist,dname,aname);
-      }
-//      error_z(dist,arr);
-      dist0[deparr] = dist;
-      lodist = min(dist,lodist);
-      hidist = max(dist,hidist);
+      } else dist = fgeodist(pdep,parr);
+      if (dist > walklimit) continue;
+      near[n++] = (ub8)arr << 32 | dist;
     }
   }
+  if (n > 1) sort8(near,n,FLN,"walk links");
+  return n;
+}
 
+// optional histograms of all port to port distances. quadratic in time
+static int walkhist(struct network *net)
+{
+  ub4 portcnt = net->portcnt;
+  ub4 walklimit = net->walklimit;
+  struct port *pdep,*parr,*ports = net->ports;
+  ub4 dist,lodist = hi32,hidist = 0;
+  ub4 dep,arr,pass;
+  ub8 port2 = (ub8)portcnt * portcnt;
   ub4 geohist[128];
   ub4 geohist2[64];
   ub4 cnt,iv,ivcnt = Elemcnt(geohist);
   ub4 iv2cnt = Elemcnt(geohist2);
-  ub4 hidist2 = min(hidist,walklimit * 2);
-  ub4 range =  max(1,hidist - lodist);
-  ub4 range2 =  max(1,hidist2 - lodist);
+  ub4 hidist2,range = 1,range2 = 1;
+  ub8 sumcnt;
+  struct eta eta;
+
   aclear(geohist);
   aclear(geohist2);
-  for (dep = 0; dep < portcnt; dep++) {
-    for (arr = 0; arr < portcnt; arr++) {
-      if (dep == arr) continue;
-      deparr = dep * portcnt + arr;
-      dist = dist0[deparr];
+
+  // first pass for the range, second to fill
+  for (pass = 0; pass < 2; pass++) {
+    for (dep = 0; dep < portcnt; dep++) {
+      if (progress(&eta,"port %u of %u for \ah%lu distance pairs",dep,portcnt,port2)) return 1;
       pdep = ports + dep;
-      parr = ports + arr;
-      if (dist == 1) info(0,"port dist %u %u-%u %s to %s",dist,dep,arr,pdep->name,parr->name);
-      else if (dist == hi32) {
-        geohist[ivcnt-1]++;
-        geohist2[iv2cnt-1]++;
-      } else {
-        iv = ((dist - lodist) * ivcnt) / range;
-        geohist[min(iv,ivcnt-1)]++;
-        iv = ((dist - lodist) * iv2cnt) / range2;
-        geohist2[min(iv,iv2cnt-1)]++;
+      for (arr = 0; arr < portcnt; arr++) {
+        if (dep == arr) continue;
+        parr = ports + arr;
+        if (pdep->valid == 0 || parr->valid == 0) dist = hi32;
+        else if (pdep->lat && pdep->lat == parr->lat && pdep->lon && pdep->lon == parr->lon) dist = 0;
+        else dist = fgeodist(pdep,parr);
+        if (pass == 0) {
+          if (dist == hi32) continue;
+          lodist = min(dist,lodist);
+          hidist = max(dist,hidist);
+        } else if (dist == 1) info(0,"port dist %u %u-%u %s to %s",dist,dep,arr,pdep->name,parr->name);
+        else if (dist == hi32) {
+          geohist[ivcnt-1]++;
+          geohist2[iv2cnt-1]++;
+        } else {
+          iv = ((dist - lodist) * ivcnt) / range;
+          geohist[min(iv,ivcnt-1)]++;
+          iv = ((dist - lodist) * iv2cnt) / range2;
+          geohist2[min(iv,iv2cnt-1)]++;
+        }
       }
     }
+    if (lodist > hidist) return info0(0,"no port distances");
+    hidist2 = min(hidist,walklimit * 2);
+    range =  max(1,hidist - lodist);
+    range2 =  max(1,hidist2 - lodist);
   }
+
   info(0,"geodist range %u - %u",lodist,hidist);
-  ub8 sumcnt = 0;
+  sumcnt = 0;
   for (iv = 0; iv < ivcnt; iv++) {
     cnt = geohist[iv];
     if (cnt == 0) continue;
@@ -168,28 +574,55 @@ static int mkwalks(struct network *net)
     sumcnt += cnt;
     info(0,"%u \ag%u = \ah%u: %u pm",iv,lodist + (iv * range2) / iv2cnt,cnt,(ub4)((sumcnt * 1000) / port2));
   }
+  return 0;
+}
 
-  ub4 *orgportsbyhop = net->portsbyhop;
-  ub4 *orghopdist = net->hopdist;
-  ub4 *orghopdur = net->hopdur;
+// infer walk links
+static int mkwalks(struct network *net)
+{
+  ub4 portcnt = net->portcnt;
+  ub4 hopcnt = net->hopcnt;
+  ub4 chopcnt = net->chopcnt;
+  struct port *ports,*pdep,*parr;
+  ub4 dist;
+  ub4 dep,arr,n,i,nearcnt;
+  ub4 walklimit = net->walklimit;
+  ub4 walkspeed = net->walkspeed;  // geo's per hour
+  struct walkgrid wg;
+  ub8 *near;
+  struct eta eta;
 
-#if 0
-  ub1 *net0 = alloc(port2,ub1,0,"net net0",portcnt);
-  for (hop = 0; hop < hopcnt; hop++) {
-    dep = orgportsbyhop[hop * 2];
-    arr = orgportsbyhop[hop * 2 + 1];
-    if (dep == hi32 || arr == hi32) continue;
-    net0[dep * portcnt + arr] = 1;
+  if (portcnt == 0) return error(0,"no ports for %u hops net",hopcnt);
+  if (hopcnt == 0) return error(0,"no hops for %u port net",portcnt);
+
+  if (walklimit < 2) {
+    net->whopcnt = chopcnt;
+    return info(0,"no walk links for %u m limit",walklimit * 10);
   }
-#endif
+
+  ports = net->ports;
+
+  if (globs.engvars[Eng_walkhist] && walkhist(net)) return 1;
+
+  oclear(wg);
+  nearcnt = mkwalkgrid(net,&wg);
+  if (nearcnt == 0) {
+    net->whopcnt = chopcnt;
+    return info(0,"no located ports for walk links in %u port net",portcnt);
+  }
+  near = alloc(nearcnt,ub8,0,"net walk near",nearcnt);
 
   ub4 whop,whopcnt = 0;
-  for (deparr = 0; deparr < port2; deparr++) {
-    if (dist0[deparr] > walklimit) continue;
-    whopcnt++;
+  for (dep = 0; dep < portcnt; dep++) {
+    if (progress(&eta,"port %u of %u for \ah%u walk links",dep,portcnt,whopcnt)) { rmwalkgrid(&wg); afree(near,"net walk near"); return 1; }
+    whopcnt += walknear(net,&wg,dep,near);
   }
   info(0,"\ah%u inferred walk links below dist %u",whopcnt,walklimit);
 
+  ub4 *orgportsbyhop = net->portsbyhop;
+  ub4 *orghopdist = net->hopdist;
+  ub4 *orghopdur = net->hopdur;
+
   ub4 newhopcnt = chopcnt + whopcnt;
 
   ub4 *portsbyhop = alloc(newhopcnt * 2,ub4,0,"net portsbyhop",newhopcnt);
@@ -203,22 +636,23 @@ static int mkwalks(struct network *net)
 
   ub4 hiwdist = 0,hiwhop = hi32;
   whop = chopcnt;
-  for (deparr = 0; deparr < port2; deparr++) {
-    dist = dist0[deparr];
-    if (dist > walklimit) continue;
-
-    dep = deparr / portcnt;
-    arr = deparr % portcnt;
-    portsbyhop[whop * 2] = dep;
-    portsbyhop[whop * 2 + 1] = arr;
-
-    if (walkspeed) hopdur[whop] = (max(dist,1) * 60) / walkspeed;
-    else hopdur[whop] = 60 * 24 * 7;
-
-    hopdist[whop] = dist;
-    if (dist > hiwdist) { hiwdist = dist; hiwhop = whop; }
-    whop++;
+  for (dep = 0; dep < portcnt; dep++) {
+    n = walknear(net,&wg,dep,near);
+    for (i = 0; i < n; i++) {
+      arr = (ub4)(near[i] >> 32);
+      dist = (ub4)near[i];
+      portsbyhop[whop * 2] = dep;
+      portsbyhop[whop * 2 + 1] = arr;
+
+      if (walkspeed) hopdur[whop] = (max(dist,1) * 60) / walkspeed;
+      else hopdur[whop] = 60 * 24 * 7;
+
+      hopdist[whop] = dist;
+      if (dist > hiwdist) { hiwdist = dist; hiwhop = whop; }
+      whop++;
+    }
   }
+  error_ne(whop,newhopcnt);
   if (hiwhop < whop) {
     dep = portsbyhop[hiwhop * 2];
     arr = portsbyhop[hiwhop * 2 + 1];
@@ -227,7 +661,8 @@ static int mkwalks(struct network *net)
     info(0,"longest walk link dist %u hop %u %u-%u %s to %s",hiwdist,hiwhop,dep,arr,pdep->name,parr->name);
   }
 
-  afree(dist0 ,"net0 geodist");
+  afree(near,"net walk near");
+  rmwalkgrid(&wg);
 
   net->whopcnt = whop;
   net->portsbyhop = portsbyhop;
@@ -242,12 +677,13 @@ static int conchk(struct network *net)
   ub4 portcnt = net->portcnt;
   ub4 vportcnt = net->vportcnt;
 
-  ub4 port2 = portcnt * portcnt;
-
   struct port *pdep,*ports = net->ports;
 
-  ub4 dep,arr,deparr;
-  ub2 *cnts = net->con0cnt;
+  ub4 dep,arr,pair,col;
+  ub4 *conrow = net->conrow[0];
+  ub4 *conarr = net->conarr[0];
+  ub4 *con0col = net->con0col;
+  ub4 *con0dep = net->con0dep;
 
   ub1 *conns = alloc(portcnt,ub1,0,"net dotlinks",portcnt);
 
@@ -255,10 +691,11 @@ static int conchk(struct network *net)
   ub4 iter = 0;
 
   // start with first hop
-  for (deparr = 0; deparr < port2; deparr++) {
-    if (cnts[deparr]) break;
+  for (dep = 0; dep < portcnt; dep++) {
+    if (conrow[dep] < conrow[dep + 1]) break;
   }
-  dep = deparr / portcnt; arr = deparr % portcnt;
+  if (dep == portcnt) return error(0,"no connections in %u port net",portcnt);
+  arr = conarr[conrow[dep]];
   conns[dep] = conns[arr] = 1;
 
   do {
@@ -269,9 +706,8 @@ static int conchk(struct network *net)
     for (dep = 0; dep < portcnt; dep++) {
       if (conns[dep] == 0) continue;
 
-      deparr = dep * portcnt;
-      for (arr = 0; arr < portcnt; arr++) {
-        if (cnts[deparr + arr] == 0) continue;
+      for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+        arr = conarr[pair];
         if (conns[arr] == 0) { conns[arr] = 1; concnt++; }
       }
     }
@@ -279,8 +715,8 @@ static int conchk(struct network *net)
     for (arr = 0; arr < portcnt; arr++) {
       if (conns[arr] == 0) continue;
 
-      for (dep = 0; dep < portcnt; dep++) {
-        if (cnts[dep * portcnt + arr] == 0) continue;
+      for (col = con0col[arr]; col < con0col[arr + 1]; col++) {
+        dep = con0dep[col];
         if (conns[dep] == 0) { conns[dep] = 1; concnt++; }
       }
     }
@@ -319,9 +755,12 @@ static int mknet0(struct network *net)
   ub4 ofs,*con0ofs;
   ub4 hop,l1,l2,*con0lst;
   ub4 dist,*lodists,*hopdist;
-  ub4 dep,arr,port2,da,depcnt,arrcnt;
+  ub4 dep,arr,depcnt,arrcnt;
+  ub4 *conrow,*conarr,*con0col,*con0dep,*con0pair,*arrcnts;
+  ub8 *pairs;
+  ub4 pair,paircnt,keycnt,n;
   ub4 rid;
-  ub4 needconn,haveconn;
+  ub4 needconn,haveconn,vportcnt;
   ub2 iv;
 
   if (portcnt == 0) return error(0,"no ports for %u hops net",hopcnt);
@@ -332,22 +771,53 @@ static int mknet0(struct network *net)
 
   info(0,"init 0-stop connections for %u port %u hop network",portcnt,hopcnt);
 
-  port2 = portcnt * portcnt;
-
   ports = net->ports;
   hops = net->hops;
   ub4 *choporg = net->choporg;
 
   portsbyhop = net->portsbyhop;
 
-  con0cnt = alloc(port2, ub2,0,"net0 concnt",portcnt);
-  con0ofs = alloc(port2, ub4,0,"net0 conofs",portcnt);
+  // dep-arr pairs present, ascending
+  pairs = alloc(whopcnt,ub8,0,"net0 pairs",portcnt);
+  keycnt = 0;
+  for (hop = 0; hop < whopcnt; hop++) {
+    dep = portsbyhop[hop * 2];
+    arr = portsbyhop[hop * 2 + 1];
+    if (dep == hi32 || arr == hi32 || dep == arr) continue;
+    error_ge(dep,portcnt);
+    error_ge(arr,portcnt);
+    if (ports[dep].valid == 0 || ports[arr].valid == 0) continue;
+    pairs[keycnt++] = ((ub8)dep << 32) | arr;
+  }
+  if (keycnt == 0) return error(0,"no valid hops for %u port net",portcnt);
+  if (keycnt > 1) sort8(pairs,keycnt,FLN,"net0 pairs");
+
+  paircnt = 0;
+  for (n = 0; n < keycnt; n++) {
+    if (paircnt && pairs[n] == pairs[paircnt - 1]) continue;
+    pairs[paircnt++] = pairs[n];
+  }
 
-  con0lst = mkblock(net->conlst,whopcnt,ub4,Init1,"net0 0-stop conlst");
+  conrow = alloc(portcnt + 1,ub4,0,"net0 conrow",portcnt);
+  conarr = alloc(paircnt,ub4,0,"net0 conarr",portcnt);
+  for (pair = 0; pair < paircnt; pair++) {
+    dep = (ub4)(pairs[pair] >> 32);
+    conarr[pair] = (ub4)pairs[pair];
+    conrow[dep + 1]++;
+  }
+  for (dep = 0; dep < portcnt; dep++) conrow[dep + 1] += conrow[dep];
+  afree(pairs,"net0 pairs");
+
+  net->conrow[0] = conrow;
+  net->conarr[0] = conarr;
+  net->conpairs[0] = paircnt;
 
-  ub1 *allcnt = alloc(port2, ub1,0,"net allcnt",portcnt);
+  con0cnt = alloc(paircnt, ub2,0,"net0 concnt",portcnt);
+  con0ofs = alloc(paircnt, ub4,0,"net0 conofs",portcnt);
 
-  if (partcnt > 1) lodists = alloc(port2, ub4,0xff,"net0 lodist",portcnt);
+  con0lst = mkblock(net->conlst,whopcnt,ub4,Init1,"net0 0-stop conlst");
+
+  if (partcnt > 1) lodists = alloc(paircnt, ub4,0xff,"net0 lodist",portcnt);
   else lodists = NULL;
 
   ub4 *hoprids = alloc(whopcnt,ub4,0xff,"net hoprids",chopcnt);
@@ -356,7 +826,7 @@ static int mknet0(struct network *net)
 
   // create 0-stop connectivity
   // support multiple hops per port pair
-  ub4 ovfcnt = 0,hicon = 0,hida = 0, nhopcnt = 0; 
+  ub4 ovfcnt = 0,hicon = 0,hidep = 0,hiarr = 0,nhopcnt = 0;
   for (hop = 0; hop < whopcnt; hop++) {
     dep = portsbyhop[hop * 2];
     arr = portsbyhop[hop * 2 + 1];
@@ -372,27 +842,22 @@ static int mknet0(struct network *net)
       rid = hp->rid;
     } else rid = hi32;
 
-    error_ge(dep,portcnt);
-    error_ge(arr,portcnt);
     pdep = ports + dep;
     parr = ports + arr;
     if (pdep->valid == 0 || parr->valid == 0) continue;
 
     dname = pdep->name;
     aname = parr->name;
-    if (dep == arr) {
-      warning(0,"hop %u dep == arr %u %s",hop,dep,dname);
-      continue;
-    }
 
     hoprids[hop] = rid;
 
-    da = dep * portcnt + arr;
+    pair = conpair(net,0,dep,arr);
+    error_eq(pair,hi32);
 
     dist = hopdist[hop];
-    if (lodists) lodists[da] = min(lodists[da],dist);
+    if (lodists) lodists[pair] = min(lodists[pair],dist);
 
-    concnt = con0cnt[da];
+    concnt = con0cnt[pair];
 
     if (concnt >= cntlim) {
       ovfcnt++;
@@ -403,24 +868,19 @@ static int mknet0(struct network *net)
       ovfcnt++;
     } else concnt++;
     nhopcnt++;
-    if (concnt > hicon) { hicon = concnt; hida = da; }
-    con0cnt[da] = concnt;
-
-//    if (hop < hopcnt && dist != dist0[da]) warning(0,"hop %u dist %u vs %u",hop,dist,dist0[da]);
+    if (concnt > hicon) { hicon = concnt; hidep = dep; hiarr = arr; }
+    con0cnt[pair] = concnt;
   }
   if (ovfcnt) warning(0,"limiting 0-stop net by \ah%u",ovfcnt);
   infocc(nhopcnt != whopcnt,0,"marked %u out of %u hops, skipped %u",nhopcnt,whopcnt,whopcnt - nhopcnt);
 
-  dep = hida / portcnt; arr = hida % portcnt;
-  pdep = ports + dep; parr = ports + arr;
-  info(0,"highest conn %u between ports %u-%u %s to %s",hicon,dep,arr,pdep->name,parr->name);
+  pdep = ports + hidep; parr = ports + hiarr;
+  info(0,"highest conn %u between ports %u-%u %s to %s",hicon,hidep,hiarr,pdep->name,parr->name);
 
   for (hop = 0; hop < whopcnt; hop++) {
     dep = portsbyhop[hop * 2];
     arr = portsbyhop[hop * 2 + 1];
-    if (dep == hi32 || arr == hi32 || dep == arr) continue;
-    da = dep * portcnt + arr;
-    if (da != hida) continue;
+    if (dep != hidep || arr != hiarr) continue;
 
     if (hop < hopcnt) {
       hp = hops + hop;
@@ -434,35 +894,20 @@ static int mknet0(struct network *net)
   }
 
   ofs = 0;
-  needconn = haveconn = 0;
-
-  for (dep = 0; dep < portcnt; dep++) {
-
-    pdep = ports + dep;
-    if (pdep->valid == 0) continue;
-
-    for (arr = 0; arr < portcnt; arr++) {
-      if (dep == arr) continue;
-      parr = ports + arr;
-      if (parr->valid == 0) continue;
-
-      needconn++;
-
-      da = dep * portcnt + arr;
-      concnt = con0cnt[da];
-      if (concnt == 0) continue;
-
-      concnt = con0cnt[da];
-      con0ofs[da] = ofs;
-      ofs += concnt;
-    }
+  for (pair = 0; pair < paircnt; pair++) {
+    con0ofs[pair] = ofs;
+    ofs += con0cnt[pair];
   }
 
   net->lstlen[0] = ofs;
 
+  vportcnt = 0;
+  for (dep = 0; dep < portcnt; dep++) if (ports[dep].valid) vportcnt++;
+  needconn = vportcnt * (vportcnt - 1);
+
   // pass 2: fill
   info(0,"pass 2 0-stop %u hop net",hopcnt);
-  nclear(con0cnt,port2); // accumulate back below
+  nclear(con0cnt,paircnt); // accumulate back below
   for (hop = 0; hop < whopcnt; hop++) {
     dep = portsbyhop[hop * 2];
     arr = portsbyhop[hop * 2 + 1];
@@ -471,21 +916,17 @@ static int mknet0(struct network *net)
     parr = ports + arr;
     if (pdep->valid == 0 || parr->valid == 0) continue;
 
-    da = dep * portcnt + arr;
-    gen = con0cnt[da];
-    ofs = con0ofs[da];
+    pair = conpair(net,0,dep,arr);
+    gen = con0cnt[pair];
+    ofs = con0ofs[pair];
     if (gen >= cntlim) continue;
     con0lst[ofs+gen] = hop;
-    con0cnt[da] = (ub2)(gen + 1);
-    allcnt[da] = 1;
+    con0cnt[pair] = (ub2)(gen + 1);
   }
 
-  for (dep = 0; dep < portcnt; dep++) {
-    for (arr = 0; arr < portcnt; arr++) {
-      da = dep * portcnt + arr;
-      concnt = con0cnt[da];
-      if (concnt) haveconn++;
-    }
+  haveconn = 0;
+  for (pair = 0; pair < paircnt; pair++) {
+    if (con0cnt[pair]) haveconn++;
   }
   info(0,"  0-stop connectivity \ah%3u of \ah%3u  = %02u%%",haveconn,needconn,haveconn * 100 / max(needconn,1));
 
@@ -499,13 +940,15 @@ static int mknet0(struct network *net)
   aclear(arrstats);
   aclear(depstats);
 
+  arrcnts = alloc(portcnt,ub4,0,"net0 arrcnts",portcnt);
+
   for (dep = 0; dep < portcnt; dep++) {
     depcnt = 0;
-    for (arr = 0; arr < portcnt; arr++) {
-      if (dep == arr) continue;
-      depcnt += con0cnt[dep * portcnt + arr];
-      if (depcnt > hicnt) { hicnt = depcnt; hiport = dep; }
+    for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+      depcnt += con0cnt[pair];
+      arrcnts[conarr[pair]] += con0cnt[pair];
     }
+    if (depcnt > hicnt) { hicnt = depcnt; hiport = dep; }
 //    error_ne(depcnt,ports[dep].ndep);
     depstats[min(depivs,depcnt)]++;
   }
@@ -517,12 +960,8 @@ static int mknet0(struct network *net)
 
   hicnt = hiport = 0;
   for (arr = 0; arr < portcnt; arr++) {
-    arrcnt = 0;
-    for (dep = 0; dep < portcnt; dep++) {
-      if (dep == arr) continue;
-      arrcnt += con0cnt[dep * portcnt + arr];
-      if (arrcnt > hicnt) { hicnt = arrcnt; hiport = arr; }
-    }
+    arrcnt = arrcnts[arr];
+    if (arrcnt > hicnt) { hicnt = arrcnt; hiport = arr; }
 //    error_ne(arrcnt,ports[arr].narr);
     arrstats[min(arrivs,arrcnt)]++;
   }
@@ -532,13 +971,32 @@ static int mknet0(struct network *net)
   parr = ports + hiport;
   info(0,"port %u reached by %u ports %s",hiport,hicnt,parr->name);
 
-  net->con0cnt = con0cnt;
-  net->con0ofs = con0ofs;
+  // index by arr
+  con0col = alloc(portcnt + 1,ub4,0,"net0 concol",portcnt);
+  con0dep = alloc(paircnt,ub4,0,"net0 condep",portcnt);
+  con0pair = alloc(paircnt,ub4,0,"net0 conpair",portcnt);
+
+  for (pair = 0; pair < paircnt; pair++) con0col[conarr[pair] + 1]++;
+  for (arr = 0; arr < portcnt; arr++) {
+    con0col[arr + 1] += con0col[arr];
+    arrcnts[arr] = con0col[arr];
+  }
+  for (dep = 0; dep < portcnt; dep++) {
+    for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+      n = arrcnts[conarr[pair]]++;
+      con0dep[n] = dep;
+      con0pair[n] = pair;
+    }
+  }
+  afree(arrcnts,"net0 arrcnts");
 
-  net->allcnt = allcnt;
+  net->con0col = con0col;
+  net->con0dep = con0dep;
+  net->con0pair = con0pair;
 
   net->concnt[0] = con0cnt;
   net->conofs[0] = con0ofs;
+  mkconbits(net,0);
 
   net->lodist[0] = lodists; // only for partitioned
 
@@ -549,8 +1007,20 @@ static int mknet0(struct network *net)
   return 0;
 }
 
-// create n-stop connectivity matrix and derived info
-static int mk_netn(struct network *net,ub4 nstop)
+// max #variants per [dep,arr] and whether to fill n-stop only where no lower stop exists
+void netnlimits(ub4 nstop,ub4 *pvarlimit,ub4 *pvar12limit,bool *pnilonly)
+{
+  // todo configurable
+  switch (nstop) {
+  case 1: *pnilonly = 0; *pvarlimit = 32; *pvar12limit = 256; break;
+  case 2: *pnilonly = 0; *pvarlimit = 16; *pvar12limit = 64; break;
+  case 3: *pnilonly = 1; *pvarlimit = 8; *pvar12limit = 64; break;
+  default: *pnilonly = 1; *pvarlimit = 2; *pvar12limit = 32; break;
+  }
+}
+
+// create n-stop connectivity matrix and derived info. budget in list bytes, 0 for fixed limits
+static int mk_netn(struct network *net,ub4 nstop,size_t budget)
 {
   ub4 portcnt = net->portcnt;
   ub4 hopcnt = net->hopcnt;
@@ -576,34 +1046,35 @@ static int mk_netn(struct network *net,ub4 nstop)
 
   vrb0(0,"init %u-stop connections for %u port %u hop network",nstop,portcnt,whopcnt);
 
-  // todo configurable
-  switch (nstop) {
-  case 1: nilonly = 0; varlimit = 32; var12limit = 256; break;
-  case 2: nilonly = 0; varlimit = 16; var12limit = 64; break;
-  case 3: nilonly = 1; varlimit = 8; var12limit = 64; break;
-  default: nilonly = 1; varlimit = 2; var12limit = 32; break;
-  }
+  netnlimits(nstop,&varlimit,&var12limit,&nilonly);
 
   if (nilonly && net->needconn <= net->haveconn[nstop-1]) {
     return info(0,"skip %u-stop init on %u-stop coverage complete",nstop,nstop-1);
   }
 
-  switch(nstop) {
-  case 1: rv = mknet1(net,varlimit,var12limit,nilonly); break;
-  case 2: rv = mknet2(net,varlimit,var12limit,nilonly); break;
-  default: rv = mknetn(net,nstop,varlimit,var12limit,nilonly); break;
-  }
+  // 2 if rows of a previous build could not be reused
+  do {
+    switch(nstop) {
+    case 1: rv = mknet1(net,varlimit,var12limit,nilonly,budget); break;
+    case 2: rv = mknet2(net,varlimit,var12limit,nilonly,budget); break;
+    default: rv = mknetn(net,nstop,varlimit,var12limit,nilonly,budget); break;
+    }
+  } while (rv == 2);
 
   if (rv) return rv;
 
   if (net->lstlen[nstop] == 0) return 0;
 
+  mkconbits(net,nstop);
+
   ports = net->ports;
 
   // get connectivity stats
 
   unsigned long doneconn,doneperc,leftcnt,needconn = net->needconn;
-  ub4 n,da,nda = 0,port,hascon,hicon,arrcon,loarrcon,lodep = 0;
+  ub4 n,da,nda = 0,port,hicon,arrcon,loarrcon,lodep = 0;
+  ub4 pair,w,lastw,words = net->conwords,newcon;
+  ub8 *row,x,rowbits[Nstop],lastbits;
   ub4 tports[Nstop];
   ub4 gtports[Nstop];
   ub4 deparrs[16];
@@ -621,39 +1092,48 @@ static int mk_netn(struct network *net,ub4 nstop)
   doneconn = 0;
   loarrcon = hi32;
 
+  // per dep a word at a time : reached arrs from the cumulative row, first-reached stops from the level rows
   for (dep = 0; dep < portcnt; dep++) {
     arrcon = 0;
     nda = 1;
     pdep = ports + dep;
-    for (arr = 0; arr < portcnt; arr++) {
-      if (dep == arr) continue;
-      deparr = dep * portcnt + arr;
-      hascon = 0;
-      nstop1 = 0;
-      while (nstop1 <= nstop) {
-        concnt = net->concnt[nstop1];
-        error_zp(concnt,nstop1);
-        if (concnt[deparr]) { hascon = 1; break; }
-        nstop1++;
+    row = net->allconn + (size_t)dep * words;
+    newcon = hi32;
+    lastbits = 0;
+    lastw = 0;
+    for (w = 0; w < words; w++) {
+      x = row[w];
+      if ((dep >> 6) == w) x &= ~((ub8)1 << (dep & 63));
+      arrcon += (ub4)__builtin_popcountl(x);
+
+      // first n-stop of each reached arr, keep the highest
+      for (nstop1 = 0; nstop1 <= nstop; nstop1++) {
+        rowbits[nstop1] = net->conbits[nstop1][(size_t)dep * words + w] & x;
+        x &= ~rowbits[nstop1];
+      }
+      nstop1 = nstop + 1;
+      while (nstop1 && rowbits[nstop1 - 1] == 0) nstop1--;
+      if (nstop1 && (newcon == hi32 || nstop1 - 1 >= newcon)) {
+        newcon = nstop1 - 1;
+        lastbits = rowbits[newcon];
+        lastw = w;
       }
-      if (hascon) {
-        arrcon++;
-//        allcnt[deparr] = 1;
-        if (nstop1 >= nstops[0]) { nstops[0] = nstop1; deparrs[0] = deparr; }
-      } else {
-        if (nda < ndacnt) deparrs[nda++] = deparr;
-
-#if 0
-        // verify no dep-mid-arr exist
-        for (mid = 0; mid < portcnt; mid++) {
-          if (mid == dep || mid == arr) continue;
-          depmid = dep * portcnt + mid; midarr = mid * portcnt + arr;
-          if (con0cnt[depmid] && con0cnt[midarr]) warninfo(limited == 0,Iter,"no conn port %u-%u with mid %u exists",dep,arr,mid);
-        }
-#endif
 
+      // unreached arrs
+      x = ~row[w];
+      if ((dep >> 6) == w) x &= ~((ub8)1 << (dep & 63));
+      if (w == words - 1 && (portcnt & 63)) x &= ((ub8)1 << (portcnt & 63)) - 1;
+      while (x && nda < ndacnt) {
+        arr = w * 64 + (ub4)__builtin_ctzl(x);
+        x &= x - 1;
+        deparrs[nda++] = dep * portcnt + arr;
       }
     }
+    if (newcon != hi32 && newcon >= nstops[0]) {
+      arr = lastw * 64 + 63 - (ub4)__builtin_clzl(lastbits);
+      nstops[0] = newcon;
+      deparrs[0] = dep * portcnt + arr;
+    }
     doneconn += arrcon;
     if (arrcon < loarrcon) {
       loarrcon = arrcon;
@@ -693,12 +1173,13 @@ static int mk_netn(struct network *net,ub4 nstop)
     parr = ports + arr;
     concnt = net->concnt[hicon];
     if (concnt == NULL) return error(0,"%u stops cnt nil",hicon);
-    cnt = concnt[deparr];
+    pair = conpair(net,hicon,dep,arr);
+    cnt = pair == hi32 ? 0 : concnt[pair];
     info(0,"%u-%u %u vars at %u stops %s to %s",dep,arr,cnt,hicon,pdep->name,parr->name);
     if (cnt == 0) continue;
     nleg = hicon + 1;
     conofs = net->conofs[hicon];
-    ofs = conofs[deparr];
+    ofs = conofs[pair];
     lstblk = net->conlst + hicon;
     lst = blkdata(lstblk,ofs * nleg,ub4);
     if (triptoports(net,lst,nleg,tports,gtports)) break;
@@ -714,35 +1195,155 @@ static int mk_netn(struct network *net,ub4 nstop)
   return 0;
 }
 
-// count connections within part
-static ub2 hasconn(struct network *net,ub4 deparr)
+// index of dep-arr connection at nstop, hi32 if none
+// rows are ascending on arr: bisect to a short stretch, then scan
+ub4 conpair(struct network *net,ub4 nstop,ub4 dep,ub4 arr)
 {
-  ub4 nstop = 0;
-  ub2 **concnts = net->concnt,*cnts,cnt = 0;
+  ub4 *conrow = net->conrow[nstop];
+  ub4 *conarr = net->conarr[nstop];
+  ub4 lo,hi,mid,end;
+
+  if (conrow == NULL) return hi32;
+
+  lo = conrow[dep];
+  hi = end = conrow[dep + 1];
+  while (hi - lo > 8) {
+    mid = lo + (hi - lo) / 2;
+    if (conarr[mid] < arr) lo = mid + 1;
+    else hi = mid;
+  }
+  while (lo < end && conarr[lo] < arr) lo++;
+  if (lo < end && conarr[lo] == arr) return lo;
+  return hi32;
+}
 
-  while (nstop <= net->histop && cnt == 0) {
-    cnts = concnts[nstop++];
-    if (cnts) cnt = cnts[deparr];
+// idem for ascending arr, continuing from *pcur, initially conrow[nstop][dep]
+ub4 conseek(struct network *net,ub4 nstop,ub4 *pcur,ub4 dep,ub4 arr)
+{
+  ub4 *conarr = net->conarr[nstop];
+  ub4 end = net->conrow[nstop][dep + 1];
+  ub4 cur = *pcur;
+
+  while (cur < end && conarr[cur] < arr) cur++;
+  *pcur = cur;
+  if (cur < end && conarr[cur] == arr) return cur;
+  return hi32;
+}
+
+// bytes per hop id in variant lists. all-ones is reserved for hi32
+static ub4 conlstwid(ub4 whopcnt)
+{
+  if (whopcnt < 0xffff) return 2;
+  else if (whopcnt < 0xffffff) return 3;
+  else return 4;
+}
+
+// narrow the nstop variant list in place to net->lstwid bytes per hop id
+static void packconlst(struct network *net,ub4 nstop)
+{
+  block *blk = net->conlst + nstop;
+  ub4 wid = nstop ? net->lstwid : net->lstwid0;
+  size_t i,len = blk->elems,newlen;
+  ub4 *src;
+  ub1 *dst;
+  ub4 x;
+
+  if (wid == 4 || blk->base == NULL || len == 0) return;
+
+  src = blkdata(blk,0,ub4);
+  dst = (ub1 *)src;
+
+  // dst byte i * wid stays below src word i + 1
+  for (i = 0; i < len; i++) {
+    x = src[i];
+    dst[0] = (ub1)x;
+    dst[1] = (ub1)(x >> 8);
+    if (wid == 3) dst[2] = (ub1)(x >> 16);
+    dst += wid;
   }
+  newlen = (len * wid + 3) / 4;
+  if (newlen < len) trimblock(blk,newlen,ub4);
+  info(0,"%u-stop conlst \ah%lu to \ah%lu bytes",nstop,len * 4,newlen * 4);
+}
 
-  return cnt;
+// hop ids of var in the nstop variant list. decoded into legs if packed
+ub4 *conlegs(struct network *net,ub4 nstop,size_t var,ub4 *legs)
+{
+  block *blk = net->conlst + nstop;
+  ub4 nleg = nstop + 1;
+  size_t pos = var * nleg;
+  ub4 wid = nstop ? net->lstwid : net->lstwid0;
+  ub4 leg,x,nil;
+  const ub1 *p;
+
+  if (wid != 2 && wid != 3) return blkdata(blk,pos,ub4);
+
+  nil = (1U << (wid * 8)) - 1;
+  p = (const ub1 *)blk->base + pos * wid;
+  for (leg = 0; leg < nleg; leg++) {
+    x = p[0] | ((ub4)p[1] << 8);
+    if (wid == 3) x |= (ub4)p[2] << 16;
+    legs[leg] = (x == nil ? hi32 : x);
+    p += wid;
+  }
+  return legs;
+}
+
+// set reachability bits of nstop from its rows, and add them to the cumulative ones
+void mkconbits(struct network *net,ub4 nstop)
+{
+  ub4 portcnt = net->portcnt;
+  ub4 *conrow = net->conrow[nstop];
+  ub4 *conarr = net->conarr[nstop];
+  ub2 *concnt = net->concnt[nstop];
+  ub4 dep,arr,pair,words;
+  ub8 *bits,*all;
+  size_t i,n;
+
+  if (net->conwords == 0) net->conwords = (portcnt + 63) / 64;
+  words = net->conwords;
+  n = (size_t)portcnt * words;
+
+  if (net->allconn == NULL) net->allconn = alloc((ub4)n,ub8,0,"net allconn",portcnt);
+  all = net->allconn;
+  bits = net->conbits[nstop] = alloc((ub4)n,ub8,0,"net conbits",nstop);
+
+  for (dep = 0; dep < portcnt; dep++) {
+    for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+      if (concnt[pair] == 0) continue;
+      arr = conarr[pair];
+      bits[(size_t)dep * words + (arr >> 6)] |= (ub8)1 << (arr & 63);
+    }
+  }
+  for (i = 0; i < n; i++) all[i] |= bits[i];
+}
+
+// count connections within part
+static ub2 hasconn(struct network *net,ub4 dep,ub4 arr)
+{
+  ub4 nstop;
+
+  if (conbit(net,net->allconn,dep,arr) == 0) return 0;
+
+  for (nstop = 0; nstop <= net->histop; nstop++) {
+    if (conbit(net,net->conbits[nstop],dep,arr)) return net->concnt[nstop][conpair(net,nstop,dep,arr)];
+  }
+  return 0;
 }
 
 // get connections within part as mask per stop
-static ub2 getconn(ub4 callee,struct network *net,ub4 deparr)
+static ub2 getconn(ub4 callee,struct network *net,ub4 dep,ub4 arr)
 {
   ub4 nstop = 0;
-  ub2 **concnts = net->concnt,*cnts,cnt;
   ub2 res = 0,mask = 0x80;
 
   enter(callee);
-  error_ge(deparr,net->portcnt * net->portcnt);
+  error_ge(dep,net->portcnt);
+  error_ge(arr,net->portcnt);
+  if (conbit(net,net->allconn,dep,arr) == 0) { leave(callee); return 0; }
   while (nstop <= net->histop) {
-    cnts = concnts[nstop++];
-    if (cnts) {
-      cnt = cnts[deparr];
-      if (cnt) res |= mask;
-    }
+    if (conbit(net,net->conbits[nstop],dep,arr)) res |= mask;
+    nstop++;
     mask >>= 1;
   }
   leave(callee);
@@ -789,7 +1390,7 @@ static int mkxmap(ub4 callee,struct gnetwork *gnet)
     for (tarr = 0; tarr < tportcnt; tarr++) {
       deparr = tdep * tportcnt + tarr;
       if (tdep == tarr) { conmask[deparr] = 0x80; continue; }
-      stopset = getconn(caller,tnet,deparr);
+      stopset = getconn(caller,tnet,tdep,tarr);
       if (stopset == 0) continue;
       conmask[deparr] = (ub1)stopset;
     }
@@ -812,8 +1413,7 @@ static int mkxmap(ub4 callee,struct gnetwork *gnet)
     if (gpdep->tpart) {
       tdep = gp2t[gdep];
       for (tarr = 0; tarr < tportcnt; tarr++) {
-        deparr = tdep * tportcnt + tarr;
-        stopset = getconn(caller,tnet,deparr);
+        stopset = getconn(caller,tnet,tdep,tarr);
         if (stopset) {
           hascon = 1;
           x = xmappos[tarr];
@@ -836,8 +1436,7 @@ static int mkxmap(ub4 callee,struct gnetwork *gnet)
       for (gi = 0; gi < gcnt; gi++) {
         arr = net->tports[gi];
         error_ge(arr,portcnt);
-        deparr = dep * portcnt + arr;
-        stopset = getconn(caller,net,deparr);
+        stopset = getconn(caller,net,dep,arr);
         if (stopset) {
           hascon = 1;
           npxcon++;
@@ -872,8 +1471,7 @@ static int mkxmap(ub4 callee,struct gnetwork *gnet)
 
       tarr = gp2t[garr];
       for (tdep = 0; tdep < tportcnt; tdep++) {
-        deparr = tdep * tportcnt + tarr;
-        stopset = getconn(caller,tnet,deparr);
+        stopset = getconn(caller,tnet,tdep,tarr);
         if (stopset) {
           hascon = 1;
           x = xmappos[tdep];
@@ -896,8 +1494,7 @@ static int mkxmap(ub4 callee,struct gnetwork *gnet)
       for (gi = 0; gi < gcnt; gi++) {
         dep = net->tports[gi];
         error_ge(dep,portcnt);
-        deparr = dep * portcnt + arr;
-        stopset = getconn(caller,net,deparr);
+        stopset = getconn(caller,net,dep,arr);
         if (stopset) {
           hascon = 1;
           npxcon++;
@@ -1019,7 +1616,7 @@ static int showgconn(ub4 callee,struct gnetwork *gnet)
           daportcnt = danet->portcnt;
           error_ge(dep,daportcnt);
           error_ge(arr,daportcnt);
-          lconn = hasconn(danet,dep * daportcnt + arr);
+          lconn = hasconn(danet,dep,arr);
         }
         part++;
       }
@@ -1096,70 +1693,195 @@ static int showgconn(ub4 callee,struct gnetwork *gnet)
   return 0;
 }
 
-// initialize basic network, and connectivity for each number of stops
-// the number of stops need to be determined such that all port pairs are reachable
-int mknet(ub4 maxstop)
+#define Maxpartworkers 64
+
+// partitions are built independently, sharing read-only gnet data only
+struct partbld {
+  ub4 partcnt,maxstop;
+  int donet0,donetn;
+  int doconchk;
+  ub4 nxtpart;
+  int err;
+  pthread_mutex_t lock;
+  ub4 *histops;   // [partcnt] hi32 for skipped
+  struct partwork {
+    struct partbld *pb;
+    pthread_t tid;
+    ub4 id;
+  } work[Maxpartworkers];
+};
+
+// build one partition. log lines are prefixed with the partition, per thread
+static int mkpart(struct partbld *pb,ub4 part)
 {
-  ub4 portcnt,hopcnt;
-  ub4 nstop,histop,allhistop = hi32,part,partcnt;
-  int rv,netok = 0;
-  struct gnetwork *gnet = getgnet();
-  struct network *net;
-  int doconchk = globs.engvars[Eng_conchk];
-
-  if (dorun(FLN,Runmknet,0) == 0) return 0;
-
-  partcnt = gnet->partcnt;
-  if (partcnt == 0) return warn(0,"no partitions for %u ports net",gnet->portcnt);
-
-  for (part = 0; part < partcnt; part++) {
+  ub4 partcnt = pb->partcnt;
+  struct network *net = getnet(part);
+  ub4 nstop,histop,lazyports;
+  size_t budget,lvlbudget,left,used = 0;
+  int rv;
 
-    info(0,"mknet partition %u of %u",part,partcnt);
-    net = getnet(part);
+  if (partcnt > 1) msgprefix(0,"p%u/%u ",part,partcnt);
 
-    portcnt = net->portcnt;
-    hopcnt = net->hopcnt;
+  info(0,"mknet partition %u of %u",part,partcnt);
 
-    if (portcnt == 0) { info0(0,"skip mknet on 0 ports"); continue; }
-    if (hopcnt == 0) { info0(0,"skip mknet on 0 hops"); continue; }
+  if (net->portcnt == 0) { info0(0,"skip mknet on 0 ports"); return msgprefix(0,NULL); }
+  if (net->hopcnt == 0) { info0(0,"skip mknet on 0 hops"); return msgprefix(0,NULL); }
 
-    if (partcnt > 1) msgprefix(0,"p%u/%u ",part,partcnt);
+  rv = mkwalks(net);
+  if (rv) return msgprefix(1,NULL);
 
-    rv = mkwalks(net);
-    if (rv) return msgprefix(1,NULL);
+  if (pb->donet0 == 0) return msgprefix(0,NULL);
 
-    if (dorun(FLN,Runnet0,0)) {
-      if (mknet0(net)) return msgprefix(1,NULL);
-      netok = 1;
+  net->lstwid = conlstwid(net->whopcnt);
+  if (mknet0(net)) return msgprefix(1,NULL);
+  pb->histops[part] = 0;
 
-      if (doconchk) rv = conchk(net);
-      if (rv) return msgprefix(1,NULL);
-    } else continue;
+  if (pb->doconchk) rv = conchk(net);
+  if (rv) return msgprefix(1,NULL);
 
-    histop = maxstop;
+  histop = pb->maxstop;
 //    if (net->istpart) histop++;
-    limit_gt(histop,Nstop,0);
+  limit_gt(histop,Nstop,0);
+
+  // too large to precompute : 2-stop rows per dep when first searched
+  lazyports = globs.netvars[Net_lazyports];
+  if (histop > 1 && pb->donetn && lazyports && net->portcnt > lazyports) {
+    info(0,"partition %u of %u ports above %u: 2-stop on demand",part,net->portcnt,lazyports);
+    net->lazystop = 2;
+    histop = 1;
+  }
 
-    if (histop && dorun(FLN,Runnetn,0)) {
-      if (mksubevs(net)) return msgprefix(1,NULL);
+  if (histop && pb->donetn) {
+    if (mksubevs(net)) return msgprefix(1,NULL);
 
+    if (rdnetcache(net,histop) == 0) {
+      budget = (size_t)globs.netvars[Net_budgetmb] << 20;
       for (nstop = 1; nstop <= histop; nstop++) {
-        if (mk_netn(net,nstop)) return msgprefix(1,NULL);
+
+        // what is left, less an eighth for each next level. these only fill remaining gaps
+        lvlbudget = 0;
+        if (budget) {
+          left = budget - min(used,budget);
+          lvlbudget = max(left - left / 8 * (histop - nstop),1);
+        }
+        if (mk_netn(net,nstop,lvlbudget)) return msgprefix(1,NULL);
         info(0,"nstop %u lstlen %lu",nstop,net->lstlen[nstop]);
         if (net->lstlen[nstop] == 0) break;
         net->histop = nstop;
+        used += (size_t)net->conpairs[nstop] * (3 * sizeof(ub4) + sizeof(ub2)) + net->lstlen[nstop] * (nstop + 1) * net->lstwid;
       }
-      info(0,"partition %u static network init done",part);
-      allhistop = min(allhistop,net->histop);
-      rmsubevs(net);
+      infocc(budget,0,"n-stop lists \ah%lu b of budget \ah%lu b",used,budget);
+      for (nstop = 1; nstop <= net->histop; nstop++) packconlst(net,nstop);
+      if (wrnetcache(net,histop)) warn(0,"partition %u connectivity not cached",part);
+      rmconprev(net);
+    }
+    info(0,"partition %u static network init done",part);
+    pb->histops[part] = net->histop;
 
-    } else {
-      info(0,"partition %u no n-stop static network init",part);
-      allhistop = 0;
+    // on-demand rows estimate durations from these
+    if (net->lazystop == 0) rmsubevs(net);
+
+  } else {
+    info(0,"partition %u no n-stop static network init",part);
+  }
+
+  // after the cache key, which covers the 0-stop list as built
+  net->lstwid0 = net->lazystop ? 4 : net->lstwid;
+  packconlst(net,0);
+  return msgprefix(0,NULL);
+}
+
+static void *partworker(void *arg)
+{
+  struct partwork *wp = arg;
+  struct partbld *pb = wp->pb;
+  ub4 part;
+
+  do {
+    pthread_mutex_lock(&pb->lock);
+    if (pb->err || pb->nxtpart >= pb->partcnt) part = hi32;
+    else part = pb->nxtpart++;
+    pthread_mutex_unlock(&pb->lock);
+    if (part == hi32) break;
+
+    if (mkpart(pb,part)) {
+      pthread_mutex_lock(&pb->lock);
+      pb->err = 1;
+      pthread_mutex_unlock(&pb->lock);
+      break;
+    }
+  } while (1);
+
+  return NULL;
+}
+
+// initialize basic network, and connectivity for each number of stops
+// the number of stops need to be determined such that all port pairs are reachable
+// partitions are built by net.partthreads workers, the calling thread being the first
+int mknet(ub4 maxstop)
+{
+  ub4 allhistop = hi32,part,partcnt;
+  ub4 t,thrcnt,cpucnt,bldthreads;
+  int rv,netok = 0;
+  struct gnetwork *gnet = getgnet();
+  struct partbld *pb;
+  struct partwork *wp;
+
+  if (dorun(FLN,Runmknet,0) == 0) return 0;
+
+  partcnt = gnet->partcnt;
+  if (partcnt == 0) return warn(0,"no partitions for %u ports net",gnet->portcnt);
+
+  pb = alloc(1,struct partbld,0,"net partbld",partcnt);
+  pb->histops = alloc(partcnt,ub4,0xff,"net partbld",partcnt);
+  pb->partcnt = partcnt;
+  pb->maxstop = maxstop;
+  pb->doconchk = globs.engvars[Eng_conchk];
+  pb->donet0 = dorun(FLN,Runnet0,0);
+  pb->donetn = pb->donet0 && maxstop && dorun(FLN,Runnetn,0);
+  pthread_mutex_init(&pb->lock,NULL);
+
+  cpucnt = oscpucnt();
+  thrcnt = globs.netvars[Net_partthreads];
+  if (thrcnt == 0) thrcnt = cpucnt;
+  thrcnt = max(min(min(thrcnt,partcnt),Maxpartworkers),1);
+
+  // share cpus between partitions built at the same time
+  bldthreads = max(cpucnt / thrcnt,1);
+  for (part = 0; part < partcnt; part++) getnet(part)->bldthreads = bldthreads;
+
+  infocc(thrcnt > 1,0,"building %u partitions using %u threads",partcnt,thrcnt);
+
+  for (t = 0; t < thrcnt; t++) {
+    wp = pb->work + t;
+    wp->pb = pb;
+    wp->id = t;
+  }
+  for (t = 1; t < thrcnt; t++) {
+    wp = pb->work + t;
+    rv = pthread_create(&wp->tid,NULL,partworker,wp);
+    if (rv) {
+      warning(0,"cannot create partition thread %u: %s",t,strerror(rv));
+      break;
     }
-    msgprefix(0,NULL);
+  }
+  thrcnt = t;
 
-  } // each part
+  partworker(pb->work);
+
+  for (t = 1; t < thrcnt; t++) pthread_join(pb->work[t].tid,NULL);
+
+  pthread_mutex_destroy(&pb->lock);
+  rv = pb->err;
+
+  for (part = 0; part < partcnt; part++) {
+    if (pb->histops[part] == hi32) continue;
+    netok = 1;
+    allhistop = min(allhistop,pb->histops[part]);
+  }
+  afree(pb->histops,"net partbld");
+  afree(pb,"net partbld");
+  if (rv) return 1;
 
   if (netok == 0) return 0;
 
@@ -1167,6 +1889,10 @@ int mknet(ub4 maxstop)
 
   if (mkxmap(caller,gnet)) return 1;
 
+  if (mkgeogrid(gnet)) return 1;
+  if (mknameidx(gnet)) return 1;
+  if (mkfareidx(gnet)) return 1;
+
   if (showgconn(caller,gnet)) return 1;
 
   globs.netok = 1;
@@ -1411,6 +2137,9 @@ int gtriptoports(struct gnetwork *gnet,ub4 udep,ub4 uarr,ub4 usrdep,ub4 usrarr,s
     fdist = geodist(dlat,dlon,alat,alon);
     dist = (ub4)fdist;
     dt = (dist * 60) / walkspeed;
+    ptrip->dist = dist;
+    ptrip->dt = dt;
+    ptrip->cnt = 1;
 
     pos += mysnprintf(buf,pos,buflen,"sum\t\at%u\t\ag%u\t%u\t%u\t%s-%u\n",dt,dist,0,0,"t",0);
 
@@ -1541,6 +2270,8 @@ int gtriptoports(struct gnetwork *gnet,ub4 udep,ub4 uarr,ub4 usrdep,ub4 usrarr,s
     tdep = ptrip->t[leg];
     tarr = tdep ? tdep + ptrip->dur[leg] : 0;
     tid = ptrip->tid[leg];
+    ptrip->rid[leg] = rid;
+    ptrip->legdist[leg] = dist;
     if (rid != hi32) {
       rp = routes + rid;
       rname = rp->name;
@@ -1637,55 +2368,43 @@ ub4 fgeodist(struct port *pdep,struct port *parr)
   return (ub4)fdist;
 }
 
-int geocode(ub4 ilat,ub4 ilon,ub4 scale,struct myfile *rep)
+int geocode(ub4 ilat,ub4 ilon,ub4 scale,ub4 cnt,ub4 radius,struct myfile *rep)
 {
   double lat = (double)ilat / (double)scale - 90;
   double lon = (double)ilon / (double)scale - 180;
   double rlat = lat * M_PI / 180;
   double rlon = lon * M_PI / 180;
   double x = 180 / M_PI;
-  double lolat,lolon;
-  double dist,lodist = 1e+10;
-  ub4 mdist,losport = hi32,loport = hi32;
+  ub4 items[Geonear_max],dists[Geonear_max];
+  ub4 n,nearcnt,item,mdist,pos = 0;
+  ub4 len = sizeof(rep->localbuf);
 
   info(0,"scale %u lat %f lon %f %f %f",scale,lat,lon,rlat,rlon);
 
   gnet *net = getgnet();
-  struct port *pp,*lopp,*ports = net->ports;
-  struct sport *sp,*losp,*sports = net->sports;
-  ub4 port,portcnt = net->portcnt;
-  ub4 sport,sportcnt = net->sportcnt;
+  struct port *pp,*ports = net->ports;
+  struct sport *sp,*sports = net->sports;
+  ub4 portcnt = net->portcnt;
 
-  lopp = NULL;
-  losp = NULL;
+  if (rlat <= -0.5 * M_PI || rlat >= 0.5 * M_PI || rlon < -M_PI || rlon > M_PI) return error(0,"invalid coords %f , %f",lat,lon);
 
-  for (sport = 0; sport < sportcnt; sport++) {
-    sp = sports + sport;
-    dist = geodist(rlat,rlon,sp->rlat,sp->rlon);
-    if (dist < lodist) { lodist = dist; losport = sport; losp = sp; }
-    else if (dist >= Georange) return 1;
-  }
-  for (port = 0; port < portcnt; port++) {
-    pp = ports + port;
-    if (pp->ndep == 0 && pp->narr == 0) continue;
-    if (pp->subcnt) continue;
-    dist = geodist(rlat,rlon,pp->rlat,pp->rlon);
-    if (dist < lodist) { lodist = dist; loport = port; lopp = pp; }
-    else if (dist >= Georange) return 1;
-  }
-  mdist = (int)(lodist * 1000 / Geoscale);
+  nearcnt = geonear(net,rlat,rlon,radius,cnt,items,dists);
+  if (nearcnt == 0) return error(0,"no geocode port for %f , %f",lat,lon);
 
   //  reqid \t dist \t lat \t lon \t id \t pid \t modes \t name \t pname",0);
 
-  if (loport != hi32) {
-   lolat = lopp->rlat * x;
-   lolon = lopp->rlon * x;
-   rep->len = fmtstring(rep->localbuf,".geo\t0\t%u\t%f\t%f\t%u\t%u\t%u\t%s\t%s\n",mdist,lolat,lolon,loport,loport,lopp->modes,lopp->name,lopp->name);
-  } else if (losport != hi32) {
-   lolat = losp->rlat * x;
-   lolon = losp->rlon * x;
-   rep->len = fmtstring(rep->localbuf,".geo\t0\t%u\t%f\t%f\t%u\t%u\t%u\t%s\t%s\n",mdist,lolat,lolon,losport + portcnt,losp->parent,losp->modes,losp->name,"(n/a)");
-  } else return error(0,"no geocode port for %f , %f",lat,lon);
+  for (n = 0; n < nearcnt && pos + 512 < len; n++) {
+    item = items[n];
+    mdist = dists[n] * 1000 / Geoscale;
+    if (item < portcnt) {
+      pp = ports + item;
+      pos += mysnprintf(rep->localbuf,pos,len,".geo\t0\t%u\t%f\t%f\t%u\t%u\t%u\t%s\t%s\n",mdist,pp->rlat * x,pp->rlon * x,item,item,pp->modes,pp->name,pp->name);
+    } else {
+      sp = sports + item - portcnt;
+      pos += mysnprintf(rep->localbuf,pos,len,".geo\t0\t%u\t%f\t%f\t%u\t%u\t%u\t%s\t%s\n",mdist,sp->rlat * x,sp->rlon * x,item,sp->parent,sp->modes,sp->name,"(n/a)");
+    }
+  }
+  rep->len = pos;
   rep->buf = rep->localbuf;
   return info(0,"%s",rep->localbuf);
 }
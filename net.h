@@ -17,7 +17,8 @@
  a net consists of ports (aka stops) connected by hops (aka links,connections)
  routes are auxiliary
 
- connectivity is stored in 2D port by port arrays for each of n stops aka transfers
+ connectivity is stored for each of n stops aka transfers as sparse rows per departure port:
+ the arrival ports reached, ascending, with count and offset of the trip variants per pair
 
  for larger #ports, a set of measures are taken to reduce the size
 
@@ -225,6 +226,8 @@ struct sidtable {
   ub4 t0,t1;
 };
 
+struct conprev;
+
 // holds all for a partition
 struct network {
   ub4 part,partcnt;
@@ -287,14 +290,23 @@ struct network {
 
   ub4 *mac2port;   // [nmac < portcnt]
 
-// connection matrices. cached separately ?
-  ub2 *con0cnt;    // [port2]  0-stop connections
-  ub4 *con0ofs;    // [port2]  offsets in lst
+// 0-stop connections by arrival, for dep lookups per arr
+  ub4 *con0col;    // [portcnt+1] start of each arr column
+  ub4 *con0dep;    // [conpairs[0]] dep ports, ascending per arr
+  ub4 *con0pair;   // [conpairs[0]] index of dep-arr in 0-stop rows
 
-  ub1 *allcnt;     // [port2]  cumulative for n-stop
+// dep-arr reachability as bit matrix, a row of conwords words per dep. see conbit()
+  ub8 *allconn;          // [portcnt * conwords] any connection at up to histop stops
+  ub8 *conbits[Nstop];   // idem at exactly n-stop
+  ub4 conwords;
 
   ub4 histop;      // highest n-stop connections inited
   ub4 maxstop;     // highest n-stop connections to be inited
+  ub4 lazystop;    // n-stop built per dep on demand instead, 0 if none. see getdeprow()
+  ub4 bldthreads;  // n-stop builder threads, set by mknet
+  ub8 conkey;      // hash of n-stop build inputs, for the cache
+  ub8 conlimkey[Nstop];     // variant limits each level was built with, hi64 if size limited
+  struct conprev *conprev;  // previous build of this partition to reuse rows from. see rdnetcache()
   ub4 walklimit;   // in geo's
   ub4 sumwalklimit;
   ub4 walkspeed;   // geo's per hour
@@ -307,14 +319,19 @@ struct network {
   size_t needconn;    // final required any-stop connectivity
   size_t haveconn[Nstop];
   
-// idem for each of n-stop...
-  ub2 *concnt[Nstop];  // [port2]
-  ub4 *conofs[Nstop];  // [port2]
-
-  block conlst[Nstop];  // [lstlen]
+// idem for each of n-stop, per dep row. see conpair()
+  ub4 *conrow[Nstop];  // [portcnt+1] start of each dep row
+  ub4 *conarr[Nstop];  // [conpairs] arr ports, ascending per row
+  ub2 *concnt[Nstop];  // [conpairs]
+  ub4 *conofs[Nstop];  // [conpairs]
+  ub4 conpairs[Nstop];
+
+  block conlst[Nstop];  // [lstlen] hop ids, packed to lstwid bytes. see conlegs()
   size_t lstlen[Nstop];
+  ub4 lstwid;           // 2 or 3 if packed, 4 otherwise
+  ub4 lstwid0;          // idem for 0-stop. 4 with lazystop, whose builder reads it as is
 
-  ub4 *lodist[Nstop];  // [port2] lowest over-route distance
+  ub4 *lodist[Nstop];  // [conpairs] lowest over-route distance
 
   ub4 *portdst[Nstop];  // [portcnt] #destinations per port
 
@@ -348,6 +365,8 @@ struct gnetwork {
   struct sport *sports;
   struct hop *hops;
   struct sidtable *sids;
+  struct geogrid *geogrid;  // spatial index on ports and sports
+  struct nameidx *nameidx;  // word index on port and sport names
   struct chain *chains;
   struct route *routes;
 
@@ -388,6 +407,8 @@ struct gnetwork {
   ub2 *fareposbase;
   ub8 fareposcnt;
   ub4 *fhopofs;     // [chopcnt] offsets into faremem
+  ub4 *rposofs;     // [ridcnt] into rposidx, hi32 for nonreserved routes
+  ub8 *rposidx;     // per reserved route : dep << 32 | pos for each hop, sorted. Then idem for arr
 
   struct chainhop *chainhops;
   ub8 *chainrhops;
@@ -419,6 +440,8 @@ struct trip {
   ub4 info[Nxleg];
   ub4 srdep[Nxleg];
   ub4 srarr[Nxleg];
+  ub4 rid[Nxleg];      // route, set by gtriptoports
+  ub4 legdist[Nxleg];  // idem, distance
 
   char desc[256];
 
@@ -426,11 +449,22 @@ struct trip {
   ub4 cnt;
   ub4 dist;
   ub4 dt;
+  ub4 fare;
 };
 
 #define triptoports(net,trip,triplen,ports,gports) triptoports_fln(FLN,(net),(trip),(triplen),(ports),(gports))
 
 extern int mknet(ub4 maxstop);
+extern int mksnapshot(const char *name,ub4 mbytes);
+extern int pubsnapshot(const char *name);
+extern int attachsnapshot(const char *name);
+extern void rmsnapshot(void);
+extern ub4 snapshotgen(const char *name);
+extern ub4 pinnet(void);
+extern void unpinnet(void);
+extern ub4 netgenid(void);
+extern void dropnetgens(void);
+extern ub4 netgenstats(char *buf,ub4 len);
 extern struct network *getnet(ub4 part);
 extern struct gnetwork *getgnet(void);
 extern int triptoports_fln(ub4 fln,struct network *net,ub4 *trip,ub4 triplen,ub4 *ports,ub4 *gports);
@@ -442,7 +476,14 @@ extern void checktrip_fln(struct network *net,ub4 *legs,ub4 nleg,ub4 dep,ub4 arr
 extern void checktrip3_fln(struct network *net,ub4 *legs,ub4 nleg,ub4 dep,ub4 arr,ub4 via,ub4 dist,ub4 fln);
 
 extern ub4 fgeodist(struct port *pdep,struct port *parr);
-extern int geocode(ub4 ilat,ub4 ilon,ub4 scale,struct myfile *rep);
+extern ub4 conpair(struct network *net,ub4 nstop,ub4 dep,ub4 arr);
+extern ub4 conseek(struct network *net,ub4 nstop,ub4 *pcur,ub4 dep,ub4 arr);
+extern ub4 *conlegs(struct network *net,ub4 nstop,size_t var,ub4 *legs);
+extern void mkconbits(struct network *net,ub4 nstop);
+extern void netnlimits(ub4 nstop,ub4 *pvarlimit,ub4 *pvar12limit,bool *pnilonly);
+
+#define conbit(net,bits,dep,arr) ((bits)[(size_t)(dep) * (net)->conwords + ((arr) >> 6)] & ((ub8)1 << ((arr) & 63)))
+extern int geocode(ub4 ilat,ub4 ilon,ub4 scale,ub4 cnt,ub4 radius,struct myfile *rep);
 
 extern int showconn(struct port *ports,ub4 portcnt,int local);
 
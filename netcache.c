@@ -0,0 +1,595 @@
+// netcache.c - cache of precomputed n-stop connectivity
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+/* After the n-stop connectivity of a partition is built, it is written to a file in net.cachedir.
+   The file is keyed on a hash of all the n-stop build reads : the 0-stop net, hops with their
+   distances, durations and sampled events, port flags and the build parameters.
+   A next start with the same key maps the file instead of building. The mapping is private :
+   pages stay shared with the page cache unless written.
+   When building a snapshot, the arrays are copied into it instead, for other servers to see.
+   A checksum over the data guards against a truncated or damaged file.
+   Variant lists are stored packed to net->lstwid bytes per hop, as in memory.
+
+   When the key differs but the build parameters and ports are the same, typically after a feed
+   update changing a few routes, the file is kept as previous build instead. Each dep has a
+   signature of its 0-stop row : arrs, port flags, and the identity and timing of the hops in it.
+   Hops are identified by their ports, route and position, as their ids may shift.
+   A dep with a changed signature has its rows rebuilt, and so on outward : the n-stop row
+   of a dep is rebuilt if the (n-1)-stop row of itself or of a 0-stop arr is.
+   Other rows are copied from the previous build with their hop ids mapped, see netn.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+#include "cfg.h"
+#include "mem.h"
+
+static ub4 msgfile;
+#include "msg.h"
+
+#include "os.h"
+#include "util.h"
+#include "net.h"
+#include "netev.h"
+#include "netcache.h"
+
+#define Cachemagic 0x6e6e6f43
+#define Cacheversion 5
+#define Cachehdrlen 4096
+#define Cachealign 4096
+
+// per nstop, file offsets of the arrays. lodofs 0 for none
+struct cachesec {
+  ub8 rowofs,arrofs,cntofs,ofsofs,lstofs,lodofs;
+  ub8 pairs;
+  ub8 lstlen,lstelems;
+  ub8 haveconn;
+  ub8 limkey;   // see net->conlimkey
+};
+
+struct cachehdr {
+  ub4 magic,version;
+  ub8 key;
+  ub8 sum;      // of all after the header
+  ub8 len;
+  ub4 part,portcnt;
+  ub4 histop;
+  ub4 lstwid;   // bytes per hop id in the lists
+  ub4 whopcnt;
+  ub8 basekey;  // build parameters and ports, for reuse after a network change
+  ub8 sigofs;   // [portcnt] 0-stop row signatures
+  ub8 hopkeyofs;  // [whopcnt] hop identities
+  struct cachesec secs[Nstop];
+};
+
+sassert(sizeof(struct cachehdr) <= Cachehdrlen,"cache header exceeds its length")
+
+void ininetcache(void)
+{
+  msgfile = setmsgfile(__FILE__);
+  iniassert();
+}
+
+// fnv-1a on 8-byte words
+static ub8 hashmem(ub8 h,const void *p,size_t len)
+{
+  const ub1 *b = p;
+  ub8 w;
+  size_t i,n = len & ~(size_t)7;
+
+  for (i = 0; i < n; i += 8) {
+    memcpy(&w,b + i,8);
+    h = (h ^ w) * 0x100000001b3ULL;
+  }
+  for (; i < len; i++) h = (h ^ b[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+static ub8 hashval(ub8 h,ub8 v) { return hashmem(h,&v,sizeof(v)); }
+
+// hash of all inputs to the n-stop build of a partition
+ub8 netcachekey(struct network *net,ub4 maxstop)
+{
+  ub4 portcnt = net->portcnt;
+  ub4 pairs = net->conpairs[0];
+  ub4 hopcnt = net->hopcnt,chopcnt = net->chopcnt,whopcnt = net->whopcnt;
+  struct port *pp;
+  struct hop *hp;
+  ub4 port,hop,var;
+  ub8 h = 0xcbf29ce484222325ULL;
+
+  h = hashval(h,Cacheversion);
+  h = hashval(h,((ub8)net->part << 32) | net->partcnt);
+  h = hashval(h,((ub8)portcnt << 32) | maxstop);
+  h = hashval(h,((ub8)hopcnt << 32) | chopcnt);
+  h = hashval(h,((ub8)whopcnt << 32) | net->walklimit);
+  h = hashval(h,net->sumwalklimit);
+  h = hashval(h,net->needconn);
+  h = hashval(h,net->haveconn[0]);
+
+  // builder thread counts do not change the result
+  for (var = 0; var < Net_cnt; var++) {
+    if (var != Net_threads && var != Net_partthreads) h = hashval(h,globs.netvars[var]);
+  }
+
+  for (port = 0; port < portcnt; port++) {
+    pp = net->ports + port;
+    h = hashval(h,((ub8)pp->valid << 32) | pp->oneroute);
+  }
+  for (hop = 0; hop < hopcnt; hop++) {
+    hp = net->hops + hop;
+    h = hashval(h,((ub8)hp->kind << 32) | hp->tp.avgdur);
+  }
+  h = hashmem(h,net->portsbyhop,whopcnt * 2 * sizeof(ub4));
+  h = hashmem(h,net->hopdist,whopcnt * sizeof(ub4));
+  h = hashmem(h,net->hopdur,whopcnt * sizeof(ub4));
+  h = hashmem(h,net->hoprids,whopcnt * sizeof(ub4));
+  if (chopcnt > hopcnt) h = hashmem(h,net->choporg,chopcnt * 2 * sizeof(ub4));
+
+  h = hashmem(h,net->shopdur,whopcnt * sizeof(ub4));
+  h = hashmem(h,net->sevcnts,chopcnt * sizeof(ub4));
+  h = hashmem(h,net->sevents,(size_t)chopcnt * Subsamples * sizeof(ub8));
+
+  h = hashmem(h,net->conrow[0],(portcnt + 1) * sizeof(ub4));
+  h = hashmem(h,net->conarr[0],pairs * sizeof(ub4));
+  h = hashmem(h,net->concnt[0],pairs * sizeof(ub2));
+  h = hashmem(h,net->conofs[0],pairs * sizeof(ub4));
+  h = hashmem(h,net->conlst[0].base,net->conlst[0].elems * net->conlst[0].elsize);
+  h = hashmem(h,net->allconn,(size_t)portcnt * net->conwords * sizeof(ub8));
+  if (net->lodist[0]) h = hashmem(h,net->lodist[0],pairs * sizeof(ub4));
+  return h;
+}
+
+// hash of the build parameters and the port identities, to reuse rows when other inputs changed
+static ub8 netbasekey(struct network *net,ub4 maxstop)
+{
+  ub4 portcnt = net->portcnt;
+  ub4 port,var;
+  ub8 h = 0xcbf29ce484222325ULL;
+
+  h = hashval(h,Cacheversion);
+  h = hashval(h,((ub8)net->part << 32) | net->partcnt);
+  h = hashval(h,((ub8)portcnt << 32) | maxstop);
+  h = hashval(h,((ub8)net->walklimit << 32) | net->sumwalklimit);
+
+  for (var = 0; var < Net_cnt; var++) {
+    if (var != Net_threads && var != Net_partthreads) h = hashval(h,globs.netvars[var]);
+  }
+  for (port = 0; port < portcnt; port++) h = hashval(h,net->ports[port].cid);
+  return h;
+}
+
+// identity of a hop across network changes : its ports, and route and position if not a walk
+// interpart hops have one port outside the partition
+static ub8 hopident(struct network *net,ub4 hop)
+{
+  struct port *ports = net->ports;
+  struct hop *hp;
+  ub4 dep = net->portsbyhop[hop * 2];
+  ub4 arr = net->portsbyhop[hop * 2 + 1];
+  ub4 dcid = dep < net->portcnt ? ports[dep].cid : hi32;
+  ub4 acid = arr < net->portcnt ? ports[arr].cid : hi32;
+  ub8 h = 0xcbf29ce484222325ULL;
+
+  h = hashval(h,((ub8)dcid << 32) | acid);
+  if (hop < net->hopcnt) {
+    hp = net->hops + hop;
+    h = hashval(h,((ub8)hp->rrid << 32) | hp->rhop);
+    h = hashval(h,hp->kind);
+  } else if (hop < net->chopcnt) {
+    h = hashval(h,hopident(net,net->choporg[hop * 2]));
+    h = hashval(h,hopident(net,net->choporg[hop * 2 + 1]));
+  } else h = hashval(h,Walk);
+  return h;
+}
+
+struct hopkey {
+  ub8 key;
+  ub4 hop;
+};
+
+static int hopkeycmp(const void *a,const void *b)
+{
+  const struct hopkey *ka = a,*kb = b;
+
+  if (ka->key != kb->key) return ka->key < kb->key ? -1 : 1;
+  return ka->hop < kb->hop ? -1 : (ka->hop > kb->hop);
+}
+
+// hop identities, sorted in keys. hops with the same identity are told apart by id order
+static void mkhopkeys(struct network *net,ub8 *hopkeys,struct hopkey *keys)
+{
+  ub4 whopcnt = net->whopcnt;
+  ub4 hop,i,rank = 0;
+  ub8 prv = 0;
+
+  for (hop = 0; hop < whopcnt; hop++) {
+    keys[hop].key = hopident(net,hop);
+    keys[hop].hop = hop;
+  }
+  qsort(keys,whopcnt,sizeof(struct hopkey),hopkeycmp);
+
+  for (i = 0; i < whopcnt; i++) {
+    if (i && keys[i].key == prv) rank++;
+    else rank = 0;
+    prv = keys[i].key;
+    hopkeys[keys[i].hop] = rank ? hashval(prv,rank) : prv;
+  }
+  for (i = 0; i < whopcnt; i++) keys[i].key = hopkeys[keys[i].hop];
+  qsort(keys,whopcnt,sizeof(struct hopkey),hopkeycmp);
+}
+
+// all the n-stop build reads of a hop
+static ub8 hopsig(struct network *net,const ub8 *hopkeys,ub4 hop,ub8 h)
+{
+  struct hop *hp;
+
+  h = hashval(h,hopkeys[hop]);
+  h = hashval(h,((ub8)net->hopdist[hop] << 32) | net->hopdur[hop]);
+  h = hashval(h,net->shopdur[hop]);
+  if (hop < net->hopcnt) {
+    hp = net->hops + hop;
+    h = hashval(h,hp->tp.avgdur);
+  }
+  if (hop < net->chopcnt) {
+    h = hashval(h,net->sevcnts[hop]);
+    h = hashmem(h,net->sevents + (size_t)hop * Subsamples,Subsamples * sizeof(ub8));
+  }
+  return h;
+}
+
+// signature per dep of its 0-stop row
+static void mkdepsigs(struct network *net,const ub8 *hopkeys,ub8 *sigs)
+{
+  struct port *pp,*ports = net->ports;
+  ub4 *conrow = net->conrow[0],*conarr = net->conarr[0],*conofs = net->conofs[0];
+  ub2 *concnt = net->concnt[0];
+  ub4 *lst = blkdata(net->conlst,0,ub4);
+  ub4 *lodist = net->lodist[0];
+  ub4 portcnt = net->portcnt;
+  ub4 dep,arr,pair,cnt,v;
+  ub8 h;
+
+  for (dep = 0; dep < portcnt; dep++) {
+    pp = ports + dep;
+    h = hashval(0xcbf29ce484222325ULL,((ub8)pp->valid << 32) | pp->oneroute);
+    for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+      arr = conarr[pair];
+      cnt = concnt[pair];
+      pp = ports + arr;
+      h = hashval(h,((ub8)arr << 32) | cnt);
+      h = hashval(h,((ub8)pp->valid << 32) | pp->oneroute);
+      if (lodist) h = hashval(h,lodist[pair]);
+      for (v = 0; v < cnt; v++) h = hopsig(net,hopkeys,lst[conofs[pair] + v],h);
+    }
+    sigs[dep] = h;
+  }
+}
+
+// keep the mapped file of a previous build, and mark the rows to rebuild
+static void mkconprev(struct network *net,ub4 maxstop,struct cachehdr *hdr,char *mem,size_t len)
+{
+  struct conprev *pp;
+  struct cachesec *sp;
+  ub4 portcnt = net->portcnt;
+  ub4 whopcnt = net->whopcnt,pwhopcnt = hdr->whopcnt;
+  ub4 *conrow = net->conrow[0],*conarr = net->conarr[0];
+  const ub8 *psigs = (const ub8 *)(mem + hdr->sigofs);
+  const ub8 *phopkeys = (const ub8 *)(mem + hdr->hopkeyofs);
+  ub8 *hopkeys,*sigs;
+  struct hopkey *keys,*pkeys;
+  ub4 nstop,dep,pair,hop,i,j,mapcnt = 0;
+  ub4 redocnts[Nstop];
+  ub1 bit,*redo;
+
+  pp = alloc(1,struct conprev,0,"net conprev",portcnt);
+  pp->mem = mem;
+  pp->len = len;
+  pp->histop = hdr->histop;
+  pp->reusestop = min(hdr->histop,maxstop);
+  pp->lstwid = hdr->lstwid;
+  pp->whopcnt = pwhopcnt;
+
+  for (nstop = 1; nstop <= hdr->histop; nstop++) {
+    sp = hdr->secs + nstop;
+    pp->conrow[nstop] = (ub4 *)(mem + sp->rowofs);
+    pp->conarr[nstop] = (ub4 *)(mem + sp->arrofs);
+    pp->concnt[nstop] = (ub2 *)(mem + sp->cntofs);
+    pp->conofs[nstop] = (ub4 *)(mem + sp->ofsofs);
+    pp->conlst[nstop] = (const ub1 *)(mem + sp->lstofs);
+    if (sp->lodofs) pp->lodist[nstop] = (ub4 *)(mem + sp->lodofs);
+    pp->limkey[nstop] = sp->limkey;
+  }
+
+  // map previous hop ids on identity
+  hopkeys = alloc(whopcnt,ub8,0,"net hopkeys",whopcnt);
+  keys = alloc(whopcnt,struct hopkey,0,"net hopkeys",whopcnt);
+  mkhopkeys(net,hopkeys,keys);
+
+  pkeys = alloc(pwhopcnt,struct hopkey,0,"net prvhopkeys",pwhopcnt);
+  for (hop = 0; hop < pwhopcnt; hop++) {
+    pkeys[hop].key = phopkeys[hop];
+    pkeys[hop].hop = hop;
+  }
+  qsort(pkeys,pwhopcnt,sizeof(struct hopkey),hopkeycmp);
+
+  pp->hopmap = alloc(pwhopcnt,ub4,0xff,"net hopmap",pwhopcnt);
+  i = j = 0;
+  while (i < pwhopcnt && j < whopcnt) {
+    if (pkeys[i].key < keys[j].key) i++;
+    else if (pkeys[i].key > keys[j].key) j++;
+    else { pp->hopmap[pkeys[i++].hop] = keys[j++].hop; mapcnt++; }
+  }
+  afree(pkeys,"net prvhopkeys");
+  afree(keys,"net hopkeys");
+
+  info(0,"%u of %u hops in previous build, %u new",mapcnt,pwhopcnt,whopcnt - mapcnt);
+
+  // changed 0-stop rows, then outward per level
+  sigs = alloc(portcnt,ub8,0,"net depsigs",portcnt);
+  mkdepsigs(net,hopkeys,sigs);
+
+  pp->redo = redo = alloc(portcnt,ub1,0,"net redo",portcnt);
+  aclear(redocnts);
+  for (dep = 0; dep < portcnt; dep++) {
+    if (sigs[dep] != psigs[dep]) { redo[dep] = 1; redocnts[0]++; }
+  }
+  afree(sigs,"net depsigs");
+  afree(hopkeys,"net hopkeys");
+
+  for (nstop = 1; nstop <= pp->reusestop; nstop++) {
+    bit = (ub1)(1 << nstop);
+    for (dep = 0; dep < portcnt; dep++) {
+      if (redo[dep] & (bit >> 1)) redo[dep] |= bit;
+      else {
+        for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+          if (redo[conarr[pair]] & (bit >> 1)) { redo[dep] |= bit; break; }
+        }
+      }
+      if (redo[dep] & bit) redocnts[nstop]++;
+    }
+  }
+  for (nstop = 0; nstop <= pp->reusestop; nstop++) info(0,"%u-stop rows changed for %u of %u ports",nstop,redocnts[nstop],portcnt);
+
+  net->conprev = pp;
+}
+
+// hop ids of var in a previous nstop list, as current ids. see conlegs()
+ub4 *prevlegs(struct conprev *pp,ub4 nstop,size_t var,ub4 *legs)
+{
+  ub4 nleg = nstop + 1;
+  ub4 wid = pp->lstwid;
+  ub4 leg,x,nil = wid == 4 ? hi32 : (1U << (wid * 8)) - 1;
+  const ub1 *p = pp->conlst[nstop] + var * nleg * wid;
+
+  for (leg = 0; leg < nleg; leg++) {
+    if (wid == 4) memcpy(&x,p,4);
+    else {
+      x = p[0] | ((ub4)p[1] << 8);
+      if (wid == 3) x |= (ub4)p[2] << 16;
+    }
+    if (x == nil) legs[leg] = hi32;
+    else {
+      error_ge(x,pp->whopcnt);
+      legs[leg] = pp->hopmap[x];
+    }
+    p += wid;
+  }
+  return legs;
+}
+
+void rmconprev(struct network *net)
+{
+  struct conprev *pp = net->conprev;
+
+  if (pp == NULL) return;
+  osmunmap(pp->mem,pp->len);
+  afree(pp->hopmap,"net hopmap");
+  afree(pp->redo,"net redo");
+  afree(pp,"net conprev");
+  net->conprev = NULL;
+}
+
+static size_t secalign(size_t ofs) { return (ofs + Cachealign - 1) & ~(size_t)(Cachealign - 1); }
+
+static void cachename(char *name,ub4 len,struct network *net)
+{
+  mysnprintf(name,0,len,"%s/conn_p%u.bin",globs.netcachedir,net->part);
+}
+
+/* use cached n-stop connectivity if present and current. returns 1 if used
+   if only partly current, it is kept in net->conprev for the build to reuse
+ */
+int rdnetcache(struct network *net,ub4 maxstop)
+{
+  struct myfile mf;
+  struct cachehdr *hdr;
+  struct cachesec *sp;
+  ub4 portcnt = net->portcnt;
+  ub4 nstop,pairs;
+  char name[1024];
+  char *mem,*data;
+  size_t len,n;
+  ub8 key,basekey,sum;
+  bool copy = (arenause() != 0);  // building a snapshot
+  block *lstblk;
+
+  if (*globs.netcachedir == 0) return 0;
+
+  cachename(name,sizeof(name),net);
+  key = net->conkey = netcachekey(net,maxstop);
+  basekey = netbasekey(net,maxstop);
+
+  if (osfileinfo(&mf,name)) { info(0,"no connectivity cache %s",name); return 0; }
+  len = mf.len;
+  if (len < Cachehdrlen) { warn(0,"connectivity cache %s truncated to \ah%lu",name,(ub8)len); return 0; }
+
+  mem = osmmapfile(name,len,NULL,0);
+  if (mem == NULL) return 0;
+  hdr = (struct cachehdr *)mem;
+
+  if (hdr->magic != Cachemagic || hdr->version != Cacheversion) {
+    warn(0,"%s is not a version %u connectivity cache",name,Cacheversion);
+    osmunmap(mem,len);
+    return 0;
+  }
+  if ((hdr->key != key && hdr->basekey != basekey) || hdr->part != net->part || hdr->portcnt != portcnt) {
+    info(0,"connectivity cache %s is for another network",name);
+    osmunmap(mem,len);
+    return 0;
+  }
+  if (hdr->len != len || hdr->histop >= Nstop) {
+    warn(0,"connectivity cache %s has length \ah%lu, expected \ah%lu",name,(ub8)len,hdr->len);
+    osmunmap(mem,len);
+    return 0;
+  }
+  sum = hashmem(0xcbf29ce484222325ULL,mem + Cachehdrlen,len - Cachehdrlen);
+  if (sum != hdr->sum) {
+    warn(0,"connectivity cache %s has checksum %lx, expected %lx",name,sum,hdr->sum);
+    osmunmap(mem,len);
+    return 0;
+  }
+
+  if (hdr->key != key || hdr->lstwid != net->lstwid) {
+    info(0,"connectivity cache %s is for a previous network, reusing unchanged rows",name);
+    mkconprev(net,maxstop,hdr,mem,len);
+    return 0;
+  }
+
+  for (nstop = 1; nstop <= hdr->histop; nstop++) {
+    sp = hdr->secs + nstop;
+    lstblk = net->conlst + nstop;
+    pairs = (ub4)sp->pairs;
+    if (copy) {
+      net->conrow[nstop] = alloc(portcnt + 1,ub4,0,"net conrow",portcnt);
+      memcpy(net->conrow[nstop],mem + sp->rowofs,(portcnt + 1) * sizeof(ub4));
+      net->conarr[nstop] = alloc(pairs,ub4,0,"net conarr",portcnt);
+      memcpy(net->conarr[nstop],mem + sp->arrofs,pairs * sizeof(ub4));
+      net->concnt[nstop] = alloc(pairs,ub2,0,"net concnt",portcnt);
+      memcpy(net->concnt[nstop],mem + sp->cntofs,pairs * sizeof(ub2));
+      net->conofs[nstop] = alloc(pairs,ub4,0,"net conofs",portcnt);
+      memcpy(net->conofs[nstop],mem + sp->ofsofs,pairs * sizeof(ub4));
+      data = (char *)mkblock(lstblk,sp->lstelems,ub4,Noinit,"netv %u-stop conlst",nstop);
+      memcpy(data,mem + sp->lstofs,sp->lstelems * sizeof(ub4));
+      if (sp->lodofs) {
+        net->lodist[nstop] = alloc(pairs,ub4,0,"net lodist",portcnt);
+        memcpy(net->lodist[nstop],mem + sp->lodofs,pairs * sizeof(ub4));
+      }
+    } else {
+      net->conrow[nstop] = (ub4 *)(mem + sp->rowofs);
+      net->conarr[nstop] = (ub4 *)(mem + sp->arrofs);
+      net->concnt[nstop] = (ub2 *)(mem + sp->cntofs);
+      net->conofs[nstop] = (ub4 *)(mem + sp->ofsofs);
+      mapblock(lstblk,mem + sp->lstofs,sp->lstelems,ub4,"netv n-stop conlst cache");
+      if (sp->lodofs) net->lodist[nstop] = (ub4 *)(mem + sp->lodofs);
+    }
+    net->conpairs[nstop] = pairs;
+    net->lstlen[nstop] = (size_t)sp->lstlen;
+    net->haveconn[nstop] = (size_t)sp->haveconn;
+  }
+  net->histop = hdr->histop;
+  for (nstop = 1; nstop <= hdr->histop; nstop++) mkconbits(net,nstop);
+
+  n = len >> 20;
+  info(0,"%s connectivity 1-%u stops from cache %s, %u MB",copy ? "copied" : "mapped",hdr->histop,name,(ub4)n);
+  if (copy) osmunmap(mem,len);
+  return 1;
+}
+
+// write n-stop connectivity for net->histop stops
+int wrnetcache(struct network *net,ub4 maxstop)
+{
+  struct cachehdr hdr;
+  struct cachesec *sp;
+  ub4 portcnt = net->portcnt;
+  ub4 whopcnt = net->whopcnt;
+  ub4 nstop,pairs,histop = net->histop;
+  char name[1024],newname[1024];
+  char *mem;
+  size_t ofs,len;
+  block *lstblk;
+  struct hopkey *keys;
+
+  if (*globs.netcachedir == 0) return 0;
+
+  if (osexists(globs.netcachedir) == 0 && osmkdir(globs.netcachedir)) return oserror(0,"cannot create dir %s",globs.netcachedir);
+
+  cachename(name,sizeof(name),net);
+  fmtstring(newname,"%s.new",name);
+
+  if (net->conkey == 0) net->conkey = netcachekey(net,maxstop);
+
+  oclear(hdr);
+  hdr.magic = Cachemagic;
+  hdr.version = Cacheversion;
+  hdr.key = net->conkey;
+  hdr.part = net->part;
+  hdr.portcnt = portcnt;
+  hdr.histop = histop;
+  hdr.lstwid = net->lstwid;
+  hdr.whopcnt = whopcnt;
+  hdr.basekey = netbasekey(net,maxstop);
+
+  // layout
+  ofs = Cachehdrlen;
+  hdr.sigofs = ofs; ofs = secalign(ofs + portcnt * sizeof(ub8));
+  hdr.hopkeyofs = ofs; ofs = secalign(ofs + whopcnt * sizeof(ub8));
+  for (nstop = 1; nstop <= histop; nstop++) {
+    sp = hdr.secs + nstop;
+    lstblk = net->conlst + nstop;
+    sp->lstlen = net->lstlen[nstop];
+    sp->lstelems = lstblk->elems;
+    sp->haveconn = net->haveconn[nstop];
+    sp->limkey = net->conlimkey[nstop];
+    sp->pairs = pairs = net->conpairs[nstop];
+    sp->rowofs = ofs; ofs = secalign(ofs + (portcnt + 1) * sizeof(ub4));
+    sp->arrofs = ofs; ofs = secalign(ofs + pairs * sizeof(ub4));
+    sp->cntofs = ofs; ofs = secalign(ofs + pairs * sizeof(ub2));
+    sp->ofsofs = ofs; ofs = secalign(ofs + pairs * sizeof(ub4));
+    sp->lstofs = ofs; ofs = secalign(ofs + lstblk->elems * sizeof(ub4));
+    if (net->lodist[nstop]) { sp->lodofs = ofs; ofs = secalign(ofs + pairs * sizeof(ub4)); }
+  }
+  len = ofs;
+  hdr.len = len;
+
+  mem = osmmapfile(newname,len,NULL,Osmap_create|Osmap_shared);
+  if (mem == NULL) return 1;
+
+  keys = alloc(whopcnt,struct hopkey,0,"net hopkeys",whopcnt);
+  mkhopkeys(net,(ub8 *)(mem + hdr.hopkeyofs),keys);
+  afree(keys,"net hopkeys");
+  mkdepsigs(net,(ub8 *)(mem + hdr.hopkeyofs),(ub8 *)(mem + hdr.sigofs));
+
+  for (nstop = 1; nstop <= histop; nstop++) {
+    sp = hdr.secs + nstop;
+    lstblk = net->conlst + nstop;
+    pairs = (ub4)sp->pairs;
+    memcpy(mem + sp->rowofs,net->conrow[nstop],(portcnt + 1) * sizeof(ub4));
+    memcpy(mem + sp->arrofs,net->conarr[nstop],pairs * sizeof(ub4));
+    memcpy(mem + sp->cntofs,net->concnt[nstop],pairs * sizeof(ub2));
+    memcpy(mem + sp->ofsofs,net->conofs[nstop],pairs * sizeof(ub4));
+    memcpy(mem + sp->lstofs,lstblk->base,lstblk->elems * sizeof(ub4));
+    if (sp->lodofs) memcpy(mem + sp->lodofs,net->lodist[nstop],pairs * sizeof(ub4));
+  }
+
+  hdr.sum = hashmem(0xcbf29ce484222325ULL,mem + Cachehdrlen,len - Cachehdrlen);
+  memcpy(mem,&hdr,sizeof(hdr));
+
+  if (osmsync(mem,len)) { osmunmap(mem,len); return oserror(0,"cannot sync %s",newname); }
+  osmunmap(mem,len);
+
+  if (osrename(newname,name)) return oserror(0,"cannot rename %s to %s",newname,name);
+
+  info(0,"wrote connectivity 1-%u stops to cache %s, %u MB",histop,name,(ub4)(len >> 20));
+  return 0;
+}
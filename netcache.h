@@ -0,0 +1,32 @@
+// netcache.h - cache of precomputed n-stop connectivity
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+// n-stop rows of a previous build of the partition, reused for deps whose neighbourhood is unchanged
+struct conprev {
+  char *mem;        // mapped cache file
+  size_t len;
+  ub4 histop;
+  ub4 reusestop;    // levels above are built in full
+  ub4 lstwid,whopcnt;
+  ub4 *conrow[Nstop],*conarr[Nstop],*conofs[Nstop],*lodist[Nstop];
+  ub2 *concnt[Nstop];
+  const ub1 *conlst[Nstop];  // packed to lstwid bytes per hop
+  ub8 limkey[Nstop];
+  ub4 *hopmap;      // [whopcnt] current hop id, hi32 if gone
+  ub1 *redo;        // [portcnt] bit n set if the n-stop row is to be rebuilt
+};
+
+extern void ininetcache(void);
+extern ub8 netcachekey(struct network *net,ub4 maxstop);
+extern int rdnetcache(struct network *net,ub4 maxstop);
+extern int wrnetcache(struct network *net,ub4 maxstop);
+extern ub4 *prevlegs(struct conprev *pp,ub4 nstop,size_t var,ub4 *legs);
+extern void rmconprev(struct network *net);
@@ -24,7 +24,7 @@ static ub4 msgfile;
 #include "net.h"
 #include "netev.h"
 
-static const ub4 subsamples = 256;
+static const ub4 subsamples = Subsamples;
 static const ub4 maxscnt = 1024 * 32;
 
 static int vrbena;
@@ -151,6 +151,9 @@ int mksubevs(lnet *net)
 
   info(0,"sampling \ah%lu events from \ah%lu in %u box",sumsevcnt,sumevcnt,hiscnt);
 
+  // sample patterns are seeded per partition, independent of other partitions being built
+  ub8 rndseed = 0x05a3ae52de3bbf0aULL ^ ((ub8)net->part << 32);
+
   ub4 hiscnt1 = hiscnt + 1;
   ub4 *rndset,*rndsets = alloc(hiscnt1 * hiscnt1,ub4,0,"time randoms",hiscnt);
   ub8 *cev = alloc(hiscnt,ub8,0xff,"time cevs",hiscnt);
@@ -167,7 +170,7 @@ int mksubevs(lnet *net)
     r = 0;
     nclear(rnduniq,hiscnt);
     while (r < i) {
-      rr = rnd(i);
+      rr = rndr(&rndseed,i);
       if (rnduniq[rr]) continue;
       rnduniq[rr] = 1;
       error_ge(r + hiscnt * i,hiscnt1 * hiscnt1);
@@ -420,10 +423,10 @@ static ub4 estdur2(lnet *net,ub4 hop1,ub4 hop2,ub4 dttmin)
   ub8 dtsum = 0,dtbsum = 0;
   ub4 ttmax,ttmin;
 
-static ub4 dtbins[60 * 12];
+static Tls ub4 dtbins[60 * 12];
 static ub4 dthibin = Elemcnt(dtbins) - 1;
-static ub4 statcnt;
-static ub4 stat_nocnt;
+static Tls ub4 statcnt;
+static Tls ub4 stat_nocnt;
 
   error_zp(sevents,0);
 
@@ -576,9 +579,9 @@ static ub4 estdur3(lnet *net,ub4 hop1,ub4 hop2,ub4 hop3,ub4 ttmin,ub4 ttmax)
   ub4 dtcnt = 0,dtbcnt = 0;
   ub8 dtsum = 0,dtbsum = 0;
 
-static ub4 dtbins[60 * 12];
+static Tls ub4 dtbins[60 * 12];
 static ub4 dthibin = Elemcnt(dtbins) - 1;
-static ub4 statcnt;
+static Tls ub4 statcnt;
 
   error_zp(sevents,0);
 
@@ -9,6 +9,8 @@
    To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
  */
 
+#define Subsamples 256  // sampled events per hop
+
 extern void ininetev(void);
 
 extern ub4 prepestdur(lnet *net,ub4 *trip,ub4 len);
@@ -29,10 +29,12 @@
  */
 
 #include <string.h>
+#include <pthread.h>
 
 #include "base.h"
 #include "cfg.h"
 #include "mem.h"
+#include "os.h"
 #include "math.h"
 
 static ub4 msgfile;
@@ -43,6 +45,8 @@ static ub4 msgfile;
 #include "net.h"
 #include "netn.h"
 #include "netev.h"
+#include "netcache.h"
+#include "rowcache.h"
 
 #undef hdrstop
 
@@ -58,83 +62,638 @@ void ininetn(void)
 #define Distcnt 64
 #define Durcnt 64
 
-// create n-stop connectivity matrix and derived info
-// uses 1 mid, varying use of underlying nets by stop position
-int mknetn(struct network *net,ub4 nstop,ub4 varlimit,ub4 var12limit,bool nilonly)
+#define Maxbuilders 64
+
+#define Nclass 16     // dep density classes, on log2 of #arrs
+#define Varhist 64    // above any variant limit
+#define Pairbytes (3 * sizeof(ub4) + sizeof(ub2))  // conarr, conofs, lodist, concnt
+
+/* Departure ports are independent in both passes below: a dep reads the lower-stop nets
+   and writes only its own [dep,*] row. Deps are handed out in order to builder threads.
+   Pass 1 runs in waves that cannot reach the list size limit, so limiting starts at the same dep
+   as in a serial run. Its rows are kept per thread and gathered in dep order afterwards.
+   Pass 2 fills each row from its tentative pass 1 offset, after which
+   rows are moved together. The result does not depend on the number of threads.
+
+   Lower-stop rows are read per dep: [dep,mid] by walking the dep row, [mid,arr] by a cursor
+   per via that only moves forward as arr ascends.
+
+   With a memory budget, an estimate pass first counts the variants available per dep-arr pair,
+   grouped by the density of the dep : its number of reachable arrs. The variant limit of each
+   group is then lowered, largest group in bytes first, until the lists fit. See bldplan().
+   Limits are thus set before pass 1 and do not depend on port order.
+
+   With a previous build of the partition, rows of deps whose neighbourhood did not change
+   are copied from it in both passes instead of built. See rdnetcache() for which rows change.
+   This applies only if the level was built with the same variant limits and not limited by size.
+ */
+
+enum Bldstats { St_nocon,St_partcnt,St_cntlim,St_partlimdur,St_partlimdist,St_altlim,St_oneroute,St_var12limit,St_cnt };
+
+struct bldctx;
+
+// pass 1 result for a dep-arr pair
+struct bldrow {
+  ub4 arr,cnt;
+  ub4 distlim,durlim;
+};
+
+// per thread scratch and stats
+struct bldwork {
+  struct bldctx *cx;
+  pthread_t tid;
+  ub4 id;
+  ub4 *dmids,*amids;
+  ub4 *dpairs,*apairs;  // [dep,mid] resp. [mid,arr] per via
+  ub4 *dcurs;           // [mid,*] row cursor per via
+  ub4 *viacnts,*viaclamps;  // [arr] pass 1 variant count over all vias resp. clamped vias
+  size_t lstlen;     // pass 1 tentative
+  struct bldrow *rows;  // pass 1 rows of this thread's deps
+  ub4 rowcnt,rowcap;
+  ub4 stats[St_cnt];
+  ub8 dupstats[16];
+  ub4 cntstats[64];
+  ub4 genstats[64];
+  ub4 dmidbins[256];
+  ub4 estdeps[Nclass];            // estimate pass : deps per density class
+  ub4 esthist[Nclass][Varhist];   // idem, pairs per available variant count
+};
+
+typedef void (*bldfn)(struct bldwork *wp,ub4 dep);
+
+struct bldctx {
+  struct network *net;
+  ub4 nstop,nleg;
+  ub4 varlimit,var12limit,altlimit,dmidlim;
+  bool nilonly;
+  int limited;
+  size_t budget;     // list bytes, 0 for fixed limits
+  ub1 *depclass;     // [portcnt] density class, with budget
+  ub4 classlims[Nclass];  // variant limit per class
+  ub8 limkey;        // hash of the above, see net->conlimkey
+  struct conprev *prev;  // rows to reuse, if any
+  ub1 redobit;       // set in prev->redo for deps to build
+
+  ub4 *conrow,*conarr;  // rows being built
+  ub4 pairs;
+  ub2 *cnts;
+  ub4 *conofs,*lst;
+  size_t lstlen;
+  ub4 *rowofs;       // [portcnt] tentative start of each dep row
+  ub4 *rowlen;       // [portcnt] entries filled in pass 2
+  ub4 *rowthr,*rowpos;  // [portcnt] thread and position of pass 1 row
+  ub4 *distlims,*durlims;
+  ub4 *lodists,*portdst;
+
+  bldfn fn;
+  ub4 pass;
+  ub4 nxtdep,enddep;
+  int stop;
+  pthread_mutex_t lock;
+  struct eta eta;
+
+  ub4 *scratch;
+  ub4 thrcnt;
+  struct bldwork work[Maxbuilders];
+  struct bldwork sum;
+};
+
+// thrcnt 0 for the configured count
+static struct bldctx *mkbld(struct network *net,ub4 nstop,ub4 dmidlen,ub4 amidlen,ub4 thrcnt)
 {
-  ub4 part = net->part;
   ub4 portcnt = net->portcnt;
-  ub4 hopcnt = net->hopcnt;
-  ub4 chopcnt = net->chopcnt;
-  ub4 whopcnt = net->whopcnt;
-  struct port *ports,*pmid,*pdep,*parr;
-  char *dname,*aname;
-  block *lstblk,*lstblk1,*lstblk2;
-  ub4 *portsbyhop;
-  ub2 *concnt,*cnts1,*cnts2;
-  ub4 *portdst;
-  ub4 ofs,ofs1,ofs2,endofs,*conofs,*conofs1,*conofs2;
-  ub4 *lst,*newlst,*conlst1,*conlst2,*lst1,*lst11,*lst2,*lst22,*lstv1,*lstv2;
-  ub4 *hopdist,*distlims;
-  ub4 dep,mid,arr,firstmid,port2,depmid,midarr,deparr,iport1,iport2;
-  ub4 iv;
-  ub4 cnt,nstop1,n1,n2,n12,altcnt,nleg1,nleg2,v1,v2,leg,leg1,leg2,nleg;
-  size_t lstlen,newlstlen;
-  ub4 midstop1,midstop2;
-  ub4 *lodists;
-  ub4 dist1,dist2,distlim,walkdist1,walkdist2,sumwalkdist1,sumwalkdist2;
-  ub4 cntlim,cntlimdist,cntlimdur,gen,outcnt;
-  ub4 dur,midur,durndx,durcnt,durlim,distcnt,distndx;
-  ub4 *hopdur,*durlims;
-  ub4 midurs[Durcnt];
-  ub4 dists[Distcnt];
-  ub4 walklimit = net->walklimit;
-  ub4 sumwalklimit = net->sumwalklimit;
-  ub4 stat_nocon = 0,stat_partcnt = 0,stat_cntlim = 0,stat_partlimdur = 0,stat_partlimdist = 0;
+  ub4 t,len = dmidlen * 3 + amidlen * 2 + portcnt * 2;
+  struct bldctx *cx;
+  struct bldwork *wp;
+
+  if (thrcnt == 0) thrcnt = globs.netvars[Net_threads];
+  if (thrcnt == 0) thrcnt = net->bldthreads;
+  if (thrcnt == 0) thrcnt = oscpucnt();
+  thrcnt = max(min(thrcnt,Maxbuilders),1);
+
+  cx = alloc(1,struct bldctx,0,"net build",nstop);
+  cx->net = net;
+  cx->nstop = nstop;
+  cx->nleg = nstop + 1;
+  cx->thrcnt = thrcnt;
+  pthread_mutex_init(&cx->lock,NULL);
+
+  cx->conrow = alloc(portcnt + 1,ub4,0,"net conrow",portcnt);
+  cx->rowthr = alloc(portcnt * 2,ub4,0,"net rowthr",portcnt);
+  cx->rowpos = cx->rowthr + portcnt;
+
+  cx->scratch = alloc(thrcnt * len,ub4,0,"net vias",nstop);
+  for (t = 0; t < thrcnt; t++) {
+    wp = cx->work + t;
+    wp->cx = cx;
+    wp->id = t;
+    wp->dmids = cx->scratch + t * len;
+    wp->dpairs = wp->dmids + dmidlen;
+    wp->dcurs = wp->dpairs + dmidlen;
+    wp->viacnts = wp->dcurs + dmidlen;
+    wp->viaclamps = wp->viacnts + portcnt;
+    if (amidlen) {
+      wp->amids = wp->viaclamps + portcnt;
+      wp->apairs = wp->amids + amidlen;
+    }
+  }
+  infocc(thrcnt > 1,0,"%u-stop net build using %u threads",nstop,thrcnt);
+  return cx;
+}
 
-  // todo
-  ub4 portlimit = 9000;
-  ub4 lstlimit = 1024 * 1024 * 512;
-  ub4 altlimit = min(var12limit * 8,256);
+// free build state. rows and counts are freed unless taken over by the net
+static void rmbld(struct bldctx *cx)
+{
+  struct bldwork *wp;
+  ub4 t;
 
-  ub4 dupcode,legport1,legport2;
-  ub4 trip1ports[Nleg * 2];
-  ub4 trip2ports[Nleg * 2];
+  for (t = 0; t < cx->thrcnt; t++) {
+    wp = cx->work + t;
+    if (wp->rows) afree(wp->rows,"net rows");
+  }
+  pthread_mutex_destroy(&cx->lock);
+  afree(cx->scratch,"net vias");
+  if (cx->rowthr) afree(cx->rowthr,"net rowthr");
+  if (cx->rowofs) afree(cx->rowofs,"net rowofs");
+  if (cx->distlims) afree(cx->distlims,"net distlims");
+  if (cx->depclass) afree(cx->depclass,"net depclass");
+  if (cx->conrow) afree(cx->conrow,"net conrow");
+  if (cx->conarr) afree(cx->conarr,"net conarr");
+  if (cx->cnts) afree(cx->cnts,"net concnt");
+  if (cx->conofs) afree(cx->conofs,"net conofs");
+  if (cx->lodists) afree(cx->lodists,"net lodist");
+  afree(cx,"net build");
+}
 
-  struct eta eta;
+/* add min(n1 * n2,lim) to the via count of each arr in a via's row, excluding arrs skip1 and skip2.
+   Walking the via's row visits arrs in storage order instead of seeking each via per arr.
+   Sums are integer, so the per-arr totals do not depend on this order
+ */
+static void bldvias(struct bldwork *wp,ub4 n1,const ub4 *arrs,const ub2 *cnts,ub4 pos,ub4 end,ub4 skip1,ub4 skip2,ub4 lim)
+{
+  ub4 *viacnts = wp->viacnts,*viaclamps = wp->viaclamps;
+  ub4 arr,n12;
+
+  for (; pos < end; pos++) {
+    arr = arrs[pos];
+    if (arr == skip1 || arr == skip2) continue;
+    n12 = n1 * cnts[pos];
+    if (n12 > lim) { viaclamps[arr]++; n12 = lim; }
+    viacnts[arr] += n12;
+  }
+}
 
-  error_z(nstop,0);
-  error_ge(nstop,Nstop);
-  error_zz(portcnt,hopcnt);
+// add pass 1 result for dep-arr. arr ascends per dep
+static void bldadd(struct bldwork *wp,ub4 arr,ub4 cnt,ub4 distlim,ub4 durlim)
+{
+  struct bldrow *rp,*rows;
+  ub4 cap;
+
+  if (wp->rowcnt == wp->rowcap) {
+    cap = max(wp->rowcap * 2,wp->cx->net->portcnt * 4);
+    rows = alloc(cap,struct bldrow,0,"net rows",wp->id);
+    if (wp->rowcnt) {
+      memcpy(rows,wp->rows,wp->rowcnt * sizeof(struct bldrow));
+      afree(wp->rows,"net rows");
+    }
+    wp->rows = rows;
+    wp->rowcap = cap;
+  }
+  rp = wp->rows + wp->rowcnt++;
+  rp->arr = arr;
+  rp->cnt = cnt;
+  rp->distlim = distlim;
+  rp->durlim = durlim;
+}
 
-  info(0,"init %u-stop connections for %u port %u hop network",nstop,portcnt,whopcnt);
+// pass 1 for a dep with an unchanged row : its pairs from the previous build
+static void bldreuse1(struct bldwork *wp,ub4 dep)
+{
+  struct bldctx *cx = wp->cx;
+  struct conprev *pp = cx->prev;
+  ub4 nstop = cx->nstop;
+  ub4 *conrow = pp->conrow[nstop],*conarr = pp->conarr[nstop];
+  ub2 *concnt = pp->concnt[nstop];
+  ub4 pair,cnt;
+
+  for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+    cnt = concnt[pair];
+    bldadd(wp,conarr[pair],cnt,hi32,hi32);
+    wp->lstlen += cnt;
+  }
+  cx->portdst[dep] = conrow[dep + 1] - conrow[dep];
+}
 
-  port2 = portcnt * portcnt;
+// idem pass 2 : its variants, with hop ids mapped to the current net
+static void bldreuse2(struct bldwork *wp,ub4 dep)
+{
+  struct bldctx *cx = wp->cx;
+  struct conprev *pp = cx->prev;
+  ub4 nstop = cx->nstop,nleg = cx->nleg;
+  ub4 whopcnt = cx->net->whopcnt;
+  ub4 *conofs = cx->conofs,*lodists = cx->lodists;
+  ub2 *cnts = cx->cnts;
+  ub4 *prvofs = pp->conofs[nstop],*prvlod = pp->lodist[nstop];
+  ub4 pair,prvpair,cnt,v,leg,*lstv;
+  ub4 ofs = cx->rowofs[dep];
+
+  prvpair = pp->conrow[nstop][dep];
+  for (pair = cx->conrow[dep]; pair < cx->conrow[dep + 1]; pair++) {
+    cnt = cnts[pair];
+    conofs[pair] = ofs;
+    lstv = cx->lst + (size_t)ofs * nleg;
+    for (v = 0; v < cnt; v++) {
+      prevlegs(pp,nstop,(size_t)prvofs[prvpair] + v,lstv);
+      for (leg = 0; leg < nleg; leg++) error_ge(lstv[leg],whopcnt);
+      lstv += nleg;
+    }
+    if (lodists && prvlod) lodists[pair] = prvlod[prvpair];
+    ofs += cnt;
+    prvpair++;
+  }
+  cx->rowlen[dep] = ofs - cx->rowofs[dep];
+}
+
+static void *bldworker(void *arg)
+{
+  struct bldwork *wp = arg;
+  struct bldctx *cx = wp->cx;
+  struct network *net = cx->net;
+  ub4 dep;
+
+  if (wp->id && net->partcnt > 1) msgprefix(0,"p%u/%u ",net->part,net->partcnt);
+
+  do {
+    pthread_mutex_lock(&cx->lock);
+    if (cx->stop || cx->nxtdep >= cx->enddep) dep = hi32;
+    else dep = cx->nxtdep++;
+    pthread_mutex_unlock(&cx->lock);
+    if (dep == hi32) break;
+
+    if (wp->id == 0 && progress(&cx->eta,"port %u of %u in pass %u %u-stop net",dep,net->portcnt,cx->pass,cx->nstop)) {
+      pthread_mutex_lock(&cx->lock);
+      cx->stop = 1;
+      pthread_mutex_unlock(&cx->lock);
+      break;
+    }
+    if (cx->pass == 1) {
+      cx->rowthr[dep] = wp->id;
+      cx->rowpos[dep] = wp->rowcnt;
+      if (cx->prev && (cx->prev->redo[dep] & cx->redobit) == 0) bldreuse1(wp,dep);
+      else cx->fn(wp,dep);
+      cx->conrow[dep + 1] = wp->rowcnt - cx->rowpos[dep];
+    } else if (cx->pass == 2 && cx->prev && (cx->prev->redo[dep] & cx->redobit) == 0) bldreuse2(wp,dep);
+    else cx->fn(wp,dep);
+  } while (1);
+
+  return NULL;
+}
 
-  ports = net->ports;
+// run fn for deps dep0 .. dep1-1, the calling thread being worker 0
+static int bldrun(struct bldctx *cx,bldfn fn,ub4 dep0,ub4 dep1)
+{
+  struct bldwork *wp;
+  ub4 t,thrcnt = min(cx->thrcnt,dep1 - dep0);
+  int rv;
 
-  portsbyhop = net->portsbyhop;
+  if (dep0 >= dep1) return 0;
 
-  ub1 *allcnt = net->allcnt;
+  cx->fn = fn;
+  cx->nxtdep = dep0;
+  cx->enddep = dep1;
+  cx->stop = 0;
 
-  concnt = alloc(port2, ub2,0,"net concnt",portcnt);
-  lodists = alloc(port2, ub4,0xff,"net lodist",portcnt);
+  if (progress(&cx->eta,"port %u of %u in pass %u %u-stop net",dep0,cx->net->portcnt,cx->pass,cx->nstop)) return 1;
 
-  distlims = alloc(port2, ub4,0,"net distlims",portcnt);
-  durlims = alloc(port2, ub4,0,"net durlims",portcnt);
+  for (t = 1; t < thrcnt; t++) {
+    wp = cx->work + t;
+    rv = pthread_create(&wp->tid,NULL,bldworker,wp);
+    if (rv) {
+      warning(0,"cannot create builder thread %u: %s",t,strerror(rv));
+      break;
+    }
+  }
+  thrcnt = t;
 
-  portdst = alloc(portcnt, ub4,0,"net portdst",portcnt);
+  bldworker(cx->work);
 
-  hopdist = net->hopdist;
-  hopdur = net->hopdur;
+  for (t = 1; t < thrcnt; t++) pthread_join(cx->work[t].tid,NULL);
+  return cx->stop;
+}
 
-  error_zp(hopdist,0);
+// use rows of a previous build if built with the same limits
+static void bldprev(struct bldctx *cx)
+{
+  struct network *net = cx->net;
+  struct conprev *pp = net->conprev;
+  ub4 nstop = cx->nstop;
+  ub4 c,dep,redocnt = 0;
+  ub8 h = 0;
+
+  if (cx->depclass) {
+    h = 0xcbf29ce484222325ULL;
+    for (c = 0; c < Nclass; c++) h = (h ^ cx->classlims[c]) * 0x100000001b3ULL;
+  }
+  cx->limkey = h;
 
-  nleg = nstop + 1;
-  nstop1 = nstop - 1;
+  if (pp == NULL || nstop > pp->reusestop) return;
+  if (pp->limkey[nstop] != h) {
+    info(0,"%u-stop net built with other limits before, not reused",nstop);
+    pp->reusestop = nstop - 1;
+    return;
+  }
+  cx->prev = pp;
+  cx->redobit = (ub1)(1 << nstop);
+  for (dep = 0; dep < net->portcnt; dep++) if (pp->redo[dep] & cx->redobit) redocnt++;
+  info(0,"%u-stop rows built for %u ports, %u reused",nstop,redocnt,net->portcnt - redocnt);
+}
 
-  memset(trip1ports,0xff,sizeof(trip1ports));
-  memset(trip2ports,0xff,sizeof(trip1ports));
+/* pass 1 in waves of deps that cannot reach the list limit.
+   the limit check and its reduced variant limits thus apply from the same dep as serially
+   returns 2 if limited while reusing rows, to be run again without
+ */
+static int bldpass1(struct bldctx *cx,bldfn fn,ub4 depcnt,size_t lstlimit,size_t margin)
+{
+  ub4 portcnt = cx->net->portcnt;
+  size_t lstlen = 0,room,depmax,n;
+  ub4 dep = 0,t;
+
+  cx->pass = 1;
+  bldprev(cx);
+
+  while (dep < depcnt) {
+    if (lstlen + margin > lstlimit) {
+      if (cx->prev) {
+        warn(0,"%u-stop net reaches \ah%lu triplets, not reusing rows",cx->nstop,lstlimit);
+        cx->prev->reusestop = cx->nstop - 1;
+        return 2;
+      }
+      warncc(cx->limited == 0,0,"limiting net by \ah%lu triplets",lstlimit);
+      cx->limited = 1;
+      cx->var12limit = cx->varlimit = 2;
+      for (t = 0; t < Nclass; t++) cx->classlims[t] = 2;
+    }
+    if (cx->limited) n = depcnt - dep;
+    else {
+      room = lstlimit - lstlen - margin;
+      depmax = (size_t)cx->varlimit * portcnt;
+      n = min(room / depmax + 1,depcnt - dep);
+    }
+    if (bldrun(cx,fn,dep,dep + (ub4)n)) return 1;
+
+    lstlen = 0;
+    for (t = 0; t < cx->thrcnt; t++) lstlen += cx->work[t].lstlen;
+    dep += (ub4)n;
+  }
+  cx->lstlen = lstlen;
+  cx->net->conlimkey[cx->nstop] = cx->limited ? hi64 : cx->limkey;
+  return 0;
+}
+
+// gather the pass 1 rows of all threads in dep order
+static void bldrows(struct bldctx *cx)
+{
+  ub4 portcnt = cx->net->portcnt;
+  ub4 *conrow = cx->conrow;
+  struct bldwork *wp;
+  struct bldrow *rp;
+  ub4 dep,pair,pairs,t;
+
+  for (dep = 0; dep < portcnt; dep++) conrow[dep + 1] += conrow[dep];
+  cx->pairs = pairs = conrow[portcnt];
+
+  cx->conarr = alloc(pairs,ub4,0,"net conarr",portcnt);
+  cx->cnts = alloc(pairs,ub2,0,"net concnt",portcnt);
+  cx->distlims = alloc(pairs * 2,ub4,0,"net distlims",portcnt);
+  cx->durlims = cx->distlims + pairs;
+
+  for (dep = 0; dep < portcnt; dep++) {
+    wp = cx->work + cx->rowthr[dep];
+    rp = wp->rows + cx->rowpos[dep];
+    for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+      cx->conarr[pair] = rp->arr;
+      cx->cnts[pair] = (ub2)rp->cnt;
+      cx->distlims[pair] = rp->distlim;
+      cx->durlims[pair] = rp->durlim;
+      rp++;
+    }
+  }
+  for (t = 0; t < cx->thrcnt; t++) {
+    wp = cx->work + t;
+    if (wp->rows) afree(wp->rows,"net rows");
+    wp->rows = NULL;
+    wp->rowcnt = wp->rowcap = 0;
+  }
+  afree(cx->rowthr,"net rowthr");
+  cx->rowthr = NULL;
+}
+
+// tentative offsets from pass 1 counts. Optionally count pairs new at this stop level
+static size_t bldofs(struct bldctx *cx,ub4 prvstop,ub4 *pnewcnt)
+{
+  struct network *net = cx->net;
+  ub4 portcnt = net->portcnt;
+  ub4 *conrow = cx->conrow;
+  ub2 *cnts = cx->cnts;
+  ub4 *conofs = cx->conofs;
+  ub4 dep,pair,cur,newcnt = 0;
+  size_t ofs = 0;
+
+  cx->rowofs = alloc(portcnt * 2,ub4,0,"net rowofs",portcnt);
+  cx->rowlen = cx->rowofs + portcnt;
+
+  for (dep = 0; dep < portcnt; dep++) {
+    cx->rowofs[dep] = (ub4)ofs;
+    if (pnewcnt) cur = net->conrow[prvstop][dep];
+    for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+      conofs[pair] = (ub4)ofs;
+      ofs += cnts[pair];
+      if (pnewcnt && conseek(net,prvstop,&cur,dep,cx->conarr[pair]) == hi32) newcnt++;
+    }
+  }
+  if (pnewcnt) *pnewcnt = newcnt;
+  return ofs;
+}
+
+// pass 2, then move rows together in dep order and drop pairs left without trips
+static int bldpass2(struct bldctx *cx,bldfn fn,ub4 depcnt,size_t *pnewlen)
+{
+  ub4 portcnt = cx->net->portcnt;
+  ub4 nleg = cx->nleg;
+  ub4 *lst = cx->lst,*conofs = cx->conofs;
+  ub4 *conrow = cx->conrow,*conarr = cx->conarr;
+  ub2 *cnts = cx->cnts;
+  ub4 *lodists = cx->lodists;
+  ub4 dep,pair,pair0,pair1,from,n,shift,npair = 0;
+  size_t ofs = 0;
+
+  cx->pass = 2;
+  if (bldrun(cx,fn,0,depcnt)) return 1;
+
+  pair0 = 0;
+  for (dep = 0; dep < portcnt; dep++) {
+    from = cx->rowofs[dep];
+    n = cx->rowlen[dep];
+    shift = from - (ub4)ofs;
+    if (shift && n) memmove(lst + ofs * nleg,lst + (size_t)from * nleg,(size_t)n * nleg * sizeof(ub4));
+
+    pair1 = conrow[dep + 1];
+    conrow[dep] = npair;
+    for (pair = pair0; pair < pair1; pair++) {
+      if (cnts[pair] == 0) continue;
+      conarr[npair] = conarr[pair];
+      cnts[npair] = cnts[pair];
+      conofs[npair] = conofs[pair] - shift;
+      if (lodists) lodists[npair] = lodists[pair];
+      npair++;
+    }
+    pair0 = pair1;
+    ofs += n;
+  }
+  conrow[portcnt] = npair;
+  cx->pairs = npair;
+
+  if (ofs < cx->lstlen) memset(lst + ofs * nleg,0xff,(cx->lstlen - ofs) * nleg * sizeof(ub4));
+  *pnewlen = ofs;
+  return 0;
+}
+
+// hand the finished rows to the net
+static void bldkeep(struct bldctx *cx,ub4 nstop)
+{
+  struct network *net = cx->net;
+
+  net->conrow[nstop] = cx->conrow;
+  net->conarr[nstop] = cx->conarr;
+  net->concnt[nstop] = cx->cnts;
+  net->conofs[nstop] = cx->conofs;
+  net->lodist[nstop] = cx->lodists;
+  net->conpairs[nstop] = cx->pairs;
+  cx->conrow = cx->conarr = cx->conofs = cx->lodists = NULL;
+  cx->cnts = NULL;
+}
+
+// add thread stats to the sum and clear them
+static void bldsum(struct bldctx *cx)
+{
+  struct bldwork *wp,*sp = &cx->sum;
+  ub4 t,i;
+
+  for (t = 0; t < cx->thrcnt; t++) {
+    wp = cx->work + t;
+    for (i = 0; i < St_cnt; i++) sp->stats[i] += wp->stats[i];
+    for (i = 0; i < Elemcnt(sp->dupstats); i++) sp->dupstats[i] += wp->dupstats[i];
+    for (i = 0; i < Elemcnt(sp->cntstats); i++) sp->cntstats[i] += wp->cntstats[i];
+    for (i = 0; i < Elemcnt(sp->genstats); i++) sp->genstats[i] += wp->genstats[i];
+    for (i = 0; i < Elemcnt(sp->dmidbins); i++) sp->dmidbins[i] += wp->dmidbins[i];
+    aclear(wp->stats);
+    aclear(wp->dupstats);
+    aclear(wp->cntstats);
+    aclear(wp->genstats);
+    aclear(wp->dmidbins);
+  }
+}
+
+// estimate pass for dep, after its via counts. see bldplan()
+static void bldcount(struct bldwork *wp,ub4 dep)
+{
+  struct bldctx *cx = wp->cx;
+  struct network *net = cx->net;
+  ub4 portcnt = net->portcnt;
+  struct port *ports = net->ports;
+  ub8 *allconn = net->allconn;
+  bool nilonly = cx->nilonly;
+  ub4 *viacnts = wp->viacnts;
+  ub4 arr,cnt,cls,k,outcnt = 0;
+  ub4 hist[Varhist];
+
+  aclear(hist);
+  for (arr = 0; arr < portcnt; arr++) {
+    if (arr == dep) continue;
+    if (nilonly && conbit(net,allconn,dep,arr)) continue;
+    if (ports[arr].valid == 0) continue;
+    cnt = viacnts[arr];
+    if (cnt == 0) continue;
+    hist[min(cnt,Varhist - 1)]++;
+    outcnt++;
+  }
+  cls = 0;
+  while (cls < Nclass - 1 && (outcnt >> (cls + 1))) cls++;
+  cx->depclass[dep] = (ub1)cls;
+  wp->estdeps[cls]++;
+  for (k = 0; k < Varhist; k++) wp->esthist[cls][k] += hist[k];
+}
+
+// list bytes once packed
+static size_t bldbytes(struct bldctx *cx,size_t pairs,size_t lstlen)
+{
+  return pairs * Pairbytes + lstlen * cx->nleg * cx->net->lstwid;
+}
+
+/* set the variant limit per density class to fit the budget, from an estimate pass.
+   repeatedly lower the limit of the class taking most bytes, down to 2
+ */
+static int bldplan(struct bldctx *cx,bldfn fn,ub4 depcnt,size_t *pplan)
+{
+  struct network *net = cx->net;
+  ub4 portcnt = net->portcnt;
+  ub4 nleg = cx->nleg;
+  ub4 wid = net->lstwid;
+  ub4 *lims = cx->classlims;
+  size_t budget = cx->budget;
+  struct bldwork *wp;
+  ub8 hist[Nclass][Varhist];
+  ub4 deps[Nclass];
+  size_t pairs = 0,fixed,total,hisize,size[Nclass];
+  ub4 t,c,hic,k;
+
+  cx->depclass = alloc(portcnt,ub1,0,"net depclass",portcnt);
+
+  cx->pass = 0;
+  if (bldrun(cx,fn,0,depcnt)) return 1;
+
+  aclear(hist);
+  aclear(deps);
+  for (t = 0; t < cx->thrcnt; t++) {
+    wp = cx->work + t;
+    for (c = 0; c < Nclass; c++) {
+      deps[c] += wp->estdeps[c];
+      for (k = 0; k < Varhist; k++) hist[c][k] += wp->esthist[c][k];
+    }
+    // counted by the pass functions before the estimate
+    aclear(wp->stats);
+    aclear(wp->cntstats);
+    aclear(wp->dmidbins);
+  }
+
+  for (c = 0; c < Nclass; c++) {
+    lims[c] = cx->varlimit;
+    for (k = 0; k < Varhist; k++) pairs += hist[c][k];
+  }
+  fixed = pairs * Pairbytes;
+
+  do {
+    total = fixed;
+    hisize = hic = 0;
+    for (c = 0; c < Nclass; c++) {
+      size[c] = 0;
+      for (k = 1; k < Varhist; k++) size[c] += hist[c][k] * min(k,lims[c]);
+      size[c] *= nleg * wid;
+      total += size[c];
+      if (lims[c] > 2 && size[c] > hisize) { hisize = size[c]; hic = c; }
+    }
+    if (total <= budget || hisize == 0) break;
+    lims[hic]--;
+  } while (1);
+
+  for (c = 0; c < Nclass; c++) {
+    if (deps[c]) info(0,"%u-stop deps with %u+ arrs: %u var limit %u for \ah%lu b",cx->nstop,c ? 1U << c : 0,deps[c],lims[c],size[c]);
+  }
+  info(0,"%u-stop lists planned \ah%lu b for \ah%lu pairs within budget \ah%lu b",cx->nstop,total,pairs,budget);
+  warncc(total > budget,0,"%u-stop lists exceed budget at minimum var limit",cx->nstop);
+  *pplan = total;
+  return 0;
+}
 
 /* Essentially we do for each (departure,arrival) pair:
    Search for a 'via' port such that trip (departure,via) and (via,arrival) exist
@@ -154,545 +713,229 @@ int mknetn(struct network *net,ub4 nstop,ub4 varlimit,ub4 var12limit,bool nilonl
   estimate size of trip list matrix
   obtain basic stats
 */
+static void netnpass1(struct bldwork *wp,ub4 dep)
+{
+  struct bldctx *cx = wp->cx;
+  struct network *net = cx->net;
+  ub4 nstop = cx->nstop;
+  ub4 portcnt = net->portcnt;
+  ub4 chopcnt = net->chopcnt;
+  ub4 whopcnt = net->whopcnt;
+  struct port *ports = net->ports,*pmid,*pdep,*parr;
+  char *dname,*mname;
+  block *lstblk1,*lstblk2;
+  ub4 *portsbyhop = net->portsbyhop;
+  ub2 *cnts1,*cnts2;
+  ub4 *conrow1,*conarr1,*conrow2,*conarr2;
+  ub4 ofs1,ofs2,*conofs1,*conofs2;
+  ub4 *conlst1,*conlst2,*lst1,*lst11,*lst2,*lst22;
+  ub4 *hopdist = net->hopdist;
+  ub4 *hopdur = net->hopdur;
+  ub8 *allconn = net->allconn;
+  ub4 mid,arr,depmid,midarr,iport1,iport2;
+  ub4 cnt,nstop1,n1,n2,n12,altcnt,nleg1,nleg2,v1,v2,leg,leg1,leg2;
+  ub4 midstop1,midstop2;
+  ub4 dist1,dist2,distlim,walkdist1,walkdist2,sumwalkdist1,sumwalkdist2;
+  ub4 cntlim,cntlimdist,cntlimdur,outcnt;
+  ub4 dur,midur,durndx,durcnt,durlim,distcnt,distndx;
+  ub4 midurs[Durcnt];
+  ub4 dists[Distcnt];
+  ub4 walklimit = net->walklimit;
+  ub4 sumwalklimit = net->sumwalklimit;
+  ub4 varlimit = cx->depclass ? cx->classlims[cx->depclass[dep]] : cx->varlimit;
+  ub4 var12limit = cx->var12limit;
+  ub4 altlimit = cx->altlimit;
+  bool nilonly = cx->nilonly;
+  ub4 *stats = wp->stats;
+  ub8 *dupstats = wp->dupstats;
+  ub4 *cntstats = wp->cntstats;
 
-  ub8 dupstats[16];
-  ub4 cntstats[16];
-
-  lstlen = 0;
-
-  aclear(dupstats);
-  aclear(cntstats);
+  ub4 dupcode,legport1,legport2;
+  ub4 trip1ports[Nleg * 2];
+  ub4 trip2ports[Nleg * 2];
 
-  ub4 dmid,dmidcnt,*dmids = alloc(portcnt * nstop,ub4,0,"net vias",portcnt);
-  ub4 *drdeps,*drarrs,*mrdeps,*mrarrs;
-  char *mname;
-  ub4 dmidcnts[Nstop];
-  int fd;
-  int dbg,limited = 0;
+  ub4 *viacnts = wp->viacnts,*viaclamps = wp->viaclamps;
+  ub4 *drdeps;
   ub4 hindx,hidur,hidist;
-  char cachefile[256];
-
-  fmtstring(cachefile,"cache/net_%u_part_%u_distlim.in",nstop,part);
-  fd = fileopen(cachefile,0);
-  if (fd != -1) {
-    fileread(fd,distlims,port2 * (ub4)sizeof(*distlims),cachefile);
-    fileclose(fd,cachefile);
-    info(0,"using dist limit cache file %s",cachefile);
-  }
 
-  if (portcnt == 0) return 1;
+  nstop1 = nstop - 1;
 
-  // for each departure port
-  for (dep = 0; dep < portcnt; dep++) {
+  memset(trip1ports,0xff,sizeof(trip1ports));
+  memset(trip2ports,0xff,sizeof(trip1ports));
 
-    if (progress(&eta,"port %u of %u in pass 1 %u-stop net",dep,portcnt,nstop)) return 1;
+  pdep = ports + dep;
+  if (pdep->valid == 0) return;
 
-    if (dep > portlimit) {
-      warning(0,"limiting net by %u ports",portlimit);
-      break;
-    }
+  // count variants to each arr over eligible via's
+  dname = pdep->name;
+  drdeps = pdep->drids;
 
-    pdep = ports + dep;
-    if (pdep->valid == 0) continue;
+  nclear(viacnts,portcnt);
+  nclear(viaclamps,portcnt);
 
-    if (lstlen + 2 * port2 > lstlimit / nleg) {
-      warncc(limited == 0,0,"limiting net by \ah%u triplets",lstlimit / nleg);
-      limited = 1;
-      var12limit = varlimit = 2;
-    }
+  for (midstop1 = 0; midstop1 < nstop; midstop1++) {
+    midstop2 = nstop1 - midstop1;
+    cnts1 = net->concnt[midstop1];
+    conrow1 = net->conrow[midstop1];
+    conarr1 = net->conarr[midstop1];
+    cnts2 = net->concnt[midstop2];
+    conrow2 = net->conrow[midstop2];
+    conarr2 = net->conarr[midstop2];
 
-    // prepare eligible via's
-    dname = pdep->name;
-    drdeps = pdep->drids;
-    drarrs = pdep->arids;
+    for (depmid = conrow1[dep]; depmid < conrow1[dep + 1]; depmid++) {
+      mid = conarr1[depmid];
+      if (mid == dep) continue;
+      pmid = ports + mid;
+      if (pmid->valid == 0) continue;
 
-    for (midstop1 = 0; midstop1 < nstop; midstop1++) {
-      cnts1 = net->concnt[midstop1];
+      n1 = cnts1[depmid];
+      if (n1 == 0) continue;
 
-      dmid = 0;
-      for (mid = 0; mid < portcnt; mid++) {
-        if (mid == dep) continue;
-        pmid = ports + mid;
-        if (pmid->valid == 0) continue;
+      // skip vias only on same route
+      mname = pmid->name;
 
-        depmid = dep * portcnt + mid;
+      if (pmid->oneroute) {
+        vrb0(0,"skip %u-%u-x on same oneway route %x %s to %s",dep,mid,drdeps[0],dname,mname);
+        continue;
+      }
 
-        n1 = cnts1[depmid];
-        if (n1 == 0) continue;
+      bldvias(wp,n1,conarr2,cnts2,conrow2[mid],conrow2[mid + 1],mid,hi32,var12limit);
+    }
+  }
 
-        // skip vias only on same route
-        mname = pmid->name;
-        mrdeps = pmid->drids;
-        mrarrs = pmid->arids;
+  if (cx->pass == 0) { bldcount(wp,dep); return; }
 
-        if (pmid->oneroute) {
-          vrb0(0,"skip %u-%u-x on same oneway route %x %s to %s",dep,mid,drdeps[0],dname,mname);
-          continue;
-        }
+  outcnt = 0;
 
-        dmids[midstop1 * portcnt + dmid++] = mid;
-      }
-      dmidcnts[midstop1] = dmid;
-    }
+  // for each arrival port
+  for (arr = 0; arr < portcnt; arr++) {
+    if (arr == dep) continue;
 
-    outcnt = 0;
+    if (nilonly && conbit(net,allconn,dep,arr)) { cntstats[9]++; continue; }
 
-    // for each arrival port
-    for (arr = 0; arr < portcnt; arr++) {
-      if (arr == dep) continue;
+    parr = ports + arr;
+    if (parr->valid == 0) continue;
 
-      deparr = dep * portcnt + arr;
+    durlim = distlim = hi32;
 
-      if (nilonly && allcnt[deparr]) { cntstats[9]++; continue; }
+    // for each #stops between dep-via-arr, each via. see bldvias()
+    // e.g. trip dep-a-b-via-c-arr has 2 stops before and 1 after via
+    cntstats[7] += viaclamps[arr];
+    cnt = viacnts[arr];
+    if (cnt == 0) continue;
+    cntlim = min(cnt,varlimit);
 
-      parr = ports + arr;
-      if (parr->valid == 0) continue;
+    // store info
+    wp->lstlen += cntlim;
+    outcnt++;
 
-      aname = parr->name;
+    // todo: start with limits derived from previous nstop
+    // e.g. lodists[da] * 2
 
-      cnt = cntlim = 0;
-      durlim = distlim = hi32;
+    // if too many options, sort on distance.
+    if (cnt > varlimit) {
+      cntstats[8]++;
+      if (nstop == 1) cntlimdist = cntlimdur = cntlim / 2;
+      else {
+        cntlimdist = cntlim;
+        cntlimdur = 0; // not yet, pending support in estdur()
+      }
+      cntlimdist = min(cntlimdist,Distcnt-1);
+      cntlimdur = min(cntlimdur,Durcnt-1);
 
-      // for each #stops between dep-via-arr.
-      // e.g. trip dep-a-b-via-c-arr has 2 stops before and 1 after via
+      // subpass 2: create distance and time top-n lists, derive threshold
+      altcnt = 0;
+      durcnt = distcnt = 0;
       for (midstop1 = 0; midstop1 < nstop; midstop1++) {
+
+        if (altcnt > altlimit) break;
+
         midstop2 = nstop1 - midstop1;
+        nleg1 = midstop1 + 1;
+        nleg2 = midstop2 + 1;
 
         cnts1 = net->concnt[midstop1];
         cnts2 = net->concnt[midstop2];
+        conrow1 = net->conrow[midstop1];
+        conarr1 = net->conarr[midstop1];
+
+        lstblk1 = net->conlst + midstop1;
+        lstblk2 = net->conlst + midstop2;
 
-        // for each via
-        // first obtain distance range
-        dmidcnt = dmidcnts[midstop1];
-        for (dmid = 0; dmid < dmidcnt; dmid++) {
-          mid = dmids[midstop1 * portcnt + dmid];
-          if (mid == arr) continue;
+        conlst1 = blkdata(lstblk1,0,ub4);
+        conlst2 = blkdata(lstblk2,0,ub4);
 
-          depmid = dep * portcnt + mid;
+        conofs1 = net->conofs[midstop1];
+        conofs2 = net->conofs[midstop2];
+
+        for (depmid = conrow1[dep]; depmid < conrow1[dep + 1]; depmid++) {
+          mid = conarr1[depmid];
+          if (mid == dep || mid == arr) continue;
 
           n1 = cnts1[depmid];
-          error_z(n1,mid);
+          if (n1 == 0) continue;
 
-          midarr = mid * portcnt + arr;
+          midarr = conpair(net,midstop2,mid,arr);
+          if (midarr == hi32) continue;
           n2 = cnts2[midarr];
           if (n2 == 0) continue;
-
-          error_ovf(n1,ub2);
-          error_ovf(n2,ub2);
-
           n12 = n1 * n2;
-          if (n12 > var12limit) { cntstats[7]++; n12 = var12limit; }
-          cnt += n12;
-          cntlim = min(cnt,varlimit);
-        } // each mid stopover port
-      } // each midpoint in stop list dep-a-b-arr
-
-      if (cnt) {  // store info
-        lstlen += cntlim;
-        concnt[deparr] = (ub2)cntlim;
-        outcnt++;
-      }
-
-      // limits precomputed from file
-//      if (distlims[deparr]) continue;
-
-      // todo: start with limits derived from previous nstop
-      // e.g. lodists[da] * 2
-
-      // if too many options, sort on distance.
-      if (cnt > varlimit) {
-        cntstats[8]++;
-        if (nstop == 1) cntlimdist = cntlimdur = cntlim / 2;
-        else {
-          cntlimdist = cntlim;
-          cntlimdur = 0; // not yet, pending support in estdur()
-        }
-        cntlimdist = min(cntlimdist,Distcnt-1);
-        cntlimdur = min(cntlimdur,Durcnt-1);
-
-        // subpass 2: create distance and time top-n lists, derive threshold
-        altcnt = 0;
-        durcnt = distcnt = 0;
-        for (midstop1 = 0; midstop1 < nstop; midstop1++) {
-
+          altcnt += n12;
           if (altcnt > altlimit) break;
 
-          midstop2 = nstop1 - midstop1;
-          nleg1 = midstop1 + 1;
-          nleg2 = midstop2 + 1;
-
-          cnts1 = net->concnt[midstop1];
-          cnts2 = net->concnt[midstop2];
-
-          lstblk1 = net->conlst + midstop1;
-          lstblk2 = net->conlst + midstop2;
-
-          conlst1 = blkdata(lstblk1,0,ub4);
-          conlst2 = blkdata(lstblk2,0,ub4);
-
-          conofs1 = net->conofs[midstop1];
-          conofs2 = net->conofs[midstop2];
+          ofs1 = conofs1[depmid];
+          ofs2 = conofs2[midarr];
+          error_eq(ofs1,hi32);
+          error_eq(ofs2,hi32);
 
-          for (mid = 0; mid < portcnt; mid++) {
-            if (mid == dep || mid == arr) continue;
-            depmid = dep * portcnt + mid;
+          lst1 = conlst1 + ofs1 * nleg1;
+          lst2 = conlst2 + ofs2 * nleg2;
 
-            n1 = cnts1[depmid];
-            if (n1 == 0) continue;
+          bound(lstblk1,ofs1 * nleg1,ub4);
+          bound(lstblk2,ofs2 * nleg2,ub4);
 
-            midarr = mid * portcnt + arr;
-            n2 = cnts2[midarr];
-            if (n2 == 0) continue;
-            n12 = n1 * n2;
-            altcnt += n12;
-            if (altcnt > altlimit) break;
+          // each dep-via alternative, except dep-*-arr-*-via
+          for (v1 = 0; v1 < n1; v1++) {
+            dist1 = walkdist1 = sumwalkdist1 = 0;
+            lst11 = lst1 + v1 * nleg1;
 
-            ofs1 = conofs1[depmid];
-            ofs2 = conofs2[midarr];
-            error_eq(ofs1,hi32);
-            error_eq(ofs2,hi32);
+            dupcode = 0;
+            for (leg1 = 0; leg1 < nleg1; leg1++) {
+              leg = lst11[leg1];
+              error_ge(leg,whopcnt);
+              dist1 += hopdist[leg];
+              if (leg >= chopcnt) {
+                walkdist1 += hopdist[leg];
+                sumwalkdist1 += hopdist[leg];
+              } else walkdist1 = 0;
+              if (nstop > 3) {
+                trip1ports[leg1 * 2] = portsbyhop[leg * 2];
+                trip1ports[leg1 * 2 + 1] = portsbyhop[leg * 2 + 1];
+              }
+              if (midstop1) dupcode |= (portsbyhop[leg * 2] == arr || portsbyhop[leg * 2 + 1] == arr);
+            }
 
-            lst1 = conlst1 + ofs1 * nleg1;
-            lst2 = conlst2 + ofs2 * nleg2;
+            if (dupcode) continue;
+            if (walkdist1 > walklimit || sumwalkdist1 > sumwalklimit) continue;
 
-            bound(lstblk1,ofs1 * nleg1,ub4);
-            bound(lstblk2,ofs2 * nleg2,ub4);
+            if (durlim != hi32) {
+              midur = prepestdur(net,lst11,nleg1);
+              if ((distlim != hi32 && dist1 > distlim) && midur > durlim) { cntstats[1]++; continue; }
+            } else if (distlim != hi32 && dist1 > distlim) { cntstats[1]++; continue; }
+            else midur = hi32;
+            if (distlim != hi32 && dist1 > distlim * 10) continue;
+//            checktrip(net,lst11,nleg1,dep,mid,dist1);
 
-            // each dep-via alternative, except dep-*-arr-*-via
-            for (v1 = 0; v1 < n1; v1++) {
-              dist1 = walkdist1 = sumwalkdist1 = 0;
-              lst11 = lst1 + v1 * nleg1;
-
-              dupcode = 0;
-              for (leg1 = 0; leg1 < nleg1; leg1++) {
-                leg = lst11[leg1];
-                error_ge(leg,whopcnt);
-                dist1 += hopdist[leg];
-                if (leg >= chopcnt) {
-                  walkdist1 += hopdist[leg];
-                  sumwalkdist1 += hopdist[leg];
-                } else walkdist1 = 0;
-                if (nstop > 3) {
-                  trip1ports[leg1 * 2] = portsbyhop[leg * 2];
-                  trip1ports[leg1 * 2 + 1] = portsbyhop[leg * 2 + 1];
-                }
-                if (midstop1) dupcode |= (portsbyhop[leg * 2] == arr || portsbyhop[leg * 2 + 1] == arr);
-              }
-
-              if (dupcode) continue;
-              if (walkdist1 > walklimit || sumwalkdist1 > sumwalklimit) continue;
-
-              if (durlim != hi32) {
-                midur = prepestdur(net,lst11,nleg1);
-                if ((distlim != hi32 && dist1 > distlim) && midur > durlim) { cntstats[1]++; continue; }
-              } else if (distlim != hi32 && dist1 > distlim) { cntstats[1]++; continue; }
-              else midur = hi32;
-              if (distlim != hi32 && dist1 > distlim * 10) continue;
-//              checktrip(net,lst11,nleg1,dep,mid,dist1);
-
-              for (v2 = 0; v2 < n2; v2++) {
-                dist2 = dist1;
-                lst22 = lst2 + v2 * nleg2;
-
-                dupcode = 0;
-                walkdist2 = walkdist1;
-                sumwalkdist2 = sumwalkdist1;
-                for (leg2 = 0; leg2 < nleg2; leg2++) {
-                  leg = lst22[leg2];
-//                  error_ge(leg,whopcnt);
-                  dist2 += hopdist[leg];
-                  if (leg >= chopcnt) {
-                    walkdist2 += hopdist[leg];
-                    sumwalkdist2 += hopdist[leg];
-                  } else walkdist2 = 0;
-                  dur = hopdur[leg];
-                  if (dur != hi32 && midur != hi32) midur += dur;
-//                  else info(Iter,"hop %u %s to %s no dur",leg,dname,aname);
-                  if (nstop > 3) {
-                    trip2ports[leg2 * 2] = portsbyhop[leg * 2];
-                    trip2ports[leg2 * 2 + 1] = portsbyhop[leg * 2 + 1];
-                  }
-                  if (midstop2) dupcode |= (portsbyhop[leg * 2] == dep || portsbyhop[leg * 2 + 1] == dep);
-                }
-                if ((distlim != hi32 && dist2 > distlim) && (durlim != hi32 && midur > durlim)) { cntstats[2]++; continue; }
-                else if (distlim != hi32 && dist2 > distlim * 15) continue;
-                if (walkdist2 > walklimit || sumwalkdist2 > sumwalklimit) continue;
-
-                if (dupcode) continue;
-
-                if (cntlimdur) midur = estdur(net,lst11,nleg1,lst22,nleg2);
-
-//                checktrip(lst22,nleg2,mid,arr,dist2);
-
-                // filter out repeated 'B' visits in dep-*-B-*-via-*-B-*-arr
-                if (nstop > 3) {
-                  for (legport1 = 0; legport1 < nleg1 * 2; legport1++) {
-                    iport1 = trip1ports[legport1];
-                    for (legport2 = 1; legport2 < nleg2 * 2; legport2++) {
-                      iport2 = trip2ports[legport2];
-                      if (iport1 == iport2) { dupcode = 7; break; }
-                    }
-                    if (dupcode) break;
-                  }
-                  if (dupcode) {
-                    dupstats[2]++;
-                    continue;
-                  }
-                }
-
-                // maintain top-n list, discard actual trip here
-
-                if (distcnt == 0) {
-                  dists[0] = dist2;
-                  distcnt = 1;
-                } else if (distcnt < cntlimdist) {
-                  dists[distcnt++] = dist2;
-                } else {
-                  hidist = hindx = 0;
-                  for (distndx = 0; distndx < cntlimdist; distndx++) {
-                    if (dists[distndx] > hidist) { hidist = dists[distndx]; hindx = distndx; }
-                  }
-                  if (dist2 < hidist) dists[hindx] = dist2;
-                  distlim = hidist;
-                  error_eq(distlim,hi32);
-                }
-
-                // idem for time: insertion sort
-                if (midur == hi32 || cntlimdur == 0) continue;
-
-                if (durcnt == 0) {
-                  midurs[0] = midur;
-                  durcnt = 1;
-                } else if (durcnt < cntlimdur) {
-                  midurs[durcnt++] = midur;
-                } else {
-                  hidur = hindx = 0;
-                  for (durndx = 0; durndx < cntlimdur; durndx++) {
-                    if (midurs[durndx] > hidur) { hidur = midurs[durndx]; hindx = durndx; }
-                  }
-                  if (midur < hidur) midurs[hindx] = midur;
-                  durlim = hidur;
-                  error_eq(durlim,hi32);
-                }
-
-              } // each v2
-            } // each v1
-
-          } // each mid
-
-        } // each midpoint
-
-        if (distcnt < cntlimdist) stat_partlimdist++;
-        if (cntlimdur && durcnt < cntlimdur) stat_partlimdur++;
-        stat_cntlim++;
-      } else {   // not cnt limited
-        distlim = hi32;
-        durlim = hi32;
-      }
-      distlims[deparr] = distlim;
-      durlims[deparr] = durlim;
-
-    } // each arrival port
-    portdst[dep] = outcnt;
-
-  } // each departure port
-
-  for (iv = 0; iv < Elemcnt(dupstats); iv++) if (dupstats[iv]) info(0,"dup %u: \ah%lu",iv,dupstats[iv]);
-  for (iv = 0; iv < Elemcnt(cntstats); iv++) if (cntstats[iv]) info(0,"cnt %u: \ah%u",iv,cntstats[iv]);
-
-  info(0,"%u-stop pass 1 done, tentative \ah%lu triplets",nstop,lstlen);
-
-  warncc(lstlen == 0 && nilonly == 0,0,"no connections at %u-stop",nstop);
-  if (lstlen == 0) return 0;
-
-  ub4 cnt1,newcnt;
-  struct range portdr;
-  ub4 ivportdst[32];
-  mkhist(caller,portdst,portcnt,&portdr,Elemcnt(ivportdst),ivportdst,"outbounds by port",Vrb);
-
-#if 0
-  fmtstring(cachefile,"cache/net_%u_part_%u_distlim",nstop,part);
-  fd = filecreate(cachefile,0);
-  if (fd != -1) {
-    filewrite(fd,distlims,port2 * sizeof(*distlims),cachefile);
-    fileclose(fd,cachefile);
-  }
-#endif
-
-  // prepare list matrix and its offsets
-  conofs = alloc(port2, ub4,0xff,"net conofs",portcnt);  // = org
-
-  lstblk = net->conlst + nstop;
-
-  lst = mkblock(lstblk,lstlen * nleg,ub4,Init1,"netv %u-stop conlst",nstop);
-
-  cnts1 = net->concnt[nstop1];
-  ofs = newcnt = 0;
-  for (deparr = 0; deparr < port2; deparr++) {
-    cnt = concnt[deparr];
-    cnt1 = cnts1[deparr];
-    if (cnt) {
-      conofs[deparr] = ofs;
-      ofs += cnt;
-      if (cnt1 == 0) newcnt++;
-    }
-  }
-  error_ne(ofs,lstlen);
-  info(0,"\ah%u new connections",newcnt);
-
-  aclear(dupstats);
-
-  // pass 2: fill based on range and thresholds determined above
-  // most code comments from pass 1 apply
-  ofs = 0;
-  for (dep = 0; dep < portcnt; dep++) {
-
-    if (progress(&eta,"port %u of %u in pass 2 %u-stop net",dep,portcnt,nstop)) return 1;
-
-    if (dep > portlimit) continue;
-
-    pdep = ports + dep;
-
-    dname = pdep->name;
-
-    for (midstop1 = 0; midstop1 < nstop; midstop1++) {
-      cnts1 = net->concnt[midstop1];
-
-      dmid = 0;
-      for (mid = 0; mid < portcnt; mid++) {
-        if (mid == dep) continue;
-        pmid = ports + mid;
-        if (pmid->valid == 0) continue;
-
-        depmid = dep * portcnt + mid;
-
-        n1 = cnts1[depmid];
-        if (n1 == 0) continue;
-
-        if (pmid->oneroute) continue;
-
-        dmids[midstop1 * portcnt + dmid++] = mid;
-      }
-      dmidcnts[midstop1] = dmid;
-    }
-
-    for (arr = 0; arr < portcnt; arr++) {
-      if (arr == dep) continue;
-      deparr = dep * portcnt + arr;
-
-      cnt = concnt[deparr];
-      if (cnt == 0) continue;
-      gen = concnt[deparr] = 0;
-
-      dbg = (part == 0 && dep == 1068 && arr == 0);
-
-      distlim = distlims[deparr];
-      durlim = durlims[deparr];
-
-//      if (distlim != hi32 || durlim != hi32) info(0,"distlim %u durlim %u",distlim,durlim);
-
-      conofs[deparr] = ofs;
-      lstv1 = lst + ofs * nleg;
-      error_ge(ofs,lstlen);
-
-      endofs = ofs + cnt - 1;
-
-      error_ge(endofs,lstlen);
-
-      infocc(dbg,0,"port %u-%u concnt %u",dep,arr,gen);
-
-      midstop1 = 0;
-      while (midstop1 < nstop && gen < cnt) {
-        midstop2 = nstop1 - midstop1;
-        nleg1 = midstop1 + 1;
-        nleg2 = midstop2 + 1;
-
-        cnts1 = net->concnt[midstop1];
-        cnts2 = net->concnt[midstop2];
-
-        lstblk1 = net->conlst + midstop1;
-        lstblk2 = net->conlst + midstop2;
-
-        conlst1 = blkdata(lstblk1,0,ub4);
-        conlst2 = blkdata(lstblk2,0,ub4);
-
-        dmidcnt = dmidcnts[midstop1];
-        dmid = 0; firstmid = hi32;
-        while (dmid < dmidcnt && gen < cnt) {
-          mid = dmids[midstop1 * nstop + dmid++];
-          if (mid == arr) continue;
-
-          depmid = dep * portcnt + mid;
-          n1 = cnts1[depmid];
-
-          midarr = mid * portcnt + arr;
-          n2 = cnts2[midarr];
-          if (n2 == 0) continue;
-
-          if (firstmid == hi32) firstmid = mid;
-
-          conofs1 = net->conofs[midstop1];
-          conofs2 = net->conofs[midstop2];
-
-          ofs1 = conofs1[depmid];
-          ofs2 = conofs2[midarr];
-          lst1 = conlst1 + ofs1 * nleg1;
-          lst2 = conlst2 + ofs2 * nleg2;
-
-          bound(lstblk1,ofs1 * nleg1,ub4);
-          bound(lstblk2,ofs2 * nleg2,ub4);
-
-          v1 = 0;
-          while (v1 < n1 && gen < cnt) {
-            dist1 = walkdist1 = sumwalkdist1 = 0;
-            lst11 = lst1 + v1 * nleg1;
-
-            dupcode = 0;
-            for (leg1 = 0; leg1 < nleg1; leg1++) {
-              leg = lst11[leg1];
-              error_ge(leg,whopcnt);
-              dist1 += hopdist[leg];
-              if (leg >= chopcnt) {
-                walkdist1 += hopdist[leg];
-                sumwalkdist1 += hopdist[leg];
-              } else walklimit = 0;
-              if (nstop > 3) {
-                trip1ports[leg1 * 2] = portsbyhop[leg * 2];
-                trip1ports[leg1 * 2 + 1] = portsbyhop[leg * 2 + 1];
-              }
-              if (midstop1) dupcode |= (portsbyhop[leg * 2] == arr || portsbyhop[leg * 2 + 1] == arr);
-            }
-            if (dupcode) { v1++; continue; }
-            if (walkdist1 > walklimit || sumwalkdist1 > sumwalklimit) { v1++; continue; }
-
-            if (durlim != hi32) {
-              midur = prepestdur(net,lst11,nleg1);
-              if ((distlim != hi32 && dist1 > distlim) && midur > durlim) { v1++; continue; }
-            } else if (distlim != hi32 && dist1 > distlim) { v1++; continue; }
-            else midur = hi32;
-            if (distlim != hi32 && dist1 > distlim * 10) { v1++; continue; }
-
-            if (nstop > 3) {
-              error_ne(trip1ports[0],dep);
-              error_eq(trip1ports[0],mid);
-              error_eq(trip1ports[0],arr);
-              error_eq(trip1ports[midstop1 * 2 + 1],dep);
-              error_ne(trip1ports[nleg1 * 2 - 1],mid);
-              error_eq(trip1ports[nleg1 * 2 - 1],arr);
-            }
-//            checktrip(net,lst11,nleg1,dep,mid,dist1);
-
-            v2 = 0;
-            while (v2 < n2 && gen < cnt) {
-              dist2 = dist1;
-              lst22 = lst2 + v2 * nleg2;
+            for (v2 = 0; v2 < n2; v2++) {
+              dist2 = dist1;
+              lst22 = lst2 + v2 * nleg2;
 
               dupcode = 0;
               walkdist2 = walkdist1;
               sumwalkdist2 = sumwalkdist1;
               for (leg2 = 0; leg2 < nleg2; leg2++) {
                 leg = lst22[leg2];
-                error_ge(leg,whopcnt);
+//                error_ge(leg,whopcnt);
                 dist2 += hopdist[leg];
                 if (leg >= chopcnt) {
                   walkdist2 += hopdist[leg];
@@ -700,28 +943,24 @@ int mknetn(struct network *net,ub4 nstop,ub4 varlimit,ub4 var12limit,bool nilonl
                 } else walkdist2 = 0;
                 dur = hopdur[leg];
                 if (dur != hi32 && midur != hi32) midur += dur;
+//                else info(Iter,"hop %u %s to %s no dur",leg,dname,aname);
                 if (nstop > 3) {
                   trip2ports[leg2 * 2] = portsbyhop[leg * 2];
                   trip2ports[leg2 * 2 + 1] = portsbyhop[leg * 2 + 1];
                 }
                 if (midstop2) dupcode |= (portsbyhop[leg * 2] == dep || portsbyhop[leg * 2 + 1] == dep);
               }
-              if (dupcode) { v2++; continue; }
+              if ((distlim != hi32 && dist2 > distlim) && (durlim != hi32 && midur > durlim)) { cntstats[2]++; continue; }
+              else if (distlim != hi32 && dist2 > distlim * 15) continue;
+              if (walkdist2 > walklimit || sumwalkdist2 > sumwalklimit) continue;
 
-              if ((distlim != hi32 && dist2 > distlim) && (durlim != hi32 && midur > durlim)) { v2++; continue; }
+              if (dupcode) continue;
 
-              if (walkdist2 > walklimit || sumwalkdist2 > sumwalklimit) { v2++; continue; }
+              if (cntlimdur) midur = estdur(net,lst11,nleg1,lst22,nleg2);
 
-              if (nstop > 3) {
-                error_ne(trip2ports[0],mid);
-                error_eq(trip2ports[0],dep);
-                error_eq(trip2ports[0],arr);
-                error_ne(trip2ports[nleg2 * 2 - 1],arr);
-                error_eq(trip2ports[nleg2 * 2 - 1],dep);
-                error_eq(trip2ports[nleg2 * 2 - 1],mid);
-              }
+//              checktrip(lst22,nleg2,mid,arr,dist2);
 
-              // filter out repeated visits a-B-c-d-B-f
+              // filter out repeated 'B' visits in dep-*-B-*-via-*-B-*-arr
               if (nstop > 3) {
                 for (legport1 = 0; legport1 < nleg1 * 2; legport1++) {
                   iport1 = trip1ports[legport1];
@@ -732,450 +971,11 @@ int mknetn(struct network *net,ub4 nstop,ub4 varlimit,ub4 var12limit,bool nilonl
                   if (dupcode) break;
                 }
                 if (dupcode) {
-                  v2++;
+                  dupstats[2]++;
                   continue;
                 }
               }
 
-//              checktrip(lst22,nleg2,mid,arr,dist2);
-
-              if (durlim != hi32) {
-                midur = estdur(net,lst11,nleg1,lst22,nleg2);
-                if ((distlim != hi32 && dist2 > distlim) && midur > durlim) { v2++; continue; }
-              } else if (distlim != hi32 && dist2 > distlim) { v2++; continue; }
-              if (distlim != hi32 && dist2 > distlim * 15) { v2++; continue; }
-
-              lodists[deparr] = min(lodists[deparr],dist2);
-              allcnt[deparr] = 1;
-              gen++;
-
-              for (leg1 = 0; leg1 < nleg1; leg1++) {
-                leg = lst11[leg1];
-//                error_ge(leg,whopcnt);
-                lstv1[leg1] = leg;
-              }
-//                memcpy(lstv1,lst11,nleg1 * sizeof(ub4));
-//                vrb(CC,"dep %u arr %u mid %u \av%u%p base %p n1 %u n2 %u",dep,arr,mid,nleg,lstv1,lst,n1,n2);
-//                checktrip(lstv1,nleg1,dep,mid,dist1);
-              lstv2 = lstv1 + nleg1;
-              for (leg2 = 0; leg2 < nleg2; leg2++) {
-                leg = lst22[leg2];
-//                error_ge(leg,whopcnt);
-                lstv2[leg2] = leg;
-              }
-//                memcpy(lstv2,lst22,nleg2 * sizeof(ub4));
-//                vrb(CC,"dep %u arr %u mid %u \av%u%p base %p n1 %u n2 %u",dep,arr,mid,nleg,lstv1,lst,n1,n2);
-//                checktrip3(lstv1,nleg,dep,arr,mid,dist12);
-
-              lstv1 = lstv2 + nleg2;
-
-              v2++;
-            }
-            v1++;
-          }
-          mid++;
-        } // each mid
-
-        if (gen < cnt) stat_partcnt++;
-
-        // if none found for any dep-Mid-arr, but mid exists, use first one
-        if (cnt && gen == 0 && firstmid != hi32) {
-          stat_nocon++;
-          vrbcc(vrbena,0,"dep %u arr %u no conn for mid %u cnt %u distlim %u",dep,arr,firstmid,cnt,distlim);
-          depmid = dep * portcnt + firstmid;
-          midarr = firstmid * portcnt + arr;
-
-          error_z(cnts1[depmid],firstmid);
-          error_z(cnts2[midarr],firstmid);
-
-          conofs1 = net->conofs[midstop1];
-          conofs2 = net->conofs[midstop2];
-
-          ofs1 = conofs1[depmid];
-          ofs2 = conofs2[midarr];
-          lst1 = conlst1 + ofs1 * nleg1;
-          lst2 = conlst2 + ofs2 * nleg2;
-
-          dist2 = 0;
-          for (leg1 = 0; leg1 < nleg1; leg1++) {
-            leg = lst1[leg1];
-            error_ge(leg,whopcnt);
-            dist2 += hopdist[leg];
-            lstv1[leg1] = leg;
-          }
-          lstv2 = lstv1 + nleg1;
-          for (leg2 = 0; leg2 < nleg2; leg2++) {
-            leg = lst2[leg2];
-            error_ge(leg,whopcnt);
-            dist2 += hopdist[leg];
-            lstv2[leg2] = leg;
-          }
-          lstv1 = lstv2 + nleg2;
-          lodists[deparr] = min(lodists[deparr],dist2);
-          gen = 1;
-          allcnt[deparr] = 1;
-        }
-
-        midstop1++;
-      } // each mid stopover port
-
-      error_gt(gen,cnt,arr);
-      warncc(cnt && gen == 0,Iter,"dep %u arr %u no conn distlim %u durlim %u",dep,arr,distlim,durlim);
-
-      ofs += gen;
-      concnt[deparr] = (ub2)gen;
-      infocc(dbg,0,"port %u-%u concnt %u",dep,arr,gen);
-    } // each arrival port
-  } // each departure port
-  newlstlen = ofs;
-  error_gt(newlstlen,lstlen,nstop);
-  info(0,"pass 2 done, \ah%lu from \ah%lu triplets",newlstlen,lstlen);
-
-  afree(distlims,"net distlims");
-
-  if (lstlen - newlstlen > 1024 * 1024 * 64) {
-    newlst = trimblock(lstblk,newlstlen * nleg,ub4);
-  } else newlst = lst;
-
-  net->lstlen[nstop] = newlstlen;
-  for (ofs = 0; ofs < newlstlen * nleg; ofs++) {
-    leg = newlst[ofs];
-    error_ge(leg,whopcnt);
-  }
-
-  for (iv = 0; iv < Elemcnt(dupstats); iv++) if (dupstats[iv]) info(0,"dup %u: \ah%lu",iv,dupstats[iv]);
-
-  info(0,"no conn %u  partcnt %u  cntlim %u %u %u",stat_nocon,stat_partcnt,stat_cntlim,stat_partlimdist,stat_partlimdur);
-
-  struct range conrange;
-  ub4 constats[16];
-
-  aclear(constats);
-  mkhist2(concnt,port2,&conrange,Elemcnt(constats),constats,"connection",Info);
-
-  net->concnt[nstop] = concnt;
-  net->conofs[nstop] = conofs;
-
-  net->lodist[nstop] = lodists;
-
-  net->lstlen[nstop] = lstlen;
-
-  return 0;
-}
-
-// create 1-stop connectivity matrix and derived info
-// uses 1 mid, varying use of underlying nets by stop position
-int mknet1(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly)
-{
-  ub4 part = net->part;
-  ub4 partcnt = net->partcnt;
-  ub4 nstop = 1;
-  ub4 portcnt = net->portcnt;
-  ub4 hopcnt = net->hopcnt;
-  ub4 chopcnt = net->chopcnt;
-  ub4 whopcnt = net->whopcnt;
-  struct port *ports,*pmid,*pdep,*parr;
-  char *dname,*aname;
-  block *lstblk,*lstblk1;
-  ub4 *portsbyhop;
-  ub2 *cnts,*cnts1;
-  ub4 *portdst;
-  ub4 ofs,ofs1,ofs2,endofs,*conofs,*conofs1;
-  ub4 *lst,*newlst,*conlst1,*lst1,*lst11,*lst2,*lst22,*lstv1;
-  ub4 *hopdist;
-  ub4 dep,mid,arr,firstmid,port2,depmid,midarr,deparr;
-  ub4 iv;
-  ub4 cnt,n1,n2,n12,altcnt,v1,v2,leg,leg1,leg2,nleg;
-  size_t lstlen,newlstlen;
-  ub4 *lodists;
-  ub4 dist1,dist2,distlim,sumwalkdist1,sumwalkdist2,walkdist1,walkdist2;
-  ub4 cntlim,cntlimdist,cntlimdur,gen,outcnt;
-  ub4 midur,durndx,durcnt,durlim,distcnt,distndx;
-  ub4 *hopdur;
-  ub4 midurs[Durcnt];
-  ub4 dists[Distcnt];
-  ub4 walklimit = net->walklimit;
-  ub4 sumwalklimit = net->sumwalklimit;
-  ub4 stat_nocon = 0,stat_partcnt = 0,stat_cntlim = 0,stat_partlimdur = 0,stat_partlimdist = 0;
-  ub4 stat_altlim = 0,stat_oneroute = 0,stat_var12limit = 0;
-
-  // todo
-  ub4 portlimit = 50000;
-  ub4 lstlimit = 1024 * 1024 * 2024;
-  ub4 altlimit = min(var12limit * 8,256);
-
-  ub4 trip1ports[Nleg * 2];
-  ub4 trip2ports[Nleg * 2];
-
-  struct eta eta;
-
-  error_zz(portcnt,hopcnt);
-
-  info(0,"init 1-stop connections for %u port \ah%u hop network",portcnt,whopcnt);
-
-  info(0,"limits: var %u var12 %u alt %u port %u lst \ah%u",varlimit,var12limit,altlimit,portlimit,lstlimit);
-
-  port2 = portcnt * portcnt;
-
-  ports = net->ports;
-
-  portsbyhop = net->portsbyhop;
-
-  ub1 *allcnt = net->allcnt;
-
-  cnts = alloc(port2, ub2,0,"net concnt",portcnt);
-  if (partcnt > 1) lodists = alloc(port2, ub4,0xff,"net lodist",portcnt);
-  else lodists = NULL;
-
-  ub4 *distlims = alloc(port2, ub4,0,"net distlims",portcnt);
-  ub2 *durlims = alloc(port2, ub2,0,"net durlims",portcnt);
-
-  portdst = alloc(portcnt, ub4,0,"net portdst",portcnt);
-
-  hopdist = net->hopdist;
-  hopdur = net->hopdur;
-
-  error_zp(hopdist,0);
-
-  nleg = 2;
-
-  memset(trip1ports,0xff,sizeof(trip1ports));
-  memset(trip2ports,0xff,sizeof(trip1ports));
-
-/* Essentially we do for each (departure,arrival) pair:
-   Search for a 'via' port such that trip (departure,via) and (via,arrival) exist
-   Trim list of alternatives based on e.g. distance
-   Store result by value. This is memory-intensive but keeps code simple
-
-   In short: foreach dep  foreach arr foreach mid with n1[dep,mid] with n2 [mid,arr]
-*/
-
-/*
-  pass 1 : foreach (dep,arr) pair at this #stops:
-  bound overall best and worst
-  currently, cost is distance only
-  create histogram and derive threshold to use as filter in next pass
-  estimate size of trip list matrix
-  obtain basic stats
-*/
-
-  ub8 dupstats[16];
-
-  lstlen = 0;
-
-  aclear(dupstats);
-
-  ub4 dmid,dmidcnt,*dmids = alloc(portcnt,ub4,0,"net vias",portcnt);
-  ub4 *drdeps,*drarrs,*mrdeps,*mrarrs;
-  char *mname;
-  int fd;
-  int dbg = 0,limited = 0;
-  ub4 hindx,hidur,hidist;
-  char cachefile[256];
-
-  fmtstring(cachefile,"cache/net_1_part_%u_distlim.in",part);
-  fd = fileopen(cachefile,0);
-  if (fd != -1) {
-    fileread(fd,distlims,port2 * (ub4)sizeof(*distlims),cachefile);
-    fileclose(fd,cachefile);
-    info(0,"using dist limit cache file %s",cachefile);
-  }
-
-  cnts1 = net->concnt[0];
-  lstblk1 = net->conlst;
-  conlst1 = blkdata(lstblk1,0,ub4);
-  conofs1 = net->conofs[0];
-
-  ub4 dmidbins[256];
-  ub4 dmidivs = Elemcnt(dmidbins) - 1;;
-
-  aclear(dmidbins);
-
-  // for each departure port
-  for (dep = 0; dep < portcnt; dep++) {
-
-    if (progress(&eta,"pass 1 port %u/%u 1-stop net \ah%lu conns",dep,portcnt,lstlen)) return 1;
-
-    if (dep > portlimit) {
-      warning(0,"limiting net by %u ports",portlimit);
-      break;
-    }
-
-    pdep = ports + dep;
-    if (pdep->valid == 0) continue;
-
-    if (lstlen + 2 * portcnt > lstlimit / nleg) {
-      warncc(limited == 0,0,"limiting net by \ah%u triplets",lstlimit / nleg);
-      limited = 1;
-      var12limit = varlimit = 2;
-    }
-
-    // prepare eligible via's
-    dname = pdep->name;
-    drdeps = pdep->drids;
-
-    dmid = 0;
-    for (mid = 0; mid < portcnt; mid++) {
-      if (mid == dep) continue;
-      pmid = ports + mid;
-      if (pmid->valid == 0) continue;
-
-      depmid = dep * portcnt + mid;
-
-      n1 = cnts1[depmid];
-      if (n1 == 0) continue;
-
-      // todo: skip vias only on same route
-      mname = pmid->name;
-      mrdeps = pmid->drids;
-      mrarrs = pmid->arids;
-
-      if (pmid->oneroute) {
-        vrb0(0,"skip %u-%u-x on same oneway route %x %s to %s",dep,mid,drdeps[0],dname,mname);
-        stat_oneroute++;
-        continue;
-      }
-
-      dmids[dmid++] = mid;
-    }
-    dmidcnt = dmid;
-    dmidbins[min(dmidcnt,dmidivs)]++;
-
-    outcnt = 0;
-
-    // for each arrival port
-    for (arr = 0; arr < portcnt; arr++) {
-      if (arr == dep) continue;
-
-      deparr = dep * portcnt + arr;
-
-      if (nilonly && allcnt[deparr]) continue;
-
-      parr = ports + arr;
-      if (parr->valid == 0) continue;
-
-      aname = parr->name;
-
-      cnt = cntlim = 0;
-      durlim = distlim = hi32;
-
-      // for each via
-      // first obtain distance range
-      for (dmid = 0; dmid < dmidcnt; dmid++) {
-        mid = dmids[dmid];
-        if (mid == arr) continue;
-
-        depmid = dep * portcnt + mid;
-
-        n1 = cnts1[depmid];
-        error_z(n1,mid);
-
-        midarr = mid * portcnt + arr;
-        n2 = cnts1[midarr];
-        if (n2 == 0) continue;
-
-        error_ovf(n1,ub2);
-        error_ovf(n2,ub2);
-
-        n12 = n1 * n2;
-        if (n12 > var12limit) { n12 = var12limit; stat_var12limit++; }
-        cnt += n12;
-        cntlim = min(cnt,varlimit);
-      } // each mid stopover port
-
-      if (cnt) {  // store info
-        lstlen += cntlim;
-        cnts[deparr] = (ub2)cntlim;
-        outcnt++;
-      }
-
-      // limits precomputed from file
-//      if (distlims[deparr]) continue;
-
-      // todo: start with limits derived from previous nstop
-      // e.g. lodists[da] * 2
-
-      // if too many options, sort on distance.
-      if (cnt > varlimit) {
-//        info(0,"cnt %u varlimit %u cntlim %u",cnt,varlimit,cntlim);
-        cntlimdist = max(cntlim / 4,1);
-        cntlimdur = max(cntlim * 3 / 4,1);
-        cntlimdist = min(cntlimdist,Distcnt-1);
-        cntlimdur = min(cntlimdur,Durcnt-1);
-
-        error_z(cntlimdist,cntlim);
-        error_z(cntlimdur,cntlim);
-
-        nsethi(dists,Distcnt);
-        nsethi(midurs,Durcnt);
-
-        // subpass 2: create distance and time top-n lists, derive threshold
-        altcnt = 0;
-        durcnt = distcnt = 0;
-
-        if (altcnt > altlimit) { stat_altlim++; break; }
-
-        for (mid = 0; mid < portcnt; mid++) {
-          if (mid == dep || mid == arr) continue;
-          depmid = dep * portcnt + mid;
-
-          n1 = cnts1[depmid];
-          if (n1 == 0) continue;
-
-          midarr = mid * portcnt + arr;
-          n2 = cnts1[midarr];
-          if (n2 == 0) continue;
-          n12 = n1 * n2;
-          altcnt += n12;
-          if (altcnt > altlimit) break;
-
-          ofs1 = conofs1[depmid];
-          ofs2 = conofs1[midarr];
-          error_eq(ofs1,hi32);
-          error_eq(ofs2,hi32);
-
-          lst1 = conlst1 + ofs1;
-          lst2 = conlst1 + ofs2;
-
-          bound(lstblk1,ofs1,ub4);
-          bound(lstblk1,ofs2,ub4);
-
-          // each dep-via alternative
-          for (v1 = 0; v1 < n1; v1++) {
-            sumwalkdist1 = walkdist1 = 0;
-            lst11 = lst1 + v1;
-
-            leg1 = lst11[0];
-            error_ge(leg1,whopcnt);
-            dist1 = hopdist[leg1];
-            if (leg1 >= chopcnt) sumwalkdist1 = walkdist1 = dist1;
-
-            if (durlim != hi32) {
-              midur = prepestdur(net,lst11,1);
-              if ((distlim != hi32 && dist1 > distlim) && midur > durlim) continue;
-            } else if (distlim != hi32 && dist1 > distlim) continue;
-            else midur = hi32;
-            if (distlim != hi32 && dist1 > distlim * 10) continue;
-
-            for (v2 = 0; v2 < n2; v2++) {
-              dist2 = dist1;
-              lst22 = lst2 + v2;
-
-              sumwalkdist2 = sumwalkdist1;
-              walkdist2 = walkdist1;
-              leg2 = lst22[0];
-              dist2 += hopdist[leg2];
-              if (leg2 >= chopcnt) {
-                walkdist2 += hopdist[leg2];
-                sumwalkdist2 += hopdist[leg2];
-              } else walkdist2 = 0;
-//              dur = hopdur[leg2];
-//              if (dur != hi32 && midur != hi32) midur += dur;
-              if ((distlim != hi32 && dist2 > distlim) && (durlim != hi32 && midur > durlim)) continue;
-              else if (distlim != hi32 && dist2 > distlim * 15) continue;
-
-              if (walkdist2 > walklimit || sumwalkdist2 > sumwalklimit) continue;
-
               // maintain top-n list, discard actual trip here
 
               if (distcnt == 0) {
@@ -1193,941 +993,1330 @@ int mknet1(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly)
                 error_eq(distlim,hi32);
               }
 
-              // idem for time: insertion sort
-              midur = estdur_2(net,leg1,leg2);
-              if (midur == hi32) continue;
-
-              if (durcnt == 0) {
-                midurs[0] = midur;
-                warncc(midur != hi32 && midur > 65534,Exit,"durlim %u at 0 of %u exceeds 64k",midur,cntlimdur);
-                durcnt = 1;
-              } else if (durcnt < cntlimdur) {
-//                infocc(durcnt == 50,Notty,"midur %u at 50",midur);
-                warncc(midur != hi32 && midur > 65534,Exit,"durlim %u at %u of %u exceeds 64k",midur,durcnt,cntlimdur);
-                midurs[durcnt++] = midur;
-              } else {
-                hidur = hindx = 0;
-                for (durndx = 0; durndx < cntlimdur; durndx++) {
-                  if (midurs[durndx] > hidur) { hidur = midurs[durndx]; hindx = durndx; }
-                  warncc(midurs[durndx] != hi32 && midurs[durndx] > 65534,Exit,"durlim %u at %u of %u exceeds 64k",midurs[durndx],durndx,cntlimdur);
-                }
-                if (midur < hidur) midurs[hindx] = midur;
-                durlim = hidur;
-                warncc(durlim != hi32 && durlim > 65534,Exit,"durlim %u at %u exceeds 64k",durlim,cntlimdur);
-                error_eq(durlim,hi32);
-              }
-
-            } // each v2
-          } // each v1
-
-        } // each mid
-
-        if (distcnt < cntlimdist) stat_partlimdist++;
-        if (durcnt < cntlimdur) stat_partlimdur++;
-        stat_cntlim++;
-        warncc(durlim != hi32 && durlim > 65534,Exit,"durlim %u exceeds 64k",durlim);
-      } else {   // not cnt limited
-        distlim = hi32;
-        durlim = hi32;
-      }
-      distlims[deparr] = distlim;
-      durlims[deparr] = (ub2)durlim;
-
-    } // each arrival port
-    portdst[dep] = outcnt;
-
-  } // each departure port
-
-  for (iv = 0; iv < Elemcnt(dupstats); iv++) if (dupstats[iv]) info(0,"dup %u: \ah%lu",iv,dupstats[iv]);
-
-  info(0,"1-stop pass 1 done, tentative \ah%lu triplets",lstlen);
-
-  info(0,"cntlim %u partlim dist %u dur %u altlim %u var12 %u",stat_cntlim,stat_partlimdist,stat_partlimdur,stat_altlim,stat_var12limit);
-  info(0,"oneroute %u",stat_oneroute);
-
-  for (iv = 0; iv <= dmidivs; iv++) if (dmidbins[iv] > 64) info(0,"dmids %u: \ah%u",iv,dmidbins[iv]);
-
-  warncc(lstlen == 0 && nilonly == 0,0,"no connections at 1-stop for %u ports",portcnt);
-  if (lstlen == 0) return 0;
-
-  ub4 cnt1,newcnt,walklimcnt;
-  struct range portdr;
-  ub4 ivportdst[32];
-  mkhist(caller,portdst,portcnt,&portdr,Elemcnt(ivportdst),ivportdst,"outbounds by port",Vrb);
-
-  ub4 genstats[64];
-  ub4 cntstats[64];
-  ub4 geniv = 63;
-
-  aclear(cntstats);
-  aclear(genstats);
-
-#if 0
-  fmtstring(cachefile,"cache/net_1_part_%u_distlim",part);
-  fd = filecreate(cachefile,0);
-  if (fd != -1) {
-    filewrite(fd,distlims,port2 * sizeof(*distlims),cachefile);
-    fileclose(fd,cachefile);
-  }
-#endif
+              // idem for time: insertion sort
+              if (midur == hi32 || cntlimdur == 0) continue;
 
-  // prepare list matrix and its offsets
-  conofs = alloc(port2, ub4,0,"net conofs",portcnt);  // = org
+              if (durcnt == 0) {
+                midurs[0] = midur;
+                durcnt = 1;
+              } else if (durcnt < cntlimdur) {
+                midurs[durcnt++] = midur;
+              } else {
+                hidur = hindx = 0;
+                for (durndx = 0; durndx < cntlimdur; durndx++) {
+                  if (midurs[durndx] > hidur) { hidur = midurs[durndx]; hindx = durndx; }
+                }
+                if (midur < hidur) midurs[hindx] = midur;
+                durlim = hidur;
+                error_eq(durlim,hi32);
+              }
 
-  lstblk = net->conlst + nstop;
+            } // each v2
+          } // each v1
 
-  lst = mkblock(lstblk,lstlen * nleg,ub4,Noinit,"netv %u-stop conlst",nstop);
+        } // each mid
 
-  ofs = newcnt = 0;
+      } // each midpoint
 
-  if (portcnt < 10000) {
-    for (deparr = 0; deparr < port2; deparr++) {
-      cnt = cnts[deparr];
-      cnt1 = cnts1[deparr];
-      if (cnt) {
-        conofs[deparr] = ofs;
-        ofs += cnt;
-        if (cnt1 == 0) newcnt++;
-      }
-    }
-    info(0,"\ah%u new connections",newcnt);
-  } else {
-    for (deparr = 0; deparr < port2; deparr++) {
-      cnt = cnts[deparr];
-      if (cnt) {
-        conofs[deparr] = ofs;
-        ofs += cnt;
-      }
+      if (distcnt < cntlimdist) stats[St_partlimdist]++;
+      if (cntlimdur && durcnt < cntlimdur) stats[St_partlimdur]++;
+      stats[St_cntlim]++;
+    } else {   // not cnt limited
+      distlim = hi32;
+      durlim = hi32;
     }
-  }
-  error_ne(ofs,lstlen);
+    bldadd(wp,arr,cntlim,distlim,durlim);
 
-  aclear(dupstats);
+  } // each arrival port
+  cx->portdst[dep] = outcnt;
+}
 
-  // pass 2: fill based on range and thresholds determined above
-  // most code comments from pass 1 apply
-  ofs = 0;
-  for (dep = 0; dep < portcnt; dep++) {
+// pass 2: fill based on range and thresholds determined above
+// most code comments from pass 1 apply
+static void netnpass2(struct bldwork *wp,ub4 dep)
+{
+  struct bldctx *cx = wp->cx;
+  struct network *net = cx->net;
+  ub4 part = net->part;
+  ub4 nstop = cx->nstop;
+  ub4 portcnt = net->portcnt;
+  ub4 chopcnt = net->chopcnt;
+  ub4 whopcnt = net->whopcnt;
+  struct port *ports = net->ports,*pmid;
+  block *lstblk1,*lstblk2;
+  ub4 *portsbyhop = net->portsbyhop;
+  ub2 *concnt = cx->cnts,*cnts1,*cnts2;
+  ub4 *conrow = cx->conrow,*conarr = cx->conarr,*conrow1,*conarr1,*conrow2;
+  ub4 ofs,ofs1,ofs2,endofs,*conofs = cx->conofs,*conofs1,*conofs2;
+  ub4 *lst = cx->lst,*conlst1,*conlst2,*lst1,*lst11,*lst2,*lst22,*lstv1,*lstv2;
+  ub4 *hopdist = net->hopdist;
+  ub4 *hopdur = net->hopdur;
+  ub4 *lodists = cx->lodists;
+  size_t lstlen = cx->lstlen;
+  ub4 mid,arr,firstmid,firstdm,firstma,pair,depmid,midarr,dmidndx,iport1,iport2;
+  ub4 cnt,nstop1,n1,n2,nleg1,nleg2,v1,v2,leg,leg1,leg2,nleg;
+  ub4 midstop1,midstop2;
+  ub4 dist1,dist2,distlim,walkdist1,walkdist2,sumwalkdist1,sumwalkdist2;
+  ub4 gen,dur,midur,durlim;
+  ub4 walklimit = net->walklimit;
+  ub4 sumwalklimit = net->sumwalklimit;
+  ub4 *stats = wp->stats;
+
+  ub4 dupcode,legport1,legport2;
+  ub4 trip1ports[Nleg * 2];
+  ub4 trip2ports[Nleg * 2];
+
+  ub4 dmid,dmidcnt,*dmids = wp->dmids,*dpairs = wp->dpairs,*dcurs = wp->dcurs;
+  ub4 dmidcnts[Nstop];
+  int dbg;
 
-    if (progress(&eta,"pass 2 port %u/%u 1-stop net \ah%u conns",dep,portcnt,ofs)) return 1;
+  nleg = nstop + 1;
+  nstop1 = nstop - 1;
 
-    if (dep > portlimit) continue;
+  memset(trip1ports,0xff,sizeof(trip1ports));
+  memset(trip2ports,0xff,sizeof(trip1ports));
 
-    pdep = ports + dep;
+  ofs = cx->rowofs[dep];
 
-    dname = pdep->name;
-    drdeps = pdep->drids;
-    drarrs = pdep->arids;
+  for (midstop1 = 0; midstop1 < nstop; midstop1++) {
+    cnts1 = net->concnt[midstop1];
+    conrow1 = net->conrow[midstop1];
+    conarr1 = net->conarr[midstop1];
+    conrow2 = net->conrow[nstop1 - midstop1];
 
     dmid = 0;
-    for (mid = 0; mid < portcnt; mid++) {
+    for (depmid = conrow1[dep]; depmid < conrow1[dep + 1]; depmid++) {
+      mid = conarr1[depmid];
       if (mid == dep) continue;
       pmid = ports + mid;
       if (pmid->valid == 0) continue;
 
-      depmid = dep * portcnt + mid;
-
       n1 = cnts1[depmid];
       if (n1 == 0) continue;
 
       if (pmid->oneroute) continue;
 
-      dmids[dmid++] = mid;
+      dmidndx = midstop1 * portcnt + dmid++;
+      dmids[dmidndx] = mid;
+      dpairs[dmidndx] = depmid;
+      dcurs[dmidndx] = conrow2[mid];
     }
-    dmidcnt = dmid;
+    dmidcnts[midstop1] = dmid;
+  }
 
-    for (arr = 0; arr < portcnt; arr++) {
-      if (arr == dep) continue;
-      deparr = dep * portcnt + arr;
+  for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+    arr = conarr[pair];
 
-      cnt = cnts[deparr];
-      if (cnt == 0) continue;
-      gen = cnts[deparr] = 0;
-      walklimcnt = 0;
+    cnt = concnt[pair];
+    if (cnt == 0) continue;
+    gen = concnt[pair] = 0;
 
-      distlim = distlims[deparr];
-      durlim = durlims[deparr];
-      if (durlim == hi16) durlim = hi32;
+    dbg = (part == 0 && dep == 1068 && arr == 0);
 
-      infocc(dbg,0,"distlim %u durlim %u",distlim,durlim);
+    distlim = cx->distlims[pair];
+    durlim = cx->durlims[pair];
 
-//      if (distlim != hi32 || durlim != hi32) info(0,"distlim %u durlim %u",distlim,durlim);
+    conofs[pair] = ofs;
+    lstv1 = lst + (size_t)ofs * nleg;
+    error_ge(ofs,lstlen);
 
-      conofs[deparr] = ofs;
-      lstv1 = lst + ofs * nleg;
-      error_ge(ofs,lstlen);
+    endofs = ofs + cnt - 1;
 
-      endofs = ofs + cnt - 1;
+    error_ge(endofs,lstlen);
 
-      error_ge(endofs,lstlen);
+    infocc(dbg,0,"port %u-%u concnt %u",dep,arr,gen);
 
-      infocc(dbg,0,"port %u-%u concnt %u",dep,arr,gen);
+    midstop1 = 0;
+    while (midstop1 < nstop && gen < cnt) {
+      midstop2 = nstop1 - midstop1;
+      nleg1 = midstop1 + 1;
+      nleg2 = midstop2 + 1;
 
-      firstmid = hi32;
-      for (dmid = 0; dmid < dmidcnt; dmid++) {
-        mid = dmids[dmid];
+      cnts1 = net->concnt[midstop1];
+      cnts2 = net->concnt[midstop2];
+
+      lstblk1 = net->conlst + midstop1;
+      lstblk2 = net->conlst + midstop2;
 
+      conlst1 = blkdata(lstblk1,0,ub4);
+      conlst2 = blkdata(lstblk2,0,ub4);
+
+      dmidcnt = dmidcnts[midstop1];
+      dmid = 0; firstmid = firstdm = firstma = hi32;
+      while (dmid < dmidcnt && gen < cnt) {
+        dmidndx = midstop1 * portcnt + dmid++;
+        mid = dmids[dmidndx];
         if (mid == arr) continue;
-        depmid = dep * portcnt + mid;
 
-        midarr = mid * portcnt + arr;
-        n2 = cnts1[midarr];
+        depmid = dpairs[dmidndx];
+        n1 = cnts1[depmid];
+
+        midarr = conseek(net,midstop2,dcurs + dmidndx,mid,arr);
+        if (midarr == hi32) continue;
+        n2 = cnts2[midarr];
         if (n2 == 0) continue;
 
-        n1 = cnts1[depmid];
-        error_z(n1,mid);
+        if (firstmid == hi32) { firstmid = mid; firstdm = depmid; firstma = midarr; }
 
-        if (firstmid == hi32) firstmid = mid;
+        conofs1 = net->conofs[midstop1];
+        conofs2 = net->conofs[midstop2];
 
         ofs1 = conofs1[depmid];
-        ofs2 = conofs1[midarr];
-        lst1 = conlst1 + ofs1;
-        lst2 = conlst1 + ofs2;
+        ofs2 = conofs2[midarr];
+        lst1 = conlst1 + ofs1 * nleg1;
+        lst2 = conlst2 + ofs2 * nleg2;
 
-        bound(lstblk1,ofs1,ub4);
-        bound(lstblk1,ofs2,ub4);
+        bound(lstblk1,ofs1 * nleg1,ub4);
+        bound(lstblk2,ofs2 * nleg2,ub4);
 
-        for (v1 = 0; v1 < n1; v1++) {
+        v1 = 0;
+        while (v1 < n1 && gen < cnt) {
           dist1 = walkdist1 = sumwalkdist1 = 0;
-          lst11 = lst1 + v1;
+          lst11 = lst1 + v1 * nleg1;
 
-          leg1 = lst11[0];
-          error_ge(leg1,whopcnt);
-          error_ne(portsbyhop[leg1 * 2],dep);
-          error_ne(portsbyhop[leg1 * 2 + 1],mid);
-          dist1 += hopdist[leg1];
-          if (leg1 >= chopcnt) walkdist1 = sumwalkdist1 = hopdist[leg1];
+          dupcode = 0;
+          for (leg1 = 0; leg1 < nleg1; leg1++) {
+            leg = lst11[leg1];
+            error_ge(leg,whopcnt);
+            dist1 += hopdist[leg];
+            if (leg >= chopcnt) {
+              walkdist1 += hopdist[leg];
+              sumwalkdist1 += hopdist[leg];
+            } else walkdist1 = 0;
+            if (nstop > 3) {
+              trip1ports[leg1 * 2] = portsbyhop[leg * 2];
+              trip1ports[leg1 * 2 + 1] = portsbyhop[leg * 2 + 1];
+            }
+            if (midstop1) dupcode |= (portsbyhop[leg * 2] == arr || portsbyhop[leg * 2 + 1] == arr);
+          }
+          if (dupcode) { v1++; continue; }
+          if (walkdist1 > walklimit || sumwalkdist1 > sumwalklimit) { v1++; continue; }
 
           if (durlim != hi32) {
-            midur = prepestdur(net,lst11,1);
-            if ((distlim != hi32 && dist1 > distlim) && midur > durlim) continue;
-          } else if (distlim != hi32 && dist1 > distlim) continue;
-            else midur = hi32;
-          if (distlim != hi32 && dist1 > distlim * 10) continue;
+            midur = prepestdur(net,lst11,nleg1);
+            if ((distlim != hi32 && dist1 > distlim) && midur > durlim) { v1++; continue; }
+          } else if (distlim != hi32 && dist1 > distlim) { v1++; continue; }
+          else midur = hi32;
+          if (distlim != hi32 && dist1 > distlim * 10) { v1++; continue; }
+
+          if (nstop > 3) {
+            error_ne(trip1ports[0],dep);
+            error_eq(trip1ports[0],mid);
+            error_eq(trip1ports[0],arr);
+            error_eq(trip1ports[midstop1 * 2 + 1],dep);
+            error_ne(trip1ports[nleg1 * 2 - 1],mid);
+            error_eq(trip1ports[nleg1 * 2 - 1],arr);
+          }
+//          checktrip(net,lst11,nleg1,dep,mid,dist1);
 
-          for (v2 = 0; v2 < n2; v2++) {
+          v2 = 0;
+          while (v2 < n2 && gen < cnt) {
             dist2 = dist1;
-            lst22 = lst2 + v2;
+            lst22 = lst2 + v2 * nleg2;
 
-            sumwalkdist2 = sumwalkdist1;
+            dupcode = 0;
             walkdist2 = walkdist1;
-            leg2 = lst22[0];
-            error_ge(leg2,whopcnt);
-            error_ne(portsbyhop[leg2 * 2],mid);
-            error_ne(portsbyhop[leg2 * 2 + 1],arr);
+            sumwalkdist2 = sumwalkdist1;
+            for (leg2 = 0; leg2 < nleg2; leg2++) {
+              leg = lst22[leg2];
+              error_ge(leg,whopcnt);
+              dist2 += hopdist[leg];
+              if (leg >= chopcnt) {
+                walkdist2 += hopdist[leg];
+                sumwalkdist2 += hopdist[leg];
+              } else walkdist2 = 0;
+              dur = hopdur[leg];
+              if (dur != hi32 && midur != hi32) midur += dur;
+              if (nstop > 3) {
+                trip2ports[leg2 * 2] = portsbyhop[leg * 2];
+                trip2ports[leg2 * 2 + 1] = portsbyhop[leg * 2 + 1];
+              }
+              if (midstop2) dupcode |= (portsbyhop[leg * 2] == dep || portsbyhop[leg * 2 + 1] == dep);
+            }
+            if (dupcode) { v2++; continue; }
 
-            dist2 += hopdist[leg2];
-            if (leg2 >= chopcnt) {
-              walkdist2 += hopdist[leg2];
-              sumwalkdist2 += hopdist[leg2];
-            } else walkdist2 = 0;
-//            dur = hopdur[leg2];
-//            if (dur != hi32 && midur != hi32) midur += dur;
+            if ((distlim != hi32 && dist2 > distlim) && (durlim != hi32 && midur > durlim)) { v2++; continue; }
 
-            if ((distlim != hi32 && dist2 > distlim) && (durlim != hi32 && midur > durlim)) continue;
+            if (walkdist2 > walklimit || sumwalkdist2 > sumwalklimit) { v2++; continue; }
 
-            if (walkdist2 > walklimit) { walklimcnt++; continue; }
-            if (sumwalkdist2 > sumwalklimit) continue;
+            if (nstop > 3) {
+              error_ne(trip2ports[0],mid);
+              error_eq(trip2ports[0],dep);
+              error_eq(trip2ports[0],arr);
+              error_ne(trip2ports[nleg2 * 2 - 1],arr);
+              error_eq(trip2ports[nleg2 * 2 - 1],dep);
+              error_eq(trip2ports[nleg2 * 2 - 1],mid);
+            }
 
-            if (durlim != hi32) {
-              midur = estdur(net,lst11,1,lst22,1);
-              if ((distlim != hi32 && dist2 > distlim) && midur > durlim) continue;
-            } else if (distlim != hi32 && dist2 > distlim) continue;
-            if (distlim != hi32 && dist2 > distlim * 15) continue;
+            // filter out repeated visits a-B-c-d-B-f
+            if (nstop > 3) {
+              for (legport1 = 0; legport1 < nleg1 * 2; legport1++) {
+                iport1 = trip1ports[legport1];
+                for (legport2 = 1; legport2 < nleg2 * 2; legport2++) {
+                  iport2 = trip2ports[legport2];
+                  if (iport1 == iport2) { dupcode = 7; break; }
+                }
+                if (dupcode) break;
+              }
+              if (dupcode) {
+                v2++;
+                continue;
+              }
+            }
 
-            if (lodists) lodists[deparr] = min(lodists[deparr],dist2);
-            allcnt[deparr] = 1;
-            gen++;
+//            checktrip(lst22,nleg2,mid,arr,dist2);
 
-            lstv1[0] = leg1;
-            lstv1[1] = leg2;
+            if (durlim != hi32) {
+              midur = estdur(net,lst11,nleg1,lst22,nleg2);
+              if ((distlim != hi32 && dist2 > distlim) && midur > durlim) { v2++; continue; }
+            } else if (distlim != hi32 && dist2 > distlim) { v2++; continue; }
+            if (distlim != hi32 && dist2 > distlim * 15) { v2++; continue; }
 
-//            checktrip3(net,lstv1,2,dep,arr,mid,dist2);
+            lodists[pair] = min(lodists[pair],dist2);
+            gen++;
 
-            lstv1 += 2;
+            for (leg1 = 0; leg1 < nleg1; leg1++) {
+              leg = lst11[leg1];
+//              error_ge(leg,whopcnt);
+              lstv1[leg1] = leg;
+            }
+//              memcpy(lstv1,lst11,nleg1 * sizeof(ub4));
+//              vrb(CC,"dep %u arr %u mid %u \av%u%p base %p n1 %u n2 %u",dep,arr,mid,nleg,lstv1,lst,n1,n2);
+//              checktrip(lstv1,nleg1,dep,mid,dist1);
+            lstv2 = lstv1 + nleg1;
+            for (leg2 = 0; leg2 < nleg2; leg2++) {
+              leg = lst22[leg2];
+//              error_ge(leg,whopcnt);
+              lstv2[leg2] = leg;
+            }
+//              memcpy(lstv2,lst22,nleg2 * sizeof(ub4));
+//              vrb(CC,"dep %u arr %u mid %u \av%u%p base %p n1 %u n2 %u",dep,arr,mid,nleg,lstv1,lst,n1,n2);
+//              checktrip3(lstv1,nleg,dep,arr,mid,dist12);
 
-            if (gen >= cnt) break;
-          } // each v2
-          if (gen >= cnt) break;
-        } // each v1
+            lstv1 = lstv2 + nleg2;
 
-        if (gen >= cnt) break;
+            v2++;
+          }
+          v1++;
+        }
       } // each mid
 
-      if (gen + walklimcnt < cnt) {
-        stat_partcnt++;
-        infocc(dmid < dmidcnt,0,"dmid %u of %u",dmid,dmidcnt);
-      }
-
-      genstats[min(gen,geniv)]++;
-      cntstats[min(cnt,geniv)]++;
+      if (gen < cnt) stats[St_partcnt]++;
 
       // if none found for any dep-Mid-arr, but mid exists, use first one
-      if (cnt > walklimcnt && gen == 0 && firstmid != hi32) {
-        stat_nocon++;
-        info(0,"no conn for %u-%u-%u cnt %u distlim %u durlim %u",dep,firstmid,arr,cnt - walklimcnt,distlim,durlim);
-        depmid = dep * portcnt + firstmid;
-        midarr = firstmid * portcnt + arr;
+      if (cnt && gen == 0 && firstmid != hi32) {
+        stats[St_nocon]++;
+        vrbcc(vrbena,0,"dep %u arr %u no conn for mid %u cnt %u distlim %u",dep,arr,firstmid,cnt,distlim);
+        depmid = firstdm;
+        midarr = firstma;
 
         error_z(cnts1[depmid],firstmid);
-        error_z(cnts1[midarr],firstmid);
+        error_z(cnts2[midarr],firstmid);
 
-        ofs1 = conofs1[depmid];
-        ofs2 = conofs1[midarr];
-        lst1 = conlst1 + ofs1;
-        lst2 = conlst1 + ofs2;
+        conofs1 = net->conofs[midstop1];
+        conofs2 = net->conofs[midstop2];
 
-        leg1 = lst1[0];
-        error_ge(leg1,whopcnt);
-        dist2 = hopdist[leg1];
-        lstv1[0] = leg1;
-        leg2 = lst2[0];
-        error_ge(leg2,whopcnt);
-        dist2 += hopdist[leg2];
-        lstv1[1] = leg2;
-        lstv1 += 2;
-        if (lodists) lodists[deparr] = min(lodists[deparr],dist2);
+        ofs1 = conofs1[depmid];
+        ofs2 = conofs2[midarr];
+        lst1 = conlst1 + ofs1 * nleg1;
+        lst2 = conlst2 + ofs2 * nleg2;
+
+        dist2 = 0;
+        for (leg1 = 0; leg1 < nleg1; leg1++) {
+          leg = lst1[leg1];
+          error_ge(leg,whopcnt);
+          dist2 += hopdist[leg];
+          lstv1[leg1] = leg;
+        }
+        lstv2 = lstv1 + nleg1;
+        for (leg2 = 0; leg2 < nleg2; leg2++) {
+          leg = lst2[leg2];
+          error_ge(leg,whopcnt);
+          dist2 += hopdist[leg];
+          lstv2[leg2] = leg;
+        }
+        lstv1 = lstv2 + nleg2;
+        lodists[pair] = min(lodists[pair],dist2);
         gen = 1;
-        allcnt[deparr] = 1;
       }
 
-      error_gt(gen,cnt,arr);
+      midstop1++;
+    } // each mid stopover port
 
-      ofs += gen;
-      cnts[deparr] = (ub2)gen;
-      infocc(dbg,0,"port %u-%u concnt %u",dep,arr,gen);
-    } // each arrival port
-  } // each departure port
-  newlstlen = ofs;
-  error_gt(newlstlen,lstlen,0);
-  info(0,"pass 2 done, \ah%lu from \ah%lu triplets",newlstlen,lstlen);
+    error_gt(gen,cnt,arr);
+    warncc(cnt && gen == 0,Iter,"dep %u arr %u no conn distlim %u durlim %u",dep,arr,distlim,durlim);
+
+    ofs += gen;
+    concnt[pair] = (ub2)gen;
+    infocc(dbg,0,"port %u-%u concnt %u",dep,arr,gen);
+  } // each arrival port
+
+  cx->rowlen[dep] = ofs - cx->rowofs[dep];
+}
+
+// create n-stop connectivity matrix and derived info
+// uses 1 mid, varying use of underlying nets by stop position
+int mknetn(struct network *net,ub4 nstop,ub4 varlimit,ub4 var12limit,bool nilonly,size_t budget)
+{
+  ub4 portcnt = net->portcnt;
+  ub4 hopcnt = net->hopcnt;
+  ub4 whopcnt = net->whopcnt;
+  block *lstblk;
+  ub4 *portdst;
+  ub4 ofs;
+  ub4 *lst,*newlst;
+  ub4 port2,leg,nleg,iv;
+  size_t lstlen,newlstlen,plan = 0;
+  struct bldctx *cx;
+  struct bldwork *sp;
+  int rv;
+
+  // todo
+  ub4 portlimit = 9000;
+  ub4 lstlimit = 1024 * 1024 * 512;
+  ub4 altlimit = min(var12limit * 8,256);
+  ub4 depcnt;
+
+  error_z(nstop,0);
+  error_ge(nstop,Nstop);
+  error_zz(portcnt,hopcnt);
+
+  info(0,"init %u-stop connections for %u port %u hop network",nstop,portcnt,whopcnt);
+
+  if (portcnt == 0) return 1;
+
+  port2 = portcnt * portcnt;
+
+  portdst = alloc(portcnt, ub4,0,"net portdst",portcnt);
+
+  error_zp(net->hopdist,0);
+
+  nleg = nstop + 1;
+
+  cx = mkbld(net,nstop,portcnt * nstop,0,0);
+  sp = &cx->sum;
+  cx->varlimit = varlimit;
+  cx->var12limit = var12limit;
+  cx->altlimit = altlimit;
+  cx->nilonly = nilonly;
+  cx->budget = budget;
+  cx->portdst = portdst;
+
+  depcnt = portcnt;
+  if (portcnt > portlimit + 1) {
+    warning(0,"limiting net by %u ports",portlimit);
+    depcnt = portlimit + 1;
+  }
+
+  if (budget && bldplan(cx,netnpass1,depcnt,&plan)) { rmbld(cx); return 1; }
+
+  rv = bldpass1(cx,netnpass1,depcnt,lstlimit / nleg,2 * (size_t)port2);
+  if (rv) { rmbld(cx); return rv; }
+  lstlen = cx->lstlen;
+  bldsum(cx);
+  bldrows(cx);
+  if (plan == 0) plan = bldbytes(cx,cx->pairs,lstlen);
+
+  for (iv = 0; iv < Elemcnt(sp->dupstats); iv++) if (sp->dupstats[iv]) info(0,"dup %u: \ah%lu",iv,sp->dupstats[iv]);
+  for (iv = 0; iv < Elemcnt(sp->cntstats); iv++) if (sp->cntstats[iv]) info(0,"cnt %u: \ah%u",iv,sp->cntstats[iv]);
+
+  info(0,"%u-stop pass 1 done, tentative \ah%lu triplets",nstop,lstlen);
+
+  warncc(lstlen == 0 && nilonly == 0,0,"no connections at %u-stop",nstop);
+  if (lstlen == 0) { rmbld(cx); return 0; }
+
+  ub4 newcnt;
+  struct range portdr;
+  ub4 ivportdst[32];
+  mkhist(caller,portdst,portcnt,&portdr,Elemcnt(ivportdst),ivportdst,"outbounds by port",Vrb);
+
+  // prepare list and its offsets
+  cx->conofs = alloc(cx->pairs,ub4,0xff,"net conofs",portcnt);
+  cx->lodists = alloc(cx->pairs,ub4,0xff,"net lodist",portcnt);
+
+  lstblk = net->conlst + nstop;
+
+  lst = mkblock(lstblk,lstlen * nleg,ub4,Init1,"netv %u-stop conlst",nstop);
+
+  cx->lst = lst;
+
+  ofs = (ub4)bldofs(cx,nstop - 1,&newcnt);
+  error_ne(ofs,lstlen);
+  info(0,"\ah%u new connections",newcnt);
+
+  aclear(sp->dupstats);
 
-  afree(distlims,"net distlims");
-  afree(durlims,"net durlims");
+  if (bldpass2(cx,netnpass2,depcnt,&newlstlen)) { rmbld(cx); return 1; }
+  bldsum(cx);
+
+  error_gt(newlstlen,lstlen,nstop);
+  info(0,"pass 2 done, \ah%lu from \ah%lu triplets",newlstlen,lstlen);
+  info(0,"%u-stop lists planned \ah%lu b, actual \ah%lu b",nstop,plan,bldbytes(cx,cx->pairs,newlstlen));
 
   if (lstlen - newlstlen > 1024 * 1024 * 64) {
     newlst = trimblock(lstblk,newlstlen * nleg,ub4);
   } else newlst = lst;
 
-  net->lstlen[1] = newlstlen;
-
+  net->lstlen[nstop] = newlstlen;
   for (ofs = 0; ofs < newlstlen * nleg; ofs++) {
     leg = newlst[ofs];
     error_ge(leg,whopcnt);
   }
 
-  for (iv = 0; iv < Elemcnt(dupstats); iv++) if (dupstats[iv]) info(0,"dup %u: \ah%lu",iv,dupstats[iv]);
+  for (iv = 0; iv < Elemcnt(sp->dupstats); iv++) if (sp->dupstats[iv]) info(0,"dup %u: \ah%lu",iv,sp->dupstats[iv]);
+
+  info(0,"no conn %u  partcnt %u  cntlim %u %u %u",sp->stats[St_nocon],sp->stats[St_partcnt],sp->stats[St_cntlim],sp->stats[St_partlimdist],sp->stats[St_partlimdur]);
+
+  struct range conrange;
+  ub4 constats[16];
+
+  aclear(constats);
+  if (cx->pairs) mkhist2(cx->cnts,cx->pairs,&conrange,Elemcnt(constats),constats,"connection",Info);
+
+  bldkeep(cx,nstop);
+  rmbld(cx);
+
+  net->lstlen[nstop] = lstlen;
+
+  return 0;
+}
+
+/* Essentially we do for each (departure,arrival) pair:
+   Search for a 'via' port such that trip (departure,via) and (via,arrival) exist
+   Trim list of alternatives based on e.g. distance
+   Store result by value. This is memory-intensive but keeps code simple
+
+   In short: foreach dep  foreach arr foreach mid with n1[dep,mid] with n2 [mid,arr]
+*/
+
+/*
+  pass 1 : foreach (dep,arr) pair at this #stops:
+  bound overall best and worst
+  currently, cost is distance only
+  create histogram and derive threshold to use as filter in next pass
+  estimate size of trip list matrix
+  obtain basic stats
+*/
+static void net1pass1(struct bldwork *wp,ub4 dep)
+{
+  struct bldctx *cx = wp->cx;
+  struct network *net = cx->net;
+  ub4 portcnt = net->portcnt;
+  ub4 chopcnt = net->chopcnt;
+  ub4 whopcnt = net->whopcnt;
+  struct port *ports = net->ports,*pmid,*pdep,*parr;
+  char *dname,*mname;
+  block *lstblk1 = net->conlst;
+  ub2 *cnts1 = net->concnt[0];
+  ub4 *conrow1 = net->conrow[0],*conarr1 = net->conarr[0];
+  ub4 ofs1,ofs2,*conofs1 = net->conofs[0];
+  ub4 *conlst1 = blkdata(lstblk1,0,ub4);
+  ub4 *lst1,*lst11,*lst2,*lst22;
+  ub4 *hopdist = net->hopdist;
+  ub8 *allconn = net->allconn;
+  ub4 mid,arr,depmid,midarr;
+  ub4 cnt,n1,n2,n12,altcnt,v1,v2,leg1,leg2;
+  ub4 dist1,dist2,distlim,sumwalkdist1,sumwalkdist2,walkdist1,walkdist2;
+  ub4 cntlim,cntlimdist,cntlimdur,outcnt;
+  ub4 midur,durndx,durcnt,durlim,distcnt,distndx;
+  ub4 midurs[Durcnt];
+  ub4 dists[Distcnt];
+  ub4 walklimit = net->walklimit;
+  ub4 sumwalklimit = net->sumwalklimit;
+  ub4 varlimit = cx->depclass ? cx->classlims[cx->depclass[dep]] : cx->varlimit;
+  ub4 var12limit = cx->var12limit;
+  ub4 altlimit = cx->altlimit;
+  bool nilonly = cx->nilonly;
+  ub4 *stats = wp->stats;
+
+  ub4 dmidcnt,*viacnts = wp->viacnts,*viaclamps = wp->viaclamps;
+  ub4 dmidivs = Elemcnt(wp->dmidbins) - 1;
+  ub4 *drdeps;
+  ub4 hindx,hidur,hidist;
+
+  pdep = ports + dep;
+  if (pdep->valid == 0) return;
+
+  // count variants to each arr over eligible via's
+  dname = pdep->name;
+  drdeps = pdep->drids;
+
+  nclear(viacnts,portcnt);
+  nclear(viaclamps,portcnt);
+
+  dmidcnt = 0;
+  for (depmid = conrow1[dep]; depmid < conrow1[dep + 1]; depmid++) {
+    mid = conarr1[depmid];
+    if (mid == dep) continue;
+    pmid = ports + mid;
+    if (pmid->valid == 0) continue;
+
+    n1 = cnts1[depmid];
+    if (n1 == 0) continue;
+
+    // todo: skip vias only on same route
+    mname = pmid->name;
+
+    if (pmid->oneroute) {
+      vrb0(0,"skip %u-%u-x on same oneway route %x %s to %s",dep,mid,drdeps[0],dname,mname);
+      stats[St_oneroute]++;
+      continue;
+    }
+
+    dmidcnt++;
+    bldvias(wp,n1,conarr1,cnts1,conrow1[mid],conrow1[mid + 1],mid,hi32,var12limit);
+  }
+  wp->dmidbins[min(dmidcnt,dmidivs)]++;
+
+  if (cx->pass == 0) { bldcount(wp,dep); return; }
+
+  outcnt = 0;
+
+  // for each arrival port
+  for (arr = 0; arr < portcnt; arr++) {
+    if (arr == dep) continue;
+
+    if (nilonly && conbit(net,allconn,dep,arr)) continue;
+
+    parr = ports + arr;
+    if (parr->valid == 0) continue;
+
+    durlim = distlim = hi32;
+
+    // sum over vias. see bldvias()
+    stats[St_var12limit] += viaclamps[arr];
+    cnt = viacnts[arr];
+    if (cnt == 0) continue;
+    cntlim = min(cnt,varlimit);
+
+    // store info
+    wp->lstlen += cntlim;
+    outcnt++;
 
-  info(0,"no conn %u  partcnt %u  cntlim %u partlim1 %u %u",stat_nocon,stat_partcnt,stat_cntlim,stat_partlimdist,stat_partlimdur);
+    // todo: start with limits derived from previous nstop
+    // e.g. lodists[da] * 2
 
-  for (iv = 0; iv <= geniv; iv++) infocc(cntstats[iv],0,"%u: gen \ah%u cnt \ah%u",iv,genstats[iv],cntstats[iv]);
+    // if too many options, sort on distance.
+    if (cnt > varlimit) {
+//      info(0,"cnt %u varlimit %u cntlim %u",cnt,varlimit,cntlim);
+      cntlimdist = max(cntlim / 4,1);
+      cntlimdur = max(cntlim * 3 / 4,1);
+      cntlimdist = min(cntlimdist,Distcnt-1);
+      cntlimdur = min(cntlimdur,Durcnt-1);
 
-  // verify all triplets
-  if (portcnt < 10000) {
-    for (dep = 0; dep < portcnt; dep++) {
-      for (arr = 0; arr < portcnt; arr++) {
-        if (dep == arr) continue;
+      error_z(cntlimdist,cntlim);
+      error_z(cntlimdur,cntlim);
 
-        deparr = dep * portcnt + arr;
-        n1 = cnts[deparr];
-        if (n1 == 0) continue;
-        ofs = conofs[deparr];
-        lstv1 = newlst + ofs * nleg;
-        for (v1 = 0; v1 < n1; v1++) {
-          checktrip(net,lstv1,nleg,dep,arr,hi32);
-          lstv1 += nleg;
-        }
-      }
-    }
-  }
+      nsethi(dists,Distcnt);
+      nsethi(midurs,Durcnt);
 
-  struct range conrange;
-  ub4 constats[16];
+      // subpass 2: create distance and time top-n lists, derive threshold
+      altcnt = 0;
+      durcnt = distcnt = 0;
 
-  aclear(constats);
+      if (altcnt > altlimit) { stats[St_altlim]++; break; }
 
-  if (portcnt < 10000) mkhist2(cnts,port2,&conrange,Elemcnt(constats),constats,"connection",Info);
+      for (depmid = conrow1[dep]; depmid < conrow1[dep + 1]; depmid++) {
+        mid = conarr1[depmid];
+        if (mid == dep || mid == arr) continue;
 
-  net->concnt[1] = cnts;
-  net->conofs[1] = conofs;
+        n1 = cnts1[depmid];
+        if (n1 == 0) continue;
 
-  net->lodist[1] = lodists; // only for partitioned
+        midarr = conpair(net,0,mid,arr);
+        if (midarr == hi32) continue;
+        n2 = cnts1[midarr];
+        if (n2 == 0) continue;
+        n12 = n1 * n2;
+        altcnt += n12;
+        if (altcnt > altlimit) break;
 
-  net->lstlen[1] = lstlen;
+        ofs1 = conofs1[depmid];
+        ofs2 = conofs1[midarr];
+        error_eq(ofs1,hi32);
+        error_eq(ofs2,hi32);
 
-  return 0;
-} // end mknet1
+        lst1 = conlst1 + ofs1;
+        lst2 = conlst1 + ofs2;
 
-// create 2-stop connectivity matrix and derived info
-// uses 2 mids, varying use of underlying nets for each
-int mknet2(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly)
-{
-  ub4 part = net->part;
-  ub4 portcnt = net->portcnt;
-  ub4 hopcnt = net->hopcnt;
-  ub4 chopcnt = net->chopcnt;
-  ub4 whopcnt = net->whopcnt;
-  ub4 nstop = 2;
-  struct port *ports,*pmid,*pdep,*parr;
-  char *dname,*aname;
-  block *lstblk,*lstblk1;
-  ub4 *portsbyhop;
-  ub4 *hoprids;
-  ub2 *cnts,*cnts1;
-  ub4 *portdst;
-  ub4 ofs,ofs1,ofs2,ofs3,endofs,*conofs,*conofs1;
-  ub4 *lst,*newlst,*conlst1,*lst1,*lst11,*lst2,*lst22,*lst3,*lst33,*lstv1;
-  ub4 *hopdist,*distlims;
-  ub4 dep,mid1,mid2,arr,port2,depmid1,mid12,mid2arr,deparr;
-  ub4 iv;
-  ub4 cnt,n1,n2,n3,n123,altcnt,v1,v2,v3,leg,leg1,leg2,leg3,nleg;
-  size_t lstlen,newlstlen;
-  ub4 *lodists;
-  ub4 dist1,dist2,dist3,distlim,walkdist1,walkdist2,walkdist3,sumwalkdist1,sumwalkdist2,sumwalkdist3;
-  ub4 cntlim,cntlimdist,cntlimdur,gen,outcnt;
-  ub4 dur,midur,durndx,durcnt,durlim,distcnt,distndx;
-  ub4 *hopdur,*durlims;
-  ub4 midurs[Durcnt];
-  ub4 dists[Distcnt];
-  ub4 walklimit = net->walklimit;
-  ub4 sumwalklimit = net->sumwalklimit;
-  ub4 stat_nocon = 0,stat_partcnt = 0,stat_cntlim = 0,stat_partlimdur = 0,stat_partlimdist = 0;
-  ub4 stat_altlim = 0,stat_oneroute = 0;
+        bound(lstblk1,ofs1,ub4);
+        bound(lstblk1,ofs2,ub4);
 
-  // todo
-  ub4 portlimit = 9000;
-  ub4 lstlimit = 1024 * 1024 * 512;
-  ub4 altlimit = min(var12limit * 4,128);
-  ub4 dmidlim = 16;
+        // each dep-via alternative
+        for (v1 = 0; v1 < n1; v1++) {
+          sumwalkdist1 = walkdist1 = 0;
+          lst11 = lst1 + v1;
 
-  ub4 trip1ports[Nleg * 2];
-  ub4 trip2ports[Nleg * 2];
+          leg1 = lst11[0];
+          error_ge(leg1,whopcnt);
+          dist1 = hopdist[leg1];
+          if (leg1 >= chopcnt) sumwalkdist1 = walkdist1 = dist1;
 
-  struct eta eta;
+          if (durlim != hi32) {
+            midur = prepestdur(net,lst11,1);
+            if ((distlim != hi32 && dist1 > distlim) && midur > durlim) continue;
+          } else if (distlim != hi32 && dist1 > distlim) continue;
+          else midur = hi32;
+          if (distlim != hi32 && dist1 > distlim * 10) continue;
 
-  error_zz(portcnt,hopcnt);
+          for (v2 = 0; v2 < n2; v2++) {
+            dist2 = dist1;
+            lst22 = lst2 + v2;
 
-  info(0,"init %u-stop connections for %u port %u hop network",nstop,portcnt,whopcnt);
+            sumwalkdist2 = sumwalkdist1;
+            walkdist2 = walkdist1;
+            leg2 = lst22[0];
+            dist2 += hopdist[leg2];
+            if (leg2 >= chopcnt) {
+              walkdist2 += hopdist[leg2];
+              sumwalkdist2 += hopdist[leg2];
+            } else walkdist2 = 0;
+//            dur = hopdur[leg2];
+//            if (dur != hi32 && midur != hi32) midur += dur;
+            if ((distlim != hi32 && dist2 > distlim) && (durlim != hi32 && midur > durlim)) continue;
+            else if (distlim != hi32 && dist2 > distlim * 15) continue;
 
-  info(0,"limits: var %u var12 %u alt %u port %u lst \ah%u",varlimit,var12limit,altlimit,portlimit,lstlimit);
+            if (walkdist2 > walklimit || sumwalkdist2 > sumwalklimit) continue;
 
-  port2 = portcnt * portcnt;
+            // maintain top-n list, discard actual trip here
 
-  ports = net->ports;
+            if (distcnt == 0) {
+              dists[0] = dist2;
+              distcnt = 1;
+            } else if (distcnt < cntlimdist) {
+              dists[distcnt++] = dist2;
+            } else {
+              hidist = hindx = 0;
+              for (distndx = 0; distndx < cntlimdist; distndx++) {
+                if (dists[distndx] > hidist) { hidist = dists[distndx]; hindx = distndx; }
+              }
+              if (dist2 < hidist) dists[hindx] = dist2;
+              distlim = hidist;
+              error_eq(distlim,hi32);
+            }
 
-  portsbyhop = net->portsbyhop;
+            // idem for time: insertion sort
+            midur = estdur_2(net,leg1,leg2);
+            if (midur == hi32) continue;
+
+            if (durcnt == 0) {
+              midurs[0] = midur;
+              warncc(midur != hi32 && midur > 65534,Exit,"durlim %u at 0 of %u exceeds 64k",midur,cntlimdur);
+              durcnt = 1;
+            } else if (durcnt < cntlimdur) {
+//              infocc(durcnt == 50,Notty,"midur %u at 50",midur);
+              warncc(midur != hi32 && midur > 65534,Exit,"durlim %u at %u of %u exceeds 64k",midur,durcnt,cntlimdur);
+              midurs[durcnt++] = midur;
+            } else {
+              hidur = hindx = 0;
+              for (durndx = 0; durndx < cntlimdur; durndx++) {
+                if (midurs[durndx] > hidur) { hidur = midurs[durndx]; hindx = durndx; }
+                warncc(midurs[durndx] != hi32 && midurs[durndx] > 65534,Exit,"durlim %u at %u of %u exceeds 64k",midurs[durndx],durndx,cntlimdur);
+              }
+              if (midur < hidur) midurs[hindx] = midur;
+              durlim = hidur;
+              warncc(durlim != hi32 && durlim > 65534,Exit,"durlim %u at %u exceeds 64k",durlim,cntlimdur);
+              error_eq(durlim,hi32);
+            }
 
-  ub1 *allcnt = net->allcnt;
+          } // each v2
+        } // each v1
 
-  cnts = alloc(port2, ub2,0,"net concnt",portcnt);
-  lodists = alloc(port2, ub4,0xff,"net lodist",portcnt);
+      } // each mid
 
-  distlims = alloc(port2, ub4,0,"net distlims",portcnt);
-  durlims = alloc(port2, ub4,0,"net durlims",portcnt);
+      if (distcnt < cntlimdist) stats[St_partlimdist]++;
+      if (durcnt < cntlimdur) stats[St_partlimdur]++;
+      stats[St_cntlim]++;
+      warncc(durlim != hi32 && durlim > 65534,Exit,"durlim %u exceeds 64k",durlim);
+    } else {   // not cnt limited
+      distlim = hi32;
+      durlim = hi32;
+    }
+    bldadd(wp,arr,cntlim,distlim,durlim);
 
-  portdst = alloc(portcnt, ub4,0,"net portdst",portcnt);
+  } // each arrival port
+  cx->portdst[dep] = outcnt;
+}
 
-  hopdist = net->hopdist;
-  hopdur = net->hopdur;
-  hoprids = net->hoprids;
+// pass 2: fill based on range and thresholds determined above
+// most code comments from pass 1 apply
+static void net1pass2(struct bldwork *wp,ub4 dep)
+{
+  struct bldctx *cx = wp->cx;
+  struct network *net = cx->net;
+  ub4 chopcnt = net->chopcnt;
+  ub4 whopcnt = net->whopcnt;
+  struct port *ports = net->ports,*pmid;
+  block *lstblk1 = net->conlst;
+  ub4 *portsbyhop = net->portsbyhop;
+  ub2 *cnts = cx->cnts,*cnts1 = net->concnt[0];
+  ub4 *conrow = cx->conrow,*conarr = cx->conarr;
+  ub4 *conrow1 = net->conrow[0],*conarr1 = net->conarr[0];
+  ub4 ofs,ofs1,ofs2,endofs,*conofs = cx->conofs,*conofs1 = net->conofs[0];
+  ub4 *conlst1 = blkdata(lstblk1,0,ub4);
+  ub4 *lst = cx->lst,*lst1,*lst11,*lst2,*lst22,*lstv1;
+  ub4 *hopdist = net->hopdist;
+  ub4 *lodists = cx->lodists;
+  size_t lstlen = cx->lstlen;
+  ub4 mid,arr,firstmid,firstdm,firstma,pair,depmid,midarr;
+  ub4 cnt,n1,n2,v1,v2,leg1,leg2,nleg = 2;
+  ub4 dist1,dist2,distlim,sumwalkdist1,sumwalkdist2,walkdist1,walkdist2;
+  ub4 gen,midur,durlim,walklimcnt;
+  ub4 walklimit = net->walklimit;
+  ub4 sumwalklimit = net->sumwalklimit;
+  ub4 *stats = wp->stats;
+  ub4 geniv = Elemcnt(wp->genstats) - 1;
 
-  error_zp(hopdist,0);
+  ub4 dmid,dmidcnt,*dmids = wp->dmids,*dpairs = wp->dpairs,*dcurs = wp->dcurs;
 
-  nleg = 3;
+  ofs = cx->rowofs[dep];
 
-  memset(trip1ports,0xff,sizeof(trip1ports));
-  memset(trip2ports,0xff,sizeof(trip1ports));
+  dmid = 0;
+  for (depmid = conrow1[dep]; depmid < conrow1[dep + 1]; depmid++) {
+    mid = conarr1[depmid];
+    if (mid == dep) continue;
+    pmid = ports + mid;
+    if (pmid->valid == 0) continue;
 
-/* Essentially we do for each (departure,arrival) pair:
-   Search for 2 'via' ports such that trip (dep,via1), (via1,via2) and (via2,arr) exist
-   Trim list of alternatives based on e.g. distance
-   Store result by value. This is memory-intensive but keeps code simple
+    n1 = cnts1[depmid];
+    if (n1 == 0) continue;
 
-   In short:
-   foreach dep
-     foreach arr
-       foreach mid1 with [dep,mid1]
-         foreach mid2 with [mid1,mid2] and [mid2,arr]
-           ...
+    if (pmid->oneroute) continue;
 
-*/ 
+    dmids[dmid] = mid;
+    dpairs[dmid] = depmid;
+    dcurs[dmid++] = conrow1[mid];
+  }
+  dmidcnt = dmid;
 
-/*
-  pass 1 : foreach (dep,arr) pair at this #stops:
-  bound overall best and worst
-  currently, cost is distance only
-  create histogram and derive threshold to use as filter in next pass
-  estimate size of trip list matrix
-  obtain basic stats
-*/
+  for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+    arr = conarr[pair];
 
-  ub8 dupstats[16];
-  ub4 cntstats[16];
+    cnt = cnts[pair];
+    if (cnt == 0) continue;
+    gen = cnts[pair] = 0;
+    walklimcnt = 0;
 
-  lstlen = 0;
+    distlim = cx->distlims[pair];
+    durlim = cx->durlims[pair];
 
-  aclear(dupstats);
-  aclear(cntstats);
+    conofs[pair] = ofs;
+    lstv1 = lst + (size_t)ofs * nleg;
+    error_ge(ofs,lstlen);
 
-  ub4 dmid,dmidcnt,*dmids = alloc(portcnt,ub4,0,"net vias",portcnt);
-  ub4 amid,amidcnt,*amids = alloc(portcnt,ub4,0,"net vias",portcnt);
-  int fd;
-  int dbg = 0,limited = 0;
-  ub4 hindx,hidur,hidist;
-  char cachefile[256];
-
-  fmtstring(cachefile,"cache/net_1_part_%u_distlim.in",part);
-  fd = fileopen(cachefile,0);
-  if (fd != -1) {
-    fileread(fd,distlims,port2 * (ub4)sizeof(*distlims),cachefile);
-    fileclose(fd,cachefile);
-    info(0,"using dist limit cache file %s",cachefile);
-  }
+    endofs = ofs + cnt - 1;
 
-  cnts1 = net->concnt[0];
-  lstblk1 = net->conlst;
-  conlst1 = blkdata(lstblk1,0,ub4);
-  conofs1 = net->conofs[0];
+    error_ge(endofs,lstlen);
 
-  ub4 dmidbins[256];
-  ub4 dmidivs = Elemcnt(dmidbins) - 1;;
+    firstmid = firstdm = firstma = hi32;
+    for (dmid = 0; dmid < dmidcnt; dmid++) {
+      mid = dmids[dmid];
 
-  aclear(dmidbins);
+      if (mid == arr) continue;
+      depmid = dpairs[dmid];
 
-  // for each departure port
-  for (dep = 0; dep < portcnt; dep++) {
+      midarr = conseek(net,0,dcurs + dmid,mid,arr);
+      if (midarr == hi32) continue;
+      n2 = cnts1[midarr];
+      if (n2 == 0) continue;
 
-    if (progress(&eta,"pass 1 port %u/%u 2-stop net \ah%lu conns",dep,portcnt,lstlen)) return 1;
+      n1 = cnts1[depmid];
+      error_z(n1,mid);
 
-    if (dep > portlimit) {
-      warning(0,"limiting net by %u ports",portlimit);
-      break;
-    }
+      if (firstmid == hi32) { firstmid = mid; firstdm = depmid; firstma = midarr; }
 
-    pdep = ports + dep;
-    if (pdep->valid == 0) continue;
+      ofs1 = conofs1[depmid];
+      ofs2 = conofs1[midarr];
+      lst1 = conlst1 + ofs1;
+      lst2 = conlst1 + ofs2;
 
-    if (lstlen + 2 * port2 > lstlimit / nleg) {
-      warncc(limited == 0,0,"limiting net by \ah%u triplets",lstlimit / nleg);
-      limited = 1;
-      var12limit = varlimit = 2;
-    }
+      bound(lstblk1,ofs1,ub4);
+      bound(lstblk1,ofs2,ub4);
 
-    dname = pdep->name;
+      for (v1 = 0; v1 < n1; v1++) {
+        dist1 = walkdist1 = sumwalkdist1 = 0;
+        lst11 = lst1 + v1;
 
-    // prepare eligible via's
-    dmid = 0;
-    for (mid1 = 0; mid1 < portcnt; mid1++) {
-      if (mid1 == dep) continue;
-      pmid = ports + mid1;
-      if (pmid->valid == 0) continue;
+        leg1 = lst11[0];
+        error_ge(leg1,whopcnt);
+        error_ne(portsbyhop[leg1 * 2],dep);
+        error_ne(portsbyhop[leg1 * 2 + 1],mid);
+        dist1 += hopdist[leg1];
+        if (leg1 >= chopcnt) walkdist1 = sumwalkdist1 = hopdist[leg1];
+
+        if (durlim != hi32) {
+          midur = prepestdur(net,lst11,1);
+          if ((distlim != hi32 && dist1 > distlim) && midur > durlim) continue;
+        } else if (distlim != hi32 && dist1 > distlim) continue;
+          else midur = hi32;
+        if (distlim != hi32 && dist1 > distlim * 10) continue;
+
+        for (v2 = 0; v2 < n2; v2++) {
+          dist2 = dist1;
+          lst22 = lst2 + v2;
+
+          sumwalkdist2 = sumwalkdist1;
+          walkdist2 = walkdist1;
+          leg2 = lst22[0];
+          error_ge(leg2,whopcnt);
+          error_ne(portsbyhop[leg2 * 2],mid);
+          error_ne(portsbyhop[leg2 * 2 + 1],arr);
+
+          dist2 += hopdist[leg2];
+          if (leg2 >= chopcnt) {
+            walkdist2 += hopdist[leg2];
+            sumwalkdist2 += hopdist[leg2];
+          } else walkdist2 = 0;
+//          dur = hopdur[leg2];
+//          if (dur != hi32 && midur != hi32) midur += dur;
+
+          if ((distlim != hi32 && dist2 > distlim) && (durlim != hi32 && midur > durlim)) continue;
+
+          if (walkdist2 > walklimit) { walklimcnt++; continue; }
+          if (sumwalkdist2 > sumwalklimit) continue;
 
-      depmid1 = dep * portcnt + mid1;
+          if (durlim != hi32) {
+            midur = estdur(net,lst11,1,lst22,1);
+            if ((distlim != hi32 && dist2 > distlim) && midur > durlim) continue;
+          } else if (distlim != hi32 && dist2 > distlim) continue;
+          if (distlim != hi32 && dist2 > distlim * 15) continue;
 
-      n1 = cnts1[depmid1];
-      if (n1 == 0) continue;
+          if (lodists) lodists[pair] = min(lodists[pair],dist2);
+          gen++;
 
-      if (pmid->oneroute) {
-        stat_oneroute++;
-        continue;
-      }
-      dmids[dmid++] = mid1;
-      if (dmid >= dmidlim) break;
-    }
-    dmidcnt = dmid;
-    dmidbins[min(dmidcnt,dmidivs)]++;
+          lstv1[0] = leg1;
+          lstv1[1] = leg2;
 
-    outcnt = 0;
+//          checktrip3(net,lstv1,2,dep,arr,mid,dist2);
 
-    // for each arrival port
-    for (arr = 0; arr < portcnt; arr++) {
-      if (arr == dep) continue;
+          lstv1 += 2;
 
-      deparr = dep * portcnt + arr;
+          if (gen >= cnt) break;
+        } // each v2
+        if (gen >= cnt) break;
+      } // each v1
 
-      if (nilonly && allcnt[deparr]) { cntstats[9]++; continue; }
+      if (gen >= cnt) break;
+    } // each mid
 
-      parr = ports + arr;
-      if (parr->valid == 0) continue;
+    if (gen + walklimcnt < cnt) {
+      stats[St_partcnt]++;
+      infocc(dmid < dmidcnt,0,"dmid %u of %u",dmid,dmidcnt);
+    }
 
-      aname = parr->name;
+    wp->genstats[min(gen,geniv)]++;
+    wp->cntstats[min(cnt,geniv)]++;
+
+    // if none found for any dep-Mid-arr, but mid exists, use first one
+    if (cnt > walklimcnt && gen == 0 && firstmid != hi32) {
+      stats[St_nocon]++;
+      info(0,"no conn for %u-%u-%u cnt %u distlim %u durlim %u",dep,firstmid,arr,cnt - walklimcnt,distlim,durlim);
+      depmid = firstdm;
+      midarr = firstma;
+
+      error_z(cnts1[depmid],firstmid);
+      error_z(cnts1[midarr],firstmid);
+
+      ofs1 = conofs1[depmid];
+      ofs2 = conofs1[midarr];
+      lst1 = conlst1 + ofs1;
+      lst2 = conlst1 + ofs2;
+
+      leg1 = lst1[0];
+      error_ge(leg1,whopcnt);
+      dist2 = hopdist[leg1];
+      lstv1[0] = leg1;
+      leg2 = lst2[0];
+      error_ge(leg2,whopcnt);
+      dist2 += hopdist[leg2];
+      lstv1[1] = leg2;
+      lstv1 += 2;
+      if (lodists) lodists[pair] = min(lodists[pair],dist2);
+      gen = 1;
+    }
 
-      amid = 0;
-      for (mid2 = 0; mid2 < portcnt; mid2++) {
-        if (mid2 == dep || mid2 == arr) continue;
-        pmid = ports + mid2;
-        if (pmid->valid == 0) continue;
+    error_gt(gen,cnt,arr);
 
-        mid2arr = mid2 * portcnt + arr;
+    ofs += gen;
+    cnts[pair] = (ub2)gen;
+  } // each arrival port
 
-        n2 = cnts1[mid2arr];
-        if (n2 == 0) continue;
+  cx->rowlen[dep] = ofs - cx->rowofs[dep];
+}
 
-        if (pmid->oneroute) continue;
+// create 1-stop connectivity matrix and derived info
+// uses 1 mid, varying use of underlying nets by stop position
+int mknet1(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly,size_t budget)
+{
+  ub4 partcnt = net->partcnt;
+  ub4 nstop = 1;
+  ub4 portcnt = net->portcnt;
+  ub4 hopcnt = net->hopcnt;
+  ub4 whopcnt = net->whopcnt;
+  block *lstblk;
+  ub2 *cnts;
+  ub4 *portdst;
+  ub4 ofs,*conofs,*conrow,*conarr;
+  ub4 *lst,*newlst,*lstv1;
+  ub4 dep,arr,pair;
+  ub4 iv;
+  ub4 n1,v1,leg,nleg;
+  size_t lstlen,newlstlen,plan = 0;
+  struct bldctx *cx;
+  struct bldwork *sp;
+  int rv;
 
-        amids[amid++] = mid2;
-      }
-      amidcnt = amid;
+  // todo
+  ub4 portlimit = 50000;
+  ub4 lstlimit = 1024 * 1024 * 2024;
+  ub4 altlimit = min(var12limit * 8,256);
+  ub4 depcnt;
 
-      cnt = cntlim = 0;
-      durlim = distlim = hi32;
+  error_zz(portcnt,hopcnt);
 
-      // for each via1
-      // first obtain distance range
-      for (dmid = 0; dmid < dmidcnt; dmid++) {
-        mid1 = dmids[dmid];
-        if (mid1 == arr) continue;
+  info(0,"init 1-stop connections for %u port \ah%u hop network",portcnt,whopcnt);
 
-        depmid1 = dep * portcnt + mid1;
+  info(0,"limits: var %u var12 %u alt %u port %u lst \ah%u",varlimit,var12limit,altlimit,portlimit,lstlimit);
 
-        n1 = cnts1[depmid1];
-        error_z(n1,mid1);
+  portdst = alloc(portcnt, ub4,0,"net portdst",portcnt);
 
-        for (amid = 0; amid < amidcnt; amid++) {
-          mid2 = amids[amid];
-          if (mid2 == mid1) continue;
+  error_zp(net->hopdist,0);
 
-          mid12 = mid1 * portcnt + mid2;
-          n2 = cnts1[mid12];
-          if (n2 == 0) continue;
+  nleg = 2;
 
-          mid2arr = mid2 * portcnt + arr;
-          n3 = cnts1[mid2arr];
-          if (n3 == 0) continue;
+  cx = mkbld(net,nstop,portcnt,0,0);
+  sp = &cx->sum;
+  cx->varlimit = varlimit;
+  cx->var12limit = var12limit;
+  cx->altlimit = altlimit;
+  cx->nilonly = nilonly;
+  cx->budget = budget;
+  cx->portdst = portdst;
+
+  depcnt = portcnt;
+  if (portcnt > portlimit + 1) {
+    warning(0,"limiting net by %u ports",portlimit);
+    depcnt = portlimit + 1;
+  }
 
-          error_ovf(n1,ub2);
-          error_ovf(n2,ub2);
+  if (budget && bldplan(cx,net1pass1,depcnt,&plan)) { rmbld(cx); return 1; }
 
-          n123 = n1 * n2 * n3;
-          if (n123 > var12limit) { cntstats[7]++; n123 = var12limit; }
-          cnt += n123;
-          cntlim = min(cnt,varlimit);
-        } // each mid2
-      } // each mid1
+  rv = bldpass1(cx,net1pass1,depcnt,lstlimit / nleg,2 * (size_t)portcnt);
+  if (rv) { rmbld(cx); return rv; }
+  lstlen = cx->lstlen;
+  bldsum(cx);
+  bldrows(cx);
+  if (plan == 0) plan = bldbytes(cx,cx->pairs,lstlen);
 
-      if (cnt) {  // store info
-        lstlen += cntlim;
-        cnts[deparr] = (ub2)cntlim;
-        outcnt++;
-      }
+  for (iv = 0; iv < Elemcnt(sp->dupstats); iv++) if (sp->dupstats[iv]) info(0,"dup %u: \ah%lu",iv,sp->dupstats[iv]);
 
-      // limits precomputed from file
-//      if (distlims[deparr]) continue;
+  info(0,"1-stop pass 1 done, tentative \ah%lu triplets",lstlen);
 
-      // todo: start with limits derived from previous nstop
-      // e.g. lodists[da] * 2
+  info(0,"cntlim %u partlim dist %u dur %u altlim %u var12 %u",sp->stats[St_cntlim],sp->stats[St_partlimdist],sp->stats[St_partlimdur],sp->stats[St_altlim],sp->stats[St_var12limit]);
+  info(0,"oneroute %u",sp->stats[St_oneroute]);
 
-      // if too many options, sort on distance.
-      if (cnt > varlimit) {
-        cntstats[8]++;
-        cntlimdist = cntlimdur = cntlim / 2;
-        cntlimdist = min(cntlimdist,Distcnt-1);
-        cntlimdur = min(cntlimdur,Durcnt-1);
+  for (iv = 0; iv < Elemcnt(sp->dmidbins); iv++) if (sp->dmidbins[iv] > 64) info(0,"dmids %u: \ah%u",iv,sp->dmidbins[iv]);
 
-        error_z(cntlimdist,cntlim);
-        error_z(cntlimdur,cntlim);
+  warncc(lstlen == 0 && nilonly == 0,0,"no connections at 1-stop for %u ports",portcnt);
+  if (lstlen == 0) { rmbld(cx); return 0; }
 
-        nsethi(dists,Distcnt);
-        nsethi(midurs,Durcnt);
+  ub4 newcnt;
+  struct range portdr;
+  ub4 ivportdst[32];
+  mkhist(caller,portdst,portcnt,&portdr,Elemcnt(ivportdst),ivportdst,"outbounds by port",Vrb);
 
-        // subpass 2: create distance and time top-n lists, derive threshold
-        altcnt = 0;
-        durcnt = distcnt = 0;
+  ub4 geniv = Elemcnt(sp->genstats) - 1;
 
-        for (dmid = 0; dmid < dmidcnt; dmid++) {
-          mid1 = dmids[dmid];
-          if (mid1 == arr) continue;
+  aclear(sp->cntstats);
+  aclear(sp->genstats);
 
-          depmid1 = dep * portcnt + mid1;
-          n1 = cnts1[depmid1];
+  // prepare list and its offsets
+  cx->conofs = alloc(cx->pairs,ub4,0,"net conofs",portcnt);
+  if (partcnt > 1) cx->lodists = alloc(cx->pairs,ub4,0xff,"net lodist",portcnt); // only for partitioned
 
-          for (amid = 0; amid < amidcnt; amid++) {
-            mid2 = amids[amid];
-            if (mid2 == mid1) continue;
+  lstblk = net->conlst + nstop;
 
-            mid12 = mid1 * portcnt + mid2;
-            n2 = cnts1[mid12];
-            if (n2 == 0) continue;
+  lst = mkblock(lstblk,lstlen * nleg,ub4,Noinit,"netv %u-stop conlst",nstop);
 
-            mid2arr = mid2 * portcnt + arr;
-            n3 = cnts1[mid2arr];
-            if (n3 == 0) continue;
+  cx->lst = lst;
 
-            n123 = n1 * n2 * n3;
-            altcnt += n123;
-            if (altcnt > altlimit) { stat_altlim++; break; }
+  if (portcnt < 10000) {
+    ofs = (ub4)bldofs(cx,0,&newcnt);
+    info(0,"\ah%u new connections",newcnt);
+  } else ofs = (ub4)bldofs(cx,0,NULL);
+  error_ne(ofs,lstlen);
 
-            ofs1 = conofs1[depmid1];
-            ofs2 = conofs1[mid12];
-            ofs3 = conofs1[mid2arr];
-            error_eq(ofs1,hi32);
-            error_eq(ofs2,hi32);
-            error_eq(ofs3,hi32);
+  aclear(sp->dupstats);
 
-            lst1 = conlst1 + ofs1;
-            lst2 = conlst1 + ofs2;
-            lst3 = conlst1 + ofs3;
+  if (bldpass2(cx,net1pass2,depcnt,&newlstlen)) { rmbld(cx); return 1; }
+  bldsum(cx);
 
-            bound(lstblk1,ofs1,ub4);
-            bound(lstblk1,ofs2,ub4);
-            bound(lstblk1,ofs3,ub4);
+  error_gt(newlstlen,lstlen,0);
+  info(0,"pass 2 done, \ah%lu from \ah%lu triplets",newlstlen,lstlen);
+  info(0,"%u-stop lists planned \ah%lu b, actual \ah%lu b",nstop,plan,bldbytes(cx,cx->pairs,newlstlen));
 
-            // each dep-via alternative, except dep-*-arr-*-via
-            for (v1 = 0; v1 < n1; v1++) {
-              dist1 = sumwalkdist1 = 0;
-              lst11 = lst1 + v1;
+  if (lstlen - newlstlen > 1024 * 1024 * 64) {
+    newlst = trimblock(lstblk,newlstlen * nleg,ub4);
+  } else newlst = lst;
 
-              leg1 = lst11[0];
-              error_ge(leg1,whopcnt);
-              dist1 += hopdist[leg1];
-              if (leg1 >= chopcnt) sumwalkdist1 = hopdist[leg1];
+  net->lstlen[1] = newlstlen;
 
-              if (durlim != hi32) {
-                midur = prepestdur(net,lst11,1);
-                if ((distlim != hi32 && dist1 > distlim) && midur > durlim) { cntstats[1]++; continue; }
-              } else if (distlim != hi32 && dist1 > distlim) { cntstats[1]++; continue; }
-              else midur = hi32;
-              if (distlim != hi32 && dist1 > distlim * 10) continue;
-
-              for (v2 = 0; v2 < n2; v2++) {
-                dist2 = dist1;
-                lst22 = lst2 + v2;
-
-                walkdist2 = sumwalkdist2 = sumwalkdist1;
-                leg2 = lst22[0];
-
-                if (hoprids[leg1] == hoprids[leg2] && hoprids[leg1] != hi32) continue;
-
-                dist2 += hopdist[leg2];
-                if (leg2 >= chopcnt) {
-                  sumwalkdist2 += hopdist[leg2];
-                  walkdist2 += hopdist[leg2];
-                  if (walkdist2 > walklimit || sumwalkdist2 > sumwalklimit) continue;
-                } else walkdist2 = 0;
+  for (ofs = 0; ofs < newlstlen * nleg; ofs++) {
+    leg = newlst[ofs];
+    error_ge(leg,whopcnt);
+  }
 
-                dur = hopdur[leg2];
-                if (dur != hi32 && midur != hi32) midur += dur;
+  for (iv = 0; iv < Elemcnt(sp->dupstats); iv++) if (sp->dupstats[iv]) info(0,"dup %u: \ah%lu",iv,sp->dupstats[iv]);
 
-                if ((distlim != hi32 && dist2 > distlim) && (durlim != hi32 && midur > durlim)) { cntstats[2]++; continue; }
-                else if (distlim != hi32 && dist2 > distlim * 15) continue;
+  info(0,"no conn %u  partcnt %u  cntlim %u partlim1 %u %u",sp->stats[St_nocon],sp->stats[St_partcnt],sp->stats[St_cntlim],sp->stats[St_partlimdist],sp->stats[St_partlimdur]);
 
-                for (v3 = 0; v3 < n3; v3++) {
-                  dist3 = dist2;
-                  lst33 = lst3 + v3;
+  for (iv = 0; iv <= geniv; iv++) infocc(sp->cntstats[iv],0,"%u: gen \ah%u cnt \ah%u",iv,sp->genstats[iv],sp->cntstats[iv]);
 
-                  walkdist3 = walkdist2;
-                  sumwalkdist3 = sumwalkdist2;
+  bldkeep(cx,1);
+  rmbld(cx);
 
-                  leg3 = lst33[0];
-                  dist3 += hopdist[leg3];
-                  if (leg3 >= chopcnt) {
-                    walkdist3 += hopdist[leg3];
-                    sumwalkdist3 += hopdist[leg3];
-                    if (walkdist3 > walklimit || sumwalkdist3 > sumwalklimit) continue;
-                  }
+  cnts = net->concnt[1];
+  conofs = net->conofs[1];
+  conrow = net->conrow[1];
+  conarr = net->conarr[1];
 
-                  if (distlim != hi32 && dist3 > distlim * 15) continue;
-
-                  midur = estdur_3(net,leg1,leg2,leg3);
-                  if ((distlim != hi32 && dist3 > distlim) && (durlim != hi32 && midur != hi32 && midur > durlim)) { cntstats[2]++; continue; }
-
-                  // maintain top-n list, discard actual trip here
-
-                  if (distcnt == 0) {
-                    dists[0] = dist3;
-                    distcnt = 1;
-                  } else if (distcnt < cntlimdist) {
-                    dists[distcnt++] = dist3;
-                  } else {
-                    hidist = hindx = 0;
-                    for (distndx = 0; distndx < cntlimdist; distndx++) {
-                      if (dists[distndx] > hidist) { hidist = dists[distndx]; hindx = distndx; }
-                    }
-                    if (dist3 < hidist) dists[hindx] = dist3;
-                    distlim = hidist;
-                    error_eq(distlim,hi32);
-                  }
+  // verify all triplets
+  if (portcnt < 10000) {
+    for (dep = 0; dep < portcnt; dep++) {
+      for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+        arr = conarr[pair];
+        if (dep == arr) continue;
 
-                  // idem for time: insertion sort
-                  if (midur == hi32) continue;
-
-                  if (durcnt == 0) {
-                    midurs[0] = midur;
-                    durcnt = 1;
-                  } else if (durcnt < cntlimdur) {
-                    midurs[durcnt++] = midur;
-                  } else {
-                    hidur = hindx = 0;
-                    for (durndx = 0; durndx < cntlimdur; durndx++) {
-                      if (midurs[durndx] > hidur) { hidur = midurs[durndx]; hindx = durndx; }
-                    }
-                    if (midur < hidur) midurs[hindx] = midur;
-                    durlim = hidur;
-                    error_eq(durlim,hi32);
-                  }
+        n1 = cnts[pair];
+        if (n1 == 0) continue;
+        ofs = conofs[pair];
+        lstv1 = newlst + ofs * nleg;
+        for (v1 = 0; v1 < n1; v1++) {
+          checktrip(net,lstv1,nleg,dep,arr,hi32);
+          lstv1 += nleg;
+        }
+      }
+    }
+  }
 
-                } // each v3
-              } // each v2
-            } // each v1
+  struct range conrange;
+  ub4 constats[16];
 
-          } // each mid2
-          if (altcnt > altlimit) break;
+  aclear(constats);
 
-        } // each mid1
+  if (portcnt < 10000 && net->conpairs[1]) mkhist2(cnts,net->conpairs[1],&conrange,Elemcnt(constats),constats,"connection",Info);
 
-        if (distcnt < cntlimdist) stat_partlimdist++;
-        if (durcnt < cntlimdur) stat_partlimdur++;
-        stat_cntlim++;
-      } else {   // not cnt limited
-        distlim = hi32;
-        durlim = hi32;
-      }
-      distlims[deparr] = distlim;
-      durlims[deparr] = durlim;
+  net->lstlen[1] = lstlen;
 
-    } // each arrival port
-    portdst[dep] = outcnt;
+  return 0;
+} // end mknet1
 
-  } // each departure port
+/* Essentially we do for each (departure,arrival) pair:
+   Search for 2 'via' ports such that trip (dep,via1), (via1,via2) and (via2,arr) exist
+   Trim list of alternatives based on e.g. distance
+   Store result by value. This is memory-intensive but keeps code simple
 
-  for (iv = 0; iv < Elemcnt(dupstats); iv++) if (dupstats[iv]) info(0,"dup %u: \ah%lu",iv,dupstats[iv]);
-  for (iv = 0; iv < Elemcnt(cntstats); iv++) if (cntstats[iv]) info(0,"cnt %u: \ah%u",iv,cntstats[iv]);
+   In short:
+   foreach dep
+     foreach arr
+       foreach mid1 with [dep,mid1]
+         foreach mid2 with [mid1,mid2] and [mid2,arr]
+           ...
 
-  info(0,"2-stop pass 1 done, tentative \ah%lu triplets",lstlen);
+*/
 
-  info(0,"cntlim %u partlim %u %u altlim %u",stat_cntlim,stat_partlimdist,stat_partlimdur,stat_altlim);
+/*
+  pass 1 : foreach (dep,arr) pair at this #stops:
+  bound overall best and worst
+  currently, cost is distance only
+  create histogram and derive threshold to use as filter in next pass
+  estimate size of trip list matrix
+  obtain basic stats
+*/
+static void net2pass1(struct bldwork *wp,ub4 dep)
+{
+  struct bldctx *cx = wp->cx;
+  struct network *net = cx->net;
+  ub4 portcnt = net->portcnt;
+  ub4 chopcnt = net->chopcnt;
+  ub4 whopcnt = net->whopcnt;
+  struct port *ports = net->ports,*pmid,*pdep,*parr;
+  block *lstblk1 = net->conlst;
+  ub4 *hoprids = net->hoprids;
+  ub2 *cnts1 = net->concnt[0];
+  ub4 *conrow1 = net->conrow[0],*conarr1 = net->conarr[0];
+  ub4 *con0col = net->con0col,*con0dep = net->con0dep,*con0pair = net->con0pair;
+  ub4 ofs1,ofs2,ofs3,*conofs1 = net->conofs[0];
+  ub4 *conlst1 = blkdata(lstblk1,0,ub4);
+  ub4 *lst1,*lst11,*lst2,*lst22,*lst3,*lst33;
+  ub4 *hopdist = net->hopdist;
+  ub4 *hopdur = net->hopdur;
+  ub8 *allconn = net->allconn;
+  ub4 mid1,mid2,arr,depmid1,mid12,mid2arr,cur,col;
+  ub4 cnt,n1,n2,n3,n123,altcnt,v1,v2,v3,leg1,leg2,leg3;
+  ub4 dist1,dist2,dist3,distlim,walkdist2,walkdist3,sumwalkdist1,sumwalkdist2,sumwalkdist3;
+  ub4 cntlim,cntlimdist,cntlimdur,outcnt;
+  ub4 dur,midur,durndx,durcnt,durlim,distcnt,distndx;
+  ub4 midurs[Durcnt];
+  ub4 dists[Distcnt];
+  ub4 walklimit = net->walklimit;
+  ub4 sumwalklimit = net->sumwalklimit;
+  ub4 varlimit = cx->depclass ? cx->classlims[cx->depclass[dep]] : cx->varlimit;
+  ub4 var12limit = cx->var12limit;
+  ub4 altlimit = cx->altlimit;
+  ub4 dmidlim = cx->dmidlim;
+  bool nilonly = cx->nilonly;
+  ub4 *stats = wp->stats;
+  ub4 *cntstats = wp->cntstats;
+
+  ub4 dmid,dmidcnt,*dmids = wp->dmids,*dpairs = wp->dpairs;
+  ub4 amid,amidcnt,*amids = wp->amids,*apairs = wp->apairs;
+  ub4 *viacnts = wp->viacnts,*viaclamps = wp->viaclamps;
+  ub4 dmidivs = Elemcnt(wp->dmidbins) - 1;
+  ub4 hindx,hidur,hidist;
 
-  for (iv = 0; iv <= dmidivs; iv++) if (dmidbins[iv]) info(0,"dmids %u: \ah%u",iv,dmidbins[iv]);
+  pdep = ports + dep;
+  if (pdep->valid == 0) return;
 
-  warncc(lstlen == 0 && nilonly == 0,0,"no connections at 2-stop for %u ports",portcnt);
-  if (lstlen == 0) return 0;
+  // prepare eligible via's
+  dmid = 0;
+  for (depmid1 = conrow1[dep]; depmid1 < conrow1[dep + 1]; depmid1++) {
+    mid1 = conarr1[depmid1];
+    if (mid1 == dep) continue;
+    pmid = ports + mid1;
+    if (pmid->valid == 0) continue;
 
-  ub4 cnt1,newcnt;
-  struct range portdr;
-  ub4 ivportdst[32];
-  mkhist(caller,portdst,portcnt,&portdr,Elemcnt(ivportdst),ivportdst,"outbounds by port",Vrb);
+    n1 = cnts1[depmid1];
+    if (n1 == 0) continue;
 
-#if 0
-  fmtstring(cachefile,"cache/net_2_part_%u_distlim",part);
-  fd = filecreate(cachefile,0);
-  if (fd != -1) {
-    filewrite(fd,distlims,port2 * sizeof(*distlims),cachefile);
-    fileclose(fd,cachefile);
+    if (pmid->oneroute) {
+      stats[St_oneroute]++;
+      continue;
+    }
+    dpairs[dmid] = depmid1;
+    dmids[dmid++] = mid1;
+    if (dmid >= dmidlim) break;
   }
-#endif
-
-  // prepare list matrix and its offsets
-  conofs = alloc(port2, ub4,0xff,"net conofs",portcnt);  // = org
-
-  lstblk = net->conlst + nstop;
-  lst = mkblock(lstblk,lstlen * nleg,ub4,Init1,"netv %u-stop conlst",nstop);
-
-  ofs = newcnt = 0;
-  for (deparr = 0; deparr < port2; deparr++) {
-    cnt = cnts[deparr];
-    cnt1 = cnts1[deparr];
-    if (cnt) {
-      conofs[deparr] = ofs;
-      ofs += cnt;
-      if (cnt1 == 0) newcnt++;
+  dmidcnt = dmid;
+  wp->dmidbins[min(dmidcnt,dmidivs)]++;
+
+  // count variants to each arr over via pairs. see bldvias()
+  nclear(viacnts,portcnt);
+  nclear(viaclamps,portcnt);
+
+  for (dmid = 0; dmid < dmidcnt; dmid++) {
+    mid1 = dmids[dmid];
+    n1 = cnts1[dpairs[dmid]];
+    error_z(n1,mid1);
+
+    for (mid12 = conrow1[mid1]; mid12 < conrow1[mid1 + 1]; mid12++) {
+      mid2 = conarr1[mid12];
+      if (mid2 == mid1 || mid2 == dep) continue;
+      n2 = cnts1[mid12];
+      if (n2 == 0) continue;
+      pmid = ports + mid2;
+      if (pmid->valid == 0 || pmid->oneroute) continue;
+
+      bldvias(wp,n1 * n2,conarr1,cnts1,conrow1[mid2],conrow1[mid2 + 1],mid1,mid2,var12limit);
     }
   }
-  error_ne(ofs,lstlen);
-  info(0,"\ah%u new connections",newcnt);
-
-  aclear(dupstats);
-
-  // pass 2: fill based on range and thresholds determined above
-  // most code comments from pass 1 apply
-  ofs = 0;
 
-  for (dep = 0; dep < portcnt; dep++) {
+  if (cx->pass == 0) { bldcount(wp,dep); return; }
 
-    if (progress(&eta,"pass 2 port %u/%u 2-stop net \ah%u conns",dep,portcnt,ofs)) return 1;
+  outcnt = 0;
 
-    if (dep > portlimit) continue;
+  // for each arrival port
+  for (arr = 0; arr < portcnt; arr++) {
+    if (arr == dep) continue;
 
-    dmid = 0;
-    for (mid1 = 0; mid1 < portcnt; mid1++) {
-      if (mid1 == dep) continue;
-      pmid = ports + mid1;
-      if (pmid->valid == 0) continue;
+    if (nilonly && conbit(net,allconn,dep,arr)) { cntstats[9]++; continue; }
 
-      depmid1 = dep * portcnt + mid1;
+    parr = ports + arr;
+    if (parr->valid == 0) continue;
 
-      n1 = cnts1[depmid1];
-      if (n1 == 0) continue;
+    durlim = distlim = hi32;
 
-      if (pmid->oneroute) continue;
+    cntstats[7] += viaclamps[arr];
+    cnt = viacnts[arr];
+    if (cnt == 0) continue;
+    cntlim = min(cnt,varlimit);
 
-      dmids[dmid++] = mid1;
-      if (dmid >= dmidlim) break;
-    }
-    dmidcnt = dmid;
+    // store info
+    wp->lstlen += cntlim;
+    outcnt++;
 
-    for (arr = 0; arr < portcnt; arr++) {
-      if (arr == dep) continue;
-      deparr = dep * portcnt + arr;
+    // todo: start with limits derived from previous nstop
+    // e.g. lodists[da] * 2
 
-      cnt = cnts[deparr];
-      if (cnt == 0) continue;
-      gen = cnts[deparr] = 0;
+    // if too many options, sort on distance.
+    if (cnt > varlimit) {
+      cntstats[8]++;
 
+      // vias mid2 to arr
       amid = 0;
-      for (mid2 = 0; mid2 < portcnt; mid2++) {
+      for (col = con0col[arr]; col < con0col[arr + 1]; col++) {
+        mid2 = con0dep[col];
         if (mid2 == dep || mid2 == arr) continue;
         pmid = ports + mid2;
         if (pmid->valid == 0) continue;
 
-        mid2arr = mid2 * portcnt + arr;
+        mid2arr = con0pair[col];
 
         n2 = cnts1[mid2arr];
         if (n2 == 0) continue;
 
         if (pmid->oneroute) continue;
 
+        apairs[amid] = mid2arr;
         amids[amid++] = mid2;
       }
       amidcnt = amid;
+      cntlimdist = cntlimdur = cntlim / 2;
+      cntlimdist = min(cntlimdist,Distcnt-1);
+      cntlimdur = min(cntlimdur,Durcnt-1);
 
-      distlim = distlims[deparr];
-      durlim = durlims[deparr];
-
-//      if (distlim != hi32 || durlim != hi32) info(0,"distlim %u durlim %u",distlim,durlim);
+      error_z(cntlimdist,cntlim);
+      error_z(cntlimdur,cntlim);
 
-      conofs[deparr] = ofs;
-      lstv1 = lst + ofs * nleg;
-      error_ge(ofs,lstlen);
+      nsethi(dists,Distcnt);
+      nsethi(midurs,Durcnt);
 
-      endofs = ofs + cnt - 1;
-
-      error_ge(endofs,lstlen);
-
-      infocc(dbg,0,"port %u-%u concnt %u",dep,arr,gen);
+      // subpass 2: create distance and time top-n lists, derive threshold
+      altcnt = 0;
+      durcnt = distcnt = 0;
 
       for (dmid = 0; dmid < dmidcnt; dmid++) {
         mid1 = dmids[dmid];
-
         if (mid1 == arr) continue;
 
-        depmid1 = dep * portcnt + mid1;
+        depmid1 = dpairs[dmid];
         n1 = cnts1[depmid1];
 
+        cur = conrow1[mid1];
         for (amid = 0; amid < amidcnt; amid++) {
           mid2 = amids[amid];
           if (mid2 == mid1) continue;
 
-          mid12 = mid1 * portcnt + mid2;
+          mid12 = conseek(net,0,&cur,mid1,mid2);
+          if (mid12 == hi32) continue;
           n2 = cnts1[mid12];
           if (n2 == 0) continue;
 
-          mid2arr = mid2 * portcnt + arr;
+          mid2arr = apairs[amid];
           n3 = cnts1[mid2arr];
           if (n3 == 0) continue;
 
+          n123 = n1 * n2 * n3;
+          altcnt += n123;
+          if (altcnt > altlimit) { stats[St_altlim]++; break; }
+
           ofs1 = conofs1[depmid1];
           ofs2 = conofs1[mid12];
           ofs3 = conofs1[mid2arr];
+          error_eq(ofs1,hi32);
+          error_eq(ofs2,hi32);
+          error_eq(ofs3,hi32);
+
           lst1 = conlst1 + ofs1;
           lst2 = conlst1 + ofs2;
           lst3 = conlst1 + ofs3;
@@ -2136,20 +2325,20 @@ int mknet2(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly)
           bound(lstblk1,ofs2,ub4);
           bound(lstblk1,ofs3,ub4);
 
+          // each dep-via alternative, except dep-*-arr-*-via
           for (v1 = 0; v1 < n1; v1++) {
-            dist1 = walkdist1 = 0;
+            dist1 = sumwalkdist1 = 0;
             lst11 = lst1 + v1;
 
             leg1 = lst11[0];
             error_ge(leg1,whopcnt);
             dist1 += hopdist[leg1];
-            if (leg1 >= chopcnt) walkdist1 = hopdist[leg1];
-            if (walkdist1 > walklimit) continue;
+            if (leg1 >= chopcnt) sumwalkdist1 = hopdist[leg1];
 
             if (durlim != hi32) {
               midur = prepestdur(net,lst11,1);
-              if ((distlim != hi32 && dist1 > distlim) && midur > durlim) continue;
-            } else if (distlim != hi32 && dist1 > distlim) continue;
+              if ((distlim != hi32 && dist1 > distlim) && midur > durlim) { cntstats[1]++; continue; }
+            } else if (distlim != hi32 && dist1 > distlim) { cntstats[1]++; continue; }
             else midur = hi32;
             if (distlim != hi32 && dist1 > distlim * 10) continue;
 
@@ -2157,28 +2346,23 @@ int mknet2(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly)
               dist2 = dist1;
               lst22 = lst2 + v2;
 
-              walkdist2 = sumwalkdist2 = walkdist1;
+              walkdist2 = sumwalkdist2 = sumwalkdist1;
               leg2 = lst22[0];
 
               if (hoprids[leg1] == hoprids[leg2] && hoprids[leg1] != hi32) continue;
 
               dist2 += hopdist[leg2];
               if (leg2 >= chopcnt) {
-                walkdist2 += hopdist[leg2];
                 sumwalkdist2 += hopdist[leg2];
+                walkdist2 += hopdist[leg2];
                 if (walkdist2 > walklimit || sumwalkdist2 > sumwalklimit) continue;
               } else walkdist2 = 0;
 
               dur = hopdur[leg2];
               if (dur != hi32 && midur != hi32) midur += dur;
 
-              if ((distlim != hi32 && dist2 > distlim) && (durlim != hi32 && midur > durlim)) continue;
-
-              if (durlim != hi32) {
-                midur = estdur_2(net,leg1,leg2);
-                if ((distlim != hi32 && dist2 > distlim) && midur > durlim) continue;
-              } else if (distlim != hi32 && dist2 > distlim) continue;
-              if (distlim != hi32 && dist2 > distlim * 15) continue;
+              if ((distlim != hi32 && dist2 > distlim) && (durlim != hi32 && midur > durlim)) { cntstats[2]++; continue; }
+              else if (distlim != hi32 && dist2 > distlim * 15) continue;
 
               for (v3 = 0; v3 < n3; v3++) {
                 dist3 = dist2;
@@ -2195,62 +2379,404 @@ int mknet2(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly)
                   if (walkdist3 > walklimit || sumwalkdist3 > sumwalklimit) continue;
                 }
 
-                dur = hopdur[leg3];
-                if (dur != hi32 && midur != hi32) midur += dur;
+                if (distlim != hi32 && dist3 > distlim * 15) continue;
 
-                if ((distlim != hi32 && dist3 > distlim) && (durlim != hi32 && midur > durlim)) continue;
+                midur = estdur_3(net,leg1,leg2,leg3);
+                if ((distlim != hi32 && dist3 > distlim) && (durlim != hi32 && midur != hi32 && midur > durlim)) { cntstats[2]++; continue; }
 
-                if (durlim != hi32) {
-                  midur = estdur_3(net,leg1,leg2,leg3);
-                  if ((distlim != hi32 && dist3 > distlim) && midur > durlim) continue;
-                } else if (distlim != hi32 && dist3 > distlim) continue;
-                if (distlim != hi32 && dist3 > distlim * 15) continue;
+                // maintain top-n list, discard actual trip here
 
-                // candidate passed, store by value
-                lodists[deparr] = min(lodists[deparr],dist3);
-                allcnt[deparr] = 1;
-                gen++;
+                if (distcnt == 0) {
+                  dists[0] = dist3;
+                  distcnt = 1;
+                } else if (distcnt < cntlimdist) {
+                  dists[distcnt++] = dist3;
+                } else {
+                  hidist = hindx = 0;
+                  for (distndx = 0; distndx < cntlimdist; distndx++) {
+                    if (dists[distndx] > hidist) { hidist = dists[distndx]; hindx = distndx; }
+                  }
+                  if (dist3 < hidist) dists[hindx] = dist3;
+                  distlim = hidist;
+                  error_eq(distlim,hi32);
+                }
 
-                leg = lst11[0];
-                lstv1[0] = lst11[0];
-                lstv1[1] = lst22[0];
-                lstv1[2] = lst33[0];
+                // idem for time: insertion sort
+                if (midur == hi32) continue;
 
-                lstv1 += nleg;
+                if (durcnt == 0) {
+                  midurs[0] = midur;
+                  durcnt = 1;
+                } else if (durcnt < cntlimdur) {
+                  midurs[durcnt++] = midur;
+                } else {
+                  hidur = hindx = 0;
+                  for (durndx = 0; durndx < cntlimdur; durndx++) {
+                    if (midurs[durndx] > hidur) { hidur = midurs[durndx]; hindx = durndx; }
+                  }
+                  if (midur < hidur) midurs[hindx] = midur;
+                  durlim = hidur;
+                  error_eq(durlim,hi32);
+                }
 
-                if (gen >= cnt) break;
               } // each v3
-              if (gen >= cnt) break;
             } // each v2
-            if (gen >= cnt) break;
           } // each v1
 
-          if (gen >= cnt) break;
         } // each mid2
+        if (altcnt > altlimit) break;
 
-        if (gen >= cnt) break;
       } // each mid1
 
-      if (gen < cnt) stat_partcnt++;
+      if (distcnt < cntlimdist) stats[St_partlimdist]++;
+      if (durcnt < cntlimdur) stats[St_partlimdur]++;
+      stats[St_cntlim]++;
+    } else {   // not cnt limited
+      distlim = hi32;
+      durlim = hi32;
+    }
+    bldadd(wp,arr,cntlim,distlim,durlim);
+
+  } // each arrival port
+  cx->portdst[dep] = outcnt;
+}
+
+// pass 2: fill based on range and thresholds determined above
+// most code comments from pass 1 apply
+static void net2pass2(struct bldwork *wp,ub4 dep)
+{
+  struct bldctx *cx = wp->cx;
+  struct network *net = cx->net;
+  ub4 chopcnt = net->chopcnt;
+  ub4 whopcnt = net->whopcnt;
+  struct port *ports = net->ports,*pmid;
+  block *lstblk1 = net->conlst;
+  ub4 *hoprids = net->hoprids;
+  ub2 *cnts = cx->cnts,*cnts1 = net->concnt[0];
+  ub4 *conrow = cx->conrow,*conarr = cx->conarr;
+  ub4 *conrow1 = net->conrow[0],*conarr1 = net->conarr[0];
+  ub4 *con0col = net->con0col,*con0dep = net->con0dep,*con0pair = net->con0pair;
+  ub4 ofs,ofs1,ofs2,ofs3,endofs,*conofs = cx->conofs,*conofs1 = net->conofs[0];
+  ub4 *conlst1 = blkdata(lstblk1,0,ub4);
+  ub4 *lst = cx->lst,*lst1,*lst11,*lst2,*lst22,*lst3,*lst33,*lstv1;
+  ub4 *hopdist = net->hopdist;
+  ub4 *hopdur = net->hopdur;
+  ub4 *lodists = cx->lodists;
+  size_t lstlen = cx->lstlen;
+  ub4 mid1,mid2,arr,pair,depmid1,mid12,mid2arr,cur,col;
+  ub4 cnt,n1,n2,n3,v1,v2,v3,leg1,leg2,leg3,nleg = 3;
+  ub4 dist1,dist2,dist3,distlim,walkdist1,walkdist2,walkdist3,sumwalkdist2,sumwalkdist3;
+  ub4 gen,dur,midur,durlim;
+  ub4 walklimit = net->walklimit;
+  ub4 sumwalklimit = net->sumwalklimit;
+  ub4 dmidlim = cx->dmidlim;
+  ub4 *stats = wp->stats;
+
+  ub4 dmid,dmidcnt,*dmids = wp->dmids,*dpairs = wp->dpairs;
+  ub4 amid,amidcnt,*amids = wp->amids,*apairs = wp->apairs;
+
+  ofs = cx->rowofs[dep];
+
+  dmid = 0;
+  for (depmid1 = conrow1[dep]; depmid1 < conrow1[dep + 1]; depmid1++) {
+    mid1 = conarr1[depmid1];
+    if (mid1 == dep) continue;
+    pmid = ports + mid1;
+    if (pmid->valid == 0) continue;
+
+    n1 = cnts1[depmid1];
+    if (n1 == 0) continue;
+
+    if (pmid->oneroute) continue;
+
+    dpairs[dmid] = depmid1;
+    dmids[dmid++] = mid1;
+    if (dmid >= dmidlim) break;
+  }
+  dmidcnt = dmid;
+
+  for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+    arr = conarr[pair];
+
+    cnt = cnts[pair];
+    if (cnt == 0) continue;
+    gen = cnts[pair] = 0;
+
+    amid = 0;
+    for (col = con0col[arr]; col < con0col[arr + 1]; col++) {
+      mid2 = con0dep[col];
+      if (mid2 == dep || mid2 == arr) continue;
+      pmid = ports + mid2;
+      if (pmid->valid == 0) continue;
+
+      mid2arr = con0pair[col];
+
+      n2 = cnts1[mid2arr];
+      if (n2 == 0) continue;
+
+      if (pmid->oneroute) continue;
+
+      apairs[amid] = mid2arr;
+      amids[amid++] = mid2;
+    }
+    amidcnt = amid;
+
+    distlim = cx->distlims[pair];
+    durlim = cx->durlims[pair];
+
+    conofs[pair] = ofs;
+    lstv1 = lst + (size_t)ofs * nleg;
+    error_ge(ofs,lstlen);
+
+    endofs = ofs + cnt - 1;
+
+    error_ge(endofs,lstlen);
+
+    for (dmid = 0; dmid < dmidcnt; dmid++) {
+      mid1 = dmids[dmid];
+
+      if (mid1 == arr) continue;
+
+      depmid1 = dpairs[dmid];
+      n1 = cnts1[depmid1];
+
+      cur = conrow1[mid1];
+      for (amid = 0; amid < amidcnt; amid++) {
+        mid2 = amids[amid];
+        if (mid2 == mid1) continue;
+
+        mid12 = conseek(net,0,&cur,mid1,mid2);
+        if (mid12 == hi32) continue;
+        n2 = cnts1[mid12];
+        if (n2 == 0) continue;
+
+        mid2arr = apairs[amid];
+        n3 = cnts1[mid2arr];
+        if (n3 == 0) continue;
+
+        ofs1 = conofs1[depmid1];
+        ofs2 = conofs1[mid12];
+        ofs3 = conofs1[mid2arr];
+        lst1 = conlst1 + ofs1;
+        lst2 = conlst1 + ofs2;
+        lst3 = conlst1 + ofs3;
+
+        bound(lstblk1,ofs1,ub4);
+        bound(lstblk1,ofs2,ub4);
+        bound(lstblk1,ofs3,ub4);
+
+        for (v1 = 0; v1 < n1; v1++) {
+          dist1 = walkdist1 = 0;
+          lst11 = lst1 + v1;
+
+          leg1 = lst11[0];
+          error_ge(leg1,whopcnt);
+          dist1 += hopdist[leg1];
+          if (leg1 >= chopcnt) walkdist1 = hopdist[leg1];
+          if (walkdist1 > walklimit) continue;
+
+          if (durlim != hi32) {
+            midur = prepestdur(net,lst11,1);
+            if ((distlim != hi32 && dist1 > distlim) && midur > durlim) continue;
+          } else if (distlim != hi32 && dist1 > distlim) continue;
+          else midur = hi32;
+          if (distlim != hi32 && dist1 > distlim * 10) continue;
+
+          for (v2 = 0; v2 < n2; v2++) {
+            dist2 = dist1;
+            lst22 = lst2 + v2;
+
+            walkdist2 = sumwalkdist2 = walkdist1;
+            leg2 = lst22[0];
+
+            if (hoprids[leg1] == hoprids[leg2] && hoprids[leg1] != hi32) continue;
+
+            dist2 += hopdist[leg2];
+            if (leg2 >= chopcnt) {
+              walkdist2 += hopdist[leg2];
+              sumwalkdist2 += hopdist[leg2];
+              if (walkdist2 > walklimit || sumwalkdist2 > sumwalklimit) continue;
+            } else walkdist2 = 0;
+
+            dur = hopdur[leg2];
+            if (dur != hi32 && midur != hi32) midur += dur;
+
+            if ((distlim != hi32 && dist2 > distlim) && (durlim != hi32 && midur > durlim)) continue;
+
+            if (durlim != hi32) {
+              midur = estdur_2(net,leg1,leg2);
+              if ((distlim != hi32 && dist2 > distlim) && midur > durlim) continue;
+            } else if (distlim != hi32 && dist2 > distlim) continue;
+            if (distlim != hi32 && dist2 > distlim * 15) continue;
+
+            for (v3 = 0; v3 < n3; v3++) {
+              dist3 = dist2;
+              lst33 = lst3 + v3;
+
+              walkdist3 = walkdist2;
+              sumwalkdist3 = sumwalkdist2;
+
+              leg3 = lst33[0];
+              dist3 += hopdist[leg3];
+              if (leg3 >= chopcnt) {
+                walkdist3 += hopdist[leg3];
+                sumwalkdist3 += hopdist[leg3];
+                if (walkdist3 > walklimit || sumwalkdist3 > sumwalklimit) continue;
+              }
+
+              dur = hopdur[leg3];
+              if (dur != hi32 && midur != hi32) midur += dur;
+
+              if ((distlim != hi32 && dist3 > distlim) && (durlim != hi32 && midur > durlim)) continue;
+
+              if (durlim != hi32) {
+                midur = estdur_3(net,leg1,leg2,leg3);
+                if ((distlim != hi32 && dist3 > distlim) && midur > durlim) continue;
+              } else if (distlim != hi32 && dist3 > distlim) continue;
+              if (distlim != hi32 && dist3 > distlim * 15) continue;
+
+              // candidate passed, store by value
+              lodists[pair] = min(lodists[pair],dist3);
+              gen++;
+
+              lstv1[0] = lst11[0];
+              lstv1[1] = lst22[0];
+              lstv1[2] = lst33[0];
+
+              lstv1 += nleg;
+
+              if (gen >= cnt) break;
+            } // each v3
+            if (gen >= cnt) break;
+          } // each v2
+          if (gen >= cnt) break;
+        } // each v1
+
+        if (gen >= cnt) break;
+      } // each mid2
+
+      if (gen >= cnt) break;
+    } // each mid1
+
+    if (gen < cnt) stats[St_partcnt]++;
+
+    error_gt(gen,cnt,arr);
+    warncc(cnt && gen == 0,Iter,"dep %u arr %u no conn distlim %u durlim %u",dep,arr,distlim,durlim);
+
+    ofs += gen;
+    cnts[pair] = (ub2)gen;
+    error_gt(ofs,lstlen,0);
+
+  } // each arrival port
+
+  cx->rowlen[dep] = ofs - cx->rowofs[dep];
+}
+
+// create 2-stop connectivity matrix and derived info
+// uses 2 mids, varying use of underlying nets for each
+int mknet2(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly,size_t budget)
+{
+  ub4 portcnt = net->portcnt;
+  ub4 hopcnt = net->hopcnt;
+  ub4 whopcnt = net->whopcnt;
+  ub4 nstop = 2;
+  block *lstblk;
+  ub2 *cnts;
+  ub4 *portdst;
+  ub4 ofs,*conofs,*conrow,*conarr;
+  ub4 *lst,*newlst,*lstv1;
+  ub4 dep,arr,port2,pair;
+  ub4 iv;
+  ub4 n1,v1,leg,nleg;
+  size_t lstlen,newlstlen,plan = 0;
+  struct bldctx *cx;
+  struct bldwork *sp;
+  int rv;
+
+  // todo
+  ub4 portlimit = 9000;
+  ub4 lstlimit = 1024 * 1024 * 512;
+  ub4 altlimit = min(var12limit * 4,128);
+  ub4 dmidlim = 16;
+  ub4 depcnt;
+
+  error_zz(portcnt,hopcnt);
+
+  info(0,"init %u-stop connections for %u port %u hop network",nstop,portcnt,whopcnt);
+
+  info(0,"limits: var %u var12 %u alt %u port %u lst \ah%u",varlimit,var12limit,altlimit,portlimit,lstlimit);
+
+  port2 = portcnt * portcnt;
+
+  portdst = alloc(portcnt, ub4,0,"net portdst",portcnt);
+
+  error_zp(net->hopdist,0);
+
+  nleg = 3;
+
+  cx = mkbld(net,nstop,portcnt,portcnt,0);
+  sp = &cx->sum;
+  cx->varlimit = varlimit;
+  cx->var12limit = var12limit;
+  cx->altlimit = altlimit;
+  cx->dmidlim = dmidlim;
+  cx->nilonly = nilonly;
+  cx->budget = budget;
+  cx->portdst = portdst;
+
+  depcnt = portcnt;
+  if (portcnt > portlimit + 1) {
+    warning(0,"limiting net by %u ports",portlimit);
+    depcnt = portlimit + 1;
+  }
+
+  if (budget && bldplan(cx,net2pass1,depcnt,&plan)) { rmbld(cx); return 1; }
+
+  rv = bldpass1(cx,net2pass1,depcnt,lstlimit / nleg,2 * (size_t)port2);
+  if (rv) { rmbld(cx); return rv; }
+  lstlen = cx->lstlen;
+  bldsum(cx);
+  bldrows(cx);
+  if (plan == 0) plan = bldbytes(cx,cx->pairs,lstlen);
+
+  for (iv = 0; iv < Elemcnt(sp->dupstats); iv++) if (sp->dupstats[iv]) info(0,"dup %u: \ah%lu",iv,sp->dupstats[iv]);
+  for (iv = 0; iv < Elemcnt(sp->cntstats); iv++) if (sp->cntstats[iv]) info(0,"cnt %u: \ah%u",iv,sp->cntstats[iv]);
+
+  info(0,"2-stop pass 1 done, tentative \ah%lu triplets",lstlen);
+
+  info(0,"cntlim %u partlim %u %u altlim %u",sp->stats[St_cntlim],sp->stats[St_partlimdist],sp->stats[St_partlimdur],sp->stats[St_altlim]);
 
-      error_gt(gen,cnt,arr);
-      warncc(cnt && gen == 0,Iter,"dep %u arr %u no conn distlim %u durlim %u",dep,arr,distlim,durlim);
+  for (iv = 0; iv < Elemcnt(sp->dmidbins); iv++) if (sp->dmidbins[iv]) info(0,"dmids %u: \ah%u",iv,sp->dmidbins[iv]);
 
-      ofs += gen;
-      cnts[deparr] = (ub2)gen;
-      infocc(dbg,0,"port %u-%u concnt %u",dep,arr,gen);
-      error_gt(ofs,lstlen,0);
+  warncc(lstlen == 0 && nilonly == 0,0,"no connections at 2-stop for %u ports",portcnt);
+  if (lstlen == 0) { rmbld(cx); return 0; }
+
+  ub4 newcnt;
+  struct range portdr;
+  ub4 ivportdst[32];
+  mkhist(caller,portdst,portcnt,&portdr,Elemcnt(ivportdst),ivportdst,"outbounds by port",Vrb);
+
+  // prepare list and its offsets
+  cx->conofs = alloc(cx->pairs,ub4,0xff,"net conofs",portcnt);
+  cx->lodists = alloc(cx->pairs,ub4,0xff,"net lodist",portcnt);
+
+  lstblk = net->conlst + nstop;
+  lst = mkblock(lstblk,lstlen * nleg,ub4,Init1,"netv %u-stop conlst",nstop);
+
+  cx->lst = lst;
+
+  ofs = (ub4)bldofs(cx,0,&newcnt);
+  error_ne(ofs,lstlen);
+  info(0,"\ah%u new connections",newcnt);
 
-    } // each arrival port
+  aclear(sp->dupstats);
 
-  } // each departure port
+  if (bldpass2(cx,net2pass2,depcnt,&newlstlen)) { rmbld(cx); return 1; }
+  bldsum(cx);
 
-  newlstlen = ofs;
   error_gt(newlstlen,lstlen,0);
   info(0,"pass 2 done, \ah%lu from \ah%lu triplets",newlstlen,lstlen);
-
-  afree(distlims,"net distlims");
-  afree(durlims,"net durlims");
+  info(0,"%u-stop lists planned \ah%lu b, actual \ah%lu b",nstop,plan,bldbytes(cx,cx->pairs,newlstlen));
 
   if (lstlen - newlstlen > 1024 * 1024 * 64) {
     newlst = trimblock(lstblk,newlstlen * nleg,ub4);
@@ -2262,19 +2788,27 @@ int mknet2(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly)
     error_ge(leg,whopcnt);
   }
 
-  for (iv = 0; iv < Elemcnt(dupstats); iv++) if (dupstats[iv]) info(0,"dup %u: \ah%lu",iv,dupstats[iv]);
+  for (iv = 0; iv < Elemcnt(sp->dupstats); iv++) if (sp->dupstats[iv]) info(0,"dup %u: \ah%lu",iv,sp->dupstats[iv]);
+
+  info(0,"no conn %u  partcnt %u  cntlim %u",sp->stats[St_nocon],sp->stats[St_partcnt],sp->stats[St_cntlim]);
+
+  bldkeep(cx,nstop);
+  rmbld(cx);
 
-  info(0,"no conn %u  partcnt %u  cntlim %u",stat_nocon,stat_partcnt,stat_cntlim);
+  cnts = net->concnt[nstop];
+  conofs = net->conofs[nstop];
+  conrow = net->conrow[nstop];
+  conarr = net->conarr[nstop];
 
   // verify all triplets
   for (dep = 0; dep < portcnt; dep++) {
-    for (arr = 0; arr < portcnt; arr++) {
+    for (pair = conrow[dep]; pair < conrow[dep + 1]; pair++) {
+      arr = conarr[pair];
       if (dep == arr) continue;
 
-      deparr = dep * portcnt + arr;
-      n1 = cnts[deparr];
+      n1 = cnts[pair];
       if (n1 == 0) continue;
-      ofs = conofs[deparr];
+      ofs = conofs[pair];
       lstv1 = newlst + ofs * nleg;
       for (v1 = 0; v1 < n1; v1++) {
         checktrip(net,lstv1,nleg,dep,arr,hi32);
@@ -2287,14 +2821,101 @@ int mknet2(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly)
   ub4 constats[16];
 
   aclear(constats);
-  mkhist2(cnts,port2,&conrange,Elemcnt(constats),constats,"connection",Info);
-
-  net->concnt[nstop] = cnts;
-  net->conofs[nstop] = conofs;
-
-  net->lodist[nstop] = lodists;
+  if (net->conpairs[nstop]) mkhist2(cnts,net->conpairs[nstop],&conrange,Elemcnt(constats),constats,"connection",Info);
 
   net->lstlen[nstop] = lstlen;
 
   return 0;
 } // end mknet2
+
+/* On-demand 2-stop rows, for partitions too large to precompute the level. see getdeprow()
+   A row is made by the passes of mknet2() for a single dep, serially on a context
+   kept for the partition. Its arrays are sized for any dep, so a row needs no allocations.
+   The 0-stop list is read unpacked, see net->lstwid0
+ */
+struct bldctx *mkdepbld(struct network *net)
+{
+  ub4 portcnt = net->portcnt;
+  ub4 varlimit,var12limit;
+  bool nilonly;
+  struct bldctx *cx;
+
+  netnlimits(2,&varlimit,&var12limit,&nilonly);
+
+  cx = mkbld(net,2,portcnt,portcnt,1);
+  cx->varlimit = varlimit;
+  cx->var12limit = var12limit;
+  cx->altlimit = min(var12limit * 4,128);
+  cx->dmidlim = 16;
+  cx->nilonly = nilonly;
+
+  cx->portdst = alloc(portcnt,ub4,0,"net portdst",portcnt);
+  cx->conarr = alloc(portcnt,ub4,0,"net conarr",portcnt);
+  cx->cnts = alloc(portcnt,ub2,0,"net concnt",portcnt);
+  cx->distlims = alloc(portcnt * 2,ub4,0,"net distlims",portcnt);
+  cx->durlims = cx->distlims + portcnt;
+  cx->conofs = alloc(portcnt,ub4,0,"net conofs",portcnt);
+  cx->lodists = alloc(portcnt,ub4,0,"net lodist",portcnt);
+  cx->rowofs = alloc(portcnt * 2,ub4,0,"net rowofs",portcnt);
+  cx->rowlen = cx->rowofs + portcnt;
+  cx->lst = alloc(portcnt * varlimit * 3,ub4,0,"net deprow",portcnt);
+  return cx;
+}
+
+void rmdepbld(struct bldctx *cx)
+{
+  afree(cx->portdst,"net portdst");
+  afree(cx->lst,"net deprow");
+  rmbld(cx);
+}
+
+// build the row of dep into the context. rp points into it until the next row
+void mkdeprow(struct bldctx *cx,ub4 dep,struct deprow *rp)
+{
+  struct bldwork *wp = cx->work;
+  struct bldrow *brp;
+  ub4 *conrow = cx->conrow,*conarr = cx->conarr,*conofs = cx->conofs,*lodists = cx->lodists;
+  ub2 *cnts = cx->cnts;
+  ub4 pair,pairs,npair = 0;
+
+  wp->rowcnt = 0;
+  wp->lstlen = 0;
+  cx->pass = 1;
+  net2pass1(wp,dep);
+
+  pairs = wp->rowcnt;
+  conrow[dep] = 0;
+  conrow[dep + 1] = pairs;
+  for (pair = 0; pair < pairs; pair++) {
+    brp = wp->rows + pair;
+    conarr[pair] = brp->arr;
+    cnts[pair] = (ub2)brp->cnt;
+    cx->distlims[pair] = brp->distlim;
+    cx->durlims[pair] = brp->durlim;
+    lodists[pair] = hi32;
+  }
+  cx->lstlen = wp->lstlen;
+  cx->rowofs[dep] = 0;
+  cx->rowlen[dep] = 0;
+
+  cx->pass = 2;
+  if (pairs) net2pass2(wp,dep);
+
+  // drop pairs left without trips. variants are filled contiguously
+  for (pair = 0; pair < pairs; pair++) {
+    if (cnts[pair] == 0) continue;
+    conarr[npair] = conarr[pair];
+    cnts[npair] = cnts[pair];
+    conofs[npair] = conofs[pair];
+    lodists[npair] = lodists[pair];
+    npair++;
+  }
+
+  rp->pairs = npair;
+  rp->arrs = conarr;
+  rp->cnts = cnts;
+  rp->ofss = conofs;
+  rp->lodists = lodists;
+  rp->varcnt = cx->rowlen[dep];
+  rp->lst = cx->lst;
+}
@@ -11,6 +11,12 @@
 
 
 extern void ininetn(void);
-extern int mknet1(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly);
-extern int mknet2(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly);
-extern int mknetn(struct network *net,ub4 nstop,ub4 varlimit,ub4 var12limit,bool nilonly);
+extern int mknet1(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly,size_t budget);
+extern int mknet2(struct network *net,ub4 varlimit,ub4 var12limit,bool nilonly,size_t budget);
+extern int mknetn(struct network *net,ub4 nstop,ub4 varlimit,ub4 var12limit,bool nilonly,size_t budget);
+
+struct bldctx;
+struct deprow;
+extern struct bldctx *mkdepbld(struct network *net);
+extern void rmdepbld(struct bldctx *cx);
+extern void mkdeprow(struct bldctx *cx,ub4 dep,struct deprow *rp);
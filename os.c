@@ -21,14 +21,17 @@
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/resource.h>
 
 //#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include <netdb.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include <errno.h>
@@ -54,8 +57,8 @@ static ub4 msgfile;
 #include "time.h"
 
 // copy at tentative messages
-static char msginfo[1024];
-static ub4 msginfolen;
+static Tls char msginfo[1024];
+static Tls ub4 msginfolen;
 
 static pid_t mypid;
 static char pidstr[64];
@@ -207,6 +210,62 @@ int osmunmap(void *p,size_t len)
 }
 #endif
 
+// map a file at the given address, to share a memory image among processes
+void *osmmapfile(const char *name,size_t len,void *adr,ub4 opts)
+{
+  int fd,oflags = O_RDWR,mflags;
+  void *p;
+
+  if (opts & Osmap_create) oflags |= O_CREAT|O_TRUNC;
+  fd = open(name,oflags,0644);
+  if (fd == -1) { oserror(0,"cannot open %s",name); return NULL; }
+  if ((opts & Osmap_create) && ftruncate(fd,(off_t)len)) {
+    oserror(0,"cannot size %s to \ah%lu b",name,(ub8)len);
+    close(fd);
+    return NULL;
+  }
+  mflags = (opts & Osmap_shared) ? MAP_SHARED : MAP_PRIVATE;
+  if (opts & Osmap_fixed) mflags |= MAP_FIXED;
+  p = mmap(adr,len,PROT_READ|PROT_WRITE,mflags,fd,0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    oserror(0,"mmap of %s failed for \ah%lu b",name,(ub8)len);
+    return NULL;
+  }
+  if (adr && p != adr) {
+    munmap(p,len);
+    error(0,"%s mapped at %p instead of %p",name,p,adr);
+    return NULL;
+  }
+  return p;
+}
+
+int osmsync(void *p,size_t len)
+{
+  return msync(p,len,MS_SYNC);
+}
+
+// give back pages of a shared file mapping
+int osmrelease(void *p,size_t len)
+{
+#ifdef MADV_REMOVE
+  return madvise(p,len,MADV_REMOVE);
+#else
+  vrb0(0,"keep %lu",len);
+  return 0;
+#endif
+}
+
+int ostruncate(const char *name,size_t len)
+{
+  return truncate(name,(off_t)len);
+}
+
+int osrename(const char *old,const char *new)
+{
+  return rename(old,new);
+}
+
 static void mysigint(int __attribute__ ((unused)) sig,siginfo_t *si,void * __attribute__ ((unused)) pp)
 {
   int n = globs.sigint++;
@@ -310,6 +369,11 @@ int setsigs(void)
   sa.sa_sigaction = mysigint;
   sigaction(SIGINT, &sa,NULL);
 
+  // a client closing its connection early is reported by write
+  oclear(sa);
+  sa.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &sa,NULL);
+
   return 0;
 }
 
@@ -325,6 +389,15 @@ void osmillisleep(ub4 msec)
   nanosleep(&ts,NULL);
 }
 
+// online cpus, 1 if unknown
+ub4 oscpucnt(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (n < 1) return 1;
+  return (ub4)n;
+}
+
 int oswaitany(ub4 *cldcnt)
 {
   int status,sig,rv = 0;
@@ -386,6 +459,38 @@ int osrun(const char *cmd,char *const argv[],char *const envp[])
   return 1;
 }
 
+// fork/exec cmd without waiting. return pid, or -1
+int osspawn(const char *cmd,char *const argv[])
+{
+  pid_t pid;
+  int fd;
+
+  pid = fork();
+  if (pid == -1) { oserror(0,"cannot fork for %s",cmd); return -1; }
+  else if (pid) return (int)pid;
+
+  for (fd = 3; fd < 1024; fd++) close(fd);
+  execvp(cmd,argv);
+  oserror(0,"cannot run %s",cmd);
+  _exit(1);
+}
+
+// check for exit of a spawned process. return 1 if exited, with its exit code in *prv
+int osreap(int pid,int *prv)
+{
+  int status = 0;
+  pid_t rv = waitpid((pid_t)pid,&status,WNOHANG);
+
+  if (rv == 0) return 0;
+  if (rv == -1) {
+    *prv = (errno == ECHILD ? 0 : -1);  // may have been reaped by oswaitany
+    return 1;
+  }
+  if (WIFEXITED(status)) *prv = WEXITSTATUS(status);
+  else *prv = -1;
+  return 1;
+}
+
 int osbackground(void)
 {
   pid_t pid = fork();
@@ -433,9 +538,13 @@ int ossocket(bool inet)
 int osbind(int fd,ub4 port)
 {
   struct sockaddr_in adr;
+  int one = 1;
 
   oclear(adr);
 
+  // allow restart while connections of a previous run linger
+  setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+
   adr.sin_family = AF_INET;
   adr.sin_port = htons(port);
   adr.sin_addr.s_addr = INADDR_ANY;
@@ -452,26 +561,146 @@ int oslisten(int fd,int backlog)
   return 0;
 }
 
+// bind to a local socket, removing a stale one left by a previous run
+int osbindlocal(int fd,const char *path)
+{
+  struct sockaddr_un adr;
+
+  oclear(adr);
+
+  if (strlen(path) >= sizeof(adr.sun_path)) return error(0,"local socket name %s too long",path);
+  adr.sun_family = AF_UNIX;
+  strcopy(adr.sun_path,path);
+
+  if (unlink(path) && errno != ENOENT) return oserror(0,"cannot remove %s",path);
+
+  if (bind(fd,(struct sockaddr *)&adr,sizeof(adr)) == -1) {
+    return oserror(0,"cannot bind socket %u to %s",fd,path);
+  }
+  return 0;
+}
+
 int osaccept(int sfd,struct osnetadr *ai)
 {
   int cfd;
-  struct sockaddr_in sa;
-  socklen_t len = sizeof(sa);
+  struct sockaddr_storage ss;
+  struct sockaddr_in *sa = (struct sockaddr_in *)&ss;
+  socklen_t len = sizeof(ss);
   ub4 port;
+  int one = 1;
 
-  cfd = accept(sfd,(struct sockaddr *)&sa,&len);
+  cfd = accept(sfd,(struct sockaddr *)&ss,&len);
   if (cfd == -1) {
     if (globs.sigint == 0) oserror(0,"cannot listen on socket %u",sfd);
     return -1;
   }
 
-  port = ntohs(sa.sin_port);
-  info(0,"new connection from %s:%u",inet_ntoa(sa.sin_addr),port);
-  ai->host = ntohl(sa.sin_addr.s_addr);
+  if (ss.ss_family != AF_INET) {
+    info(0,"new local connection on %u",cfd);
+    ai->host = ai->port = 0;
+    return cfd;
+  }
+
+  // replies are written as header and body : do not wait for acks in between
+  setsockopt(cfd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+
+  port = ntohs(sa->sin_port);
+  info(0,"new connection from %s:%u",inet_ntoa(sa->sin_addr),port);
+  ai->host = ntohl(sa->sin_addr.s_addr);
   ai->port = port;
   return cfd;
 }
 
+int osconnect(int fd,const char *host,ub4 port)
+{
+  struct sockaddr_in adr;
+
+  oclear(adr);
+
+  if (port == 0 || port > 65535) return error(0,"invalid port %u for %s",port,host);
+  adr.sin_family = AF_INET;
+  adr.sin_port = htons((ub2)port);
+  if (inet_pton(AF_INET,host,&adr.sin_addr) != 1) return error(0,"invalid host address %s",host);
+
+  if (connect(fd,(struct sockaddr *)&adr,sizeof(adr)) == -1) {
+    return oserror(0,"cannot connect to %s:%u",host,port);
+  }
+  return 0;
+}
+
+int osconnectlocal(int fd,const char *path)
+{
+  struct sockaddr_un adr;
+
+  oclear(adr);
+
+  if (strlen(path) >= sizeof(adr.sun_path)) return error(0,"local socket name %s too long",path);
+  adr.sun_family = AF_UNIX;
+  strcopy(adr.sun_path,path);
+
+  if (connect(fd,(struct sockaddr *)&adr,sizeof(adr)) == -1) {
+    return oserror(0,"cannot connect to %s",path);
+  }
+  return 0;
+}
+
+// write all of buf to a socket or pipe
+int oswriteall(int fd,const void *buf,ub4 len)
+{
+  const char *p = buf;
+  ub4 pos = 0;
+  long nw;
+
+  while (pos < len) {
+    nw = oswrite(fd,p + pos,len - pos);
+    if (nw == -1) return oserror(0,"cannot write to connection %d at %u",fd,pos);
+    else if (nw == 0) return error(0,"eof on connection %d at %u",fd,pos);
+    pos += (ub4)nw;
+  }
+  return 0;
+}
+
+// read exactly len bytes. silently return 1 on eof before any data
+int osreadall(int fd,void *buf,ub4 len)
+{
+  char *p = buf;
+  ub4 pos = 0;
+  long nr;
+
+  while (pos < len) {
+    nr = osread(fd,p + pos,len - pos);
+    if (nr == -1) return oserror(0,"cannot read from connection %d at %u",fd,pos);
+    else if (nr == 0) return pos ? error(0,"eof on connection %d at %u of %u",fd,pos,len) : 1;
+    pos += (ub4)nr;
+  }
+  return 0;
+}
+
+/* wait at most msec for any of fds to become readable
+   rdy is set per fd, return count of ready fds, 0 at timeout or signal, -1 on error
+ */
+int ospoll(const int *fds,ub1 *rdy,ub4 cnt,ub4 msec)
+{
+  struct pollfd pfds[256];
+  ub4 n;
+  int rv;
+
+  if (cnt > Elemcnt(pfds)) { error(0,"cannot poll %u fds, max %u",cnt,(ub4)Elemcnt(pfds)); return -1; }
+
+  for (n = 0; n < cnt; n++) {
+    pfds[n].fd = fds[n];
+    pfds[n].events = POLLIN;
+    pfds[n].revents = 0;
+  }
+  rv = poll(pfds,cnt,(int)msec);
+  if (rv == -1) {
+    if (errno == EINTR) rv = 0;
+    else { oserror(0,"cannot poll %u fds",cnt); return -1; }
+  }
+  for (n = 0; n < cnt; n++) rdy[n] = (pfds[n].revents != 0);
+  return rv;
+}
+
 static const char namepattern[] = "p_glob_542346b6f3b_5dfa.rcv";
 
 // arrange reply to previous query
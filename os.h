@@ -28,6 +28,8 @@ extern int osmkdir(const char *dir);
 extern int osexists(const char *name);
 
 extern int osrun(const char *cmd,char *const argv[],char *const envp[]);
+extern int osspawn(const char *cmd,char *const argv[]);
+extern int osreap(int pid,int *prv);
 extern int oswaitany(ub4 *cldcnt);
 extern int osbackground(void);
 
@@ -36,6 +38,13 @@ extern int osrewind(int fd);
 extern void *osmmap(size_t len);
 extern int osmunmap(void *p,size_t len);
 
+enum Osmapopts { Osmap_create = 1,Osmap_shared = 2,Osmap_fixed = 4 };
+extern void *osmmapfile(const char *name,size_t len,void *adr,ub4 opts);
+extern int osmsync(void *p,size_t len);
+extern int osmrelease(void *p,size_t len);
+extern int ostruncate(const char *name,size_t len);
+extern int osrename(const char *old,const char *new);
+
 extern int setsigs(void);
 extern int oslimits(void);
 
@@ -45,11 +54,18 @@ extern int getqentry(const char *qdir,struct myfile *mf,const char *region,const
 extern int setqentry(struct myfile *mfreq,struct myfile *mfrep,const char *ext);
 
 extern void osmillisleep(ub4 msec);
+extern ub4 oscpucnt(void);
 
 extern int ossocket(bool inet);
 extern int osbind(int fd,ub4 port);
+extern int osbindlocal(int fd,const char *path);
 extern int oslisten(int fd,int backlog);
 extern int osaccept(int sfd,struct osnetadr *ai);
+extern int ospoll(const int *fds,ub1 *rdy,ub4 cnt,ub4 msec);
+extern int osconnect(int fd,const char *host,ub4 port);
+extern int osconnectlocal(int fd,const char *path);
+extern int oswriteall(int fd,const void *buf,ub4 len);
+extern int osreadall(int fd,void *buf,ub4 len);
 
 extern ub4 osmeminfo(void);
 
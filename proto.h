@@ -0,0 +1,136 @@
+// proto.h - framing for the socket interface between server and clients
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+/* A client connects to the server's tcp port or local socket, and sends requests
+   as a fixed header followed by len bytes of body. The body has the same content
+   as a directory queue entry. cmd is the command letter as used in queue entry names.
+
+   The server answers each request with a header echoing cmd and seq, followed by the
+   reply body. code is the status of the command, 0 for success.
+   Without plan workers, requests on a connection are answered in order. With workers,
+   plan replies may arrive out of order : match on seq. Fields are in host byte order :
+   clients are expected to run on a machine of the same architecture.
+ */
+
+#define Proto_magic 0x5470
+#define Proto_version 1
+
+struct proto_hdr {
+  ub2 magic;
+  ub1 ver;
+  ub1 cmd;
+  ub4 len;    // body length, excluding header
+  ub4 seq;    // client tag, echoed in reply
+  ub4 code;   // reply status. In requests, wait limit and priority as below
+};
+
+sassert(sizeof(struct proto_hdr) == 16,"proto header size")
+
+/* a request's code holds the time in msec the client waits for a reply, 0 for the server default,
+   and in the top byte a priority. Queued plan requests are served on highest priority, then earliest deadline.
+   Requests that expire before their search starts get a reply with code Proto_expired
+ */
+#define Proto_waitmask 0xffffff
+#define Proto_prioshift 24
+#define Proto_expired 2
+
+/* web query as forwarded by the proxy, command 'w'
+   coordinates are in millionths of a degree, offset by +90 for lat and +180 for lon
+   date and time as for plan queries, utcofs biased as 100 * (12 + hours) + minutes
+ */
+#define Proto_geoscale 1000000
+
+enum Toreqcmd { Toreq_plan,Toreq_geo2name };
+
+struct toreq {
+  ub4 id;
+  ub4 cmd;
+  ub4 deplat,deplon;
+  ub4 arrlat,arrlon;
+  ub4 dep,arr;
+  ub4 date,time;
+  ub4 utcofs;
+  ub4 walklim;
+};
+
+/* binary plan queries, command 'b'
+   request body : struct planbatch followed by cnt struct planreq
+   reply body : struct planbatch followed by cnt results in request order. Each result is
+   a struct planres, followed by tripcnt times a struct restrip with its legcnt struct resleg
+   All records are a multiple of 4 bytes and read in place : no parsing.
+   The text 'p' queries remain as before.
+ */
+#define Planreq_version 2
+#define Planbatch_max 256
+#define Planreq_dflt hi32 // use server default for this field
+#define Planreq_nvia 16
+
+struct planbatch {
+  ub4 ver;
+  ub4 cnt;
+};
+
+struct planreq {
+  ub4 id;            // client tag, echoed in result
+  ub4 dep,arr;       // port, or portcnt + member stop
+  ub4 date,time;     // yyyymmdd and hhmm local
+  ub4 utcofs;
+  ub4 plusday,minday;
+  ub4 lostop,histop,nethistop;
+  ub4 mintt,maxtt;   // transfer times in minutes
+  ub4 costperstop;
+  ub4 walklimit,sumwalklimit;  // meters
+  ub4 viacnt;
+  ub4 vias[Planreq_nvia];  // reserved, not searched yet
+};
+
+struct planres {
+  ub4 id;
+  ub4 code;          // 0 for success, also if no trip found
+  ub4 gen;           // network generation used
+  ub4 tripcnt;
+  ub4 len;           // bytes, including this header and its trips
+};
+
+struct restrip {
+  ub4 legcnt;        // 0 for a walk within a parent station
+  ub4 dt;            // minutes, hi32 if untimed
+  ub4 dist;          // geo units of 10 m
+  ub4 fare;
+};
+
+struct resleg {
+  ub4 dep,arr;       // port
+  ub4 tdep,tarr;     // local minutes since Epoch, 0 if untimed
+  ub4 tid;           // hi32 if untimed
+  ub4 rid;           // route, hi32 for walk
+  ub4 dist;
+};
+
+/* many origin-destination pairs with shared parameters, command 'm'
+   request body : struct pairbatch followed by cnt struct planpair. dep and arr of par are unused.
+   Pairs are planned grouped by departure, to reuse departure events.
+   Results are streamed as frames with the layout of a 'b' reply, in order of planning :
+   match on planres.id. A frame with cnt 0 ends the batch.
+   Via the query directory, all results come as a single reply.
+ */
+#define Planpair_max 4096
+
+struct planpair {
+  ub4 id;
+  ub4 dep,arr;
+};
+
+struct pairbatch {
+  ub4 ver;
+  ub4 cnt;
+  struct planreq par;
+};
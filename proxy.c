@@ -26,6 +26,7 @@ struct globs globs;
 #include "mem.h"
 #include "util.h"
 #include "time.h"
+#include "proto.h"
 
 static ub4 msgfile;
 #include "msg.h"
@@ -35,7 +36,24 @@ static const ub4 apiversion = 0;
 
 static ub4 port = 7001; // set on commandline
 
-static ub4 geoscale = 1000000; // matches .js
+static ub4 geoscale = Proto_geoscale; // matches .js
+
+// seconds to wait for a server reply
+static const ub4 srvtimeout = 4;
+
+#define Maxserver 8
+
+// tripover server to forward to, via a persistent connection
+struct server {
+  char addr[256];   // host:port or local socket path
+  char host[128];
+  ub4 port;         // 0 for local socket
+  int fd;           // -1 if not connected
+  ub4 seq;
+};
+
+static struct server servers[Maxserver];
+static ub4 servercnt,curserver;
 
 static const char repdir[] = "rep";
 
@@ -81,24 +99,13 @@ static int parserr(ub4 pos,ub4 fln)
   return errorfln(fln,0,FLN,"parse error at pos %u",pos);
 }
 
-struct toreq {
-  ub4 id;
-  ub4 cmd;
-  ub4 deplat,deplon;
-  ub4 arrlat,arrlon;
-  ub4 dep,arr;
-  ub4 date,time;
-  ub4 utcofs;
-  ub4 walklim;
-};
-
 struct torep {
   ub4 id;
   ub4 len,maxlen;
   char txt[4096];
 };
 
-enum cmds { Cmd_plan,Cmd_geo2name };
+enum cmds { Cmd_plan = Toreq_plan,Cmd_geo2name = Toreq_geo2name };
 enum urlvals { Aver,Ver,Id,Cmd,Deplat,Deplon,Arrlat,Arrlon,Dep,Arr,Date,Time,Utcofs,Delay,Walklim,Vcnt };
 
 static char rspline[] =
@@ -297,6 +304,160 @@ static int run(struct toreq *treq,struct torep *trep,ub4 seq,char *envp[])
   return 0;
 }
 
+static int srvconnect(struct server *sp)
+{
+  int fd,rv;
+
+  fd = ossocket(sp->port != 0);
+  if (fd == -1) return 1;
+  if (sp->port) rv = osconnect(fd,sp->host,sp->port);
+  else rv = osconnectlocal(fd,sp->addr);
+  if (rv) { osclose(fd); return 1; }
+  info(0,"connected to server %s",sp->addr);
+  sp->fd = fd;
+  return 0;
+}
+
+static void srvclose(struct server *sp)
+{
+  if (sp->fd == -1) return;
+  osclose(sp->fd);
+  sp->fd = -1;
+}
+
+// send a request to a server and wait for its reply
+static int srvquery(struct server *sp,struct toreq *treq,struct torep *trep)
+{
+  struct proto_hdr hdr;
+  int fd = sp->fd;
+  ub4 len,seq = ++sp->seq;
+  char skip[256];
+  ub1 rdy;
+  ub4 n;
+
+  oclear(hdr);
+  hdr.magic = Proto_magic;
+  hdr.ver = Proto_version;
+  hdr.cmd = 'w';
+  hdr.len = sizeof(*treq);
+  hdr.seq = seq;
+  hdr.code = srvtimeout * 1000; // wait limit
+  if (oswriteall(fd,&hdr,sizeof(hdr))) return 1;
+  if (oswriteall(fd,treq,sizeof(*treq))) return 1;
+
+  do {
+    if (ospoll(&fd,&rdy,1,srvtimeout * 1000) <= 0) return error(0,"no reply from server %s in %u sec",sp->addr,srvtimeout);
+    if (osreadall(fd,&hdr,sizeof(hdr))) return error(0,"server %s closed connection",sp->addr);
+    if (hdr.magic != Proto_magic) return error(0,"invalid reply from server %s",sp->addr);
+    len = hdr.len;
+    n = min(len,trep->maxlen - 1);
+    if (n && osreadall(fd,trep->txt,n)) return 1;
+    trep->txt[n] = 0;
+    trep->len = n;
+    len -= n;
+    while (len) {
+      n = min(len,sizeof(skip));
+      if (osreadall(fd,skip,n)) return 1;
+      len -= n;
+    }
+    infocc(hdr.seq != seq,0,"skip stale reply %u from %s",hdr.seq,sp->addr);
+  } while (hdr.seq != seq);
+
+  if (hdr.code) info(0,"server %s returned %u for request %u",sp->addr,hdr.code,treq->id);
+  return 0;
+}
+
+// forward request to servers in turn, reconnecting as needed
+static int forward(struct toreq *treq,struct torep *trep)
+{
+  struct server *sp;
+  ub4 iter,start = curserver;
+
+  curserver = (curserver + 1) % servercnt; // next request starts at the next server
+
+  for (iter = 0; iter < servercnt; iter++) {
+    sp = servers + (start + iter) % servercnt;
+    if (sp->fd != -1) {
+      if (srvquery(sp,treq,trep) == 0) return 0;
+      srvclose(sp);   // connection may be stale after server restart : retry once
+    }
+    if (srvconnect(sp)) continue;
+    if (srvquery(sp,treq,trep) == 0) return 0;
+    srvclose(sp);
+  }
+  return error(0,"no server available for request %u",treq->id);
+}
+
+// format a plan reply into plantrip client's web format
+static ub4 fmtplan(const char *src,ub4 srclen,char *dst,ub4 maxlen)
+{
+  static const ub4 tripcols[3] = { 5,5,3 };
+  const char *lp = src,*lend,*cend,*end = src + srclen;
+  const char *cols[8];
+  ub4 collens[8];
+  ub4 pos,col,colcnt,ncol,triprow = 0;
+
+  lend = lp;
+  while (lend < end && *lend != '\n') lend++;
+  pos = mysnprintf(dst,0,maxlen,".planres\tresult\t%.*s\n",(ub4)(lend - lp),lp);
+
+  while (lp < end && pos + 16 < maxlen) {
+    lend = lp;
+    while (lend < end && *lend != '\n') lend++;
+
+    colcnt = 0;
+    cols[0] = lp;
+    while (colcnt < Elemcnt(cols)) {
+      cend = cols[colcnt];
+      while (cend < lend && *cend != '\t') cend++;
+      collens[colcnt] = (ub4)(cend - cols[colcnt]);
+      colcnt++;
+      if (cend == lend || colcnt == Elemcnt(cols)) break;
+      cols[colcnt] = cend + 1;
+    }
+
+    if (*lp == '#') pos += mysnprintf(dst,pos,maxlen,"%.*s\n",(ub4)(lend - lp),lp);
+    else if (colcnt > 1 && collens[0] == 4 && memcmp(lp,"trip",4) == 0) {
+      ncol = tripcols[triprow];
+      pos += mysnprintf(dst,pos,maxlen,".planres");
+      for (col = 0; col < ncol; col++) {
+        if (col < colcnt) pos += mysnprintf(dst,pos,maxlen,"\t%.*s",collens[col],cols[col]);
+        else pos += mysnprintf(dst,pos,maxlen,"\t");
+      }
+      pos += mysnprintf(dst,pos,maxlen,"\n");
+      triprow = (triprow + 1) % 3;
+    } else if (colcnt > 1 && ((collens[0] == 3 && memcmp(lp,"sum",3) == 0) || (collens[0] == 4 && memcmp(lp,"stat",4) == 0))) {
+      pos += mysnprintf(dst,pos,maxlen,".planres\t%.*s\n",(ub4)(lend - lp),lp);
+    }
+    lp = lend + 1;
+  }
+  return pos;
+}
+
+// forward to a tripover server and format the reply for the web client
+static int runsrv(struct toreq *treq,struct torep *trep)
+{
+  struct torep srep;
+  ub4 len;
+
+  oclear(srep);
+  srep.maxlen = (ub4)sizeof(srep.txt);
+
+  if (forward(treq,&srep)) return 1;
+
+  switch(treq->cmd) {
+  case Cmd_plan:
+    len = fmtplan(srep.txt,srep.len,trep->txt,trep->maxlen);
+    break;
+  case Cmd_geo2name:
+    len = mysnprintf(trep->txt,0,trep->maxlen,"# reqid\tdist\tlat\tlon\tid\tpid\tmodes\tname\tpname\n%s",srep.txt);
+    break;
+  default: return error(0,"skip unknown command %u",treq->cmd);
+  }
+  trep->len = len;
+  return 0;
+}
+
 static int proxy(char *envp[])
 {
   int sfd,cfd;
@@ -327,7 +488,8 @@ static int proxy(char *envp[])
     trep.len = fmtstring(trep.txt,"test at \ad%u.%u\n",(ub4)(now / 60),(ub4)(now % 60));
     if (getreq(cfd,&treq)) { osclose(cfd); continue; }
     trep.id = treq.id;
-    run(&treq,&trep,seq,envp);
+    if (servercnt) runsrv(&treq,&trep);
+    else run(&treq,&trep,seq,envp);
     putrep(cfd,&treq,&trep);
     osclose(cfd);
   } while (globs.sigint == 0);
@@ -347,6 +509,25 @@ static int cmd_port(struct cmdval *cv) {
   return 0;
 }
 
+static int cmd_server(struct cmdval *cv) {
+  struct server *sp;
+  char *colon;
+  ub4 sport;
+
+  if (servercnt == Maxserver) return error(0,"exceeded %u server limit",Maxserver);
+  sp = servers + servercnt;
+  strcopy(sp->addr,cv->sval);
+  sp->fd = -1;
+  colon = strrchr(sp->addr,':');
+  if (colon && *sp->addr != '/') {
+    if (str2ub4(colon + 1,&sport) == 0 || sport == 0 || sport > 65535) return error(0,"invalid port in server %s",sp->addr);
+    fmtstring(sp->host,"%.*s",(ub4)(colon - sp->addr),sp->addr);
+    sp->port = sport;
+  }
+  servercnt++;
+  return 0;
+}
+
 static int cmd_limassert(struct cmdval *cv) {
   globs.limassert = cv->uval;
   setmsglvl(globs.msglvl,0,globs.limassert);
@@ -371,6 +552,7 @@ static int cmd_arg(struct cmdval *cv)
 static struct cmdarg cmdargs[] = {
   { "verbose|v", "[level]%u", "set or increase verbosity", cmd_vrb },
   { "port|p", "port%u", "listen port", cmd_port },
+  { "server|s", "addr", "forward to tripover server at host:port or local socket, repeatable", cmd_server },
   { "assert-limit", "[limit]%u", "stop at this #assertions", cmd_limassert },
   { NULL, "dir", "proxy", cmd_arg }
 };
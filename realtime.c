@@ -0,0 +1,697 @@
+// realtime.c - real-time trip updates
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+/* Delays, cancellations and added runs of a trip are applied to the time events of
+   the hops it serves, leaving other hops as they are. A run is a trip on a service day.
+
+   As for fares, updates never write what searches may be reading. The first update of a hop
+   in a request copies its event list, from net.events or its newest version. Later updates
+   in that request change the copy, which is kept in time order when the request publishes.
+   Each event keeps its scheduled time, so a delay is always relative to the timetable,
+   and its position in net.events, to keep fares at the departure they were given for.
+   Delays for all runs of a trip also update its route hop times, as used for compound hops.
+   These are not per day, so a single-day delay from a later stop on is refused for trips
+   that may have compounds : a compound over the delayed stop would keep its timetable arrival.
+   Queries pin an epoch and see all updates of a request or none.
+
+   net.events and net.chainrhops are in the snapshot shared by serve instances, so versions
+   are process-local, per network generation. chainhops only serves compound building and
+   is left as is.
+ */
+
+#include <string.h>
+#include <pthread.h>
+
+#include "base.h"
+#include "cfg.h"
+#include "mem.h"
+#include "math.h"
+
+static ub4 msgfile;
+#include "msg.h"
+
+#include "util.h"
+#include "time.h"
+#include "net.h"
+#include "realtime.h"
+
+#undef hdrstop
+
+#define Ngen 2
+#define Rtpins 128     // distinct epochs of concurrent queries
+#define Rtminev 16     // events in smallest size class
+#define Rtclasses 28
+#define Rtchunk (16 * 1024 * 1024)
+#define Chainchunk 256
+
+struct rtstate {
+  ub4 gen;                 // network generation
+  ub4 hopcnt,chaincnt;
+  struct rtver **hvers;    // [hopcnt] newest version, NULL for none
+  struct rtchain **cvers;  // [chaincnt] idem
+  ub4 epoch;               // last published
+  ub4 pinepochs[Rtpins];
+  ub4 pinusers[Rtpins];
+  ub1 *hflags;             // [hopcnt] in dirty and old lists
+  ub1 *cflags;             // [chaincnt] in cold list
+  ub4 *dirty,dirtycnt;     // hops written in the pending epoch
+  ub4 *old,oldcnt;         // hops with older versions
+  ub4 *cold,coldcnt;       // chains with older versions
+  struct rtver *grown;     // pending versions replaced by a larger one
+  ub4 vercnt,cvercnt;
+};
+
+enum { Hdirty = 1,Hold = 2 };
+
+static struct rtstate rtstates[Ngen];
+static pthread_mutex_t rtlock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct rtver *verfree[Rtclasses];
+static char *pool;
+static size_t poolpos,poollen;
+static struct rtchain *chainfree;
+
+static ub8 *sortkeys,*sortev;
+static ub4 *sortfi,sortlen;
+
+static Tls struct rtstate *usestate;
+static Tls ub4 useepoch;
+
+// use the current trip epoch for this thread until unpinned. Pin the network first
+ub4 rtpin(void)
+{
+  struct rtstate *st = NULL;
+  ub4 gen = netgenid();
+  ub4 i,slot = hi32;
+
+  pthread_mutex_lock(&rtlock);
+  for (i = 0; i < Ngen; i++) {
+    if (rtstates[i].hvers && rtstates[i].gen == gen) { st = rtstates + i; break; }
+  }
+  if (st) {
+    for (i = 0; i < Rtpins; i++) {
+      if (st->pinusers[i] && st->pinepochs[i] == st->epoch) { slot = i; break; }
+      else if (st->pinusers[i] == 0 && slot == hi32) slot = i;
+    }
+    if (slot == hi32) error(Exit,"more than %u trip epochs in use",Rtpins);
+    st->pinepochs[slot] = st->epoch;
+    st->pinusers[slot]++;
+    useepoch = st->epoch;
+  } else useepoch = 0;
+  pthread_mutex_unlock(&rtlock);
+  usestate = st;
+  return useepoch;
+}
+
+void rtunpin(void)
+{
+  struct rtstate *st = usestate;
+  ub4 i;
+
+  if (st == NULL) return;
+  pthread_mutex_lock(&rtlock);
+  for (i = 0; i < Rtpins; i++) {
+    if (st->pinusers[i] && st->pinepochs[i] == useepoch) { st->pinusers[i]--; break; }
+  }
+  pthread_mutex_unlock(&rtlock);
+  usestate = NULL;
+}
+
+// events of global hop as of the pinned epoch, NULL if as in net.events
+struct rtver *rtevents(ub4 hop)
+{
+  struct rtstate *st = usestate;
+  struct rtver *v;
+
+  if (st == NULL || hop >= st->hopcnt) return NULL;
+  v = __atomic_load_n(st->hvers + hop,__ATOMIC_ACQUIRE);
+  while (v && v->epoch > useepoch) v = v->prv;
+  return v;
+}
+
+// route hop times of trip tid as of the pinned epoch
+ub8 *rtrhops(ub8 *chainrhops,struct chain *cp,ub4 tid)
+{
+  struct rtstate *st = usestate;
+  struct rtchain *v;
+
+  if (st == NULL || tid >= st->chaincnt) return chainrhops + cp->rhopofs;
+  v = __atomic_load_n(st->cvers + tid,__ATOMIC_ACQUIRE);
+  while (v && v->epoch > useepoch) v = v->prv;
+  if (v == NULL) return chainrhops + cp->rhopofs;
+  return v->rhops;
+}
+
+// event list with room for at least evcnt, from size class pools
+static struct rtver *newver(ub4 evcnt)
+{
+  struct rtver *v;
+  ub4 cls = 0,evlen;
+  size_t n;
+
+  while (cls + 1 < Rtclasses && ((ub8)Rtminev << cls) < evcnt) cls++;
+  evlen = Rtminev << cls;
+
+  if ( (v = verfree[cls]) ) verfree[cls] = v->prv;
+  else {
+    n = sizeof(struct rtver) + (size_t)evlen * (3 * sizeof(ub8) + sizeof(ub4));
+    n = (n + 7) & ~(size_t)7;
+    if (poolpos + n > poollen) {
+      poollen = max(n,Rtchunk);
+      pool = alloc((ub4)poollen,char,0,"trip versions",evlen);
+      poolpos = 0;
+    }
+    v = (struct rtver *)(pool + poolpos);
+    poolpos += n;
+  }
+  v->cls = cls;
+  v->evlen = evlen;
+  v->ev = (ub8 *)(v + 1);
+  v->sched = v->ev + evlen * 2;
+  v->fi = (ub4 *)(v->sched + evlen);
+  v->lnk = NULL;
+  return v;
+}
+
+static void freever(struct rtver *v)
+{
+  v->prv = verfree[v->cls];
+  verfree[v->cls] = v;
+}
+
+static struct rtchain *newchain(void)
+{
+  struct rtchain *v;
+  ub4 n;
+
+  if (chainfree == NULL) {
+    v = alloc(Chainchunk,struct rtchain,0,"trip chain versions",Chainchunk);
+    for (n = 0; n < Chainchunk; n++) { v[n].prv = chainfree; chainfree = v + n; }
+  }
+  v = chainfree;
+  chainfree = v->prv;
+  return v;
+}
+
+// writer's state for the current generation
+static struct rtstate *getstate(gnet *net,int create)
+{
+  struct rtstate *st;
+  struct rtver *v,*ov;
+  struct rtchain *cv,*ocv;
+  ub4 gen = netgenid();
+  ub4 i,n,hop,chain;
+
+  for (i = 0; i < Ngen; i++) {
+    st = rtstates + i;
+    if (st->hvers && st->gen == gen) return st;
+  }
+  if (create == 0) return NULL;
+
+  // take a free slot, or one of a previous generation without queries
+  pthread_mutex_lock(&rtlock);
+  for (i = 0; i < Ngen; i++) {
+    st = rtstates + i;
+    if (st->hvers == NULL) break;
+    for (n = 0; n < Rtpins; n++) if (st->pinusers[n]) break;
+    if (n == Rtpins) break;
+  }
+  if (i == Ngen) {
+    pthread_mutex_unlock(&rtlock);
+    warn(0,"no trip state available for generation %u",gen);
+    return NULL;
+  }
+
+  if (st->hvers) {
+    info(0,"release %u trip versions of generation %u",st->vercnt + st->cvercnt,st->gen);
+    for (hop = 0; hop < st->hopcnt; hop++) {
+      v = st->hvers[hop];
+      while (v) { ov = v->prv; freever(v); v = ov; }
+    }
+    while ( (v = st->grown) ) { st->grown = v->lnk; freever(v); }
+    for (chain = 0; chain < st->chaincnt; chain++) {
+      cv = st->cvers[chain];
+      while (cv) {
+        ocv = cv->prv;
+        cv->prv = chainfree;
+        chainfree = cv;
+        cv = ocv;
+      }
+    }
+    afree(st->hvers,"trip versions");
+    afree(st->hflags,"trip versions");
+    afree(st->dirty,"trip versions");
+    afree(st->old,"trip versions");
+    if (st->cvers) {
+      afree(st->cvers,"trip versions");
+      afree(st->cflags,"trip versions");
+      afree(st->cold,"trip versions");
+    }
+  }
+  oclear(*st);
+  st->gen = gen;
+  st->hopcnt = net->hopcnt;
+  st->chaincnt = net->chaincnt;
+  st->hvers = alloc(st->hopcnt,struct rtver *,0,"trip versions",st->hopcnt);
+  st->hflags = alloc(st->hopcnt,ub1,0,"trip versions",st->hopcnt);
+  st->dirty = alloc(st->hopcnt,ub4,0,"trip versions",st->hopcnt);
+  st->old = alloc(st->hopcnt,ub4,0,"trip versions",st->hopcnt);
+  if (st->chaincnt) {
+    st->cvers = alloc(st->chaincnt,struct rtchain *,0,"trip versions",st->chaincnt);
+    st->cflags = alloc(st->chaincnt,ub1,0,"trip versions",st->chaincnt);
+    st->cold = alloc(st->chaincnt,ub4,0,"trip versions",st->chaincnt);
+  }
+  pthread_mutex_unlock(&rtlock);
+  return st;
+}
+
+// writable event list of hop in the pending epoch, with room to add events
+static struct rtver *hopwrite(gnet *net,struct rtstate *st,ub4 hop,ub4 add)
+{
+  struct timepat *tp = &net->hops[hop].tp;
+  struct rtver *v,*hd;
+  ub4 i,cnt,wepoch = st->epoch + 1;
+  ub8 *ev;
+
+  hd = st->hvers[hop];
+  if (hd && hd->epoch == wepoch && hd->evcnt + add <= hd->evlen) return hd;
+
+  cnt = hd ? hd->evcnt : tp->genevcnt;
+  v = newver(cnt + max(add,cnt / 8));
+  v->epoch = wepoch;
+  v->hop = hop;
+  v->evcnt = cnt;
+  if (hd) {
+    memcpy(v->ev,hd->ev,cnt * 2 * sizeof(ub8));
+    memcpy(v->sched,hd->sched,cnt * sizeof(ub8));
+    memcpy(v->fi,hd->fi,cnt * sizeof(ub4));
+    v->t0 = hd->t0; v->t1 = hd->t1;
+  } else {
+    ev = net->events + tp->evofs;
+    memcpy(v->ev,ev,cnt * 2 * sizeof(ub8));
+    for (i = 0; i < cnt; i++) { v->sched[i] = ev[i * 2]; v->fi[i] = i; }
+    v->t0 = tp->t0; v->t1 = tp->t1;
+  }
+
+  if (hd && hd->epoch == wepoch) { // grown : queries may still look at the replaced one for their epoch
+    v->prv = hd->prv;
+    hd->lnk = st->grown;
+    st->grown = hd;
+  } else {
+    v->prv = hd;
+    st->dirty[st->dirtycnt++] = hop;
+    st->hflags[hop] |= Hdirty;
+    if (hd && (st->hflags[hop] & Hold) == 0) {
+      st->old[st->oldcnt++] = hop;
+      st->hflags[hop] |= Hold;
+    }
+    st->vercnt++;
+  }
+  __atomic_store_n(st->hvers + hop,v,__ATOMIC_RELEASE);
+  return v;
+}
+
+// writable route hop times of trip in the pending epoch
+static ub8 *chainwrite(gnet *net,struct rtstate *st,ub4 tid)
+{
+  struct chain *cp = net->chains + tid;
+  struct rtchain *v,*hd;
+  ub4 wepoch = st->epoch + 1;
+
+  hd = st->cvers[tid];
+  if (hd && hd->epoch == wepoch) return hd->rhops;
+
+  v = newchain();
+  if (hd) memcpy(v->rhops,hd->rhops,sizeof(v->rhops));
+  else memcpy(v->rhops,net->chainrhops + cp->rhopofs,min(cp->rhopcnt,Chainlen) * sizeof(ub8));
+  v->epoch = wepoch;
+  v->prv = hd;
+  if (hd && st->cflags[tid] == 0) {
+    st->cold[st->coldcnt++] = tid;
+    st->cflags[tid] = 1;
+  }
+  st->cvercnt++;
+  __atomic_store_n(st->cvers + tid,v,__ATOMIC_RELEASE);
+  return v->rhops;
+}
+
+// put events back in time order, and extend the time range if needed
+static void sortver(struct rtver *v,struct timepat *tp)
+{
+  ub4 i,cnt = v->evcnt,ndx;
+  ub4 t,lo = hi32,hi = 0;
+
+  for (i = 0; i < cnt; i++) {
+    t = (ub4)v->ev[i * 2];
+    lo = min(lo,t); hi = max(hi,t);
+    if (i && t < (ub4)v->ev[(i - 1) * 2]) break;
+  }
+  if (i < cnt) {
+    if (cnt > sortlen) {
+      if (sortlen) {
+        afree(sortkeys,"trip sort");
+        afree(sortev,"trip sort");
+        afree(sortfi,"trip sort");
+      }
+      sortlen = max(cnt,sortlen * 2);
+      sortkeys = alloc(sortlen,ub8,0,"trip sort",sortlen);
+      sortev = alloc(sortlen * 3,ub8,0,"trip sort",sortlen);
+      sortfi = alloc(sortlen,ub4,0,"trip sort",sortlen);
+    }
+    for (i = 0; i < cnt; i++) sortkeys[i] = ((ub8)(ub4)v->ev[i * 2] << 32) | i;
+    sort8(sortkeys,cnt,FLN,"trip events");
+    memcpy(sortev,v->ev,cnt * 2 * sizeof(ub8));
+    memcpy(sortev + cnt * 2,v->sched,cnt * sizeof(ub8));
+    memcpy(sortfi,v->fi,cnt * sizeof(ub4));
+    for (i = 0; i < cnt; i++) {
+      ndx = sortkeys[i] & hi32;
+      v->ev[i * 2] = sortev[ndx * 2];
+      v->ev[i * 2 + 1] = sortev[ndx * 2 + 1];
+      v->sched[i] = sortev[cnt * 2 + ndx];
+      v->fi[i] = sortfi[ndx];
+    }
+    lo = (ub4)v->ev[0];
+    hi = (ub4)v->ev[(cnt - 1) * 2];
+  }
+  if (cnt) {
+    v->t0 = min(tp->t0,lo);
+    v->t1 = max(tp->t1,hi + 1);
+  }
+}
+
+/* make the updates of a request visible to new queries,
+   and release versions superseded for all pinned queries
+ */
+void rtpublish(gnet *net)
+{
+  struct rtstate *st = getstate(net,0);
+  struct rtver *v,*ov,**pv;
+  struct rtchain *cv,*ocv;
+  ub4 i,hop,tid,minpin,relcnt = 0,crelcnt = 0;
+
+  if (st == NULL) return;
+
+  for (i = 0; i < st->dirtycnt; i++) {
+    hop = st->dirty[i];
+    sortver(st->hvers[hop],&net->hops[hop].tp);
+    st->hflags[hop] &= ~Hdirty;
+  }
+  st->dirtycnt = 0;
+
+  pthread_mutex_lock(&rtlock);
+  st->epoch++;
+  minpin = st->epoch;
+  for (i = 0; i < Rtpins; i++) {
+    if (st->pinusers[i]) minpin = min(minpin,st->pinepochs[i]);
+  }
+
+  // all pinned queries stop at the newest version not after minpin
+  i = 0;
+  while (i < st->oldcnt) {
+    hop = st->old[i];
+    v = st->hvers[hop];
+    while (v && v->epoch > minpin) v = v->prv;
+    if (v) {
+      while ( (ov = v->prv) ) { v->prv = ov->prv; freever(ov); relcnt++; }
+    }
+    if (st->hvers[hop]->prv == NULL) {
+      st->hflags[hop] &= ~Hold;
+      st->old[i] = st->old[--st->oldcnt];
+    } else i++;
+  }
+  pv = &st->grown;
+  while ( (v = *pv) ) {
+    if (v->epoch <= minpin) { *pv = v->lnk; freever(v); }
+    else pv = &v->lnk;
+  }
+
+  i = 0;
+  while (i < st->coldcnt) {
+    tid = st->cold[i];
+    cv = st->cvers[tid];
+    while (cv && cv->epoch > minpin) cv = cv->prv;
+    if (cv) {
+      while ( (ocv = cv->prv) ) {
+        cv->prv = ocv->prv;
+        ocv->prv = chainfree;
+        chainfree = ocv;
+        crelcnt++;
+      }
+    }
+    if (st->cvers[tid]->prv == NULL) {
+      st->cflags[tid] = 0;
+      st->cold[i] = st->cold[--st->coldcnt];
+    } else i++;
+  }
+  st->vercnt -= relcnt;
+  st->cvercnt -= crelcnt;
+  pthread_mutex_unlock(&rtlock);
+  vrb0(0,"trip epoch %u, %u + %u versions, %u + %u released",st->epoch,st->vercnt,st->cvercnt,relcnt,crelcnt);
+}
+
+ub4 rtstats(char *buf,ub4 len)
+{
+  struct rtstate *st;
+  ub4 i,pos = 0;
+
+  pthread_mutex_lock(&rtlock);
+  for (i = 0; i < Ngen; i++) {
+    st = rtstates + i;
+    if (st->hvers) pos += mysnprintf(buf,pos,len,"trips\tgeneration %u\tepoch %u\tversions %u\tchains %u\n",st->gen,st->epoch,st->vercnt,st->cvercnt);
+  }
+  pthread_mutex_unlock(&rtlock);
+  return pos;
+}
+
+// route and hop count of trip
+static struct route *triproute(gnet *net,ub4 tid,ub4 *pcnt)
+{
+  struct chain *cp;
+  struct route *rp;
+
+  if (tid >= net->chaincnt) { error(0,"tid %u above %u",tid,net->chaincnt); return NULL; }
+  cp = net->chains + tid;
+  if (cp->rid >= net->ridcnt) { warn(0,"tid %u has no route",tid); return NULL; }
+  rp = net->routes + cp->rid;
+  *pcnt = min(min(rp->hopcnt,cp->rhopcnt),Chainlen);
+  return rp;
+}
+
+// service day of a scheduled event departing tdep minutes into it
+static ub4 runday(struct timepat *tp,ub8 sched,ub4 tdep)
+{
+  ub4 lt = min2lmin((ub4)sched + tp->gt0,tp->utcofs);
+
+  return (lt + 720 - tdep) / 1440;
+}
+
+// events of hop as currently visible to the writer
+static ub8 *curevs(gnet *net,struct rtstate *st,ub4 hop,ub4 *pcnt)
+{
+  struct timepat *tp = &net->hops[hop].tp;
+  struct rtver *v = st->hvers[hop];
+
+  if (v) { *pcnt = v->evcnt; return v->ev; }
+  *pcnt = tp->genevcnt;
+  return net->events + tp->evofs;
+}
+
+static int hastrip(ub8 *ev,ub4 cnt,ub4 tid)
+{
+  ub4 i;
+
+  for (i = 0; i < cnt; i++) if ((ev[i * 2 + 1] & hi24) == tid) return 1;
+  return 0;
+}
+
+static ub4 shift(ub4 t,int delay)
+{
+  if (delay < 0 && t < (ub4)-delay) return 0;
+  return t + (ub4)delay;
+}
+
+/* delay runs of trip tid by delay minutes, from its departure at route stop rhop on.
+   t is a local time within the service day in minutes since epoch, 0 for all runs
+ */
+int rtdelay(gnet *net,ub4 tid,ub4 t,ub4 rhop,int delay,ub4 *prid)
+{
+  struct rtstate *st;
+  struct route *rp;
+  struct timepat *tp;
+  struct rtver *v;
+  ub8 *ev,*rhops,*crp;
+  ub8 x1,sched;
+  ub4 r,r0,cnt,hop,evcnt,i,day,tdep,tarr,dep,arr,dur,n = 0;
+
+  if ( (rp = triproute(net,tid,&cnt)) == NULL) return 1;
+  if (rhop >= cnt) return error(0,"tid %u rhop %u above %u",tid,rhop,cnt);
+  if (t && rhop && net->chopcnt > net->hopcnt && net->chains[tid].hopcnt > 1) {
+    return error(0,"tid %u on \ad%u : single-day delay from rhop %u not supported for compounds, delay all days or cancel and add",tid,t,rhop);
+  }
+  if ( (st = getstate(net,1)) == NULL) return 1;
+
+  crp = net->chainrhops + net->chains[tid].rhopofs;
+  day = t / 1440;
+  r0 = rhop ? rhop - 1 : 0;  // arrival at the delayed stop
+
+  for (r = r0; r < cnt; r++) {
+    hop = rp->hops[r];
+    if (hop >= net->hopcnt) continue;
+    tdep = (ub4)(crp[r] >> 32);
+    if (tdep == hi32) continue;
+    ev = curevs(net,st,hop,&evcnt);
+    if (hastrip(ev,evcnt,tid) == 0) continue;
+
+    tp = &net->hops[hop].tp;
+    v = hopwrite(net,st,hop,0);
+    for (i = 0; i < v->evcnt; i++) {
+      x1 = v->ev[i * 2 + 1];
+      if ((x1 & hi24) != tid) continue;
+      sched = v->sched[i];
+      if (t && runday(tp,sched,tdep) != day) continue;
+      dep = r >= rhop ? shift((ub4)sched,delay) : (ub4)v->ev[i * 2];
+      arr = shift((ub4)sched + (ub4)(sched >> 32),delay);
+      dur = arr > dep ? arr - dep : 0;
+      v->ev[i * 2] = dep | ((ub8)dur << 32);
+      v->ev[i * 2 + 1] = (x1 & ~((ub8)hi16 << 32)) | ((ub8)(dur & hi16) << 32);
+      n++;
+    }
+  }
+  if (n == 0) return info(0,"no events for tid %u on \ad%u",tid,t);
+
+  if (t == 0) { // relative to the timetable row, also for compounds
+    rhops = chainwrite(net,st,tid);
+    for (r = r0; r < cnt; r++) {
+      tdep = (ub4)(crp[r] >> 32);
+      tarr = crp[r] & hi32;
+      if (r >= rhop && tdep != hi32) tdep = shift(tdep,delay);
+      else tdep = (ub4)(rhops[r] >> 32);
+      if (tarr != hi32) tarr = shift(tarr,delay);
+      rhops[r] = ((ub8)tdep << 32) | tarr;
+    }
+  }
+  vrb0(0,"tid %u delay %d from %u on %u event\as",tid,delay,rhop,n);
+  *prid = net->chains[tid].rid;
+  return 0;
+}
+
+// remove runs of trip tid. t as above
+int rtcancel(gnet *net,ub4 tid,ub4 t,ub4 *prid)
+{
+  struct rtstate *st;
+  struct route *rp;
+  struct timepat *tp;
+  struct rtver *v;
+  ub8 *ev,*crp;
+  ub4 r,cnt,hop,evcnt,i,j,day,tdep,n = 0;
+
+  if ( (rp = triproute(net,tid,&cnt)) == NULL) return 1;
+  if ( (st = getstate(net,1)) == NULL) return 1;
+
+  crp = net->chainrhops + net->chains[tid].rhopofs;
+  day = t / 1440;
+
+  for (r = 0; r < cnt; r++) {
+    hop = rp->hops[r];
+    if (hop >= net->hopcnt) continue;
+    tdep = (ub4)(crp[r] >> 32);
+    if (tdep == hi32) continue;
+    ev = curevs(net,st,hop,&evcnt);
+    if (hastrip(ev,evcnt,tid) == 0) continue;
+
+    tp = &net->hops[hop].tp;
+    v = hopwrite(net,st,hop,0);
+    for (i = j = 0; i < v->evcnt; i++) {
+      if ((v->ev[i * 2 + 1] & hi24) == tid && (t == 0 || runday(tp,v->sched[i],tdep) == day)) { n++; continue; }
+      if (i != j) {
+        v->ev[j * 2] = v->ev[i * 2];
+        v->ev[j * 2 + 1] = v->ev[i * 2 + 1];
+        v->sched[j] = v->sched[i];
+        v->fi[j] = v->fi[i];
+      }
+      j++;
+    }
+    v->evcnt = j;
+  }
+  if (n == 0) return info(0,"no events for tid %u on \ad%u",tid,t);
+  vrb0(0,"tid %u cancel %u event\as",tid,n);
+  *prid = net->chains[tid].rid;
+  return 0;
+}
+
+/* add a run of trip tid departing at local time t, in minutes since epoch,
+   with the scheduled running times and fares of the trip
+ */
+int rtadd(gnet *net,ub4 tid,ub4 t,ub4 *prid)
+{
+  struct rtstate *st;
+  struct route *rp;
+  struct timepat *tp;
+  struct rtver *v,*cur;
+  ub8 *ev,*crp;
+  ub8 x,x1 = 0;
+  ub4 r,cnt,hop,evcnt,i,tdep,tdep0 = hi32,tarr,lt,ut,dur,fi = hi32,n = 0;
+  int found;
+
+  if ( (rp = triproute(net,tid,&cnt)) == NULL) return 1;
+  if ( (st = getstate(net,1)) == NULL) return 1;
+
+  crp = net->chainrhops + net->chains[tid].rhopofs;
+
+  for (r = 0; r < cnt; r++) {
+    hop = rp->hops[r];
+    if (hop >= net->hopcnt) continue;
+    tdep = (ub4)(crp[r] >> 32);
+    tarr = crp[r] & hi32;
+    if (tdep == hi32) continue;
+    if (tdep0 == hi32) tdep0 = tdep;
+    if (tdep < tdep0) continue;
+
+    tp = &net->hops[hop].tp;
+    lt = t + tdep - tdep0;
+    if (lt <= tp->utcofs) continue;
+    ut = lmin2min(lt,tp->utcofs);
+    if (ut < tp->gt0) continue;
+    dur = tarr != hi32 && tarr > tdep ? tarr - tdep : 0;
+    x = (ut - tp->gt0) | ((ub8)dur << 32);
+
+    // take the other fields from a scheduled run, and skip if already added
+    ev = curevs(net,st,hop,&evcnt);
+    cur = st->hvers[hop];
+    found = 0;
+    for (i = 0; i < evcnt; i++) {
+      if ((ev[i * 2 + 1] & hi24) != tid) continue;
+      if ((ub4)(cur ? cur->sched[i] : ev[i * 2]) == (ub4)x) break;
+      x1 = ev[i * 2 + 1];
+      fi = cur ? cur->fi[i] : i;
+      found = 1;
+    }
+    if (i < evcnt || found == 0) continue;
+
+    v = hopwrite(net,st,hop,1);
+    i = v->evcnt++;
+    v->ev[i * 2] = x;
+    v->ev[i * 2 + 1] = (x1 & ~((ub8)hi16 << 32)) | ((ub8)(dur & hi16) << 32);
+    v->sched[i] = x;
+    v->fi[i] = fi;
+    n++;
+  }
+  if (n == 0) return info(0,"no events added for tid %u at \ad%u",tid,t);
+  vrb0(0,"tid %u add %u event\as",tid,n);
+  *prid = net->chains[tid].rid;
+  return 0;
+}
+
+void inirealtime(void)
+{
+  msgfile = setmsgfile(__FILE__);
+  iniassert();
+}
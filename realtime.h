@@ -0,0 +1,42 @@
+// realtime.h - real-time trip updates
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+// event list of a hop, replacing net.events for queries pinned at epoch or later
+struct rtver {
+  ub4 epoch;
+  struct rtver *prv;     // older version. Also free list
+  struct rtver *lnk;     // writer's list of replaced pending versions
+  ub4 hop;
+  ub4 cls;               // size class of the block
+  ub4 evcnt,evlen;       // used, room
+  ub4 t0,t1;
+  ub8 *ev;               // [evlen * 2] as net.events
+  ub8 *sched;            // [evlen] scheduled <time,dur>
+  ub4 *fi;               // [evlen] position in net.events for fares, hi32 for none
+};
+
+// times per route hop of a trip, replacing net.chainrhops
+struct rtchain {
+  ub4 epoch;
+  struct rtchain *prv;
+  ub8 rhops[Chainlen];
+};
+
+extern void inirealtime(void);
+extern ub4 rtpin(void);
+extern void rtunpin(void);
+extern struct rtver *rtevents(ub4 hop);
+extern ub8 *rtrhops(ub8 *chainrhops,struct chain *cp,ub4 tid);
+extern int rtdelay(gnet *net,ub4 tid,ub4 t,ub4 rhop,int delay,ub4 *prid);
+extern int rtcancel(gnet *net,ub4 tid,ub4 t,ub4 *prid);
+extern int rtadd(gnet *net,ub4 tid,ub4 t,ub4 *prid);
+extern void rtpublish(gnet *net);
+extern ub4 rtstats(char *buf,ub4 len);
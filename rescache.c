@@ -0,0 +1,288 @@
+// rescache.c - cache of plan results
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+/* Results of plan queries are kept keyed on all search parameters, in a fixed set of
+   entries sized from the configured memory budget. When full, the least recently used
+   entry is reused.
+
+   A fare update on a route invalidates the entries with a trip on that route.
+   An update may also make a trip possible for entries not using the route. The age limit
+   bounds how long such entries can be served.
+   Each update also starts a new cache generation. Searches pinned before are not stored.
+
+   Only searches in the server process use the cache : plan workers, or socket clients without.
+ */
+
+#include <string.h>
+#include <pthread.h>
+
+#include "base.h"
+#include "cfg.h"
+#include "mem.h"
+
+static ub4 msgfile;
+#include "msg.h"
+
+#include "util.h"
+#include "time.h"
+#include "net.h"
+#include "search.h"
+#include "rescache.h"
+
+#define Maxrids (2 * Nxleg)
+
+struct rcent {
+  struct rckey key;
+  ub4 hash;
+  ub4 hnxt;           // hash chain
+  ub4 prv,nxt;        // lru list, most recent first. free list via nxt
+  ub4 t0;             // secs
+  ub4 ridcnt;
+  ub4 rids[Maxrids];  // routes used by trips
+  struct trip trips[2];
+  ub4 reslen;
+  char res[sizeof(((search *)0)->resbuf)];
+};
+
+static struct rcent *ents;
+static ub4 entcnt,usecnt;
+static ub4 *hashtab;
+static ub4 hashmask;
+static ub4 lruhd,lrutl,freehd;
+static ub4 maxage;
+static ub4 curgen;  // bumped on each update
+
+static ub4 hits,misses,stores,invals,evicts,expires;
+
+static pthread_mutex_t rclock = PTHREAD_MUTEX_INITIALIZER;
+
+static ub4 keyhash(const struct rckey *key)
+{
+  const ub4 *p = (const ub4 *)key;
+  ub4 i,h = 2166136261U;
+
+  for (i = 0; i < sizeof(*key) / sizeof(ub4); i++) h = (h ^ p[i]) * 16777619U;
+  return h;
+}
+
+static void lruunlink(ub4 e)
+{
+  struct rcent *ep = ents + e;
+
+  if (ep->prv == hi32) lruhd = ep->nxt; else ents[ep->prv].nxt = ep->nxt;
+  if (ep->nxt == hi32) lrutl = ep->prv; else ents[ep->nxt].prv = ep->prv;
+}
+
+static void lrufront(ub4 e)
+{
+  struct rcent *ep = ents + e;
+
+  ep->prv = hi32;
+  ep->nxt = lruhd;
+  if (lruhd == hi32) lrutl = e; else ents[lruhd].prv = e;
+  lruhd = e;
+}
+
+// remove from hash and lru, and add to free list
+static void dropent(ub4 e)
+{
+  struct rcent *ep = ents + e;
+  ub4 *pe = hashtab + (ep->hash & hashmask);
+
+  while (*pe != e) pe = &ents[*pe].hnxt;
+  *pe = ep->hnxt;
+  lruunlink(e);
+  ep->nxt = freehd;
+  freehd = e;
+  usecnt--;
+}
+
+int mkrescache(ub4 mbytes,ub4 age)
+{
+  ub4 e,hlen;
+
+  if (mbytes == 0) return info0(0,"no result cache");
+
+  entcnt = (ub4)(((ub8)mbytes << 20) / sizeof(struct rcent));
+  if (entcnt < 2) return warn(0,"result cache of %u MB below entry size %u",mbytes,(ub4)sizeof(struct rcent));
+
+  hlen = 1;
+  while (hlen < entcnt) hlen <<= 1;
+  hashmask = hlen - 1;
+
+  ents = alloc(entcnt,struct rcent,0,"rescache entries",entcnt);
+  hashtab = alloc(hlen,ub4,0xff,"rescache hash",hlen);
+  for (e = 0; e < entcnt; e++) ents[e].nxt = e + 1;
+  ents[entcnt - 1].nxt = hi32;
+  freehd = 0;
+  lruhd = lrutl = hi32;
+  maxage = age;
+
+  info(0,"result cache of %u entries in %u MB, max age %u sec",entcnt,mbytes,age);
+  return 0;
+}
+
+// fill result from cache if present
+int getrescache(const struct rckey *key,search *src)
+{
+  struct rcent *ep;
+  ub4 e,h,len;
+
+  if (entcnt == 0) return 0;
+
+  h = keyhash(key);
+
+  pthread_mutex_lock(&rclock);
+  e = hashtab[h & hashmask];
+  while (e != hi32) {
+    ep = ents + e;
+    if (ep->hash == h && memcmp(&ep->key,key,sizeof(*key)) == 0) break;
+    e = ep->hnxt;
+  }
+  if (e != hi32 && maxage && gettime_sec() - ents[e].t0 > maxage) {
+    dropent(e);
+    expires++;
+    e = hi32;
+  }
+  if (e == hi32) {
+    misses++;
+    pthread_mutex_unlock(&rclock);
+    return 0;
+  }
+  hits++;
+  lruunlink(e);
+  lrufront(e);
+
+  ep = ents + e;
+  memcpy(src->trips,ep->trips,sizeof(src->trips));
+  len = ep->reslen;
+  memcpy(src->resbuf,ep->res,len);
+  if (len < sizeof(src->resbuf)) src->resbuf[len] = 0;
+  src->reslen = len;
+  pthread_mutex_unlock(&rclock);
+
+  vrb0(0,"cached result for %u-%u",key->dep,key->arr);
+  return 1;
+}
+
+// generation to pass to putrescache, taken before pinning fares and trips
+ub4 rescachegen(void)
+{
+  ub4 gen;
+
+  pthread_mutex_lock(&rclock);
+  gen = curgen;
+  pthread_mutex_unlock(&rclock);
+  return gen;
+}
+
+// store result of last search, unless an update was made since src->rcgen
+void putrescache(const struct rckey *key,search *src)
+{
+  struct rcent *ep;
+  struct trip *stp;
+  ub4 e,h,t,leg,r,rid;
+
+  if (entcnt == 0) return;
+
+  h = keyhash(key);
+
+  pthread_mutex_lock(&rclock);
+
+  if (src->rcgen != curgen) { pthread_mutex_unlock(&rclock); return; }
+
+  // a concurrent search may have stored it already
+  e = hashtab[h & hashmask];
+  while (e != hi32 && (ents[e].hash != h || memcmp(&ents[e].key,key,sizeof(*key)))) e = ents[e].hnxt;
+  if (e != hi32) { pthread_mutex_unlock(&rclock); return; }
+
+  if (freehd == hi32) {
+    dropent(lrutl);
+    evicts++;
+  }
+  e = freehd;
+  ep = ents + e;
+  freehd = ep->nxt;
+
+  ep->key = *key;
+  ep->hash = h;
+  ep->t0 = gettime_sec();
+  memcpy(ep->trips,src->trips,sizeof(ep->trips));
+  ep->reslen = src->reslen;
+  memcpy(ep->res,src->resbuf,src->reslen);
+
+  ep->ridcnt = 0;
+  for (t = 0; t < Elemcnt(src->trips); t++) {
+    stp = src->trips + t;
+    if (stp->cnt == 0) continue;
+    for (leg = 0; leg < stp->len; leg++) {
+      rid = stp->rid[leg];
+      if (rid == hi32) continue;
+      for (r = 0; r < ep->ridcnt && ep->rids[r] != rid; r++) ;
+      if (r == ep->ridcnt) ep->rids[ep->ridcnt++] = rid;
+    }
+  }
+
+  ep->hnxt = hashtab[h & hashmask];
+  hashtab[h & hashmask] = e;
+  lrufront(e);
+  usecnt++;
+  stores++;
+
+  pthread_mutex_unlock(&rclock);
+}
+
+/* drop entries with a trip on any of the given routes, or all for rids NULL,
+   and start a new generation. Call after publishing the update
+ */
+ub4 invrescache(const ub4 *rids,ub4 ridcnt)
+{
+  struct rcent *ep;
+  ub4 e,nxt,r,i,cnt = 0;
+
+  if (entcnt == 0) return 0;
+
+  pthread_mutex_lock(&rclock);
+  curgen++;
+  for (e = lruhd; e != hi32; e = nxt) {
+    ep = ents + e;
+    nxt = ep->nxt;
+    if (rids == NULL) { dropent(e); cnt++; continue; }
+    for (r = 0; r < ep->ridcnt; r++) {
+      for (i = 0; i < ridcnt && rids[i] != ep->rids[r]; i++) ;
+      if (i < ridcnt) break;
+    }
+    if (r < ep->ridcnt) { dropent(e); cnt++; }
+  }
+  invals += cnt;
+  pthread_mutex_unlock(&rclock);
+
+  infocc(cnt && rids,0,"invalidated %u cached result\as for %u rid\as",cnt,ridcnt);
+  infocc(cnt && rids == NULL,0,"invalidated all %u cached result\as",cnt);
+  return cnt;
+}
+
+ub4 rescachestats(char *buf,ub4 len)
+{
+  ub4 pos;
+
+  pthread_mutex_lock(&rclock);
+  pos = mysnprintf(buf,0,len,"cache\tentries %u of %u\thits %u\tmisses %u\tstores %u\tinvalidated %u\tevicted %u\texpired %u\n",
+    usecnt,entcnt,hits,misses,stores,invals,evicts,expires);
+  pthread_mutex_unlock(&rclock);
+  return pos;
+}
+
+void inirescache(void)
+{
+  msgfile = setmsgfile(__FILE__);
+  iniassert();
+}
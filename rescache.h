@@ -0,0 +1,30 @@
+// rescache.h - cache of plan results
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+// all search parameters that determine a result
+struct rckey {
+  ub4 dep,arr;
+  ub4 tdep,ttdep,utcofs;
+  ub4 plusday,minday;
+  ub4 lostop,histop,nethistop;
+  ub4 mintt,maxtt;
+  ub4 costperstop;
+  ub4 walklimit,sumwalklimit;
+  ub4 gen;  // network generation
+};
+
+extern void inirescache(void);
+extern int mkrescache(ub4 mbytes,ub4 maxage);
+extern int getrescache(const struct rckey *key,search *src);
+extern ub4 rescachegen(void);
+extern void putrescache(const struct rckey *key,search *src);
+extern ub4 invrescache(const ub4 *rids,ub4 ridcnt);
+extern ub4 rescachestats(char *buf,ub4 len);
@@ -0,0 +1,314 @@
+// rowcache.c - cache of on-demand n-stop rows
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+/* Partitions above net.lazyports ports have no precomputed 2-stop level.
+   Instead, the 2-stop row of a dep is built when a search first needs it, see mkdeprow(),
+   and kept keyed on network generation, partition and dep.
+
+   Rows are allocated individually from the heap, as their size varies with the dep. A mapping
+   per row would run into the process map count limit. When the configured memory is exceeded,
+   the least recently used rows not in use by a search are dropped.
+   Rows are built on a context per partition, so builds in a partition are serialized.
+
+   The cache is shared by the searches in a process : plan workers, or socket clients without.
+   Queries using a row are timed separately when one of their rows had to be built.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "base.h"
+#include "cfg.h"
+#include "mem.h"
+#include "os.h"
+
+static ub4 msgfile;
+#include "msg.h"
+
+#include "util.h"
+#include "time.h"
+#include "net.h"
+#include "netn.h"
+#include "rowcache.h"
+
+struct rcpart {
+  ub4 gen;
+  struct bldctx *cx;  // row builder for this generation, NULL if none yet
+  pthread_mutex_t lock;
+};
+
+static struct rcpart rcparts[Npart];
+
+static struct deprow **hashtab;
+static ub4 hashmask;
+static struct deprow *lruhd,*lrutl;
+static size_t maxlen,uselen;
+static ub4 usecnt;
+
+static ub4 hits,builds,evicts;
+static ub8 buildus;
+
+// per query : warm, cold
+static ub4 qcnts[2];
+static ub8 qsums[2],qmaxs[2];
+
+static pthread_mutex_t rclock = PTHREAD_MUTEX_INITIALIZER;
+
+static ub4 rowhash(ub4 gen,ub4 part,ub4 dep)
+{
+  ub4 h = 2166136261U;
+
+  h = (h ^ gen) * 16777619U;
+  h = (h ^ part) * 16777619U;
+  h = (h ^ dep) * 16777619U;
+  return h;
+}
+
+static struct deprow *findrow(ub4 gen,ub4 part,ub4 dep)
+{
+  struct deprow *rp = hashtab[rowhash(gen,part,dep) & hashmask];
+
+  while (rp && (rp->dep != dep || rp->part != part || rp->gen != gen)) rp = rp->hnxt;
+  return rp;
+}
+
+static void lruunlink(struct deprow *rp)
+{
+  if (rp->prv) rp->prv->nxt = rp->nxt; else lruhd = rp->nxt;
+  if (rp->nxt) rp->nxt->prv = rp->prv; else lrutl = rp->prv;
+}
+
+static void lrufront(struct deprow *rp)
+{
+  rp->prv = NULL;
+  rp->nxt = lruhd;
+  if (lruhd) lruhd->prv = rp; else lrutl = rp;
+  lruhd = rp;
+}
+
+static void droprow(struct deprow *rp)
+{
+  struct deprow **prp = hashtab + (rowhash(rp->gen,rp->part,rp->dep) & hashmask);
+
+  while (*prp != rp) prp = &(*prp)->hnxt;
+  *prp = rp->hnxt;
+  lruunlink(rp);
+  uselen -= rp->len;
+  usecnt--;
+  free(rp);
+}
+
+// drop least recently used rows not in use until within limit
+static void trimrows(void)
+{
+  struct deprow *rp = lrutl,*prv;
+
+  while (rp && uselen > maxlen) {
+    prv = rp->prv;
+    if (rp->refs == 0) { droprow(rp); evicts++; }
+    rp = prv;
+  }
+}
+
+int mkrowcache(ub4 mbytes)
+{
+  ub4 hlen = 1024;
+
+  if (mbytes == 0) return info0(0,"no on-demand row cache");
+
+  while (hlen < mbytes * 16) hlen <<= 1;
+  hashmask = hlen - 1;
+  hashtab = alloc(hlen,struct deprow *,0,"rowcache hash",hlen);
+  maxlen = (size_t)mbytes << 20;
+
+  info(0,"on-demand row cache of %u MB",mbytes);
+  return 0;
+}
+
+// copy a built row into its own allocation
+static struct deprow *newrow(const struct deprow *brp,ub4 nleg,ub4 dep)
+{
+  struct deprow *rp;
+  ub4 pairs = brp->pairs;
+  size_t varlen = brp->varcnt * nleg;
+  size_t hdrlen = (sizeof(struct deprow) + 7) & ~(size_t)7;
+  size_t len = hdrlen + (size_t)pairs * 3 * sizeof(ub4) + varlen * sizeof(ub4) + (size_t)pairs * sizeof(ub2);
+  ub1 *p;
+
+  p = malloc(len);
+  if (p == NULL) {
+    error(0,"cannot allocate \ah%lu b for row of dep %u with \ah%lu vars",(ub8)len,dep,(ub8)brp->varcnt);
+    return NULL;
+  }
+  rp = (struct deprow *)p;
+  rp->len = len;
+  rp->pairs = pairs;
+  rp->varcnt = brp->varcnt;
+
+  p += hdrlen;
+  rp->arrs = (ub4 *)p; p += pairs * sizeof(ub4);
+  rp->ofss = (ub4 *)p; p += pairs * sizeof(ub4);
+  rp->lodists = (ub4 *)p; p += pairs * sizeof(ub4);
+  rp->lst = (ub4 *)p; p += varlen * sizeof(ub4);
+  rp->cnts = (ub2 *)p;
+
+  memcpy(rp->arrs,brp->arrs,pairs * sizeof(ub4));
+  memcpy(rp->ofss,brp->ofss,pairs * sizeof(ub4));
+  memcpy(rp->lodists,brp->lodists,pairs * sizeof(ub4));
+  memcpy(rp->lst,brp->lst,varlen * sizeof(ub4));
+  memcpy(rp->cnts,brp->cnts,pairs * sizeof(ub2));
+  return rp;
+}
+
+/* net->lazystop row of dep, built if not cached. *pcold is set if built
+   the row stays valid until putdeprow()
+ */
+struct deprow *getdeprow(struct network *net,ub4 dep,ub4 *pcold)
+{
+  struct rcpart *pp;
+  struct deprow *rp,brow;
+  ub4 gen = netgenid();
+  ub4 part = net->part;
+  ub8 t0,dt;
+
+  error_ge(dep,net->portcnt);
+  error_ge(part,Npart);
+
+  *pcold = 0;
+
+  if (hashtab) {
+    pthread_mutex_lock(&rclock);
+    rp = findrow(gen,part,dep);
+    if (rp) {
+      rp->refs++;
+      lruunlink(rp);
+      lrufront(rp);
+      hits++;
+    }
+    pthread_mutex_unlock(&rclock);
+    if (rp) return rp;
+  }
+
+  pp = rcparts + part;
+  pthread_mutex_lock(&pp->lock);
+
+  // a concurrent search may have built it meanwhile
+  if (hashtab) {
+    pthread_mutex_lock(&rclock);
+    rp = findrow(gen,part,dep);
+    if (rp) {
+      rp->refs++;
+      lruunlink(rp);
+      lrufront(rp);
+      hits++;
+    }
+    pthread_mutex_unlock(&rclock);
+    if (rp) { pthread_mutex_unlock(&pp->lock); return rp; }
+  }
+
+  t0 = gettime_usec();
+
+  if (pp->cx && pp->gen != gen) { rmdepbld(pp->cx); pp->cx = NULL; }
+  if (pp->cx == NULL) {
+    pp->cx = mkdepbld(net);
+    pp->gen = gen;
+  }
+  mkdeprow(pp->cx,dep,&brow);
+  rp = newrow(&brow,net->lazystop + 1,dep);
+
+  pthread_mutex_unlock(&pp->lock);
+
+  if (rp == NULL) return NULL;
+
+  rp->gen = gen;
+  rp->part = part;
+  rp->dep = dep;
+  rp->refs = 1;
+  *pcold = 1;
+
+  dt = gettime_usec() - t0;
+  info(0,"built %u-stop row of dep %u: %u arr\as \ah%lu var\as \ah%lu b in %lu usec",net->lazystop,dep,rp->pairs,rp->varcnt,rp->len,dt);
+
+  pthread_mutex_lock(&rclock);
+  builds++;
+  buildus += dt;
+  if (hashtab) {
+    ub4 h = rowhash(gen,part,dep) & hashmask;
+    rp->hnxt = hashtab[h];
+    hashtab[h] = rp;
+    lrufront(rp);
+    uselen += rp->len;
+    usecnt++;
+    trimrows();
+  }
+  pthread_mutex_unlock(&rclock);
+  return rp;
+}
+
+void putdeprow(struct deprow *rp)
+{
+  if (hashtab == NULL) { free(rp); return; }
+
+  pthread_mutex_lock(&rclock);
+  error_z(rp->refs,rp->dep);
+  rp->refs--;
+  if (rp->refs == 0 && uselen > maxlen) trimrows();
+  pthread_mutex_unlock(&rclock);
+}
+
+// index of arr in row, hi32 if none
+ub4 deprowpair(const struct deprow *rp,ub4 arr)
+{
+  const ub4 *arrs = rp->arrs;
+  ub4 lo = 0,hi = rp->pairs,mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (arrs[mid] < arr) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo < rp->pairs && arrs[lo] == arr) return lo;
+  return hi32;
+}
+
+// time of a query that used on-demand rows
+void rowcachequery(int cold,ub8 dt)
+{
+  pthread_mutex_lock(&rclock);
+  qcnts[cold]++;
+  qsums[cold] += dt;
+  qmaxs[cold] = max(qmaxs[cold],dt);
+  pthread_mutex_unlock(&rclock);
+}
+
+ub4 rowcachestats(char *buf,ub4 len)
+{
+  ub4 pos;
+
+  pthread_mutex_lock(&rclock);
+  pos = mysnprintf(buf,0,len,"rows\tentries %u in \ah%lu of \ah%lu b\thits %u\tbuilds %u avg %lu usec\tevicted %u\n",
+    usecnt,(ub8)uselen,(ub8)maxlen,hits,builds,builds ? buildus / builds : 0,evicts);
+  pos += mysnprintf(buf,pos,len,"rowqueries\tcold %u avg %lu max %lu usec\twarm %u avg %lu max %lu usec\n",
+    qcnts[1],qcnts[1] ? qsums[1] / qcnts[1] : 0,qmaxs[1],qcnts[0],qcnts[0] ? qsums[0] / qcnts[0] : 0,qmaxs[0]);
+  pthread_mutex_unlock(&rclock);
+  return pos;
+}
+
+void inirowcache(void)
+{
+  ub4 part;
+
+  msgfile = setmsgfile(__FILE__);
+  iniassert();
+
+  for (part = 0; part < Npart; part++) pthread_mutex_init(&rcparts[part].lock,NULL);
+}
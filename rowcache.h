@@ -0,0 +1,35 @@
+// rowcache.h - cache of on-demand n-stop rows
+
+/*
+   This file is part of Tripover, a broad-search journey planner.
+
+   Copyright (C) 2015 Joris van der Geer.
+
+   This work is licensed under the Creative Commons Attribution-NonCommercial-NoDerivatives 4.0 International License.
+   To view a copy of this license, visit http://creativecommons.org/licenses/by-nc-nd/4.0/
+ */
+
+// lazystop connections of a single dep, as in the net's conarr .. conlst for its row
+struct deprow {
+  struct deprow *prv,*nxt;  // lru list, most recent first
+  struct deprow *hnxt;      // hash chain
+  ub4 gen,part,dep;
+  ub4 refs;
+  size_t len;       // bytes allocated, including this header
+
+  ub4 pairs;
+  ub4 *arrs;        // [pairs] ascending
+  ub2 *cnts;        // [pairs]
+  ub4 *ofss;        // [pairs]
+  ub4 *lodists;     // [pairs]
+  size_t varcnt;
+  ub4 *lst;         // [varcnt * nleg] hop ids
+};
+
+extern void inirowcache(void);
+extern int mkrowcache(ub4 mbytes);
+extern struct deprow *getdeprow(struct network *net,ub4 dep,ub4 *pcold);
+extern void putdeprow(struct deprow *rp);
+extern ub4 deprowpair(const struct deprow *rp,ub4 arr);
+extern void rowcachequery(int cold,ub8 dt);
+extern ub4 rowcachestats(char *buf,ub4 len);
@@ -31,8 +31,11 @@ static ub4 msgfile;
 #include "msg.h"
 
 #include "net.h"
+#include "fare.h"
+#include "realtime.h"
 
 #include "search.h"
+#include "rowcache.h"
 
 // time limit in msec for searches
 static const ub8 Timelimit = 3000;
@@ -56,6 +59,40 @@ void inisearch(void)
 
 enum evfld { timefld,tidfld,dtfld,durfld,costfld,prvfld,farefld,sdafld,flnfld,fldcnt };
 
+#define Depcache_hops 4096
+#define Depcache_hash 1024
+#define Depcache_pool (256 * 1024)
+
+// first leg candidate events for a hop and departure window, without cost limit
+struct depcent {
+  ub4 part,hop;
+  ub4 deptmin,deptmax,deptmid;
+  ub4 ofs,cnt;    // in pool. cnt hi32 if truncated at Maxevs
+  ub4 hop1,hop2,duracc;
+  struct hop *hp1;
+  ub4 nxt;        // hash chain
+};
+
+// departure related search state kept over a batch of searches sharing parameters
+struct depcache {
+  int ena;
+
+  // getdepwin() first event per leg, valid for deptmin
+  ub4 deptmin;
+  ub4 firsthop[Nxleg];
+  ub4 first[Nxleg];
+  ub4 firstndx[Nxleg];
+
+  // mkdepevs()
+  ub4 hash[Depcache_hash];
+  struct depcent ents[Depcache_hops];
+  ub4 entcnt;
+  ub4 *pool;
+  ub4 poolpos;
+
+  ub4 hits,misses;
+};
+
 static const ub4 evmagic1 = 0xbdc90b28;
 static const ub4 evmagic2 = 0x695c4b78;
 
@@ -75,6 +112,7 @@ static void inisrc(search *src,const char *desc,ub4 arg)
   for (t = 0; t < Elemcnt(src->trips); t++) {
     stp = src->trips + t;
     stp->cnt = stp->len = 0;
+    stp->dt = stp->dist = stp->fare = 0;
     for (i = 0; i < Nxleg; i++) {
       stp->trip[i * 2] = stp->trip[i * 2 + 1] = hi32;
       stp->port[i] = hi32;
@@ -101,11 +139,21 @@ static void timelimit(search *src,ub4 limit)
   src->tlim = min(src->tlim,limit);
 }
 
+// time limit or deadline reached : the result is partial
+static int timedout(search *src)
+{
+  if (gettime_usec() <= src->querytlim) return 0;
+  src->truncated = 1;
+  return 1;
+}
+
 static void fmtsum(struct trip *stp,ub4 dt,ub4 nxt,ub4 dist,ub4 fare,ub4 lodt,const char *ref)
 {
   ub4 len = (ub4)sizeof(stp->desc);
   ub4 pos = mysnprintf(stp->desc,0,len,"#item\ttime\tdistance\tstops\nfare\tref\n");
 
+  stp->dt = dt;
+  stp->fare = fare;
   if (nxt == 0) nxt = hi32;
   mysnprintf(stp->desc,pos,len,"sum\t\at%u\t\ag%u\t%u\t%u\t\at%u\t%s-%u\n",dt,dist,stp->len - 1,fare,nxt,ref,lodt);
 }
@@ -133,7 +181,8 @@ static ub4 getdepwin(search *src,lnet *net,ub4 *legs,ub4 nleg)
   ub4 lospan4,lospan8,lospan24,lospan48,lospan72;
   ub4 span4,span8,span24,span48,span72;
   struct timepat *tp,*tp1,*tp2;
-  struct hop *hp1,*hp2,*hops = net->hops;
+  struct hop *hp,*hp1,*hp2 = NULL,*hops = net->hops;
+  struct rtver *rv;
   ub4 *choporg = net->choporg;
   ub4 hopcnt = net->hopcnt;
   ub4 chopcnt = net->chopcnt;
@@ -159,12 +208,18 @@ static ub4 getdepwin(search *src,lnet *net,ub4 *legs,ub4 nleg)
 
     hp1 = hops + hop1;
     tp1 = &hp1->tp;
-    if (hop2 != hi32 && tp2->genevcnt < tp1->genevcnt) tp = tp2;
-    else tp = tp1;
+    if (hop2 != hi32 && tp2->genevcnt < tp1->genevcnt) { tp = tp2; hp = hp2; }
+    else { tp = tp1; hp = hp1; }
 
     gencnt = tp->genevcnt;
     gt0 = tp->gt0;
     ev = events + tp->evofs;
+    t0 = tp->t0;
+    t1 = tp->t1;
+    if ( (rv = rtevents(hp->gid)) ) {
+      gencnt = rv->evcnt; ev = rv->ev;
+      t0 = rv->t0; t1 = rv->t1;
+    }
 
     if (src->firsthop[leg] == hop) {
       tf = src->first[leg];
@@ -175,9 +230,6 @@ static ub4 getdepwin(search *src,lnet *net,ub4 *legs,ub4 nleg)
 
       tf = 0;
 
-      t0 = tp->t0;
-      t1 = tp->t1;
-
       if (gencnt == 0) break;
       if (t0 == t1) break;
       if (t1 + gt0 <= deptmin) break;
@@ -248,7 +300,7 @@ static ub4 getdepwin(search *src,lnet *net,ub4 *legs,ub4 nleg)
 }
 
 // create list of candidate events for first leg
-static ub4 mkdepevs(search *src,lnet *net,ub4 hop,ub4 midur,ub4 costlim)
+static ub4 gendepevs(search *src,lnet *net,ub4 hop,ub4 midur,ub4 costlim)
 {
   ub4 deptmin = src->deptmin;
   ub4 deptmax = src->deptmax;
@@ -271,9 +323,10 @@ static ub4 mkdepevs(search *src,lnet *net,ub4 hop,ub4 midur,ub4 costlim)
   ub4 chaincnt = net->chaincnt;
   ub8 *events = net->events;
   ub4 hop1,hop2,rh1,rh2,rid;
-  ub4 ofs;
+  ub4 fareofs,fi,*evfi;
   ub2 fare;
-  ub2 *farepos,*fareposbase = net->fareposbase;
+  struct rtver *rv;
+  ub2 *fareposbase = net->fareposbase;
   ub4 deptbias;
   ub4 cost,locost;
 
@@ -307,6 +360,11 @@ static ub4 mkdepevs(search *src,lnet *net,ub4 hop,ub4 midur,ub4 costlim)
 
   ub4 extracost;
 
+  if ( (rv = rtevents(hp1->gid)) ) {
+    gencnt = rv->evcnt;
+    t0 = rv->t0; t1 = rv->t1;
+  }
+
   if (gencnt == 0) return vrb0(Notty,"no events for hop %u at \ad%u - \ad%u",hop,t0 + gt0,t1 + gt0);
 
   if (t0 == t1) return info(Iter|Notty,"hop %u tt range %u-%u, dep window %u-%u",hp1->gid,t0,t1,deptmin,deptmax);
@@ -315,7 +373,8 @@ static ub4 mkdepevs(search *src,lnet *net,ub4 hop,ub4 midur,ub4 costlim)
 
   locost = hi32;
 
-  ev = events + tp->evofs;
+  if (rv) { ev = rv->ev; evfi = rv->fi; }
+  else { ev = events + tp->evofs; evfi = NULL; }
   dev = src->depevs[0];
 
   if (chkdev(dev,0)) return 0;
@@ -333,10 +392,8 @@ static ub4 mkdepevs(search *src,lnet *net,ub4 hop,ub4 midur,ub4 costlim)
 //    extracost_win = (deptmin - (t1 + gt0)) * 8;
   }
 
-  if (hp1->reserve && net->fhopofs) {
-    ofs = net->fhopofs[hop];
-    farepos = fareposbase + ofs * Faregrp;
-  } else farepos = NULL;
+  if (hp1->reserve && net->fhopofs && fareposbase) fareofs = net->fhopofs[hop];
+  else fareofs = hi32;
 
   prvt = 0;
   lodur = hi32; lodev = lodev2 = hi32;
@@ -366,9 +423,9 @@ static ub4 mkdepevs(search *src,lnet *net,ub4 hop,ub4 midur,ub4 costlim)
       if (deptbias > 1440) extracost += (deptbias - 1440) / 400;
     }
 
-    if (farepos) {
-      fare = farepos[gndx * Faregrp];
-//      info(0,"hop %u ev %u t \ad%u fare %u at %p",hop,gndx,t + gt0,fare,farepos + gndx * Faregrp);
+    fi = evfi ? evfi[gndx] : gndx;
+    if (fareofs != hi32 && fi != hi32) {
+      fare = getfare(fareposbase,fareofs + fi);
       if (fare == hi16) continue;
     } else fare = 0; // todo: use nonreserved fare rules
 
@@ -387,7 +444,7 @@ static ub4 mkdepevs(search *src,lnet *net,ub4 hop,ub4 midur,ub4 costlim)
       cp = chains + tid;
       if (cp->hopcnt < 2) continue;
       if (rh1 >= cp->rhopcnt || rh2 >= cp->rhopcnt) continue;
-      crp = chainrhops + cp->rhopofs;
+      crp = rtrhops(chainrhops,cp,tid);
       crpp = chainrphops + cp->rhopofs;
       tdep1 = (ub4)(crp[rh1] >> 32);
       tarr2 = crp[rh2] & hi32;
@@ -457,6 +514,117 @@ static ub4 mkdepevs(search *src,lnet *net,ub4 hop,ub4 midur,ub4 costlim)
   return dcnt;
 }
 
+static void resetdepcache(struct depcache *dc)
+{
+  nsethi(dc->hash,Depcache_hash);
+  dc->entcnt = 0;
+  dc->poolpos = 0;
+  dc->deptmin = hi32;
+}
+
+static struct depcent *getdepcent(struct depcache *dc,search *src,ub4 part,ub4 hop)
+{
+  struct depcent *ep;
+  ub4 e = dc->hash[(hop ^ (part << 6)) & (Depcache_hash - 1)];
+
+  while (e != hi32) {
+    ep = dc->ents + e;
+    if (ep->hop == hop && ep->part == part && ep->deptmin == src->deptmin && ep->deptmax == src->deptmax && ep->deptmid == src->deptmid) return ep;
+    e = ep->nxt;
+  }
+  return NULL;
+}
+
+// store events just generated without cost limit
+static struct depcent *adddepcent(struct depcache *dc,search *src,ub4 part,ub4 hop,ub4 dcnt)
+{
+  struct depcent *ep;
+  ub4 h,len = dcnt * fldcnt;
+
+  if (dc->entcnt == Depcache_hops || dc->poolpos + len > Depcache_pool * fldcnt) {
+    vrb0(0,"reset dep cache at %u entries",dc->entcnt);
+    resetdepcache(dc);
+  }
+  h = (hop ^ (part << 6)) & (Depcache_hash - 1);
+  ep = dc->ents + dc->entcnt;
+  ep->part = part; ep->hop = hop;
+  ep->deptmin = src->deptmin; ep->deptmax = src->deptmax; ep->deptmid = src->deptmid;
+  ep->nxt = dc->hash[h];
+  dc->hash[h] = dc->entcnt++;
+
+  if (dcnt >= Maxevs) { ep->cnt = hi32; return ep; }
+
+  ep->ofs = dc->poolpos;
+  ep->cnt = dcnt;
+  if (dcnt) {
+    ep->hop1 = src->hop1s[0]; ep->hop2 = src->hop2s[0]; ep->hp1 = src->hp1s[0];
+    ep->duracc = src->duraccs[0];
+    memcpy(dc->pool + ep->ofs,src->depevs[0],len * sizeof(ub4));
+    dc->poolpos += len;
+  }
+  return ep;
+}
+
+/* create list of candidate events for first leg
+   in batch mode, the list without cost limit is generated once per hop and window,
+   and filtered here on cost. Identical to a direct generate unless truncated
+ */
+static ub4 mkdepevs(search *src,lnet *net,ub4 hop,ub4 midur,ub4 costlim)
+{
+  struct depcache *dc = src->depcache;
+  struct depcent *ep;
+  ub4 part = net->part;
+  ub4 i,dcnt,cost,locost,lodev,lodev2;
+  ub4 *cev,*dev,*devp;
+
+  if (dc == NULL || dc->ena == 0) return gendepevs(src,net,hop,midur,costlim);
+
+  ep = getdepcent(dc,src,part,hop);
+  if (ep) dc->hits++;
+  else {
+    dc->misses++;
+    dcnt = gendepevs(src,net,hop,midur,hi32);
+    ep = adddepcent(dc,src,part,hop,dcnt);
+  }
+  if (ep->cnt == hi32) return gendepevs(src,net,hop,midur,costlim);
+
+  src->dcnts[0] = src->dcnts[1] = 0;
+  src->nleg = 0;
+
+  dev = src->depevs[0];
+  if (chkdev(dev,0)) return 0;
+
+  cev = dc->pool + ep->ofs;
+  locost = hi32; lodev = lodev2 = hi32;
+  dcnt = 0;
+  for (i = 0; i < ep->cnt; i++) {
+    cost = cev[costfld];
+    if (cost < costlim) {
+      devp = dev + dcnt * fldcnt;
+      memcpy(devp,cev,fldcnt * sizeof(ub4));
+      if (cost < locost) { locost = cost; lodev = dcnt; }
+      else if (cost == locost && lodev2 == hi32) lodev2 = dcnt;
+      dcnt++;
+    }
+    cev += fldcnt;
+  }
+  src->dcnts[0] = dcnt;
+  if (dcnt == 0) return 0;
+  src->duraccs[0] = ep->duracc;
+
+  src->nleg = 1;
+
+  src->hop1s[0] = ep->hop1;
+  src->hp1s[0] = ep->hp1;
+  src->hop2s[0] = ep->hop2;
+  src->parts[0] = part;
+
+  src->costcurs[0] = locost;
+  src->devcurs[0] = lodev;
+  src->devcurs2[0] = lodev2;
+  return dcnt;
+}
+
 // create list of candidate events for subsequent legs
 static ub4 nxtevs(search *src,lnet *net,ub4 leg,ub4 bstop,ub4 hop,ub4 midur,ub4 costlim)
 {
@@ -465,7 +633,7 @@ static ub4 nxtevs(search *src,lnet *net,ub4 leg,ub4 bstop,ub4 hop,ub4 midur,ub4
   ub4 aleg,ahop;
   ub4 dndx,dcnt,ddcnt,gencnt;
   ub4 gndx,agndx,prvgndx,dmax = Maxevs;
-  ub4 adndx,adcnt,ofs;
+  ub4 adndx,adcnt;
   ub4 rt,t,last,at,dur,atarr,adur,dt,adt;
   ub4 srdep,srarr,srda,srda2;
   ub4 tid,atid,lodev,lodev2,loadev;
@@ -487,9 +655,10 @@ static ub4 nxtevs(search *src,lnet *net,ub4 leg,ub4 bstop,ub4 hop,ub4 midur,ub4
   ub8 *events = net->events;
   ub4 hop1,hop2,rh1,rh2,gid,rid,rid2;
   ub4 costperstop = src->costperstop;
-  ub4 fare,afare;
-  ub2 *farepos,*fareposbase = net->fareposbase;
+  ub4 fare,afare,fareofs,fi,*evfi;
+  ub2 *fareposbase = net->fareposbase;
   ub4 ttbiascost;
+  struct rtver *rv;
 
   error_z(leg,0);
   aleg = leg - 1;
@@ -527,13 +696,15 @@ static ub4 nxtevs(search *src,lnet *net,ub4 leg,ub4 bstop,ub4 hop,ub4 midur,ub4
   if (rh1 >= Chainlen || rh2 >= Chainlen) return 0;
 
   gencnt = tp->genevcnt;
+  rv = rtevents(gid);
+  if (rv) gencnt = rv->evcnt;
 
   if (gencnt == 0) return 0;
 
   ub4 gt0 = tp->gt0;
 
-  ub4 t0 = tp->t0;
-  ub4 t1 = tp->t1;
+  ub4 t0 = rv ? rv->t0 : tp->t0;
+  ub4 t1 = rv ? rv->t1 : tp->t1;
 
   ttmin = max(tp->duracc,ttmin);
 
@@ -546,10 +717,8 @@ static ub4 nxtevs(search *src,lnet *net,ub4 leg,ub4 bstop,ub4 hop,ub4 midur,ub4
 
   if (t0 == t1) return info(Notty,"hop %u tt range %u-%u, dep window %u-%u",gid,t0,t1,deptmin,deptmax);
 
-  if (hp1->reserve && net->fhopofs) {
-    ofs = net->fhopofs[hop];
-    farepos = fareposbase + ofs * Faregrp;
-  } else farepos = NULL;
+  if (hp1->reserve && net->fhopofs && fareposbase) fareofs = net->fhopofs[hop];
+  else fareofs = hi32;
 
   ahop = src->hop1s[aleg];
   ahp = src->hp1s[aleg];
@@ -568,7 +737,8 @@ static ub4 nxtevs(search *src,lnet *net,ub4 leg,ub4 bstop,ub4 hop,ub4 midur,ub4
 
   src->duraccs[leg] = tp->duracc;
 
-  ev = events + tp->evofs;
+  if (rv) { ev = rv->ev; evfi = rv->fi; }
+  else { ev = events + tp->evofs; evfi = NULL; }
 
   dev = src->depevs[leg];
   adev = src->depevs[aleg];
@@ -626,9 +796,9 @@ static ub4 nxtevs(search *src,lnet *net,ub4 leg,ub4 bstop,ub4 hop,ub4 midur,ub4
         ddcnt++;
       }
 
-      if (farepos) {
-        fare = farepos[gndx * Faregrp];
-//      info(0,"hop %u ev %u t \ad%u fare %u at %p",hop,gndx,t + gt0,fare,farepos + gndx * Faregrp);
+      fi = evfi ? evfi[gndx] : gndx;
+      if (fareofs != hi32 && fi != hi32) {
+        fare = getfare(fareposbase,fareofs + fi);
         if (fare == hi16) continue;
       } else fare = 0; // todo: use nonreserved fare rules
 
@@ -651,7 +821,7 @@ static ub4 nxtevs(search *src,lnet *net,ub4 leg,ub4 bstop,ub4 hop,ub4 midur,ub4
         srda = (ub4)(x1 >> 48);
         srdep = (srda >> 8) & 0xff;
 
-        crp = chainrhops + cp->rhopofs;
+        crp = rtrhops(chainrhops,cp,tid);
         crpp = chainrphops + cp->rhopofs;
 
         if (rh1 >= cp->rhopcnt) {
@@ -869,6 +1039,7 @@ static ub4 frqevs(search *src,lnet *net,ub4 leg,ub4 hop1,ub4 nxthop,ub4 midur,ub
 
   struct timepat *tp;
   struct hop *hp,*hops = net->hops;
+  struct rtver *rv;
   ub8 *events = net->events;
   ub4 hopcnt = net->hopcnt;
   ub4 chopcnt = net->chopcnt;
@@ -900,6 +1071,10 @@ static ub4 frqevs(search *src,lnet *net,ub4 leg,ub4 hop1,ub4 nxthop,ub4 midur,ub
     gt0 = tp->gt0;
     t0 = tp->t0;
     t1 = tp->t1;
+    if ( (rv = rtevents(hp->gid)) ) {
+      gencnt = rv->evcnt; ev = rv->ev;
+      t0 = rv->t0; t1 = rv->t1;
+    }
 
     for (gndx = 0; gndx < gencnt; gndx++) {
       x = ev[gndx * 2];
@@ -1147,16 +1322,14 @@ static ub4 addevs(ub4 callee,search *src,lnet *net, ub4 *legs,ub4 nleg,ub4 nxleg
 static int srcdyn(gnet *gnet,lnet *net,search *src,ub4 dep,ub4 arr,ub4 stop,int havedist,const char *desc)
 {
   struct port *pmid,*ports = net->ports;
-  ub4 portcnt = net->portcnt;
   ub4 chopcnt = net->chopcnt;
   ub4 *hopdist = net->hopdist;
   ub4 part = net->part;
   ub4 midstop1,midstop2,mid,depmid,midarr;
   ub4 ofs1,ofs2,stop1,leg1,leg2,nleg1,nleg2,n1,n2,v1,v2;
-  ub4 *conofs1,*conofs2;
+  ub4 *conofs1,*conofs2,*conrow1,*conarr1;
   ub2 *cnts1,*cnts2;
-  block *lstblk1,*lstblk2;
-  ub4 *conlst1,*conlst2,*lst1,*lst2,*lst11,*lst22;
+  ub4 *lst11,*lst22,legs1[Nleg],legs2[Nleg];
   ub4 dtcur,sumdt;
   ub4 fare;
   ub4 curcost,costlim;
@@ -1203,40 +1376,34 @@ static int srcdyn(gnet *gnet,lnet *net,search *src,ub4 dep,ub4 arr,ub4 stop,int
 
     src->hisrcstop = max(src->hisrcstop,nleg - 1);
 
-    lstblk1 = net->conlst + midstop1;
-    lstblk2 = net->conlst + midstop2;
-
-    conlst1 = blkdata(lstblk1,0,ub4);
-    conlst2 = blkdata(lstblk2,0,ub4);
-
     conofs1 = net->conofs[midstop1];
     conofs2 = net->conofs[midstop2];
+    conrow1 = net->conrow[midstop1];
+    conarr1 = net->conarr[midstop1];
 
-    for (mid = 0; mid < portcnt; mid++) {
+    for (depmid = conrow1[dep]; depmid < conrow1[dep + 1]; depmid++) {
+      mid = conarr1[depmid];
       if (mid == dep || mid == arr) continue;
-      depmid = dep * portcnt + mid;
       n1 = cnts1[depmid];
       if (n1 == 0) continue;
 
       pmid = ports + mid;
       if (pmid->oneroute) continue;
 
-      midarr = mid * portcnt + arr;
+      midarr = conpair(net,midstop2,mid,arr);
+      if (midarr == hi32) continue;
       n2 = cnts2[midarr];
       if (n2 == 0) continue;
 
-      if (gettime_usec() > src->querytlim) return havedist | havetime;
+      if (timedout(src)) return havedist | havetime;
 
 //      info(Notty,"mid %u depmid %u midarr %u",mid,n1,n2);
 
       ofs1 = conofs1[depmid];
       ofs2 = conofs2[midarr];
 
-      lst1 = conlst1 + ofs1 * nleg1;
-      lst2 = conlst2 + ofs2 * nleg2;
-
       for (v1 = 0; v1 < n1; v1++) {
-        lst11 = lst1 + v1 * nleg1;
+        lst11 = conlegs(net,midstop1,ofs1 + v1,legs1);
 
         dist1 = walkdist1 = sumwalkdist1 = 0;
         for (leg1 = 0; leg1 < nleg1; leg1++) {
@@ -1253,7 +1420,7 @@ static int srcdyn(gnet *gnet,lnet *net,search *src,ub4 dep,ub4 arr,ub4 stop,int
         if (walkdist1 > walklimit || sumwalkdist1 > sumwalklimit) continue;
 
         for (v2 = 0; v2 < n2; v2++) {
-          lst22 = lst2 + v2 * nleg2;
+          lst22 = conlegs(net,midstop2,ofs2 + v2,legs2);
 
           dist2 = dist1;
           walkdist2 = walkdist1;
@@ -1364,7 +1531,6 @@ static int srcdyn(gnet *gnet,lnet *net,search *src,ub4 dep,ub4 arr,ub4 stop,int
 // dynamic search for one or more extra stops, using 2 vias
 static int srcleg3(gnet *gnet,lnet *net,search *src,ub4 dep,ub4 arr,ub4 nleg1,ub4 nleg2,ub4 nleg3,int havedist,const char *desc)
 {
-  ub4 portcnt = net->portcnt;
   ub4 chopcnt = net->chopcnt;
   ub4 *hopdist = net->hopdist;
   struct port *pmid1,*pmid2,*ports = net->ports;
@@ -1372,10 +1538,9 @@ static int srcleg3(gnet *gnet,lnet *net,search *src,ub4 dep,ub4 arr,ub4 nleg1,ub
   ub4 stop1,stop2,stop3;
   ub4 mid1,mid2,depmid1,mid12,mid2arr;
   ub4 ofs1,ofs2,ofs3,leg1,leg2,leg3,n1,n2,n3,v1,v2,v3;
-  ub4 *conofs1,*conofs2,*conofs3;
+  ub4 *conofs1,*conofs2,*conofs3,*conrow1,*conarr1,*conrow2,*conarr2;
   ub2 *cnts1,*cnts2,*cnts3;
-  block *lstblk1,*lstblk2,*lstblk3;
-  ub4 *conlst1,*conlst2,*conlst3,*lst1,*lst2,*lst3,*lst11,*lst22,*lst33;
+  ub4 *lst11,*lst22,*lst33,legs1[Nleg],legs2[Nleg],legs3[Nleg];
   ub4 sumdt;
   ub4 evcnt;
   ub4 trip[Nxleg];
@@ -1421,38 +1586,36 @@ static int srcleg3(gnet *gnet,lnet *net,search *src,ub4 dep,ub4 arr,ub4 nleg1,ub
 
   src->hisrcstop = max(src->hisrcstop,nleg - 1);
 
-  lstblk1 = net->conlst + stop1;
-  lstblk2 = net->conlst + stop2;
-  lstblk3 = net->conlst + stop3;
-
-  conlst1 = blkdata(lstblk1,0,ub4);
-  conlst2 = blkdata(lstblk2,0,ub4);
-  conlst3 = blkdata(lstblk3,0,ub4);
-
   conofs1 = net->conofs[stop1];
   conofs2 = net->conofs[stop2];
   conofs3 = net->conofs[stop3];
 
-  for (mid1 = 0; mid1 < portcnt; mid1++) {
+  conrow1 = net->conrow[stop1];
+  conarr1 = net->conarr[stop1];
+  conrow2 = net->conrow[stop2];
+  conarr2 = net->conarr[stop2];
+
+  for (depmid1 = conrow1[dep]; depmid1 < conrow1[dep + 1]; depmid1++) {
+    mid1 = conarr1[depmid1];
     if (mid1 == dep || mid1 == arr) continue;
-    depmid1 = dep * portcnt + mid1;
     n1 = cnts1[depmid1];
     if (n1 == 0) continue;
 
     pmid1 = ports + mid1;
     if (pmid1->oneroute) continue;
 
-    if (gettime_usec() > src->querytlim) return havetime | havedist;
+    if (timedout(src)) return havetime | havedist;
 
 //    info(Notty,"mid1 %u cnt %u lodist %u",mid1,n1,lodist);
 
-    for (mid2 = 0; mid2 < portcnt; mid2++) {
+    for (mid12 = conrow2[mid1]; mid12 < conrow2[mid1 + 1]; mid12++) {
+      mid2 = conarr2[mid12];
       if (mid2 == dep || mid2 == mid1 || mid2 == arr) continue;
-      mid12 = mid1 * portcnt + mid2;
       n2 = cnts2[mid12];
       if (n2 == 0) continue;
 
-      mid2arr = mid2 * portcnt + arr;
+      mid2arr = conpair(net,stop3,mid2,arr);
+      if (mid2arr == hi32) continue;
       n3 = cnts3[mid2arr];
       if (n3 == 0) continue;
 
@@ -1465,17 +1628,13 @@ static int srcleg3(gnet *gnet,lnet *net,search *src,ub4 dep,ub4 arr,ub4 nleg1,ub
       ofs2 = conofs2[mid12];
       ofs3 = conofs3[mid2arr];
 
-      lst1 = conlst1 + ofs1 * nleg1;
-      lst2 = conlst2 + ofs2 * nleg2;
-      lst3 = conlst3 + ofs3 * nleg3;
-
       altcnt = 0;
 
       for (v1 = 0; v1 < n1; v1++) {
         if (altcnt > altlimit) break;
-        lst11 = lst1 + v1 * nleg1;
+        lst11 = conlegs(net,stop1,ofs1 + v1,legs1);
 
-        if (gettime_usec() > src->querytlim) return havetime | havedist;
+        if (timedout(src)) return havetime | havedist;
 
         dist1 = walkdist1 = sumwalkdist1 = 0;
         for (leg1 = 0; leg1 < nleg1; leg1++) {
@@ -1496,7 +1655,7 @@ static int srcleg3(gnet *gnet,lnet *net,search *src,ub4 dep,ub4 arr,ub4 nleg1,ub
         for (v2 = 0; v2 < n2; v2++) {
           if (altcnt > altlimit) break;
 
-          lst22 = lst2 + v2 * nleg2;
+          lst22 = conlegs(net,stop2,ofs2 + v2,legs2);
 
           dist2 = dist1;
           walkdist2 = walkdist1;
@@ -1519,7 +1678,7 @@ static int srcleg3(gnet *gnet,lnet *net,search *src,ub4 dep,ub4 arr,ub4 nleg1,ub
           for (v3 = 0; v3 < n3; v3++) {
             if (altcnt++ > altlimit) break;
 
-            lst33 = lst3 + v3 * nleg3;
+            lst33 = conlegs(net,stop3,ofs3 + v3,legs3);
 
             dist3 = dist2;
             walkdist3 = walkdist2;
@@ -1653,7 +1812,7 @@ static int srcdyn2(gnet *gnet,lnet *net,search *src,ub4 dep,ub4 arr,ub4 stop,int
         info(0,"searching %u+%u+%u legs costlim %u",nleg1,nleg2,nleg3,src->locost);
         rv |= srcleg3(gnet,net,src,dep,arr,nleg1,nleg2,nleg3,havedist,desc);
         info(0,"now %lu t0 %lu lim %lu dif %lu",gettime_usec() / 1000,src->queryt0 / 1000,src->querytlim / 1000,(gettime_usec() - src->queryt0) / 1000);
-        if (gettime_usec() > src->querytlim) {
+        if (timedout(src)) {
           info(0,"timeout at %lu msec",(gettime_usec() - src->queryt0) / 1000);
           return rv;
         }
@@ -1668,8 +1827,6 @@ static ub4 srclocal(ub4 callee,gnet *gnet,lnet *net,ub4 part,ub4 dep,ub4 arr,ub4
 {
   ub2 *cnts,cnt;
   ub4 *ofss,ofs;
-  ub4 *lst;
-  block *lstblk;
   ub4 *lodists,lodist;
   ub4 nleg = stop + 1;
   ub4 nethistop = min(net->histop,src->nethistop);
@@ -1678,11 +1835,10 @@ static ub4 srclocal(ub4 callee,gnet *gnet,lnet *net,ub4 part,ub4 dep,ub4 arr,ub4
   ub4 evcnt;
   ub4 hdist,dist = 0,leg,l;
   ub4 dtcur,sumdt;
-  ub4 *vp;
+  ub4 *vp,legs[Nleg];
   ub4 curcost,costlim = src->locost;
   ub4 *hopdist;
   ub4 v0;
-  ub4 portcnt = net->portcnt;
   ub4 chopcnt = net->chopcnt;
   ub4 whopcnt = net->whopcnt;
   struct trip *stp;
@@ -1693,9 +1849,17 @@ static ub4 srclocal(ub4 callee,gnet *gnet,lnet *net,ub4 part,ub4 dep,ub4 arr,ub4
   ub4 walklimit = src->walklimit;
   ub4 sumwalklimit = src->sumwalklimit;
   ub4 walkdist,sumwalkdist;
+  struct deprow *rp = NULL;
+  ub4 cold;
 
   lodist = src->lodist;
 
+  // an on-demand level counts as precomputed
+  if (net->lazystop > nethistop && net->lazystop <= src->nethistop) {
+    nethistop = net->lazystop;
+    nethileg = nethistop + 1;
+  }
+
   if (stop > nethistop) {
     info(Notty,"%s: net part %u has %u-stop connections, request %u",desc,part,src->nethistop,stop);
     info(0,"nleg %u nethileg %u nethistop %u",nleg,nethileg,nethistop);
@@ -1721,31 +1885,43 @@ static ub4 srclocal(ub4 callee,gnet *gnet,lnet *net,ub4 part,ub4 dep,ub4 arr,ub4
   deptmin = src->deptmin;
   deptmax = src->deptmax;
 
-  info(0,"search in precomputed %u-stop net",stop);
-
-  cnts = net->concnt[stop];
-  ofss = net->conofs[stop];
-  lstblk = net->conlst + stop;
-  lodists = net->lodist[stop];
   hopdist = net->hopdist;
 
-  ub4 da = dep * portcnt + arr;
+  ub4 da;
+
+  if (net->lazystop && stop == net->lazystop) {
+    info(0,"search in on-demand %u-stop row",stop);
+    rp = getdeprow(net,dep,&cold);
+    if (rp == NULL) { src->truncated = 1; return 0; }
+    src->lazyrows++;
+    src->lazycold += cold;
+    cnts = rp->cnts;
+    ofss = rp->ofss;
+    lodists = rp->lodists;
+    da = deprowpair(rp,arr);
+  } else {
+    info(0,"search in precomputed %u-stop net",stop);
+    cnts = net->concnt[stop];
+    ofss = net->conofs[stop];
+    lodists = net->lodist[stop];
+    da = conpair(net,stop,dep,arr);
+  }
 
-  cnt = cnts[da];
+  cnt = (da == hi32 ? 0 : cnts[da]);
 
   if (cnt) {
     ofs = ofss[da];
-    lst = blkdata(lstblk,0,ub4);
-    bound(lstblk,ofs * nleg,ub4);
-    error_ge(ofs,net->lstlen[stop]);
-    vp = lst + ofs * nleg;
+    if (rp) error_ge(ofs,rp->varcnt);
+    else error_ge(ofs,net->lstlen[stop]);
   } else {
-    vp = NULL;
+    ofs = 0;
     src->locnocnt++;
     vrb0(0,"no %u-stop connection %u-%u",stop,dep,arr);
   }
 
   for (v0 = 0; v0 < cnt; v0++) {
+    if (rp) vp = rp->lst + (size_t)(ofs + v0) * nleg;
+    else vp = conlegs(net,stop,ofs + v0,legs);
 
     // distance-only
     dist = walkdist = sumwalkdist = 0;
@@ -1760,7 +1936,7 @@ static ub4 srclocal(ub4 callee,gnet *gnet,lnet *net,ub4 part,ub4 dep,ub4 arr,ub4
         if (walkdist > walklimit || sumwalkdist > sumwalklimit) break;
       } else walkdist = 0;
     }
-    if (walkdist > walklimit || sumwalkdist > sumwalklimit) { vp += nleg; continue; }
+    if (walkdist > walklimit || sumwalkdist > sumwalklimit) continue;
 
 //    infovrb(dist == 0,0,"dist %u for var %u",dist,v0);
     if (dist < lodist) {
@@ -1790,7 +1966,6 @@ static ub4 srclocal(ub4 callee,gnet *gnet,lnet *net,ub4 part,ub4 dep,ub4 arr,ub4
 
     stp = src->trips;
     if (evcnt == 0 || (costlim < curcost && stp->cnt)) {
-      vp += nleg;
       src->locvarcnt++;
       continue;
     }
@@ -1798,7 +1973,7 @@ static ub4 srclocal(ub4 callee,gnet *gnet,lnet *net,ub4 part,ub4 dep,ub4 arr,ub4
     costlim = curcost;
 
     evcnt = getevs(src,gnet,nleg,0);
-    if (evcnt == 0) { vp += nleg; continue; }
+    if (evcnt == 0) continue;
 
     for (leg = 0; leg < nleg; leg++) {
       stp->trip[leg * 2 + 1] = vp[leg];
@@ -1832,10 +2007,11 @@ static ub4 srclocal(ub4 callee,gnet *gnet,lnet *net,ub4 part,ub4 dep,ub4 arr,ub4
     else tnxt = hi32;
     fmtsum(stp,sumdt,tnxt,dist,fare,0,"s");
 
-    vp += nleg;
     src->locvarcnt++;
   } // each v0
 
+  if (rp) putdeprow(rp);
+
   if (havetime) {
     src->locsrccnt++;
     src->timestop = min(src->timestop,stop);
@@ -1849,7 +2025,7 @@ static ub4 srclocal(ub4 callee,gnet *gnet,lnet *net,ub4 part,ub4 dep,ub4 arr,ub4
   if (havedist == 0) info(0,"no route for %u-stop trip %u-%u",stop,dep,arr);
 
   if (stop < nethistop || stop == src->histop) return havedist;
-  if (gettime_usec() > src->querytlim) return havedist;
+  if (timedout(src)) return havedist;
 
   // if no time, search for new via. if no route, search with one added via
 
@@ -1884,17 +2060,15 @@ static ub4 srcglocal(struct gnetwork *gnet,ub4 part,ub4 gdep,ub4 garr,ub4 stop,s
 static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gdmid,ub4 gamid,search *src)
 {
   ub4 tpart = tnet->part;
-  ub4 tportcnt,dportcnt,aportcnt;
   ub4 whopcnt,twhopcnt,awhopcnt;
   struct network *dnet,*anet;
   ub4 dep,arr,dmid,amid,depmid,tdepmid,tdmid,tamid,amidarr;
   ub2 *cnts,*tcnts,*acnts,cnt,tcnt,acnt,var,tvar,avar;
   ub4 *ofss,*tofss,*aofss,ofs,tofs,aofs;
-  ub4 *vp,*tvp,*avp;
+  ub4 *vp,*tvp,*avp,legs[Nleg],tlegs[Nleg],alegs[Nleg];
   ub4 dstop,tstop,astop,histop;
   ub4 nleg,ntleg,naleg,l,leg,tleg,aleg,triplen;
-  block *lstblk,*tlstblk,*alstblk;
-  ub4 *lst,*tlst,*alst;
+  block *alstblk;
   ub4 *lodists,*tlodists,*alodists,lodist,tlodist,alodist;
   ub4 *hopdist,*thopdist,*ahopdist;
   ub4 dist,distrange,distiv,iv,pct;
@@ -1923,10 +2097,6 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
   dnet = getnet(dpart);
   anet = getnet(apart);
 
-  tportcnt = tnet->portcnt;
-  dportcnt = dnet->portcnt;
-  aportcnt = anet->portcnt;
-
   whopcnt = dnet->whopcnt;
   twhopcnt = tnet->whopcnt;
   awhopcnt = anet->whopcnt;
@@ -1941,21 +2111,19 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
 
   dep = dnet->g2pport[gdep];
   dmid = dnet->g2pport[gdmid];
-  depmid = dep * dportcnt + dmid;
 
   tdmid = tnet->g2pport[gdmid];
   tamid = tnet->g2pport[gamid];
-  tdepmid = tdmid * tportcnt + tamid;
 
   amid = anet->g2pport[gamid];
   arr = anet->g2pport[garr];
-  amidarr = amid * aportcnt + arr;
 
   // todo: verification
   tcnt = 0;
   for (tstop = 0; tstop <= min(tnet->histop,histop); tstop++) {
     tcnts = tnet->concnt[tstop];
-    tcnt = tcnts[tdepmid];
+    tdepmid = conpair(tnet,tstop,tdmid,tamid);
+    tcnt = (tdepmid == hi32 ? 0 : tcnts[tdepmid]);
     if (tcnt) {
       vrb0(0,"histop %u net %u dist %u top con at %u stop",histop,dnet->histop,src->geodist,tstop);
       break;
@@ -1972,24 +2140,24 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
 
     nleg = dstop + 1;
     cnts = dnet->concnt[dstop];
+    depmid = conpair(dnet,dstop,dep,dmid);
+    if (depmid == hi32) continue;
     cnt = cnts[depmid];
     if (cnt == 0) continue;
     dvarcnt += cnt;
 
     ofss = dnet->conofs[dstop];
-    lstblk = &dnet->conlst[dstop];
     lodists = dnet->lodist[dstop];
     hopdist = dnet->hopdist;
 
     ofs = ofss[depmid];
     lodist = lodists[depmid];
-    lst = blkdata(lstblk,0,ub4);
     error_ge(ofs,dnet->lstlen[dstop]);
-    vp = lst + ofs * nleg;
 
     distrange = max(lodist,1) * 10;
 
     for (var = 0; var < cnt; var++) {
+      vp = conlegs(dnet,dstop,ofs + var,legs);
 
       if (globs.sigint) return 0;
 
@@ -2001,11 +2169,11 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
       }
       dist = max(dist,lodist);
       distiv = (dist - lodist) * Distbins / distrange;
-      if (totvarcnt > 5 && distiv >= Distbins) { vp += nleg; continue; }
+      if (totvarcnt > 5 && distiv >= Distbins) continue;
 
       if (varcnt > 50 && distiv < Distbins) {
         pct = distsums[distiv] * Percbins / varcnt;
-        if (pct >= Percbins || distsums[distiv] > distlims[pct]) { vp += nleg; continue; }
+        if (pct >= Percbins || distsums[distiv] > distlims[pct]) continue;
       }
 
       dvarxcnt++;
@@ -2017,33 +2185,31 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
 
       if (evcnt == 0 || dtcur >= topdts[topdt1]) {
 //        info(0,"evcnt %u dtcur %u leg %u",evcnt,dtcur,leg);
-        vp += nleg;
         continue;
       }
 
       for (tstop = 0; tstop <= min(tnet->histop,histop - dstop); tstop++) {
         ntleg = tstop + 1;
         tcnts = tnet->concnt[tstop];
+        tdepmid = conpair(tnet,tstop,tdmid,tamid);
+        if (tdepmid == hi32) continue;
         tcnt = tcnts[tdepmid];
         if (tcnt == 0) continue;
         tvarcnt += tcnt;
 
         tofss = tnet->conofs[tstop];
-        tlstblk = &tnet->conlst[tstop];
         tlodists = tnet->lodist[tstop];
         thopdist = tnet->hopdist;
 
         tofs = tofss[tdepmid];
         tlodist = tlodists[tdepmid];
-        tlst = blkdata(tlstblk,0,ub4);
         if (tofs >= tnet->lstlen[tstop]) {
           info(Iter|Notty,"ofs %u stop %u part %u",tofs,tstop,tpart);
         }
-        bound(tlstblk,tofs * ntleg,ub4);
         error_ge(tofs,tnet->lstlen[tstop]);
-        tvp = tlst + tofs * ntleg;
 
         for (tvar = 0; tvar < tcnt; tvar++) {
+          tvp = conlegs(tnet,tstop,tofs + tvar,tlegs);
 
           for (tleg = 0; tleg < ntleg; tleg++) {
             l = tvp[tleg];
@@ -2052,11 +2218,11 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
           }
           dist = max(dist,lodist + tlodist);
           distiv = (dist - lodist - tlodist) * Distbins / distrange;
-          if (totvarcnt > 5 && distiv >= Distbins) { tvp += ntleg; continue; }
+          if (totvarcnt > 5 && distiv >= Distbins) continue;
 
           if (distiv < Distbins && varcnt > 50) {
             pct = distsums[distiv] * Percbins / varcnt;
-            if (pct >= Percbins || distsums[distiv] > distlims[pct]) { tvp += ntleg; continue; }
+            if (pct >= Percbins || distsums[distiv] > distlims[pct]) continue;
           }
 
           dtcur = hi32;
@@ -2065,7 +2231,7 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
           infocc(evcnt,Iter|Notty,"%u event\as",evcnt);
 
           if (evcnt == 0 || dtcur >= topdts[topdt1]) {
-            tvp += ntleg; continue;
+            continue;
           }
 
           tvarxcnt++;
@@ -2073,6 +2239,8 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
           for (astop = 0; astop <= min(anet->histop,histop - dstop - tstop); astop++) {
             naleg = astop + 1;
             acnts = anet->concnt[astop];
+            amidarr = conpair(anet,astop,amid,arr);
+            if (amidarr == hi32) continue;
             acnt = acnts[amidarr];
             if (acnt == 0) continue;
             avarcnt += acnt;
@@ -2084,13 +2252,10 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
 
             aofs = aofss[amidarr];
             alodist = alodists[amidarr];
-            alst = blkdata(alstblk,0,ub4);
             error_ge(aofs,anet->lstlen[astop]);
-            bound(alstblk,aofs * naleg,ub4);
-            avp = alst + aofs * naleg;
-            bound(alstblk,(aofs + acnt) * naleg,ub4);
 
             for (avar = 0; avar < acnt; avar++) {
+              avp = conlegs(anet,astop,aofs + avar,alegs);
 
               for (aleg = 0; aleg < naleg; aleg++) {
                 l = avp[aleg];
@@ -2103,11 +2268,11 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
               }
               dist = max(dist,lodist + tlodist + alodist);
               distiv = (dist - lodist - tlodist - alodist) * Distbins / distrange;
-              if (totvarcnt > 5 && distiv >= Distbins) { avp += naleg; continue; }
+              if (totvarcnt > 5 && distiv >= Distbins) continue;
 
               if (distiv < Distbins && varcnt > 50) {
                 pct = distsums[distiv] * Percbins / varcnt;
-                if (pct >= Percbins || distsums[distiv] > distlims[pct]) { avp += naleg; continue; }
+                if (pct >= Percbins || distsums[distiv] > distlims[pct]) continue;
               }
 
               avarxcnt++;
@@ -2120,7 +2285,7 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
               evcnt = addevs(caller,src,anet,avp,naleg,nleg + ntleg,dthi,&dtcur);
               infocc(evcnt,Iter|Notty,"%u event\as",evcnt);
 
-              if (evcnt == 0 || dtcur >= topdts[topdt1]) { avp += naleg; continue; }
+              if (evcnt == 0 || dtcur >= topdts[topdt1]) continue;
 
               triplen = nleg + ntleg + naleg;
               error_ge(triplen,Nxleg);
@@ -2128,7 +2293,7 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
               dt = dtcur;
 
               evcnt = getevs(src,gnet,triplen,0);
-              if (evcnt == 0) { avp += naleg; continue; }
+              if (evcnt == 0) continue;
 
               dtndx = 0;
               while (dtndx < Topdts && dtcur >= topdts[dtndx]) dtndx++;
@@ -2182,14 +2347,10 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
                 src->lotid = src->curtids[leg];
                 src->lodist = dist;
               }
-              avp += naleg;
-
             } // avar
           } // each astop
-          tvp += ntleg;
         } // each tvar
       } // each tstop
-      vp += nleg;
     } // each depvar
   } // each dstop
 
@@ -2209,17 +2370,15 @@ static ub4 srcxpart2(gnet *gnet,lnet *tnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr
 // special case of core search loop : single node at top
 static ub4 srcxpart2t(gnet *gnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gamid,search *src)
 {
-  ub4 dportcnt,aportcnt;
   ub4 whopcnt,awhopcnt;
   struct network *dnet,*anet;
   ub4 dep,arr,dmid,amid,depmid,amidarr;
   ub2 *cnts,*acnts,cnt,acnt,var,avar;
   ub4 *ofss,*aofss,ofs,aofs;
-  ub4 *vp,*avp;
+  ub4 *vp,*avp,legs[Nleg],alegs[Nleg];
   ub4 dstop,astop,histop;
   ub4 nleg,ntleg,naleg,l,leg,aleg,triplen;
-  block *lstblk,*alstblk;
-  ub4 *lst,*alst;
+  block *alstblk;
   ub4 *lodists,*alodists,lodist,alodist;
   ub4 *hopdist,*ahopdist;
   ub4 dist,distrange,distiv,iv,pct;
@@ -2248,9 +2407,6 @@ static ub4 srcxpart2t(gnet *gnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gamid
   dnet = getnet(dpart);
   anet = getnet(apart);
 
-  dportcnt = dnet->portcnt;
-  aportcnt = anet->portcnt;
-
   whopcnt = dnet->whopcnt;
   awhopcnt = anet->whopcnt;
 
@@ -2264,11 +2420,9 @@ static ub4 srcxpart2t(gnet *gnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gamid
 
   dep = dnet->g2pport[gdep];
   dmid = dnet->g2pport[gamid];
-  depmid = dep * dportcnt + dmid;
 
   amid = anet->g2pport[gamid];
   arr = anet->g2pport[garr];
-  amidarr = amid * aportcnt + arr;
 
   for (pct = 0; pct < Percbins; pct++) distlims[pct] = pct * 5;
 
@@ -2276,24 +2430,24 @@ static ub4 srcxpart2t(gnet *gnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gamid
 
     nleg = dstop + 1;
     cnts = dnet->concnt[dstop];
+    depmid = conpair(dnet,dstop,dep,dmid);
+    if (depmid == hi32) continue;
     cnt = cnts[depmid];
     if (cnt == 0) continue;
     dvarcnt += cnt;
 
     ofss = dnet->conofs[dstop];
-    lstblk = &dnet->conlst[dstop];
     lodists = dnet->lodist[dstop];
     hopdist = dnet->hopdist;
 
     ofs = ofss[depmid];
     lodist = lodists[depmid];
-    lst = blkdata(lstblk,0,ub4);
     error_ge(ofs,dnet->lstlen[dstop]);
-    vp = lst + ofs * nleg;
 
     distrange = max(lodist,1) * 10;
 
     for (var = 0; var < cnt; var++) {
+      vp = conlegs(dnet,dstop,ofs + var,legs);
 
       if (globs.sigint) return 0;
 
@@ -2305,11 +2459,11 @@ static ub4 srcxpart2t(gnet *gnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gamid
       }
       dist = max(dist,lodist);
       distiv = (dist - lodist) * Distbins / distrange;
-      if (totvarcnt > 5 && distiv >= Distbins) { vp += nleg; continue; }
+      if (totvarcnt > 5 && distiv >= Distbins) continue;
 
       if (varcnt > 50 && distiv < Distbins) {
         pct = distsums[distiv] * Percbins / varcnt;
-        if (pct >= Percbins || distsums[distiv] > distlims[pct]) { vp += nleg; continue; }
+        if (pct >= Percbins || distsums[distiv] > distlims[pct]) continue;
       }
 
       dvarxcnt++;
@@ -2321,7 +2475,6 @@ static ub4 srcxpart2t(gnet *gnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gamid
 
       if (evcnt == 0 || dtcur >= topdts[topdt1]) {
 //        info(0,"evcnt %u dtcur %u leg %u",evcnt,dtcur,leg);
-        vp += nleg;
         continue;
       }
 
@@ -2330,6 +2483,8 @@ static ub4 srcxpart2t(gnet *gnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gamid
           for (astop = 0; astop <= min(anet->histop,histop - dstop); astop++) {
             naleg = astop + 1;
             acnts = anet->concnt[astop];
+            amidarr = conpair(anet,astop,amid,arr);
+            if (amidarr == hi32) continue;
             acnt = acnts[amidarr];
             if (acnt == 0) continue;
             avarcnt += acnt;
@@ -2341,13 +2496,10 @@ static ub4 srcxpart2t(gnet *gnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gamid
 
             aofs = aofss[amidarr];
             alodist = alodists[amidarr];
-            alst = blkdata(alstblk,0,ub4);
             error_ge(aofs,anet->lstlen[astop]);
-            bound(alstblk,aofs * naleg,ub4);
-            avp = alst + aofs * naleg;
-            bound(alstblk,(aofs + acnt) * naleg,ub4);
 
             for (avar = 0; avar < acnt; avar++) {
+              avp = conlegs(anet,astop,aofs + avar,alegs);
 
               for (aleg = 0; aleg < naleg; aleg++) {
                 l = avp[aleg];
@@ -2360,11 +2512,11 @@ static ub4 srcxpart2t(gnet *gnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gamid
               }
               dist = max(dist,lodist + alodist);
               distiv = (dist - lodist - alodist) * Distbins / distrange;
-              if (totvarcnt > 5 && distiv >= Distbins) { avp += naleg; continue; }
+              if (totvarcnt > 5 && distiv >= Distbins) continue;
 
               if (distiv < Distbins && varcnt > 50) {
                 pct = distsums[distiv] * Percbins / varcnt;
-                if (pct >= Percbins || distsums[distiv] > distlims[pct]) { avp += naleg; continue; }
+                if (pct >= Percbins || distsums[distiv] > distlims[pct]) continue;
               }
 
               avarxcnt++;
@@ -2377,7 +2529,7 @@ static ub4 srcxpart2t(gnet *gnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gamid
               evcnt = addevs(caller,src,anet,avp,naleg,nleg + ntleg,dthi,&dtcur);
               infocc(evcnt,Iter|Notty,"%u event\as",evcnt);
 
-              if (evcnt == 0 || dtcur >= topdts[topdt1]) { avp += naleg; continue; }
+              if (evcnt == 0 || dtcur >= topdts[topdt1]) continue;
 
               triplen = nleg + ntleg + naleg;
               error_ge(triplen,Nxleg);
@@ -2385,7 +2537,7 @@ static ub4 srcxpart2t(gnet *gnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gamid
               dt = dtcur;
 
               evcnt = getevs(src,gnet,triplen,0);
-              if (evcnt == 0) { avp += naleg; continue; }
+              if (evcnt == 0) continue;
 
               dtndx = 0;
               while (dtndx < Topdts && dtcur >= topdts[dtndx]) dtndx++;
@@ -2430,12 +2582,9 @@ static ub4 srcxpart2t(gnet *gnet,ub4 dpart,ub4 apart,ub4 gdep,ub4 garr,ub4 gamid
                 src->lotid = src->curtids[leg];
                 src->lodist = dist;
               }
-              avp += naleg;
-
             } // avar
           } // each astop
 
-      vp += nleg;
     } // each depvar
   } // each dstop
 
@@ -2540,7 +2689,7 @@ static ub4 srcxpart(struct gnetwork *gnet,ub4 gdep,ub4 garr,search *src,char *re
           stats[7] = xpartcnt;
           estvar = xpartcnt * tportcnt / max(tdmid,1);
 
-          if (progress(&eta,"step %u of %u, %u vars",xpartcnt - 1,estvar,src->varcnt)) return 0;
+          if (progress(&eta,"step %u of %u, %u vars",xpartcnt - 1,estvar,src->varcnt)) { src->truncated = 1; return 0; }
           if (xpartcnt == 1) eta.limit = src->querytlim;
 
           if (gdmid == gamid) conn += srcxpart2t(gnet,dpart,apart,gdep,garr,gdmid,src);
@@ -2626,7 +2775,7 @@ static ub4 srcxdpart(struct gnetwork *gnet,ub4 gdep,ub4 garr,search *src,char *r
       stats[7] = xpartcnt;
       estvar = xpartcnt * tportcnt / max(tdmid,1);
 
-      if (progress(&eta,"step %u of %u, %u vars",xpartcnt - 1,estvar,src->varcnt)) return 0;
+      if (progress(&eta,"step %u of %u, %u vars",xpartcnt - 1,estvar,src->varcnt)) { src->truncated = 1; return 0; }
       if (xpartcnt == 1) eta.limit = src->querytlim;
 
       conn += srcxpart2t(gnet,dpart,apart,gdep,garr,gamid,src);
@@ -2700,7 +2849,7 @@ static ub4 srcxapart(struct gnetwork *gnet,ub4 gdep,ub4 garr,search *src,char *r
       stats[7] = xpartcnt;
       estvar = xpartcnt * tportcnt / max(tdmid,1);
 
-      if (progress(&eta,"step %u of %u, %u vars",xpartcnt - 1,estvar,src->varcnt)) return 0;
+      if (progress(&eta,"step %u of %u, %u vars",xpartcnt - 1,estvar,src->varcnt)) { src->truncated = 1; return 0; }
       if (xpartcnt == 1) eta.limit = src->querytlim;
 
       conn += srcxpart2t(gnet,dpart,apart,gdep,garr,gdmid,src);
@@ -2712,6 +2861,18 @@ static ub4 srcxapart(struct gnetwork *gnet,ub4 gdep,ub4 garr,search *src,char *r
   return conn;
 }
 
+// keep first events per leg for a next search in batch
+static void savedepwin(search *src)
+{
+  struct depcache *dc = src->depcache;
+
+  if (dc == NULL || dc->ena == 0) return;
+  dc->deptmin = src->deptmin;
+  memcpy(dc->firsthop,src->firsthop,sizeof(dc->firsthop));
+  memcpy(dc->first,src->first,sizeof(dc->first));
+  memcpy(dc->firstndx,src->firstndx,sizeof(dc->firstndx));
+}
+
 // toplevel: choose transfer count and partitions
 static ub4 dosrc(struct gnetwork *gnet,ub4 nstoplo,ub4 nstophi,search *src,char *ref)
 {
@@ -2724,11 +2885,18 @@ static ub4 dosrc(struct gnetwork *gnet,ub4 nstoplo,ub4 nstophi,search *src,char
   ub4 stop;
   ub4 nethistop;
   lnet *net;
+  struct depcache *dc = src->depcache;
 
   ub4 conn = 0,allconn = 0;
 
-  nsethi(src->firsthop,Nxleg);
-  aclear(src->first);
+  if (dc && dc->ena && dc->deptmin == src->deptmin) {
+    memcpy(src->firsthop,dc->firsthop,sizeof(src->firsthop));
+    memcpy(src->first,dc->first,sizeof(src->first));
+    memcpy(src->firstndx,dc->firstndx,sizeof(src->firstndx));
+  } else {
+    nsethi(src->firsthop,Nxleg);
+    aclear(src->first);
+  }
 
   if (gportcnt == 0) { error(0,"search without ports, ref %s",ref); return 0; }
 
@@ -2749,7 +2917,7 @@ static ub4 dosrc(struct gnetwork *gnet,ub4 nstoplo,ub4 nstophi,search *src,char
         if (stop > nethistop + 1) timelimit(src,300);
       }
       vrb0(0,"timestop %u",src->timestop);
-      if (gettime_usec() > src->querytlim) { info(0,"timeout at %u %lu",src->tlim,(src->querytlim - src->queryt0) / 1000); return allconn; }
+      if (timedout(src)) { info(0,"timeout at %u %lu",src->tlim,(src->querytlim - src->queryt0) / 1000); return allconn; }
     }
     return allconn;
   }
@@ -2986,13 +3154,18 @@ int plantrip(search *src,char *ref,ub4 xdep,ub4 xarr,ub4 nstoplo,ub4 nstophi)
 
   info(CC,"search dep %u arr %u on \ad%u-\ad%u \au%u %s to %s geodist %u",dep,arr,deptmin,deptmax,utcofs,pdep->name,parr->name,src->geodist);
 
+  src->lazyrows = src->lazycold = 0;
+
   t0 = src->queryt0 = gettime_usec();
   src->querytlim = hi64;
+  src->truncated = 0;
   src->tlim = hi32;
   timelimit(src,Timelimit);
+  if (src->deadline) src->querytlim = min(src->querytlim,src->deadline);
   src->locost = hi32;
 
   conn = dosrc(net,nstoplo,nstophi,src,ref);
+  savedepwin(src);
 
   dt = gettime_usec() - t0;
 
@@ -3008,6 +3181,8 @@ int plantrip(search *src,char *ref,ub4 xdep,ub4 xarr,ub4 nstoplo,ub4 nstophi)
     infocc(totcnt,0,"leg %u \ah%lu events",leg,totcnt);
   }
 
+  if (src->lazyrows) rowcachequery(src->lazycold != 0,dt);
+
   ub4 duriv = (ub4)min(dt / 1000,Elemcnt(src->querydurs) - 1);
   src->querydurs[duriv]++;
   if (dt > src->querymaxdur) {
@@ -3033,8 +3208,10 @@ int plantrip(search *src,char *ref,ub4 xdep,ub4 xarr,ub4 nstoplo,ub4 nstophi)
       info(0,"redo search on last dep \ad%u above departure limit \ad%u",tmax,deptmax);
       t0 = src->queryt0 = gettime_usec();
       src->querytlim = t0 + (1000UL * Timelimit) / 2;
+      if (src->deadline) src->querytlim = min(src->querytlim,src->deadline);
       src->deptmax = tmax;
       conn = dosrc(net,nstoplo,nstophi,src,ref);
+      savedepwin(src);
     }
   }
 
@@ -3055,7 +3232,7 @@ int plantrip(search *src,char *ref,ub4 xdep,ub4 xarr,ub4 nstoplo,ub4 nstophi)
       same = sametrip(stp,stp2);
       if (same) break;
     }
-    if (same) continue;
+    if (same) { stp->cnt = 0; continue; }
     while (mergelegs(stp)) ;
     if (gtriptoports(net,dep,arr,srdep,srarr,stp,src->resbuf,resmax,&src->reslen,utcofs)) return 1;
   }
@@ -3063,3 +3240,23 @@ int plantrip(search *src,char *ref,ub4 xdep,ub4 xarr,ub4 nstoplo,ub4 nstophi)
   info(0,"%s",src->resbuf);
   return 0;
 }
+
+// keep departure caches over a batch of searches with shared parameters
+void srcbatch(search *src,int ena)
+{
+  struct depcache *dc = src->depcache;
+
+  if (ena == 0) {
+    if (dc == NULL || dc->ena == 0) return;
+    info(0,"dep cache hits %u misses %u",dc->hits,dc->misses);
+    dc->ena = 0;
+    return;
+  }
+  if (dc == NULL) {
+    dc = src->depcache = alloc(1,struct depcache,0,"src depcache",0);
+    dc->pool = alloc(Depcache_pool * fldcnt,ub4,0,"src depcache events",Depcache_pool);
+  }
+  resetdepcache(dc);
+  dc->hits = dc->misses = 0;
+  dc->ena = 1;
+}
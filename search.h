@@ -22,6 +22,7 @@ struct srcctx {
   ub4 reslen;
   ub8 querytlim,queryt0;
   ub4 tlim;
+  ub4 truncated; // search ended on time limit, deadline or missing row
   struct trip trips[2];
   ub4 hisrcstop;
 
@@ -29,6 +30,8 @@ struct srcctx {
   ub4 dep,arr;
   ub4 vias[Nvia];
   ub4 viacnt;
+  ub8 deadline; // usec, 0 for none
+  ub4 rcgen;    // result cache generation, see rescache.c
 
   // search params
   ub4 deptmin,deptmax,deptmid,udeptmax,dephwin;
@@ -75,6 +78,8 @@ struct srcctx {
   ub8 combicnt;
   ub8 totevcnt[Nxleg];
 
+  ub4 lazyrows,lazycold;  // on-demand rows used in this query, of which built
+
   ub4 stat_noprv;
   ub4 stat_nxtlim;
   ub4 stat_nxt0,stat_nxt3;
@@ -106,8 +111,10 @@ struct srcctx {
   ub4 topdts[Topdts];
 
   ub4 *evpool;
+  struct depcache *depcache; // kept over a batch, see srcbatch()
 };
 typedef struct srcctx search;
 
 extern void inisearch(void);
+extern void srcbatch(search *src,int ena);
 extern int plantrip(search *src,char *ref,ub4 dep,ub4 arr,ub4 nstoplo,ub4 nstophi);
@@ -29,9 +29,12 @@
   a separate network proxy can provide http-style interface, forwarding to a local client
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include "base.h"
 #include "cfg.h"
@@ -43,12 +46,18 @@ static ub4 msgfile;
 #include "msg.h"
 
 #include "util.h"
+#include "time.h"
 
 #include "netbase.h"
 #include "net.h"
 #include "fare.h"
+#include "realtime.h"
 
 #include "search.h"
+#include "rescache.h"
+#include "rowcache.h"
+#include "names.h"
+#include "proto.h"
 
 static int memeq(const char *s,const char *q,ub4 n) { return !memcmp(s,q,n); }
 
@@ -80,23 +89,148 @@ static void mkbitmask(void)
   }
 }
 
-enum Cmds { Cmd_nil,Cmd_plan,Cmd_upd,Cmd_geo,Cmd_stop,Cmd_cnt };
+enum Cmds { Cmd_nil,Cmd_plan,Cmd_upd,Cmd_geo,Cmd_name,Cmd_stat,Cmd_reload,Cmd_stop,Cmd_cnt };
+
+#define Maxconn 64
+#define Maxworker 64
+#define Jobqlen 256
+
+// client connection, shared between server loop and workers
+struct conn {
+  int fd;       // -1 if free
+  ub4 pending;  // requests queued or in progress
+  bool eof;     // close when last pending request is answered
+  pthread_mutex_t wrlock;
+};
+
+// a client request, from either the directory queue or a socket connection
+struct qreq {
+  struct myfile mf;
+  int fd;     // connection, -1 for queue entries
+  struct conn *conn;
+  ub4 seq;    // client tag from frame header
+  char cmd;
+  bool replied;
+  ub8 deadline; // usec, 0 for none
+  ub4 prio;     // higher first
+  ub8 arrival;
+};
+
+struct worker {
+  pthread_t tid;
+  ub4 id;
+  search *src;
+  ub4 jobcnt;
+};
+
+static struct conn conns[Maxconn];
+
+static struct worker workers[Maxworker];
+static ub4 workercnt;
+
+// plan requests queued for workers, served on priority, then earliest deadline, then arrival
+static struct qreq jobq[Jobqlen];
+static ub4 jobheap[Jobqlen]; // jobq slots
+static ub4 jobfree[Jobqlen];
+static ub4 heapcnt,freecnt;
+static ub8 jobseq;
+static bool jobstop;
+
+static pthread_mutex_t qlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t qwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t qspace = PTHREAD_COND_INITIALIZER;
+
+static int buildpid; // network generation in progress
+
+// reply to a request : via its connection, or as queue entry
+static int putreply(struct qreq *req,struct myfile *rep,int code)
+{
+  struct proto_hdr hdr;
+  ub4 len = (ub4)rep->len;
+  int rv;
+
+  req->replied = 1;
+  if (req->fd == -1) return setqentry(&req->mf,rep,".rep");
+
+  oclear(hdr);
+  hdr.magic = Proto_magic;
+  hdr.ver = Proto_version;
+  hdr.cmd = (ub1)req->cmd;
+  hdr.len = len;
+  hdr.seq = req->seq;
+  hdr.code = (ub4)code;
+
+  vrb0(0,"reply seq %u len %u on connection %d",req->seq,len,req->fd);
+  pthread_mutex_lock(&req->conn->wrlock);
+  rv = oswriteall(req->fd,&hdr,sizeof(hdr));
+  if (rv == 0 && len) rv = oswriteall(req->fd,rep->buf,len);
+  pthread_mutex_unlock(&req->conn->wrlock);
+  return rv;
+}
 
-static int cmd_geo(struct myfile *req)
+// deadline from the client's wait limit, or the configured default
+static void setdeadline(struct qreq *req,ub4 waitms,ub4 prio)
+{
+  if (waitms == 0) waitms = globs.srvvars[Srv_deadline];
+  req->deadline = waitms ? gettime_usec() + waitms * 1000UL : 0;
+  req->prio = prio;
+}
+
+// read one framed request from a connection. return 1 on eof or invalid frame
+static int getframe(struct conn *cp,struct qreq *req)
+{
+  struct proto_hdr hdr;
+  struct myfile *mf = &req->mf;
+  int fd = cp->fd;
+  ub4 len;
+
+  clear(req);
+  req->fd = fd;
+  req->conn = cp;
+
+  if (osreadall(fd,&hdr,sizeof(hdr))) return 1;
+  if (hdr.magic != Proto_magic) return error(0,"invalid frame magic %x on connection %d",hdr.magic,fd);
+  if (hdr.ver != Proto_version) return error(0,"frame version %u on connection %d, expected %u",hdr.ver,fd,Proto_version);
+  len = hdr.len;
+  if (len >= Maxquerysize) return error(0,"frame len %u on connection %d exceeds %u",len,fd,Maxquerysize);
+
+  req->seq = hdr.seq;
+  req->cmd = (char)hdr.cmd;
+  setdeadline(req,hdr.code & Proto_waitmask,hdr.code >> Proto_prioshift);
+
+  if (len < sizeof(mf->localbuf)) mf->buf = mf->localbuf;
+  else {
+    mf->buf = alloc(len + 1,char,0,"client request",len);
+    mf->alloced = 1;
+  }
+  if (len && osreadall(fd,mf->buf,len)) {
+    if (mf->alloced) afree(mf->buf,"client request");
+    return 1;
+  }
+  mf->buf[len] = 0;
+  mf->len = len;
+  mf->exist = 1;
+  fmtstring(mf->name,"%c_sock_%d_%u",req->cmd,fd,req->seq);
+  return 0;
+}
+
+static int cmd_geo(struct qreq *req)
 {
   struct myfile rep;
-  char *vp,*lp = req->buf;
-  ub4 n,pos = 0,len = (ub4)req->len;
+  char *vp,*lp = req->mf.buf;
+  ub4 n,pos = 0,len = (ub4)req->mf.len;
   ub4 ival;
   ub4 varstart,varend,varlen,valstart,valend,type;
-  ub4 lat = 0,lon = 0,scale = 1;
+  ub4 lat = 0,lon = 0,scale = 1,cnt = 1,radius = (ub4)Georange;
   int rv;
 
   enum Vars {
     Cnone,
     Clat,
     Clon,
-    Cscale
+    Cscale,
+    Ccnt,
+    Cradius
   } var;
 
   if (len == 0) return 1;
@@ -135,6 +269,8 @@ static int cmd_geo(struct myfile *req)
     if (varlen == 3 && memeq(vp,"lat",3)) var = Clat;
     else if (varlen == 3 && memeq(vp,"lon",3)) var = Clon;
     else if (varlen == 5 && memeq(vp,"scale",5)) var = Cscale;
+    else if (varlen == 3 && memeq(vp,"cnt",3)) var = Ccnt;
+    else if (varlen == 6 && memeq(vp,"radius",6)) var = Cradius;
     else {
       warn(0,"ignoring unknown var '%s'",vp);
       var = Cnone;
@@ -144,39 +280,120 @@ static int cmd_geo(struct myfile *req)
     case Clat: lat = ival; break;
     case Clon: lon = ival; break;
     case Cscale: scale = ival; break;
+    case Ccnt: cnt = ival; break;
+    case Cradius: radius = m2geo(ival); break;
     }
   }
-  rv = geocode(lat,lon,scale,&rep);
+  rv = geocode(lat,lon,scale,cnt,radius,&rep);
 
-  rv |= setqentry(req,&rep,".rep");
+  rv |= putreply(req,&rep,rv);
   return rv;
 }
 
-// parse parameters and invoke actual planning. Runs in separate process
-// to be elaborated: temporary simple interface
-static int cmd_plan(gnet *net,struct myfile *req,search *src)
+// stop name lookup
+static int cmd_name(struct qreq *req)
 {
   struct myfile rep;
-  char *vp,*lp = req->buf;
-  ub4 n,pos = 0,len = (ub4)req->len;
-  ub4 ival;
+  char *vp,*lp = req->mf.buf;
+  const char *name = "";
+  ub4 n,pos = 0,len = (ub4)req->mf.len;
+  ub4 ival,namelen = 0;
   ub4 varstart,varend,varlen,valstart,valend,type;
+  ub4 cnt = 10;
+  int rv;
 
-  ub4 portcnt = net->portcnt;
-  ub4 sportcnt = net->sportcnt;
+  enum Vars {
+    Cnone,
+    Cname,
+    Ccnt
+  } var;
 
-  ub4 dep = 0,arr = 0,lostop = 0,histop = 3,tdep = 0,ttdep = 0,utcofs=2200;
-  ub4 plusday = 1,minday = 0;
-  ub4 costperstop = 1;
-  ub4 mintt = globs.mintt;
-  ub4 maxtt = globs.maxtt;
-  ub4 walklimit = globs.walklimit;
-  ub4 sumwalklimit = globs.sumwalklimit;
-  ub4 nethistop = hi32;
-  ub4 delay = 0;
-  ub4 testiter = 0;
+  if (len == 0) return 1;
+
+  oclear(rep);
+
+  while (pos < len && lp[pos] >= 'a' && lp[pos] <= 'z') {
+    ival = 0;
+    varstart = varend = pos;
+    while (varend < len && lp[varend] >= 'a' && lp[varend] <= 'z') varend++;
+    varlen = varend - varstart; pos = varend;
+    if (varlen == 0) break;
+
+    while (pos < len && lp[pos] == ' ') pos++;
+    if (pos == len) break;
+    type = lp[pos++];
+    if (type == '\n' || pos == len) break;
+    while (pos < len && lp[pos] == ' ') pos++;
+    lp[varend] = 0;
+
+    valstart = valend = pos;
+    while (valend < len && lp[valend] != '\n') valend++;
+    if (valend == len) break;
+    pos = valend;
+    while (pos < len && lp[pos] != '\n') pos++;
+    if (lp[pos] == '\n') pos++;
+    if (pos == len) break;
+    lp[valend] = 0;
+
+    if (type == 'i') {
+      n = str2ub4(lp + valstart,&ival);
+      if (n == 0) return error(0,"expected integer for %s, found '%.*s'",lp + varstart,valend - valstart,lp + valstart);
+    }
+    vp = lp + varstart;
+    if (varlen == 4 && memeq(vp,"name",4) && type == 's') var = Cname;
+    else if (varlen == 3 && memeq(vp,"cnt",3)) var = Ccnt;
+    else {
+      warn(0,"ignoring unknown var '%s'",vp);
+      var = Cnone;
+    }
+    switch (var) {
+    case Cnone: break;
+    case Cname: name = lp + valstart; namelen = valend - valstart; break;
+    case Ccnt: cnt = ival; break;
+    }
+  }
+  rv = namesearch(name,namelen,cnt,&rep);
+
+  rv |= putreply(req,&rep,rv);
+  return rv;
+}
+
+// parameters of a plan query
+struct planparams {
+  ub4 dep,arr;
+  ub4 lostop,histop,nethistop;
+  ub4 tdep,ttdep,utcofs;
+  ub4 plusday,minday;
+  ub4 costperstop;
+  ub4 mintt,maxtt;
+  ub4 walklimit,sumwalklimit;
+  ub4 delay;
+  ub4 testiter;
+  ub8 deadline;
+};
+
+static void iniplanparams(struct planparams *pp)
+{
+  clear(pp);
+  pp->histop = 3;
+  pp->utcofs = 2200;
+  pp->plusday = 1;
+  pp->costperstop = 1;
+  pp->mintt = globs.mintt;
+  pp->maxtt = globs.maxtt;
+  pp->walklimit = globs.walklimit;
+  pp->sumwalklimit = globs.sumwalklimit;
+  pp->nethistop = hi32;
+}
+
+// parse text parameters as 'name type value' lines
+static int rdplanparams(struct qreq *req,struct planparams *pp)
+{
+  char *vp,*lp = req->mf.buf;
+  ub4 n,pos = 0,len = (ub4)req->mf.len;
+  ub4 ival;
+  ub4 varstart,varend,varlen,valstart,valend,type;
 
-  int rv;
   enum Vars {
     Cnone,
     Cdep,
@@ -198,12 +415,8 @@ static int cmd_plan(gnet *net,struct myfile *req,search *src)
     Ctestiter
   } var;
 
-  ub4 *evpool;
-
   if (len == 0) return 1;
 
-  oclear(rep);
-
   while (pos < len && lp[pos] >= 'a' && lp[pos] <= 'z') {
     ival = 0;
     varstart = varend = pos;
@@ -255,25 +468,49 @@ static int cmd_plan(gnet *net,struct myfile *req,search *src)
     }
     switch (var) {
     case Cnone: break;
-    case Cdep: dep = ival; break;
-    case Carr: arr = ival; break;
-    case Ctdep: tdep = ival; break;
-    case Cttdep: ttdep = ival; break;
-    case Cplusday: plusday = ival; break;
-    case Cminday: minday = ival; break;
-    case Clostop:  lostop = ival; break;
-    case Chistop: histop = ival; break;
-    case Cmintt: mintt = ival; break;
-    case Cmaxtt: maxtt = ival; break;
-    case Ccostperstop: costperstop = ival; break;
-    case Cwalklimit: walklimit = ival; break;
-    case Csumwalklimit: sumwalklimit = ival; break;
-    case Cnethistop: nethistop = ival; break;
-    case Cutcofs: utcofs = ival; break;
-    case Cdelay: delay = ival; break;
-    case Ctestiter: testiter = ival; break;
+    case Cdep: pp->dep = ival; break;
+    case Carr: pp->arr = ival; break;
+    case Ctdep: pp->tdep = ival; break;
+    case Cttdep: pp->ttdep = ival; break;
+    case Cplusday: pp->plusday = ival; break;
+    case Cminday: pp->minday = ival; break;
+    case Clostop:  pp->lostop = ival; break;
+    case Chistop: pp->histop = ival; break;
+    case Cmintt: pp->mintt = ival; break;
+    case Cmaxtt: pp->maxtt = ival; break;
+    case Ccostperstop: pp->costperstop = ival; break;
+    case Cwalklimit: pp->walklimit = ival; break;
+    case Csumwalklimit: pp->sumwalklimit = ival; break;
+    case Cnethistop: pp->nethistop = ival; break;
+    case Cutcofs: pp->utcofs = ival; break;
+    case Cdelay: pp->delay = ival; break;
+    case Ctestiter: pp->testiter = ival; break;
     }
   }
+  return 0;
+}
+
+// validate parameters, set up search and run it
+static int planone(gnet *net,char *ref,struct planparams *pp,search *src)
+{
+  ub4 portcnt = net->portcnt;
+  ub4 sportcnt = net->sportcnt;
+
+  ub4 dep = pp->dep,arr = pp->arr;
+  ub4 lostop = pp->lostop,histop = pp->histop;
+  ub4 tdep = pp->tdep,ttdep = pp->ttdep,utcofs = pp->utcofs;
+  ub4 plusday = pp->plusday,minday = pp->minday;
+  ub4 costperstop = pp->costperstop;
+  ub4 mintt = pp->mintt;
+  ub4 maxtt = pp->maxtt;
+  ub4 walklimit = pp->walklimit;
+  ub4 sumwalklimit = pp->sumwalklimit;
+  ub4 nethistop = pp->nethistop;
+
+  ub4 *evpool;
+  struct depcache *depcache;
+  struct rckey key;
+  int rv;
 
   if (mintt > maxtt) {
     warn(0,"min transfer time %u cannot be above max %u",mintt,maxtt);
@@ -287,10 +524,18 @@ static int cmd_plan(gnet *net,struct myfile *req,search *src)
   if (dep > portcnt && dep - portcnt >= sportcnt) return error(0,"dep %u not in %u member net",dep - portcnt,sportcnt);
   if (arr > portcnt && arr - portcnt >= sportcnt) return error(0,"arr %u not in %u member net",arr - portcnt,sportcnt);
 
+  if (pp->deadline && gettime_usec() >= pp->deadline) {
+    info(0,"plan %u to %u expired before search",dep,arr);
+    return Proto_expired;
+  }
+
   if (dep == arr) warning(0,"dep %u equal to arr",dep);
   evpool = src->evpool;
+  depcache = src->depcache;
   clear(src);
   src->evpool = evpool;
+  src->depcache = depcache;
+  src->deadline = pp->deadline;
 
   src->depttmin_cd = ttdep;
   src->deptmin_cd = tdep;
@@ -305,12 +550,48 @@ static int cmd_plan(gnet *net,struct myfile *req,search *src)
   src->walklimit = m2geo(walklimit);
   src->sumwalklimit = m2geo(sumwalklimit);
 
+  oclear(key);
+  key.dep = dep; key.arr = arr;
+  key.tdep = tdep; key.ttdep = ttdep; key.utcofs = utcofs;
+  key.plusday = plusday; key.minday = minday;
+  key.lostop = lostop; key.histop = histop; key.nethistop = src->nethistop;
+  key.mintt = mintt; key.maxtt = maxtt;
+  key.costperstop = costperstop;
+  key.walklimit = walklimit; key.sumwalklimit = sumwalklimit;
+  key.gen = netgenid();
+
+  if (getrescache(&key,src)) return info(0,"plan %u to %u from cache",dep,arr);
+
   // invoke actual plan here
   info(0,"plan %u to %u in %u to %u stop\as from %u.%u for +%u -%u days",dep,arr,lostop,histop,tdep,ttdep,plusday,minday);
   info(0,"mintt %u maxtt %u maxwalk %u costperstop %u",mintt,maxtt,walklimit,costperstop);
   info(0,"utcofs %u",utcofs);
 
-  rv = plantrip(src,req->name,dep,arr,lostop,histop);
+  rv = plantrip(src,ref,dep,arr,lostop,histop);
+
+  // a search cut short by its limit or deadline may differ on a later run
+  if (rv == 0 && src->truncated == 0) putrescache(&key,src);
+  return rv;
+}
+
+// invoke actual planning for given parameters and reply
+static int doplan(gnet *net,struct qreq *req,struct planparams *pp,search *src)
+{
+  struct myfile rep;
+  ub4 len;
+
+  ub4 portcnt = net->portcnt;
+
+  ub4 dep = pp->dep,arr = pp->arr;
+  ub4 lostop = pp->lostop,histop = pp->histop;
+  ub4 delay = pp->delay;
+  ub4 testiter = pp->testiter;
+
+  int rv;
+
+  oclear(rep);
+
+  rv = planone(net,req->mf.name,pp,src);
 
   // prepare reply
   rep.buf = rep.localbuf;
@@ -319,12 +600,13 @@ static int cmd_plan(gnet *net,struct myfile *req,search *src)
     len = min(src->reslen,sizeof(rep.localbuf));
     memcpy(rep.localbuf,src->resbuf,len);
   } else len = fmtstring(rep.localbuf,"reply plan %u-%u : no trip found\n",dep,arr);
+  len += mysnprintf(rep.localbuf,len,sizeof(rep.localbuf),"gen\t%u\n",netgenid());
   vrb0(0,"reply len %u",len);
   rep.len = len;
 
   if (delay) osmillisleep(delay);
 
-  rv |= setqentry(req,&rep,".rep");
+  rv |= putreply(req,&rep,rv);
 
   if (testiter == 0 || dep == arr) return rv;
 
@@ -337,7 +619,7 @@ static int cmd_plan(gnet *net,struct myfile *req,search *src)
     }
     if (dep == arr) continue;
     iter++;
-    rv = plantrip(src,req->name,dep,arr,lostop,histop);
+    rv = plantrip(src,req->mf.name,dep,arr,lostop,histop);
     if (rv) return rv;
   }
 
@@ -356,7 +638,315 @@ static int cmd_plan(gnet *net,struct myfile *req,search *src)
   return 0;
 }
 
-static int updfares(gnet *net,ub4 *vals,ub4 valcnt)
+// parse parameters and invoke actual planning. Runs in separate process or worker thread
+// to be elaborated: temporary simple interface
+static int cmd_plan(gnet *net,struct qreq *req,search *src)
+{
+  struct planparams pp;
+
+  iniplanparams(&pp);
+  if (rdplanparams(req,&pp)) return 1;
+  pp.deadline = req->deadline;
+  return doplan(net,req,&pp,src);
+}
+
+/* handle a web query as forwarded by the proxy : plan or geocode
+   search limits as in plantrip client defaults
+ */
+static int cmd_web(gnet *net,struct qreq *req,search *src)
+{
+  struct toreq treq;
+  struct planparams pp;
+  struct myfile rep;
+  int rv;
+
+  if (req->mf.len != sizeof(treq)) return error(0,"web request len %u, expected %u",(ub4)req->mf.len,(ub4)sizeof(treq));
+  memcpy(&treq,req->mf.buf,sizeof(treq));
+
+  switch(treq.cmd) {
+  case Toreq_plan:
+    info(0,"web plan id %u",treq.id);
+    iniplanparams(&pp);
+    pp.deadline = req->deadline;
+    pp.dep = treq.dep;
+    pp.arr = treq.arr;
+    pp.tdep = treq.date;
+    pp.ttdep = treq.time;
+    pp.utcofs = treq.utcofs;
+    pp.histop = 6;
+    pp.nethistop = 5;
+    if (treq.walklim) pp.walklimit = treq.walklim;
+    return doplan(net,req,&pp,src);
+
+  case Toreq_geo2name:
+    info(0,"web geocode id %u",treq.id);
+    oclear(rep);
+    rv = geocode(treq.deplat,treq.deplon,Proto_geoscale,1,(ub4)Georange,&rep);
+    rv |= putreply(req,&rep,rv);
+    return rv;
+
+  default: return error(0,"unknown web command %u",treq.cmd);
+  }
+}
+
+// upper bound of a binary result for one query
+#define Maxbinres (sizeof(struct planres) + 2 * (sizeof(struct restrip) + Nxleg * sizeof(struct resleg)))
+
+// append a binary result for the trips of the last search
+static ub4 putbinres(search *src,ub4 id,int code,ub4 utcofs,char *buf,ub4 pos)
+{
+  struct planres *rp = (struct planres *)(buf + pos);
+  struct restrip *tp;
+  struct resleg *lp;
+  struct trip *stp;
+  ub4 t,leg,legcnt,tdep;
+  ub4 rpos = pos;
+
+  pos += sizeof(struct planres);
+  rp->id = id;
+  rp->code = (ub4)code;
+  rp->gen = netgenid();
+  rp->tripcnt = 0;
+
+  for (t = 0; code == 0 && t < Elemcnt(src->trips); t++) {
+    stp = src->trips + t;
+    if (stp->cnt == 0) continue;
+    legcnt = stp->len;
+    tp = (struct restrip *)(buf + pos);
+    pos += sizeof(struct restrip);
+    tp->legcnt = legcnt;
+    tp->dt = stp->dt;
+    tp->dist = stp->dist;
+    tp->fare = stp->fare;
+    for (leg = 0; leg < legcnt; leg++) {
+      lp = (struct resleg *)(buf + pos);
+      pos += sizeof(struct resleg);
+      lp->dep = stp->port[leg];
+      lp->arr = stp->port[leg + 1];
+      tdep = stp->t[leg];
+      if (tdep) {
+        lp->tdep = min2lmin(tdep,utcofs);
+        lp->tarr = min2lmin(tdep + stp->dur[leg],utcofs);
+        lp->tid = stp->tid[leg];
+      } else {
+        lp->tdep = lp->tarr = 0;
+        lp->tid = hi32;
+      }
+      lp->rid = stp->rid[leg];
+      lp->dist = stp->legdist[leg];
+    }
+    rp->tripcnt++;
+  }
+  rp->len = pos - rpos;
+  return pos;
+}
+
+// fields set to Planreq_dflt keep the default
+static void setparam(ub4 *pv,ub4 val)
+{
+  if (val != Planreq_dflt) *pv = val;
+}
+
+static void binparams(struct planparams *pp,const struct planreq *prq)
+{
+  iniplanparams(pp);
+  pp->dep = prq->dep;
+  pp->arr = prq->arr;
+  setparam(&pp->tdep,prq->date);
+  setparam(&pp->ttdep,prq->time);
+  setparam(&pp->utcofs,prq->utcofs);
+  setparam(&pp->plusday,prq->plusday);
+  setparam(&pp->minday,prq->minday);
+  setparam(&pp->lostop,prq->lostop);
+  setparam(&pp->histop,prq->histop);
+  setparam(&pp->nethistop,prq->nethistop);
+  setparam(&pp->mintt,prq->mintt);
+  setparam(&pp->maxtt,prq->maxtt);
+  setparam(&pp->costperstop,prq->costperstop);
+  setparam(&pp->walklimit,prq->walklimit);
+  setparam(&pp->sumwalklimit,prq->sumwalklimit);
+  if (prq->viacnt && prq->viacnt != Planreq_dflt) warn(0,"query %u: ignoring %u via\as",prq->id,prq->viacnt);
+}
+
+/* handle a batch of binary plan queries. Requests are used in place from the frame buffer,
+   results are collected in a single reply
+ */
+static int cmd_bin(gnet *net,struct qreq *req,search *src)
+{
+  struct myfile rep;
+  struct planparams pp;
+  struct planbatch *bp,*rbp;
+  const struct planreq *prq,*reqs;
+  char *buf = req->mf.buf;
+  ub4 len = (ub4)req->mf.len;
+  ub4 n,cnt,pos,replen;
+  int rv;
+
+  if (len < sizeof(struct planbatch)) return error(0,"binary request len %u below header",len);
+  if ((size_t)buf & 3) return error(0,"binary request %s not aligned",req->mf.name);
+
+  bp = (struct planbatch *)buf;
+  cnt = bp->cnt;
+  if (bp->ver != Planreq_version) return error(0,"binary request version %u, expected %u",bp->ver,Planreq_version);
+  if (cnt == 0 || cnt > Planbatch_max) return error(0,"binary request count %u not in 1-%u",cnt,Planbatch_max);
+  if (len != sizeof(struct planbatch) + cnt * sizeof(struct planreq)) return error(0,"binary request len %u for %u queries",len,cnt);
+  reqs = (const struct planreq *)(buf + sizeof(struct planbatch));
+
+  replen = (ub4)(sizeof(struct planbatch) + cnt * Maxbinres); // cnt within Planbatch_max
+  oclear(rep);
+  rep.buf = alloc(replen,char,0,"plan batch reply",cnt);
+  rbp = (struct planbatch *)rep.buf;
+  rbp->ver = Planreq_version;
+  rbp->cnt = cnt;
+  pos = sizeof(struct planbatch);
+
+  info(0,"binary plan batch of %u",cnt);
+
+  for (n = 0; n < cnt; n++) {
+    prq = reqs + n;
+    binparams(&pp,prq);
+    pp.deadline = req->deadline;
+
+    rv = planone(net,req->mf.name,&pp,src);
+    pos = putbinres(src,prq->id,rv,utc12ofs(pp.utcofs),rep.buf,pos);
+  }
+  rep.len = pos;
+  vrb0(0,"reply len %u",pos);
+
+  rv = putreply(req,&rep,0);
+  afree(rep.buf,"plan batch reply");
+  return rv;
+}
+
+// send collected results of a pair batch as one frame
+static int flushpairs(struct qreq *req,struct myfile *rep,ub4 cnt,ub4 len)
+{
+  struct planbatch *rbp = (struct planbatch *)rep->buf;
+
+  rbp->ver = Planreq_version;
+  rbp->cnt = cnt;
+  rep->len = len;
+  vrb0(0,"reply %u results len %u",cnt,len);
+  return putreply(req,rep,0);
+}
+
+/* handle many dep-arr pairs with shared parameters
+   pairs are sorted on departure and planned with the departure caches kept in between.
+   Socket clients get results per departure group as they come
+ */
+static int cmd_pairs(gnet *net,struct qreq *req,search *src)
+{
+  struct myfile rep;
+  struct planparams pp;
+  const struct pairbatch *bp;
+  const struct planpair *pairs,*pr;
+  char *buf = req->mf.buf;
+  ub4 len = (ub4)req->mf.len;
+  ub4 n,cnt,pos,rescnt,cap,replen,dep,prvdep,grpcnt = 0;
+  ub8 *order;
+  int stream = (req->fd != -1);
+  int rv = 0;
+
+  if (len < sizeof(struct pairbatch)) return error(0,"pair request len %u below header",len);
+  if ((size_t)buf & 3) return error(0,"pair request %s not aligned",req->mf.name);
+
+  bp = (const struct pairbatch *)buf;
+  cnt = bp->cnt;
+  if (bp->ver != Planreq_version) return error(0,"pair request version %u, expected %u",bp->ver,Planreq_version);
+  if (cnt == 0 || cnt > Planpair_max) return error(0,"pair request count %u not in 1-%u",cnt,Planpair_max);
+  if (len != sizeof(struct pairbatch) + cnt * sizeof(struct planpair)) return error(0,"pair request len %u for %u pairs",len,cnt);
+  pairs = (const struct planpair *)(buf + sizeof(struct pairbatch));
+
+  order = alloc(cnt,ub8,0,"pair order",cnt);
+  for (n = 0; n < cnt; n++) order[n] = ((ub8)pairs[n].dep << 32) | n;
+  sort8(order,cnt,FLN,"pairs");
+
+  cap = stream ? min(cnt,Planbatch_max) : cnt; // within Planpair_max
+  replen = (ub4)(sizeof(struct planbatch) + cap * Maxbinres);
+  oclear(rep);
+  rep.buf = alloc(replen,char,0,"pair batch reply",cnt);
+  pos = sizeof(struct planbatch);
+  rescnt = 0;
+
+  binparams(&pp,&bp->par);
+  pp.deadline = req->deadline;
+
+  info(0,"plan %u pairs",cnt);
+  srcbatch(src,1);
+
+  prvdep = hi32;
+  for (n = 0; n < cnt; n++) {
+    pr = pairs + (order[n] & hi32);
+    dep = pr->dep;
+    if (dep != prvdep) {
+      if (stream && rescnt) {
+        rv |= flushpairs(req,&rep,rescnt,pos);
+        pos = sizeof(struct planbatch);
+        rescnt = 0;
+      }
+      grpcnt++;
+      prvdep = dep;
+    } else if (rescnt == cap) {
+      rv |= flushpairs(req,&rep,rescnt,pos);
+      pos = sizeof(struct planbatch);
+      rescnt = 0;
+    }
+    pp.dep = dep;
+    pp.arr = pr->arr;
+    pos = putbinres(src,pr->id,planone(net,req->mf.name,&pp,src),utc12ofs(pp.utcofs),rep.buf,pos);
+    rescnt++;
+  }
+
+  srcbatch(src,0);
+  info(0,"planned %u pairs in %u departure group\as",cnt,grpcnt);
+
+  if (stream && rescnt) {
+    rv |= flushpairs(req,&rep,rescnt,pos);
+    pos = sizeof(struct planbatch);
+    rescnt = 0;
+  }
+  rv |= flushpairs(req,&rep,rescnt,pos);
+
+  afree(rep.buf,"pair batch reply");
+  afree(order,"pair order");
+  return rv;
+}
+
+// socket clients always get a reply, also for requests failing early
+static void ackerror(struct qreq *req,int rv)
+{
+  struct myfile rep;
+
+  if (rv == 0 || req->replied || req->fd == -1) return;
+  oclear(rep);
+  rep.buf = rep.localbuf;
+  rep.len = fmtstring(rep.localbuf,"reply error code %d\n",rv);
+  putreply(req,&rep,rv);
+}
+
+static int runplan(gnet *net,struct qreq *req,search *src)
+{
+  struct myfile rep;
+  int rv;
+
+  // drop if the client stopped waiting
+  if (req->deadline && gettime_usec() >= req->deadline) {
+    info(0,"drop expired request %s",req->mf.name);
+    oclear(rep);
+    rep.buf = rep.localbuf;
+    rep.len = fmtstring(rep.localbuf,"reply %s expired\n",req->mf.name);
+    return putreply(req,&rep,Proto_expired);
+  }
+
+  if (req->cmd == 'w') rv = cmd_web(net,req,src);
+  else if (req->cmd == 'b') rv = cmd_bin(net,req,src);
+  else if (req->cmd == 'm') rv = cmd_pairs(net,req,src);
+  else rv = cmd_plan(net,req,src);
+  ackerror(req,rv);
+  return rv;
+}
+
+static int updfares(gnet *net,ub4 *vals,ub4 valcnt,ub4 *pcnt,ub4 *prid)
 {
   ub4 rrid = vals[0];
   ub4 dep = vals[1];
@@ -367,18 +957,14 @@ static int updfares(gnet *net,ub4 *vals,ub4 valcnt)
   ub4 *rrid2rid = net->rrid2rid;
   ub4 hirrid = net->hirrid;
   struct route *rp;
-  struct port *pdep,*parr,*ports = net->ports;
   ub4 portcnt = net->portcnt;
-  ub4 hopcnt = net->hopcnt;
-  ub4 *portsbyhop = net->portsbyhop;
+  ub4 hop1,hop2,chop;
 
   if (net->fareposcnt == 0) return warn(0,"no reserved routes to update for %u-%u",dep,arr);
   if (dep == arr) return error(0,"dep %u equals arr",dep);
   else if (dep >= portcnt) return error(0,"dep %u above %u",dep,portcnt);
   else if (arr >= portcnt) return error(0,"arr %u above %u",arr,portcnt);
-  pdep = ports + dep;
-  parr = ports + arr;
-  info(0,"%u-%u %s to %s",dep,arr,pdep->name,parr->name);
+  vrb0(0,"%u-%u %s to %s",dep,arr,net->ports[dep].name,net->ports[arr].name);
 
   if (rrid > hirrid) return error(0,"rrid %u above max %u",rrid,hirrid);
   rid = rrid2rid[rrid];
@@ -390,28 +976,10 @@ static int updfares(gnet *net,ub4 *vals,ub4 valcnt)
   if (rp->reserve == 0) return warn(0,"ignoring rrid %u for nonreserved route",rrid);
   if (rp->hopcnt == 0) return warn(0,"no hops on rrid %u",rrid);
 
-  ub4 *ridhops,*ridhopbase = net->ridhopbase;
-  ridhops = ridhopbase + rp->hop2pos;
-
   // get hop from rid,dep,arr. orgs in case of compound
-  ub4 hopndx = 0,h1ndx = 0,h2ndx = 0;
-  ub4 rhopcnt = rp->hopcnt;
-  ub4 h,chop,hop1 = hi32,hop2 = hi32;
+  if (farehops(net,rid,dep,arr,&hop1,&hop2,&chop)) return 1;
 
-  while (hopndx < rhopcnt && (hop1 == hi32 || hop2 == hi32)) {
-    h = rp->hops[hopndx];
-    if (portsbyhop[h * 2] == dep) { hop1 = h; h1ndx = hopndx; }
-    if (portsbyhop[h * 2 + 1] == arr) { hop2 = h;  h2ndx = hopndx; }
-    hopndx++;
-  }
-  if (hop1 == hi32 || hop2 == hi32) return error(0,"no hop found for %u-%u",dep,arr);
-  else if (hop1 >= hopcnt) return error(0,"invalid hop %u found for %u-%u",hop1,dep,arr);
-  else if (hop2 >= hopcnt) return error(0,"invalid hop %u found for %u-%u",hop2,dep,arr);
-  if (hop1 == hop2) chop = hop1;
-  else chop = ridhops[h1ndx * rhopcnt + h2ndx];
-  if (chop == hi32) return 1;
-
-  info(0,"found hop %u,%u = %u",hop1,hop2,chop);
+  vrb0(0,"found hop %u,%u = %u",hop1,hop2,chop);
 
   while (vndx + 2 < valcnt) {
     dt = vals[vndx];
@@ -420,41 +988,76 @@ static int updfares(gnet *net,ub4 *vals,ub4 valcnt)
     t = t0 + dt;
     vrb0(0,"dt %u t \ad%u mask %u",dt,t,mask);
     n = bitsinmask[mask & (Faregrp-1)];
-    fareupd(net,rid,hop1,hop2,chop,t,mask,n,vals + vndx);
+    if (vndx + n > valcnt) return error(0,"rrid %u: %u fares for mask %x beyond record",rrid,n,mask);
+    if (fareupd(net,rid,hop1,hop2,chop,t,mask,n,vals + vndx) == 0) *pcnt += 1;
     vndx += n;
   }
+  *prid = rid;
   return 0;
 }
 
 #define Maxvals 1024
+#define Maxuprids 1024
+
+// fares and trips of an update are published together, and pinned together
+static pthread_mutex_t publock = PTHREAD_MUTEX_INITIALIZER;
+
+static void pinupd(search *src)
+{
+  pthread_mutex_lock(&publock);
+  src->rcgen = rescachegen();
+  farepin();
+  rtpin();
+  pthread_mutex_unlock(&publock);
+}
+
+static void unpinupd(void)
+{
+  rtunpin();
+  fareunpin();
+}
+
 /* handle an update command
-   fare availability:
-     rid t (dt grpmask fare1 fare2 ..)+
+   fare availability, one record per line, any number of lines :
+     0 rid t (dt grpmask fare1 fare2 ..)+
      rid  = route id : rrid
      t = time in minutes since epoch
      dt = idem, relative to above
      grpmask is bitmap for each known fare group
+   real-time trip updates, idem :
+     1 tid t rhop delay : delay runs from route stop rhop on, minutes in two's complement. For a single day, only from rhop 0 on trips with compounds
+     2 tid t : cancel runs
+     3 tid t : add a run of the trip departing at local time t
+     tid = trip id as in results
+     t = for 1 and 2, a local time within the service day in minutes since epoch, 0 for all days
  */
-static int cmd_upd(struct myfile *req,ub4 seq)
+static int cmd_upd(struct qreq *req,ub4 seq,struct myfile *rep)
 {
-  char c,*lp = req->buf;
-  ub4 pos = 0,len = (ub4)req->len;
+  char c,*lp = req->mf.buf;
+  ub4 pos = 0,len = (ub4)req->mf.len;
   ub4 valcnt,val,x;
-  enum states { Out, Val0, Val1, Item, Fls } state;
-  enum cmd { Upd_fare };
+  ub4 reccnt = 0,errcnt = 0,updcnt = 0,tripcnt = 0;
+  ub4 rid,r,ridcnt = 0;
+  int ridall = 0;
+  ub8 t0,dt;
+  enum states { Out, Val0, Val1, Item, Fls } state,prvstate;
+  enum cmd { Upd_fare,Upd_delay,Upd_cancel,Upd_add };
   ub4 vals[Maxvals];
+  ub4 rids[Maxuprids];
 
   info(0,"update seq %u len %u",seq,len);
 
   if (len == 0) return 0;
   gnet *net = getgnet();
 
+  t0 = gettime_usec();
+
   state = Out; valcnt = val = 0;
   while (pos < len) {
     c = lp[pos++];
     x = hexmap[(ub4)(c & 0x7f)];
 
-//  info(0,"c %x x %x state %u",c,x,state);
+    prvstate = state;
     switch(state) {
     case Out:  if (x < 0x10) { val = x; state = Val1; }
                else if (x != 0xfe) state = Fls;
@@ -464,43 +1067,85 @@ static int cmd_upd(struct myfile *req,ub4 seq)
                else if (x != 0x20) state = Fls;
                break;
     case Val1: if (x < 0x10) val = (val << 4) + x;
-               else if (x == 0x20) { vals[valcnt++] = val; state = Val0; }
-               else if (x == 0xfe) state = Item;
+               else if (x == 0x20 || x == 0xfe) {
+                 if (valcnt == Maxvals) { state = Fls; break; }
+                 vals[valcnt++] = val;
+                 state = (x == 0xfe ? Item : Val0);
+               }
                else state = Fls;
                break;
 
     case Fls:  if (x == 0xfe) state = Out; break;
 
-    case Item: info(0,"%u vals",valcnt); break;
+    case Item: break;
+    }
+
+    // malformed line : skip to its end, without its values
+    if (state == Fls && prvstate != Fls) {
+      valcnt = 0;
+      errcnt++;
+      if (x == 0xfe) state = Out;
     }
     if (state == Item) {
       state = Out;
-      info(0,"%u vals",valcnt);
-      if (valcnt == 0) break;
-      else if (vals[0] == Upd_fare && valcnt > 7) updfares(net,vals+1,valcnt-1);
-      break;
+      if (valcnt == 0) continue;
+      reccnt++;
+      rid = hi32;
+      if (vals[0] == Upd_fare && valcnt > 7) {
+        if (updfares(net,vals+1,valcnt-1,&updcnt,&rid)) errcnt++;
+      } else if (vals[0] == Upd_delay && valcnt == 5) {
+        if (rtdelay(net,vals[1],vals[2],vals[3],(int)vals[4],&rid)) errcnt++;
+        else tripcnt++;
+      } else if (vals[0] == Upd_cancel && valcnt == 3) {
+        if (rtcancel(net,vals[1],vals[2],&rid)) errcnt++;
+        else tripcnt++;
+      } else if (vals[0] == Upd_add && valcnt == 3) {
+        if (rtadd(net,vals[1],vals[2],&rid)) errcnt++;
+        else tripcnt++;
+      } else errcnt++;
+      if (rid != hi32) {
+        for (r = 0; r < ridcnt && rids[r] != rid; r++) ;
+        if (r == ridcnt && ridcnt < Maxuprids) rids[ridcnt++] = rid;
+        else if (r == ridcnt) ridall = 1;
+      }
+      valcnt = 0;
     }
   }
 
-  return 0;
+  // results of queries on an older epoch are not cached after this
+  if (ridall) info(0,"more than %u routes updated, invalidate all cached results",Maxuprids);
+  pthread_mutex_lock(&publock);
+  farepublish(net);
+  rtpublish(net);
+  invrescache(ridall ? NULL : rids,ridcnt);
+  pthread_mutex_unlock(&publock);
+
+  dt = gettime_usec() - t0;
+  info(0,"update seq %u: %u record\as with %u error\as, %u fare and %u trip update\as in %lu usec",seq,reccnt,errcnt,updcnt,tripcnt,dt);
+  if (reccnt) info(0,"%lu updates per sec, %lu nsec per record",(updcnt + tripcnt) * 1000000UL / max(dt,1),dt * 1000 / reccnt);
+  rep->len = mysnprintf(rep->localbuf,0,sizeof(rep->localbuf),"update %u records %u errors %u fares %u trips %lu usec\n",reccnt,errcnt,updcnt,tripcnt,dt);
+
+  return errcnt != 0;
 }
 
+// search context of plans in the server process, kept over queries as for workers
+static search *plansrc;
+
 // wrapper around cmd_plan, fork here
-static int start_plan(struct myfile *req,int do_fork)
+static int start_plan(struct qreq *req,int do_fork)
 {
   int rv;
   char logname[1024];
   char filename[1024];
   char *file,*ext;
+  char *name = req->mf.name;
   int pid;
 
-  search src;
-
-  oclear(src);
+  if (plansrc == NULL) plansrc = alloc(1,search,0,"server search",0);
 
-  file = strrchr(req->name,'/');
-  if (file) file++; else file = req->name;
-  ext = strrchr(req->name,'.');
+  file = strrchr(name,'/');
+  if (file) file++; else file = name;
+  ext = strrchr(name,'.');
   if (ext) fmtstring(filename,"%.*s",(ub4)(ext - file),file);
   else strcopy(filename,file);
 
@@ -514,9 +1159,11 @@ static int start_plan(struct myfile *req,int do_fork)
     setmsglog(globs.netdir,logname,1);
   }
 
-  gnet *net = getgnet();
-
-  rv = cmd_plan(net,req,&src);
+  pinnet();
+  pinupd(plansrc);
+  rv = runplan(getgnet(),req,plansrc);
+  unpinupd();
+  unpinnet();
   if (rv) info(0,"plan returned %d",rv);
   if (do_fork) {
     eximsg(0);
@@ -524,75 +1171,484 @@ static int start_plan(struct myfile *req,int do_fork)
   } else return rv;
 }
 
-/* currently a directory queue based interface
+// order of queued jobs : higher priority, then earlier deadline, then arrival
+static int jobbefore(ub4 a,ub4 b)
+{
+  struct qreq *ja = jobq + a,*jb = jobq + b;
+  ub8 da = ja->deadline ? ja->deadline : hi64;
+  ub8 db = jb->deadline ? jb->deadline : hi64;
+
+  if (ja->prio != jb->prio) return ja->prio > jb->prio;
+  else if (da != db) return da < db;
+  else return ja->arrival < jb->arrival;
+}
+
+static void jobpush(ub4 slot)
+{
+  ub4 pos = heapcnt++,par;
+
+  while (pos && jobbefore(slot,jobheap[par = (pos - 1) / 2])) {
+    jobheap[pos] = jobheap[par];
+    pos = par;
+  }
+  jobheap[pos] = slot;
+}
+
+static ub4 jobpop(void)
+{
+  ub4 top = jobheap[0];
+  ub4 last = jobheap[--heapcnt];
+  ub4 pos = 0,kid;
+
+  while ((kid = pos * 2 + 1) < heapcnt) {
+    if (kid + 1 < heapcnt && jobbefore(jobheap[kid + 1],jobheap[kid])) kid++;
+    if (!jobbefore(jobheap[kid],last)) break;
+    jobheap[pos] = jobheap[kid];
+    pos = kid;
+  }
+  jobheap[pos] = last;
+  return top;
+}
+
+// queue a plan request for the workers, waiting for space if needed
+static void addjob(struct qreq *req)
+{
+  struct qreq *jp;
+  ub4 slot;
+
+  pthread_mutex_lock(&qlock);
+  while (freecnt == 0) pthread_cond_wait(&qspace,&qlock);
+  slot = jobfree[--freecnt];
+  jp = jobq + slot;
+  *jp = *req;
+  if (req->mf.alloced == 0) jp->mf.buf = jp->mf.localbuf;
+  jp->arrival = jobseq++;
+  if (req->conn) req->conn->pending++;
+  jobpush(slot);
+  pthread_cond_signal(&qwork);
+  pthread_mutex_unlock(&qlock);
+}
+
+// release a connection: now, or when its last pending request is answered
+static void dropconn(struct conn *cp,int done)
+{
+  pthread_mutex_lock(&qlock);
+  if (done) cp->pending--;
+  else cp->eof = 1;
+  if (cp->eof && cp->pending == 0) {
+    osclose(cp->fd);
+    cp->fd = -1;
+    cp->eof = 0;
+  }
+  pthread_mutex_unlock(&qlock);
+}
+
+static void *worker(void *arg)
+{
+  struct worker *wp = arg;
+  struct qreq *jp,req;
+  ub4 slot;
+  int rv;
+
+  msgprefix(0,"w%u ",wp->id);
+  vrb0(0,"worker %u started",wp->id);
+
+  do {
+    pthread_mutex_lock(&qlock);
+    while (heapcnt == 0 && jobstop == 0) pthread_cond_wait(&qwork,&qlock);
+    if (heapcnt == 0) {
+      pthread_mutex_unlock(&qlock);
+      break;
+    }
+    slot = jobpop();
+    jp = jobq + slot;
+    req = *jp;
+    if (req.mf.alloced == 0) req.mf.buf = req.mf.localbuf;
+    jobfree[freecnt++] = slot;
+    pthread_cond_signal(&qspace);
+    pthread_mutex_unlock(&qlock);
+
+    pinnet();
+    pinupd(wp->src);
+    rv = runplan(getgnet(),&req,wp->src);
+    unpinupd();
+    unpinnet();
+    if (rv) info(0,"plan returned %d",rv);
+    wp->jobcnt++;
+
+    if (req.mf.alloced) afree(req.mf.buf,"client request");
+    if (req.conn) dropconn(req.conn,1);
+  } while (1);
+
+  vrb0(0,"worker %u stopped after %u queries",wp->id,wp->jobcnt);
+  return NULL;
+}
+
+// start plan workers as configured. each has its own search context, sharing the network
+static ub4 startworkers(void)
+{
+  struct worker *wp;
+  ub4 cnt = min(globs.srvvars[Srv_workers],Maxworker);
+  ub4 w;
+  int rv;
+
+  for (w = 0; w < Jobqlen; w++) jobfree[w] = Jobqlen - 1 - w;
+  freecnt = Jobqlen;
+  heapcnt = 0;
+
+  for (w = 0; w < cnt; w++) {
+    wp = workers + w;
+    wp->id = w;
+    wp->src = alloc(1,search,0,"worker search",w);
+    rv = pthread_create(&wp->tid,NULL,worker,wp);
+    if (rv) {
+      error(0,"cannot create worker %u: %s",w,strerror(rv));
+      afree(wp->src,"worker search");
+      break;
+    }
+  }
+  infocc(w,0,"started %u plan worker\as",w);
+  return w;
+}
+
+static void stopworkers(void)
+{
+  struct worker *wp;
+  ub4 w;
+
+  pthread_mutex_lock(&qlock);
+  jobstop = 1;
+  pthread_cond_broadcast(&qwork);
+  pthread_mutex_unlock(&qlock);
+
+  for (w = 0; w < workercnt; w++) {
+    wp = workers + w;
+    pthread_join(wp->tid,NULL);
+    info(0,"worker %u handled %u queries",w,wp->jobcnt);
+  }
+  workercnt = 0;
+}
+
+/* switch to a newer published network generation if present. Otherwise build one
+   in a separate process, to be attached when published.
+   Searches continue on the current generation meanwhile
+ */
+static int startreload(char *buf,ub4 len,ub4 *plen)
+{
+  ub4 gen;
+
+  char *argv[6];
+  char cfgarg[1100];
+  char stoparg[64];
+
+  if (*globs.snapshot == 0) {
+    *plen = mysnprintf(buf,0,len,"reload needs srv.snapshot\n");
+    return error0(0,"reload needs srv.snapshot in config");
+  }
+  if (buildpid) {
+    *plen = mysnprintf(buf,0,len,"reload in progress by process %u\n",buildpid);
+    return 0;
+  }
+  gen = snapshotgen(globs.snapshot);
+  if (gen && gen != netgenid()) {
+    if (attachsnapshot(globs.snapshot)) {
+      *plen = mysnprintf(buf,0,len,"reload cannot attach generation %u\n",gen);
+      return 1;
+    }
+    *plen = mysnprintf(buf,0,len,"reload attached generation %u\n",gen);
+    return 0;
+  }
+
+  // same settings as this server
+  fmtstring(cfgarg,"-config=%s",globs.cfgfile);
+  fmtstring(stoparg,"-max-stops=%u",globs.maxstops);
+  argv[0] = (char *)globs.progpath;
+  argv[1] = cfgarg;
+  argv[2] = stoparg;
+  argv[3] = (char *)"build";
+  argv[4] = globs.netdir;
+  argv[5] = NULL;
+
+  buildpid = osspawn(globs.progpath,argv);
+  if (buildpid == -1) {
+    buildpid = 0;
+    *plen = mysnprintf(buf,0,len,"reload cannot start builder\n");
+    return 1;
+  }
+  info(0,"building new network generation in process %u",buildpid);
+  *plen = mysnprintf(buf,0,len,"reload started by process %u after generation %u\n",buildpid,netgenid());
+  return 0;
+}
+
+// attach a newly built generation and release drained ones
+static void chkreload(void)
+{
+  int rv;
+
+  if (buildpid && osreap(buildpid,&rv)) {
+    if (rv) error(0,"network build in process %u failed with %d",buildpid,rv);
+    else attachsnapshot(globs.snapshot);
+    buildpid = 0;
+  }
+  dropnetgens();
+}
+
+// dispatch a request on its command letter
+static int handlereq(struct qreq *req,enum Cmds *pcmd,ub4 *pseq,ub4 *puseq,ub4 *pcldcnt)
+{
+  struct myfile rep;
+  enum Cmds cmd = Cmd_nil;
+  int do_fork = 1;
+  int cpid,prv,rv = 0;
+  ub4 len;
+  char c = req->cmd;
+
+  switch(c) {
+  case 's': cmd = Cmd_stop; break;
+  case 'p': cmd = Cmd_plan; break;
+  case 'P': cmd = Cmd_plan; do_fork = 0; break;
+  case 'g': cmd = Cmd_geo; do_fork = 0; break;
+  case 'n': cmd = Cmd_name; break;
+  case 'c': cmd = Cmd_stat; break;
+  case 'r': cmd = Cmd_reload; break;
+  case 'w': cmd = Cmd_plan; do_fork = 0; break;
+  case 'b': cmd = Cmd_plan; do_fork = 0; break;
+  case 'm': cmd = Cmd_plan; do_fork = 0; break;
+  case 'u': cmd = Cmd_upd; break;
+  default: info(0,"unknown command '%c'",c);
+  }
+
+  // without workers, connections get their replies in order, so plan in-process
+  if (req->fd != -1) do_fork = 0;
+
+  *pcmd = cmd;
+
+  if (cmd == Cmd_plan && workercnt) {
+    *pseq += 1;
+    addjob(req);
+    return 0;
+  }
+
+  oclear(rep);
+  rep.buf = rep.localbuf;
+
+  if (cmd == Cmd_plan) {
+    *pseq += 1;
+    if (do_fork) {
+      cpid = start_plan(req,1);
+      if (cpid > 0) *pcldcnt += 1;
+    } else {
+      rv = start_plan(req,do_fork);
+    }
+  } else if (cmd == Cmd_upd) {
+    prv = cmd_upd(req,*puseq,&rep);
+    if (prv) info(0,"update returned %d",prv);
+    *puseq += 1;
+    if (req->fd != -1) putreply(req,&rep,prv);
+  } else if (cmd == Cmd_geo) {
+    prv = cmd_geo(req);
+    ackerror(req,prv);
+  } else if (cmd == Cmd_name) {
+    prv = cmd_name(req);
+    ackerror(req,prv);
+  } else if (cmd == Cmd_stat) {
+    len = netgenstats(rep.localbuf,sizeof(rep.localbuf));
+    len += rescachestats(rep.localbuf + len,sizeof(rep.localbuf) - len);
+    len += rowcachestats(rep.localbuf + len,sizeof(rep.localbuf) - len);
+    len += farestats(rep.localbuf + len,sizeof(rep.localbuf) - len);
+    len += rtstats(rep.localbuf + len,sizeof(rep.localbuf) - len);
+    rep.len = len;
+    putreply(req,&rep,0);
+  } else if (cmd == Cmd_reload) {
+    prv = startreload(rep.localbuf,sizeof(rep.localbuf),&len);
+    rep.len = len;
+    putreply(req,&rep,prv);
+  } else if (req->fd != -1) {
+    putreply(req,&rep,cmd == Cmd_stop ? 0 : 1);
+  }
+  if (req->mf.alloced) afree(req->mf.buf,"client request");
+  return rv;
+}
+
+// open listening sockets as configured
+static ub4 mklisten(int *fds)
+{
+  ub4 port = globs.srvvars[Srv_port];
+  const char *sockname = globs.srvsock;
+  ub4 cnt = 0;
+  int fd;
+
+  if (port) {
+    fd = ossocket(1);
+    if (fd == -1) return 0;
+    if (osbind(fd,port) || oslisten(fd,Maxconn)) osclose(fd);
+    else {
+      info(0,"listening on port %u",port);
+      fds[cnt++] = fd;
+    }
+  }
+  if (*sockname) {
+    fd = ossocket(0);
+    if (fd == -1) return cnt;
+    if (osbindlocal(fd,sockname) || oslisten(fd,Maxconn)) { osclose(fd); return cnt; }
+    info(0,"listening on %s",sockname);
+    fds[cnt++] = fd;
+  }
+  return cnt;
+}
+
+static struct conn *newconn(int fd)
+{
+  struct conn *cp;
+  ub4 c;
+
+  pthread_mutex_lock(&qlock);
+  for (c = 0; c < Maxconn; c++) {
+    cp = conns + c;
+    if (cp->fd == -1) {
+      cp->fd = fd;
+      cp->pending = 0;
+      cp->eof = 0;
+      pthread_mutex_unlock(&qlock);
+      return cp;
+    }
+  }
+  pthread_mutex_unlock(&qlock);
+  return NULL;
+}
+
+/* serve queries from socket connections and from a directory queue
+
+  When a tcp port or local socket is configured, clients connect and send framed
+  requests as described in proto.h. These are handled as soon as they arrive.
+  The directory queue remains available as fallback. It is checked when the sockets
+  are idle for a while, or every few requests when busy.
+
+  Plan requests are handled by a pool of worker threads if configured,
+  otherwise in a forked process per request as before.
+
  future plan :
-  use a single local proxy on same system that interfaces here with sockets
   have at least a set of 2 servers, allow network rebuild
   remote client interfaces to proxy at e.g. port 80
-  proxy on behalf of client to here, synchronously. proxy forks per request
-  server accepts one conn only, proxy knows list of servers and iterates
   have directory-based queue for real-time status updates only
   status updates synchronously, rely on having a set of servers
  */
 int serverloop(void)
 {
   const char *querydir = globs.querydir;
-  struct myfile req;
+  struct qreq req;
   int prv,rv = 1;
   enum Cmds cmd = Cmd_nil;
   ub4 prvseq = 0,seq = 0,useq = 0;
-  char c;
   const char *region = "glob"; // todo
-  int cpid;
-  int do_fork;
   ub4 cldcnt = 0;
 
+  int fds[2 + Maxconn];
+  ub1 rdy[2 + Maxconn];
+  struct conn *slotconns[Maxconn];
+  struct conn *cp;
+  struct osnetadr adr;
+  ub4 lsncnt,conncnt = 0,n,c,qskip = 0;
+  ub4 qwait = 100;
+  int nrdy,fd;
+  char statbuf[256];
+
   info(0,"entering server loop for id %u",globs.serverid);
 
+  for (c = 0; c < Maxconn; c++) {
+    conns[c].fd = -1;
+    pthread_mutex_init(&conns[c].wrlock,NULL);
+  }
+
+  lsncnt = mklisten(fds);
+  infocc(lsncnt == 0,0,"no listening sockets, using query dir %s",querydir);
+
+  workercnt = startworkers();
+  mkrescache(globs.srvvars[Srv_cachemb],globs.srvvars[Srv_cacheage]);
+  mkrowcache(globs.srvvars[Srv_rowmb]);
+
   do {
     infovrb(seq > prvseq,0,"wait for new cmd %u",seq);
-    rv = getqentry(querydir,&req,region,".sub");
-    if (rv) break;
-
     prvseq = seq;
 
-    if (req.direxist == 0) osmillisleep(2000);
-    else if (req.exist == 0) {
-      if (cldcnt) prv = oswaitany(&cldcnt);
-      osmillisleep(10);  // for linux only we may use inotify instead
-    } else {
-      info(0,"new client entry %s",req.name);
-      do_fork = 1;
-      c = req.name[req.basename];
-      switch(c) {
-      case 's': cmd = Cmd_stop; break;
-      case 'p': cmd = Cmd_plan; break;
-      case 'P': cmd = Cmd_plan; do_fork = 0; break;
-      case 'g': cmd = Cmd_geo; do_fork = 0; break;
-      case 'u': cmd = Cmd_upd; break;
-      default: info(0,"unknown command '%c'",c);
-      }
-      if (cmd == Cmd_plan) {
-        seq++;
-        if (do_fork) {
-          cpid = start_plan(&req,1);
-          if (cpid > 0) cldcnt++;
-        } else {
-          rv = start_plan(&req,do_fork);
+    chkreload();
+
+    if (lsncnt) {
+      nrdy = ospoll(fds,rdy,lsncnt + conncnt,qwait);
+      if (nrdy < 0) break;
+
+      for (n = 0; n < lsncnt + conncnt && cmd != Cmd_stop; n++) {
+        if (rdy[n] == 0) continue;
+        if (n < lsncnt) {
+          fd = osaccept(fds[n],&adr);
+          if (fd == -1) continue;
+          cp = newconn(fd);
+          if (cp == NULL) {
+            warn(0,"closing connection %d: max %u reached",fd,Maxconn);
+            osclose(fd);
+            continue;
+          }
+          fds[lsncnt + conncnt] = fd;
+          rdy[lsncnt + conncnt] = 0;
+          slotconns[conncnt] = cp;
+          conncnt++;
+          continue;
+        }
+        cp = slotconns[n - lsncnt];
+        fd = cp->fd;
+        if (getframe(cp,&req)) {
+          info(0,"closing connection %d",fd);
+          dropconn(cp,0);
+          conncnt--;
+          fds[n] = fds[lsncnt + conncnt];
+          rdy[n] = rdy[lsncnt + conncnt];
+          slotconns[n - lsncnt] = slotconns[conncnt];
+          n--;
+          continue;
         }
-        if (req.alloced) afree(req.buf,"client request");
-      } else if (cmd == Cmd_upd) {
-        prv = cmd_upd(&req,useq);
-        if (prv) info(0,"update returned %d",prv);
-        if (req.alloced) afree(req.buf,"client request");
-        useq++;
-      } else if (cmd == Cmd_geo) {
-        prv = cmd_geo(&req);
-        if (req.alloced) afree(req.buf,"client request");
+        vrb0(0,"new request '%c' seq %u len %u on connection %d",req.cmd,req.seq,(ub4)req.mf.len,fd);
+        prv = handlereq(&req,&cmd,&seq,&useq,&cldcnt);
+        if (prv) info(0,"request returned %d",prv);
       }
+      if (cmd == Cmd_stop) break;
+
+      // busy on sockets: look at the directory queue every few rounds only
+      if (nrdy > 0 && ++qskip < 16) continue;
+      qskip = 0;
+    }
+
+    rv = getqentry(querydir,&req.mf,region,".sub");
+    if (rv) break;
+
+    qwait = 100;
+    if (req.mf.direxist == 0) {
+      if (lsncnt == 0) osmillisleep(2000);
+    } else if (req.mf.exist == 0) {
+      if (cldcnt) prv = oswaitany(&cldcnt);
+      if (lsncnt == 0) osmillisleep(10);  // for linux only we may use inotify instead
+    } else {
+      info(0,"new client entry %s",req.mf.name);
+      req.fd = -1;
+      req.conn = NULL;
+      req.seq = 0;
+      req.cmd = req.mf.name[req.mf.basename];
+      setdeadline(&req,0,0);
+      rv = handlereq(&req,&cmd,&seq,&useq,&cldcnt);
+      qwait = 0;
     }
   } while (rv == 0 && cmd != Cmd_stop && globs.sigint == 0);
 
+  stopworkers();
+
+  rescachestats(statbuf,sizeof(statbuf));
+  info(0,"%s",statbuf);
+  rowcachestats(statbuf,sizeof(statbuf));
+  info(0,"%s",statbuf);
+
+  for (n = 0; n < lsncnt; n++) osclose(fds[n]);
+  for (n = 0; n < conncnt; n++) dropconn(slotconns[n],0);
+  if (*globs.srvsock && lsncnt) osremove(globs.srvsock);
+
   info(0,"leaving server loop for id %u",globs.serverid);
 
   return rv;
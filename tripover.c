@@ -37,13 +37,19 @@ static ub4 msgfile;
 #include "event.h"
 #include "net.h"
 #include "netn.h"
+#include "netcache.h"
 #include "netev.h"
 #include "netprep.h"
 #include "condense.h"
 #include "compound.h"
 #include "partition.h"
 #include "search.h"
+#include "rescache.h"
+#include "rowcache.h"
+#include "grid.h"
+#include "names.h"
 #include "fare.h"
+#include "realtime.h"
 
 static const char copyright[] = "Copyright (C) 2014-2015, and Creative Commons CC-by-nc-nd'd by Joris van der Geer";
 
@@ -58,6 +64,7 @@ static int init0(char *progname)
 
   p = strrchr(progname,'/');
   globs.progname = (p ? p + 1 : progname);
+  globs.progpath = progname;
 
   inimsg(progname,"tripover.log",Msg_stamp|Msg_pos|Msg_type);
   msgfile = setmsgfile(__FILE__);
@@ -83,6 +90,7 @@ static int init0(char *progname)
   inigtfs();
   ininet();
   ininetn();
+  ininetcache();
   ininetio();
   ininetev();
   ininetprep();
@@ -91,7 +99,12 @@ static int init0(char *progname)
   inipartition();
   inicompound();
   inisearch();
+  inirescache();
+  inirowcache();
+  inigrid();
+  ininames();
   inifare();
+  inirealtime();
   return 0;
 }
 
@@ -106,12 +119,9 @@ static void exit0(void)
   if (do_eximsg) eximsg(1);
 }
 
-// init network
-static int initnet(void)
+// search defaults from config
+static void netparams(void)
 {
-  netbase *basenet = getnetbase();
-  gnet *gnet;
-  int rv = 0;
   ub4 mintt,maxtt;
   ub4 walklimit,sumwalklimit,walkspeed;
 
@@ -156,6 +166,16 @@ static int initnet(void)
   }
   globs.periodt0 = t0;
   globs.periodt1 = t1;
+}
+
+// init network
+static int initnet(void)
+{
+  netbase *basenet = getnetbase();
+  gnet *gnet;
+  int rv = 0;
+
+  netparams();
 
   if (*globs.netdir == 0) return 1;
 
@@ -193,7 +213,7 @@ static int do_main(void)
   struct myfile nd;
   const char *cmdstr;
   char logdir[1024];
-  int rv;
+  int rv,attach = 0,build = 0;
 
   if (argc == 0) return shortusage();
 
@@ -206,18 +226,26 @@ static int do_main(void)
     info0(0,"cmd: 'gtfsout' TODO: read net, process events and write normalised gtfs");
     globs.stopat = Runprep;
     globs.writgtfs = 1;
+  } else if (streq(cmdstr,"serve")) {
+    info0(0,"command 'serve'");
+    if (*globs.snapshot == 0) return error0(0,"command 'serve' needs srv.snapshot in config");
+    attach = 1;
+  } else if (streq(cmdstr,"build")) {
+    info0(0,"command 'build'");
+    if (*globs.snapshot == 0) return error0(0,"command 'build' needs srv.snapshot in config");
+    build = 1;
   } else if (streq(cmdstr,"init")) {
     return 0;
-  } else return error(0,"unknown command '%s': known are 'run','init'",cmdstr);
+  } else return error(0,"unknown command '%s': known are 'run','serve','build','init'",cmdstr);
 
-  if (argc < 2) return error0(0,"commands 'run' and 'gtfsout' need network dir arg");
+  if (argc < 2) return error0(0,"commands 'run', 'serve', 'build' and 'gtfsout' need network dir arg");
   strcopy(globs.netdir,globs.args[1]);
 
   if (*globs.netdir) {
     oclear(nd);
     if (osfileinfo(&nd,globs.netdir)) return oserror(0,"cannot access net directory %s",globs.netdir);
     else if (nd.isdir == 0) return error(0,"net arg %s is not a directory",globs.netdir);
-    if (setmsglog(globs.netdir,"tripover.log",0)) return 1;
+    if (setmsglog(globs.netdir,build ? "build.log" : "tripover.log",0)) return 1;
 
     fmtstring(logdir,"%s/log",globs.netdir);
     rv = osexists(logdir);
@@ -239,9 +267,19 @@ static int do_main(void)
 
   if (background) osbackground();
 
-  if (initnet()) return 1;
+  if (attach) {
+    netparams();
+    if (attachsnapshot(globs.snapshot)) return 1;
+  } else {
+    if (*globs.snapshot && (build || dorun(FLN,Runserver,0)) && mksnapshot(globs.snapshot,globs.srvvars[Srv_snapmb])) return 1;
+
+    if (initnet() || mknet(globs.maxstops)) { rmsnapshot(); return 1; }
 
-  if (mknet(globs.maxstops)) return 1;
+    if (*globs.snapshot && globs.netok && pubsnapshot(globs.snapshot)) { rmsnapshot(); return 1; }
+
+    if (build && globs.netok == 0) { rmsnapshot(); return error0(0,"no network built"); }
+    else if (build) return 0;
+  }
 
   if (globs.testcnt > 1 && globs.netok) {
     ub4 dep,arr,lostop = 0, histop = 3;